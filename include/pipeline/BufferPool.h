@@ -0,0 +1,48 @@
+#ifndef PIPELINE_BUFFER_POOL_H
+#define PIPELINE_BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace pipeline {
+
+// Recycles the large per-frame output buffers (converted images, depth
+// maps, ...) so steady-state processing does not hit the allocator for
+// every frame.
+//
+// acquire() hands out a reference counted buffer.  When the last
+// reference goes away the buffer goes back to the pool instead of being
+// freed, as long as the pool still exists and keeps fewer than maxIdle
+// buffers around.  Buffers are 64-byte aligned so SIMD stages can use
+// aligned loads and stores on them.  All members are thread safe.
+class BufferPool {
+public:
+    typedef std::shared_ptr<uint8_t> Buffer;
+
+    explicit BufferPool(size_t maxIdle = 4);
+    ~BufferPool();
+
+    // Get a buffer of at least size bytes.  Idle buffers of a different
+    // size are dropped, since frame sizes only change on reconfiguration.
+    // Returns an empty pointer if memory is exhausted.
+    Buffer acquire(size_t size);
+
+    // Free all idle buffers.
+    void trim();
+
+    // Buffers allocated so far, and buffers currently waiting for reuse.
+    uint64_t allocations() const;
+    size_t idle() const;
+
+private:
+    BufferPool(const BufferPool &);
+    BufferPool &operator=(const BufferPool &);
+
+    struct State;
+    std::shared_ptr<State> m_state;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_BUFFER_POOL_H
@@ -0,0 +1,126 @@
+#ifndef PIPELINE_CALLBACK_BUFFER_MONITOR_H
+#define PIPELINE_CALLBACK_BUFFER_MONITOR_H
+
+#include <pthread.h>
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace pipeline {
+
+// Accounting of the callback buffers held with reserveCallbackBuffer().
+//
+// libMultiSense keeps every image callback's latest image in a buffer
+// until the next one arrives, matching luma with chroma keeps a few
+// more, and images wait for the callback thread in a bounded queue.
+// When the callbacks fall behind, the library drops images without
+// notice.  The monitor counts the buffers held per source, with
+// high-water marks, and the frames lost per source from gaps in the
+// frame ids delivered.
+//
+// Lost frames, or a buffer the library refuses, call for shedding load:
+// while shedding, new images are neither held nor processed, so the
+// callbacks return quickly and buffers go back to the library as soon as
+// their callback returns.  Shedding stops once resumeImages images in a
+// row arrived without a gap.
+//
+// The callbacks hold a fixed number of buffers at most (one per image
+// callback plus those kept for matching), so the count held alone cannot
+// tell a stall from normal operation unless the library's capacity is
+// known.  If it is, shedding also starts at shedFraction of it held and
+// only stops once no more than resumeFraction of it is held.  Without a
+// configured capacity, the count held when the library first refuses a
+// buffer is taken as the capacity.
+//
+// Sources are DataSource bits.  All members are thread safe.
+class CallbackBufferMonitor {
+public:
+    struct Config {
+        // Buffers the library can lend out at once, 0 if unknown.
+        uint32_t capacity = 0;
+
+        // Shares of the capacity held at which shedding starts and below
+        // which it may stop.
+        float shedFraction = 0.75f;
+        float resumeFraction = 0.5f;
+
+        // Images in a row without lost frames before shedding stops.
+        uint32_t resumeImages = 30;
+    };
+
+    struct SourceStats {
+        uint32_t source = 0;
+        uint32_t outstanding = 0;
+        uint32_t highWater = 0;
+        uint64_t reserved = 0;
+        uint64_t failed = 0;
+        uint64_t shed = 0;
+        uint64_t dropped = 0;       // Frames lost before delivery
+        int64_t lastFrameId = -1;   // -1 before the first image
+    };
+
+    // What a call changed about load shedding.
+    enum Event {
+        Event_None,
+        Event_ShedStarted,
+        Event_ShedStopped
+    };
+
+    CallbackBufferMonitor();
+    explicit CallbackBufferMonitor(const Config &config);
+    ~CallbackBufferMonitor();
+
+    Config config() const;
+
+    // Whether a buffer may be reserved for image frameId of source being
+    // delivered.  Frames skipped since the last image of source count as
+    // dropped and start shedding.  If not admitted, the image counts as
+    // shed and is to be neither held nor processed.  Shedding also stops
+    // here, as no buffer may be left to release.
+    bool admit(uint32_t source, int64_t frameId, Event *eventP = 0);
+
+    // A buffer was reserved for an image of source.  bufferP is what the
+    // library returned; null counts as a refusal.
+    Event reserved(uint32_t source, const void *bufferP);
+
+    // A buffer held for source went back to the library.
+    Event released(uint32_t source);
+
+    // The given sources (a DataSource mask) are being restarted, so the
+    // frames they skip until their next image are not lost.
+    void restarted(uint64_t sources);
+
+    bool shedding() const;
+    uint32_t outstanding() const;
+    uint32_t highWater() const;
+    uint64_t shedCount() const;
+    uint64_t droppedCount() const;
+
+    // Per source, in source order.
+    std::vector<SourceStats> sources() const;
+
+private:
+    CallbackBufferMonitor(const CallbackBufferMonitor &);
+    CallbackBufferMonitor &operator=(const CallbackBufferMonitor &);
+
+    void setCapacity(uint32_t capacity);
+    bool mayResume() const;
+
+    Config m_config;
+    uint32_t m_shedAt;
+    uint32_t m_resumeAt;
+
+    mutable pthread_mutex_t m_mutex;
+    std::map<uint32_t, SourceStats> m_sources;
+    uint32_t m_outstanding;
+    uint32_t m_highWater;
+    uint64_t m_shed;
+    uint64_t m_dropped;
+    uint32_t m_cleanImages;
+    bool m_shedding;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_CALLBACK_BUFFER_MONITOR_H
@@ -0,0 +1,48 @@
+#ifndef PIPELINE_CLOUD_CODEC_H
+#define PIPELINE_CLOUD_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pipeline {
+
+// Compact encoding for point clouds reprojected from disparity.
+//
+// Coordinates are quantized to signed 16 bits inside a cube of
+// +/- extent meters (0.3mm steps for the default 10m box used by the
+// viewer).  Points are kept in the order they are given, which for
+// clouds built from disparity is image row order, so consecutive
+// points are close in space.  Each coordinate is stored as the
+// difference to the previous point, optionally Rice coded in blocks
+// with a per-block parameter.  NaN coordinates survive the round trip,
+// which keeps organized clouds organized.
+enum CloudEntropy {
+    CloudEntropy_None = 0,  // 6 bytes per point
+    CloudEntropy_Rice = 1   // Variable length, typically 2-3 bytes per point
+};
+
+struct CloudCodecOptions {
+    float extent = 10.0f;
+    CloudEntropy entropy = CloudEntropy_Rice;
+};
+
+// Encode count points starting at xyzP.  strideFloats is the distance
+// between consecutive points, e.g. 4 for pcl::PointXYZ.  The encoded
+// stream replaces the contents of output; the buffer capacity is reused
+// between calls.
+void encodeCloud(const float *xyzP,
+                 size_t count,
+                 size_t strideFloats,
+                 const CloudCodecOptions &options,
+                 std::vector<uint8_t> &output);
+
+// Decode a stream produced by encodeCloud() into packed x, y, z
+// triplets.  Throws on malformed input.
+void decodeCloud(const uint8_t *dataP,
+                 size_t length,
+                 std::vector<float> &xyz);
+
+} // namespace pipeline
+
+#endif // PIPELINE_CLOUD_CODEC_H
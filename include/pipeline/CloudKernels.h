@@ -0,0 +1,95 @@
+#ifndef PIPELINE_CLOUD_KERNELS_H
+#define PIPELINE_CLOUD_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pipeline {
+
+class PointFrame;
+class RectifiedColorLookup;
+
+enum CloudPointType {
+    CloudPoint_Xyz,
+    // Colored from the raw left luma and chroma.
+    CloudPoint_XyzRgb,
+    // Intensity from the point frame, which DisparityReprojector::reproject()
+    // takes from a luma image.
+    CloudPoint_XyzI,
+    CloudPoint_Count
+};
+
+enum CloudLayout {
+    // Kept points only, in image row order.
+    CloudLayout_Compact,
+    // One point per pixel, NaN where there is no kept point, so the cloud
+    // can be indexed like the image.
+    CloudLayout_Organized,
+    CloudLayout_Count
+};
+
+struct CloudConfig {
+    CloudPointType pointType = CloudPoint_Xyz;
+    CloudLayout layout = CloudLayout_Compact;
+
+    // Drop points whose pixel has an 8-bit disparity cost above maxCost.
+    bool filterCost = false;
+    uint8_t maxCost = 128;
+};
+
+// What the kernels read.  Only the images the configuration needs have to
+// be set; all are the size of the point frame's image.
+struct CloudSources {
+    const PointFrame *pointsP = 0;
+
+    // 8-bit disparity cost, for filterCost.
+    const uint8_t *costP = 0;
+
+    // Raw left luma and chroma and the lookup that rectifies them, for
+    // CloudPoint_XyzRgb.  The lookup keeps scratch rows, so a kernel using
+    // it must not run on two threads at once.
+    RectifiedColorLookup *colorLookupP = 0;
+    const uint8_t *rawLumaP = 0;
+    const uint8_t *rawChromaP = 0;
+};
+
+// Points are written strideFloats floats apart, starting with x, y, z
+// (e.g. into the points of a PCL cloud).  The packed B, G, R, A color or
+// the intensity goes extraOffset floats after x.
+struct CloudOutput {
+    float *pointsP = 0;
+    size_t capacity = 0;
+    size_t strideFloats = 3;
+    size_t extraOffset = 3;
+};
+
+// Conversion of the reprojected points of a frame into the cloud a
+// consumer wants, specialized at compile time.
+//
+// One kernel template is instantiated for every combination of point
+// type, layout and filter, so each is a loop that only does the work of
+// its own options instead of testing them for every point.  cloudKernel()
+// picks the instantiation for a runtime configuration out of a table.
+// The points are reprojected once per frame into the PointFrame; kernels
+// only read it, a row of the image at a time.  Kernels return the number
+// of points written.
+typedef size_t (*CloudKernel)(const CloudConfig &config,
+                              const CloudSources &sources,
+                              const CloudOutput &output);
+
+CloudKernel cloudKernel(const CloudConfig &config);
+
+// Points the output of config needs room for.
+size_t cloudCapacity(const CloudConfig &config, const PointFrame &points);
+
+// Convert the points of sources into output as config selects, setting
+// count to the points written.  Returns false, without touching output,
+// if an image the configuration needs is missing or output is too small.
+bool convertCloud(const CloudConfig &config,
+                  const CloudSources &sources,
+                  const CloudOutput &output,
+                  size_t &count);
+
+} // namespace pipeline
+
+#endif // PIPELINE_CLOUD_KERNELS_H
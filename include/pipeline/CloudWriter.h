@@ -0,0 +1,144 @@
+#ifndef PIPELINE_CLOUD_WRITER_H
+#define PIPELINE_CLOUD_WRITER_H
+
+#include <pthread.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace pipeline {
+
+// Writes clouds to disk in the background, one binary PCD or PLY file
+// per frame.
+//
+// submit() only queues a reference to the cloud and never touches the
+// disk.  A serializer thread packs queued clouds into one of two large
+// page-aligned staging buffers while an I/O thread writes out the other
+// one, so formatting and disk writes overlap.  When the queue is full
+// the configured drop policy decides which frame is lost, so a slow
+// disk cannot stall the camera callbacks or the viewer.
+class CloudWriter {
+public:
+    enum Format {
+        Format_PCD,
+        Format_PLY
+    };
+
+    enum DropPolicy {
+        Drop_Newest,  // Reject the incoming frame
+        Drop_Oldest,  // Evict the oldest queued frame
+        Drop_Never    // Block the caller until there is room
+    };
+
+    struct Config {
+        std::string directory = ".";
+        std::string prefix = "cloud";
+        Format format = Format_PCD;
+        DropPolicy dropPolicy = Drop_Oldest;
+
+        // Frames that may wait for serialization.
+        size_t queueDepth = 4;
+
+        // Once more than this many files have been written, the oldest
+        // one is deleted.  Zero keeps every file.
+        size_t maxFiles = 0;
+
+        // Bypass the page cache where the file system allows it.
+        bool directIo = false;
+    };
+
+    struct Stats {
+        uint64_t submitted = 0;
+        uint64_t written = 0;
+        // Frames lost to a full queue, or that could not be serialized.
+        uint64_t dropped = 0;
+        // Frames whose file could not be written.
+        uint64_t failed = 0;
+        uint64_t bytes = 0;
+        size_t queued = 0;
+    };
+
+    CloudWriter();
+    ~CloudWriter();
+
+    // Start the writer threads.  Throws if the writer is already running.
+    void start(const Config &config);
+
+    // Write out everything that is queued and join the writer threads.
+    void stop();
+
+    bool isRunning() const;
+
+    // Queue count points, strideFloats floats apart, for writing.  owner
+    // keeps the point data alive until it has been serialized.  Returns
+    // false if the frame was dropped.
+    bool submit(int64_t frameId,
+                const float *xyzP,
+                size_t count,
+                size_t strideFloats,
+                std::shared_ptr<const void> owner);
+
+    // Convenience overload for pcl::PointCloud<>::ConstPtr and friends.
+    // The smart pointer is held by the deleter, which works for both
+    // std:: and boost:: shared pointers.
+    template <class CloudPtr>
+    bool submit(int64_t frameId, const CloudPtr &cloud) {
+        if (!cloud || cloud->points.empty()) {
+            return false;
+        }
+        std::shared_ptr<const void> owner(static_cast<const void *>(0),
+                                          [cloud](const void *) {});
+        return submit(frameId, &cloud->points[0].x, cloud->points.size(),
+                      sizeof(cloud->points[0]) / sizeof(float), owner);
+    }
+
+    Stats stats() const;
+
+private:
+    struct Job {
+        int64_t frameId;
+        const float *xyzP;
+        size_t count;
+        size_t strideFloats;
+        std::shared_ptr<const void> owner;
+    };
+
+    // Page-aligned buffer handed from the serializer to the I/O thread.
+    struct Staging {
+        uint8_t *dataP = 0;
+        size_t capacity = 0;
+        size_t length = 0;
+        int64_t frameId = 0;
+        bool filled = false;
+    };
+
+    void serializeThread();
+    void ioThread();
+    bool serialize(const Job &job, Staging &staging);
+    bool writeFile(const Staging &staging, const std::string &path);
+    void rotate(const std::string &path);
+
+    Config m_config;
+    bool m_running;
+    bool m_stopping;
+    bool m_serializerDone;
+
+    std::deque<Job> m_queue;
+    Staging m_staging[2];
+    std::deque<std::string> m_files;
+    Stats m_stats;
+
+    mutable pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+
+    std::thread m_serializeThread;
+    std::thread m_ioThread;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_CLOUD_WRITER_H
@@ -0,0 +1,38 @@
+#ifndef PIPELINE_DEPTH_CODEC_H
+#define PIPELINE_DEPTH_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pipeline {
+
+// Lossless encoding for 16-bit millimeter depth images (see
+// DepthImage.h), for recording.
+//
+// Every row is stored as the run lengths of its pixels with and without
+// depth, followed by the prediction residuals of the pixels with depth.
+// A pixel is predicted from its valid left, upper and upper left
+// neighbours with the median edge detector of LOCO-I, so smooth
+// surfaces cost a few bits per pixel and holes cost almost nothing.
+// Run lengths and residuals are Rice coded in blocks with a per-block
+// parameter, as in CloudCodec.
+//
+// The depth is width x height pixels packed row by row.  The encoded
+// stream replaces the contents of output; the buffer capacity is reused
+// between calls.
+void encodeDepth(const uint16_t *depthP,
+                 uint32_t width,
+                 uint32_t height,
+                 std::vector<uint8_t> &output);
+
+// Decode a stream produced by encodeDepth().  Throws on malformed input.
+void decodeDepth(const uint8_t *dataP,
+                 size_t length,
+                 std::vector<uint16_t> &depth,
+                 uint32_t &width,
+                 uint32_t &height);
+
+} // namespace pipeline
+
+#endif // PIPELINE_DEPTH_CODEC_H
@@ -0,0 +1,80 @@
+#ifndef PIPELINE_DEPTH_IMAGE_H
+#define PIPELINE_DEPTH_IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "pipeline/BufferPool.h"
+
+namespace pipeline {
+
+class DisparityReprojector;
+class WorkerPool;
+
+enum DepthFormat {
+    DepthFormat_Meters = 0,      // float32 meters
+    DepthFormat_Millimeters = 1  // uint16 millimeters, up to 65.535 m
+};
+
+// Per-pixel depth along the optical axis, for consumers that do not need
+// full points: 2 or 4 bytes per pixel instead of 12 for packed x, y, z.
+// Pixels are packed row by row; 0 marks pixels without depth.
+struct DepthImage {
+    int64_t frameId = -1;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    DepthFormat format = DepthFormat_Millimeters;
+    BufferPool::Buffer buffer;
+
+    size_t bytesPerPixel() const { return DepthFormat_Meters == format ? sizeof(float) : sizeof(uint16_t); }
+    size_t sizeBytes() const { return static_cast<size_t>(width) * height * bytesPerPixel(); }
+
+    // The pixels in the image's format, or null for the other one.
+    const float *meters() const {
+        return DepthFormat_Meters == format ? reinterpret_cast<const float *>(buffer.get()) : 0;
+    }
+    const uint16_t *millimeters() const {
+        return DepthFormat_Millimeters == format ? reinterpret_cast<const uint16_t *>(buffer.get()) : 0;
+    }
+};
+
+// Converts raw 16-bit disparity to depth images through the reprojection
+// matrix: depth = depthTerm / (d * disparityScale + wOffset) with the
+// reprojector's ray table terms.
+//
+// Rows are converted four pixels at a time with SSE2 and split into
+// tiles that run on a WorkerPool.  Output buffers come from a pool of
+// the converter's, so an image handed to a consumer goes back into
+// circulation once the last reference to it is dropped.
+class DepthConverter {
+public:
+    struct Config {
+        DepthFormat format = DepthFormat_Millimeters;
+
+        // Image rows per task.
+        uint32_t rowsPerTile = 32;
+    };
+
+    DepthConverter();
+    explicit DepthConverter(const Config &config);
+
+    const Config &config() const { return m_config; }
+
+    // Convert a disparity image the size of the reprojector's.  Pixels
+    // outside the reprojector's region, without disparity, or too far
+    // for millimeters are 0.  Returns false if the reprojector has no
+    // calibration or no buffer could be allocated.
+    bool convert(const DisparityReprojector &reprojector,
+                 const uint16_t *disparityP,
+                 int64_t frameId,
+                 DepthImage &depth,
+                 WorkerPool *poolP = 0);
+
+private:
+    Config m_config;
+    BufferPool m_pool;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_DEPTH_IMAGE_H
@@ -0,0 +1,135 @@
+#ifndef PIPELINE_DISPARITY_FRAME_H
+#define PIPELINE_DISPARITY_FRAME_H
+
+#include <pthread.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "pipeline/BufferPool.h"
+#include "pipeline/DepthImage.h"
+
+namespace pipeline {
+
+class DepthConverter;
+class DisparityReprojector;
+class PointFrame;
+class PointFramePool;
+class WorkerPool;
+
+// What the products of a frame are computed with.  The pointers are not
+// owned and must outlive every frame made with the context; all but the
+// reprojector are optional.
+struct DisparityFrameContext {
+    // Calibration and region the frame was taken with.  Shared, so the
+    // owner can install a new one without disturbing frames in flight.
+    std::shared_ptr<const DisparityReprojector> reprojector;
+
+    // Needed for depth().
+    DepthConverter *depthConverterP = 0;
+
+    // Where the disparity copy and the point frames come from, and the
+    // threads the products are computed on.
+    BufferPool *disparityPoolP = 0;
+    PointFramePool *pointPoolP = 0;
+    WorkerPool *workerPoolP = 0;
+
+    // Normals are taken across neighbours normalStep pixels away, and
+    // not across depth jumps of more than maxDepthJump times the depth.
+    uint32_t normalStep = 2;
+    float maxDepthJump = 0.05f;
+};
+
+// One disparity frame and everything derived from it, computed only when
+// somebody asks.
+//
+// Few consumers need every product of a frame, and frames the render
+// thread skips need none.  Each product is computed on its first
+// request and kept for the life of the frame, so consumers share one
+// copy and a dropped frame costs nothing beyond the disparity copy.
+//
+// All members are thread safe.  Every product has its own lock, so
+// concurrent requests for the same product compute it once while the
+// others wait, and different products are computed side by side.
+// References returned stay valid as long as the frame.
+class DisparityFrame {
+public:
+    // Copies width x height raw 16-bit disparity (1/16th pixel units) of
+    // frame frameId.  The products are empty if the size does not match
+    // the context's reprojector.
+    DisparityFrame(const DisparityFrameContext &context,
+                   int64_t frameId,
+                   const uint16_t *disparityP,
+                   uint32_t width,
+                   uint32_t height);
+    ~DisparityFrame();
+
+    int64_t frameId() const { return m_frameId; }
+    uint32_t width() const { return m_width; }
+    uint32_t height() const { return m_height; }
+    const uint16_t *disparity() const { return reinterpret_cast<const uint16_t *>(m_disparity.get()); }
+
+    // Disparity in pixels, 0 where there is none.
+    const std::vector<float> &floatDisparity();
+
+    // Depth in the format of the context's converter.  Has no buffer
+    // without a converter.
+    const DepthImage &depth();
+
+    // The reprojected points of the region.
+    std::shared_ptr<const PointFrame> points();
+
+    // 8-bit disparity in pixels, black outside the region.
+    const std::vector<uint8_t> &display();
+
+    // display() through the JET color map as packed BGR, black where
+    // there is no disparity.
+    const std::vector<uint8_t> &colorized();
+
+    // Unit surface normals as packed x, y, z per pixel in the viewer
+    // convention, facing the camera.  NaN where a pixel or its
+    // neighbours have no point, or the surface is not continuous.
+    const std::vector<float> &normals();
+
+private:
+    DisparityFrame(const DisparityFrame &);
+    DisparityFrame &operator=(const DisparityFrame &);
+
+    enum Product {
+        Product_FloatDisparity,
+        Product_Depth,
+        Product_Points,
+        Product_Display,
+        Product_Colorized,
+        Product_Normals,
+        Product_Count
+    };
+
+    // Run compute unless product is already there.
+    template <class Compute>
+    void once(Product product, Compute compute);
+
+    bool matchesReprojector() const;
+
+    DisparityFrameContext m_context;
+    int64_t m_frameId;
+    uint32_t m_width;
+    uint32_t m_height;
+    BufferPool::Buffer m_disparity;
+
+    pthread_mutex_t m_mutexes[Product_Count];
+    bool m_computed[Product_Count];
+
+    std::vector<float> m_floatDisparity;
+    DepthImage m_depth;
+    std::shared_ptr<PointFrame> m_points;
+    std::vector<uint8_t> m_display;
+    std::vector<uint8_t> m_colorized;
+    std::vector<float> m_normals;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_DISPARITY_FRAME_H
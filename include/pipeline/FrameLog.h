@@ -0,0 +1,151 @@
+#ifndef PIPELINE_FRAME_LOG_H
+#define PIPELINE_FRAME_LOG_H
+
+#include <pthread.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "pipeline/BufferPool.h"
+
+namespace pipeline {
+
+// Recordings of the raw images the sensor callbacks get, for processing
+// sessions again offline.
+//
+// A log is a short file header followed by records in the order they
+// were written: images as the callbacks got them, and the calibration
+// they were taken with, written before the first image and again after
+// every change.  Values are stored in host byte order.
+
+enum FrameLogKind {
+    FrameLogKind_Image = 1,
+    FrameLogKind_Calibration = 2
+};
+
+// Stereo calibration scaled to the image size, and the reprojection
+// matrix Q derived from it, in row-major order.
+struct FrameLogCalibration {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    float q[16] = {};
+    float leftM[3][3] = {}, leftD[8] = {}, leftR[3][3] = {}, leftP[3][4] = {};
+    float rightM[3][3] = {}, rightD[8] = {}, rightR[3][3] = {}, rightP[3][4] = {};
+};
+
+// One image with the fields of its crl::multisense::image::Header.
+struct FrameLogImage {
+    uint32_t source = 0;
+    int64_t frameId = -1;
+    uint32_t timeSeconds = 0;
+    uint32_t timeMicroSeconds = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t bitsPerPixel = 0;
+    uint32_t length = 0;
+    BufferPool::Buffer data;
+
+    double time() const { return timeSeconds + timeMicroSeconds * 1e-6; }
+};
+
+struct FrameLogRecord {
+    FrameLogKind kind = FrameLogKind_Image;
+    FrameLogImage image;
+    FrameLogCalibration calibration;
+};
+
+// Writes a frame log in the background.
+//
+// submit() copies the image into a buffer from a pool per source (pools
+// only recycle buffers of one size) and queues it; a writer thread
+// appends the queue to the file.  When the queue is full the image is
+// dropped, so a slow disk cannot stall the callbacks.  Calibration
+// records are never dropped.  All members are thread safe.
+class FrameLogWriter {
+public:
+    struct Stats {
+        uint64_t written = 0;
+        uint64_t dropped = 0;
+        uint64_t bytes = 0;
+    };
+
+    // Images that may wait for the disk.
+    explicit FrameLogWriter(size_t queueDepth = 16);
+    ~FrameLogWriter();
+
+    // Create the log at path and start the writer thread, with the
+    // calibration queued ahead of any image.  Throws if the file cannot be
+    // created or the writer is already running.
+    void start(const std::string &path, const FrameLogCalibration &calibration);
+
+    // Write out everything that is queued and close the file.
+    void stop();
+
+    bool isRunning() const;
+
+    // Log a change of calibration.  Images submitted afterwards were taken
+    // with it.
+    void writeCalibration(const FrameLogCalibration &calibration);
+
+    // Copy and queue an image.  image.data is ignored; the length bytes
+    // at dataP are logged instead.  Returns false if the image was
+    // dropped.
+    bool submit(const FrameLogImage &image, const void *dataP);
+
+    Stats stats() const;
+
+private:
+    FrameLogWriter(const FrameLogWriter &);
+    FrameLogWriter &operator=(const FrameLogWriter &);
+
+    void writeThread();
+    bool writeRecord(const FrameLogRecord &record);
+
+    size_t m_queueDepth;
+    std::map<uint32_t, std::unique_ptr<BufferPool> > m_pools;
+
+    mutable pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+    bool m_running;
+    bool m_stopping;
+    std::deque<FrameLogRecord> m_queue;
+    Stats m_stats;
+
+    FILE *m_fileP;
+    std::thread m_thread;
+};
+
+// Reads a frame log front to back.  Image data comes from pools of the
+// reader's, one per source, so records can be handed to other threads
+// and their buffers go back into circulation once the last copy is gone.
+class FrameLogReader {
+public:
+    FrameLogReader();
+    ~FrameLogReader();
+
+    // Throws if the file cannot be opened or is not a frame log.
+    void open(const std::string &path);
+    void close();
+
+    // Read the next record.  Returns false at the end of the log.  A
+    // record cut short, as by a recorder that was killed, also ends the
+    // log; any other damage throws.
+    bool next(FrameLogRecord &record);
+
+private:
+    FrameLogReader(const FrameLogReader &);
+    FrameLogReader &operator=(const FrameLogReader &);
+
+    FILE *m_fileP;
+    std::map<uint32_t, std::unique_ptr<BufferPool> > m_pools;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_FRAME_LOG_H
@@ -0,0 +1,50 @@
+#ifndef PIPELINE_FRAME_VIEW_H
+#define PIPELINE_FRAME_VIEW_H
+
+#include "MultiSense/MultiSenseTypes.hh"
+#include "opencv2/core.hpp"
+
+namespace pipeline {
+
+// OpenCV type of the pixels described by a libMultiSense image header,
+// or -1 if the layout is not known.  Chroma images carry interleaved
+// Cb, Cr byte pairs; other 16-bit images (luma in 12/16-bit modes,
+// disparity in 1/16th pixels) are single channel.
+inline int frameType(const crl::multisense::image::Header &header) {
+    const bool chroma = 0 != (header.source & (crl::multisense::Source_Chroma_Left |
+                                               crl::multisense::Source_Chroma_Right));
+    switch (header.bitsPerPixel) {
+        case 8:
+            return CV_8UC1;
+        case 16:
+            return chroma ? CV_8UC2 : CV_16UC1;
+        case 24:
+            return CV_8UC3;
+        case 32:
+            return CV_32FC1;
+        default:
+            return -1;
+    }
+}
+
+// Wrap the image data of a header in a cv::Mat without copying, sized
+// from the header rather than from the configured resolution.  The view
+// is only valid while the callback buffer backing the header is held.
+// Returns an empty Mat for unknown pixel formats or missing data.
+inline cv::Mat frameView(const crl::multisense::image::Header &header) {
+    const int type = frameType(header);
+    if (type < 0 || 0 == header.imageDataP || 0 == header.width || 0 == header.height) {
+        return cv::Mat();
+    }
+
+    const size_t step = static_cast<size_t>(header.width) * header.bitsPerPixel / 8;
+    if (static_cast<size_t>(header.imageLength) < step * header.height) {
+        return cv::Mat();
+    }
+
+    return cv::Mat(header.height, header.width, type, const_cast<void *>(header.imageDataP), step);
+}
+
+} // namespace pipeline
+
+#endif // PIPELINE_FRAME_VIEW_H
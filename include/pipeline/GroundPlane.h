@@ -0,0 +1,109 @@
+#ifndef PIPELINE_GROUND_PLANE_H
+#define PIPELINE_GROUND_PLANE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pipeline {
+
+// Plane normal . p + d = 0 with a unit normal.
+struct Plane {
+    float normal[3];
+    float d;
+
+    float distance(const float *p) const {
+        return normal[0] * p[0] + normal[1] * p[1] + normal[2] * p[2] + d;
+    }
+};
+
+// Finds the ground plane in every frame of a point cloud.
+//
+// Each frame works on an evenly spread subset of the points.  RANSAC
+// hypotheses are drawn from that subset, and only planes within
+// maxTilt of the expected up direction are considered.  The plane of
+// the previous frame is scored first; if it still explains the subset
+// about as well as before, only a few extra hypotheses are tried,
+// otherwise a full search is made.  The winner is refined by least
+// squares over its inliers, and the inlier mask is computed for all
+// points in a single final pass.
+class GroundPlaneEstimator {
+public:
+    struct Config {
+        // Points closer than this to the plane are inliers, in meters.
+        float inlierDistance = 0.05f;
+
+        // Points used for hypotheses and refinement.
+        uint32_t sampleCount = 4096;
+
+        // Hypotheses tried without a previous plane, and on top of a
+        // previous plane that still fits.
+        uint32_t coldIterations = 100;
+        uint32_t warmIterations = 8;
+
+        // The previous plane still fits if it keeps this fraction of its
+        // former inlier share.
+        float warmKeep = 0.9f;
+
+        // Least squares passes, each re-selecting inliers.
+        uint32_t refineIterations = 2;
+
+        // A plane needs this share of inliers to count as ground.
+        float minInlierFraction = 0.1f;
+
+        // Expected up direction (in the viewer convention y is up) and the
+        // largest accepted angle between it and the plane normal.
+        float up[3] = {0.0f, 1.0f, 0.0f};
+        float maxTiltDegrees = 30.0f;
+    };
+
+    GroundPlaneEstimator();
+    explicit GroundPlaneEstimator(const Config &config);
+
+    // Estimate the plane of count points strideFloats floats apart.  If
+    // inlierMaskP is given it is resized to count and set to 1 for ground
+    // points.  Returns false, and forgets the previous plane, if no
+    // acceptable plane was found.
+    bool estimate(const float *xyzP, size_t count, size_t strideFloats,
+                  std::vector<uint8_t> *inlierMaskP = 0);
+
+    // Same for points in separate x, y and z arrays (see PointFrame).
+    bool estimate(const float *xP, const float *yP, const float *zP, size_t count,
+                  std::vector<uint8_t> *inlierMaskP = 0);
+
+    bool hasPlane() const { return m_hasPlane; }
+    const Plane &plane() const { return m_plane; }
+
+    // Share of the sampled points within inlierDistance of the plane.
+    float inlierFraction() const { return m_inlierFraction; }
+
+    // True if the last estimate started from the previous plane.
+    bool warmStarted() const { return m_warmStarted; }
+
+    void reset();
+
+private:
+    template <class Points>
+    bool estimatePoints(const Points &points, size_t count, std::vector<uint8_t> *inlierMaskP);
+
+    uint32_t random();
+    bool planeFromPoints(const float *a, const float *b, const float *c, Plane &plane) const;
+    uint32_t countInliers(const Plane &plane) const;
+    bool refine(Plane &plane) const;
+
+    Config m_config;
+    float m_minUpDot;
+
+    Plane m_plane;
+    bool m_hasPlane;
+    float m_inlierFraction;
+    bool m_warmStarted;
+
+    // Packed x, y, z of the sampled points.
+    std::vector<float> m_samples;
+    uint32_t m_randomState;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_GROUND_PLANE_H
@@ -0,0 +1,98 @@
+#ifndef PIPELINE_HEIGHT_MAP_H
+#define PIPELINE_HEIGHT_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pipeline {
+
+class DisparityReprojector;
+class WorkerPool;
+
+// Robot-centric 2.5D grid on the ground, seen from above.
+//
+// Columns run across the view along viewer x, rows run forward away from
+// the camera (along viewer -z).  Heights are viewer y plus the builder's
+// height offset.  Cells without hits have both heights 0.
+struct HeightMap {
+    uint32_t columns = 0;
+    uint32_t rows = 0;
+    float cellSize = 0.0f;
+
+    // Viewer x of the left edge of column 0 and forward distance of the
+    // near edge of row 0, in meters.
+    float originX = 0.0f;
+    float originForward = 0.0f;
+
+    std::vector<float> maxHeight;
+    std::vector<float> minHeight;
+    std::vector<uint32_t> hits;
+
+    size_t index(uint32_t column, uint32_t row) const { return static_cast<size_t>(row) * columns + column; }
+};
+
+// Bins disparity straight into a HeightMap.
+//
+// Every valid pixel of the reprojector's region is projected with its ray
+// tables and dropped into its cell, so no point cloud is built.  Rows are
+// split into tiles that run on a WorkerPool; each worker bins into a grid
+// of its own, which it clears on first use in a frame, and the grids of
+// the workers that took part are merged cell-parallel at the end.
+class HeightMapBuilder {
+public:
+    struct Config {
+        float cellSize = 0.1f;
+
+        // Grid size in cells, and its placement as in HeightMap.
+        uint32_t columns = 200;
+        uint32_t rows = 150;
+        float originX = -10.0f;
+        float originForward = 0.0f;
+
+        // Added to viewer y, e.g. the mounting height of the camera so
+        // heights are relative to the ground.  Points outside
+        // [minHeight, maxHeight] after the offset are dropped.
+        float heightOffset = 0.0f;
+        float minHeight = -2.0f;
+        float maxHeight = 3.0f;
+
+        // Image rows per task.
+        uint32_t rowsPerTile = 16;
+    };
+
+    HeightMapBuilder();
+    explicit HeightMapBuilder(const Config &config);
+
+    const Config &config() const { return m_config; }
+
+    // Build the map of a raw 16-bit disparity image the size of the
+    // reprojector's.  Without a pool the tiles run on the calling thread.
+    void build(const DisparityReprojector &reprojector,
+               const uint16_t *disparityP,
+               HeightMap &map,
+               WorkerPool *poolP = 0);
+
+private:
+    struct Grid {
+        std::vector<float> maxHeight;
+        std::vector<float> minHeight;
+        std::vector<uint32_t> hits;
+        uint64_t frame = 0;
+    };
+
+    void binRows(const DisparityReprojector &reprojector,
+                 const uint16_t *disparityP,
+                 uint32_t beginRow,
+                 uint32_t endRow,
+                 Grid &grid) const;
+    void merge(const std::vector<const Grid *> &grids, HeightMap &map, size_t begin, size_t end) const;
+
+    Config m_config;
+    std::vector<Grid> m_grids;
+    uint64_t m_frame;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_HEIGHT_MAP_H
@@ -0,0 +1,112 @@
+#ifndef PIPELINE_LATEST_MAILBOX_H
+#define PIPELINE_LATEST_MAILBOX_H
+
+#include <pthread.h>
+#include <time.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <utility>
+
+#include "pipeline/ScopedLock.h"
+
+namespace pipeline {
+
+// Single-slot "latest wins" handoff between a producer that must never
+// wait and a consumer that runs at its own pace.  post() replaces any
+// item the consumer has not picked up yet, so the consumer always sees
+// the newest item and the producer never queues up behind it.  The lock
+// is only held for a move; replaced items are destroyed outside it.
+template <class T>
+class LatestMailbox {
+public:
+    LatestMailbox()
+            : m_full(false),
+              m_closed(false),
+              m_posted(0),
+              m_overwritten(0) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&m_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_init(&m_mutex, NULL);
+    }
+
+    ~LatestMailbox() {
+        pthread_cond_destroy(&m_cond);
+        pthread_mutex_destroy(&m_mutex);
+    }
+
+    // Store item, replacing any unread one.  Returns true if an unread
+    // item was replaced.
+    bool post(T item) {
+        bool replaced;
+        {
+            ScopedLock lock(&m_mutex);
+            std::swap(m_item, item);
+            replaced = m_full;
+            m_full = true;
+            m_posted++;
+            if (replaced) {
+                m_overwritten++;
+            }
+            pthread_cond_signal(&m_cond);
+        }
+        // item now holds the previous contents and is destroyed here,
+        // outside the lock.
+        return replaced;
+    }
+
+    // Wait up to timeoutMs for an item and move it out.  Returns false on
+    // timeout or once the mailbox has been closed.
+    bool take(T &item, uint32_t timeoutMs) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeoutMs / 1000;
+        deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        ScopedLock lock(&m_mutex);
+        while (!m_full && !m_closed) {
+            if (ETIMEDOUT == pthread_cond_timedwait(&m_cond, &m_mutex, &deadline)) {
+                break;
+            }
+        }
+        if (!m_full) {
+            return false;
+        }
+        std::swap(item, m_item);
+        m_item = T();
+        m_full = false;
+        return true;
+    }
+
+    // Wake up any waiting consumer; take() returns false from now on
+    // once the mailbox is empty.
+    void close() {
+        ScopedLock lock(&m_mutex);
+        m_closed = true;
+        pthread_cond_broadcast(&m_cond);
+    }
+
+    uint64_t posted() const { ScopedLock lock(&m_mutex); return m_posted; }
+    uint64_t overwritten() const { ScopedLock lock(&m_mutex); return m_overwritten; }
+
+private:
+    T m_item;
+    bool m_full;
+    bool m_closed;
+    uint64_t m_posted;
+    uint64_t m_overwritten;
+
+    mutable pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_LATEST_MAILBOX_H
@@ -0,0 +1,63 @@
+#ifndef PIPELINE_LEVEL_OF_DETAIL_H
+#define PIPELINE_LEVEL_OF_DETAIL_H
+
+#include <cstdint>
+
+namespace pipeline {
+
+// Picks how many points the viewer draws so that rendering keeps up
+// with a target frame time.
+//
+// The caller reports the measured render time of each frame.  When the
+// smoothed time stays above the target, the controller moves to a
+// coarser level, which draws every n-th point.  It moves back to a finer
+// level once the predicted time at that level fits comfortably under
+// the target.  Both moves need a number of consecutive frames to agree,
+// so the level does not flicker.  Only the displayed cloud is
+// decimated; recording and other consumers still get full resolution.
+class LevelOfDetailController {
+public:
+    struct Config {
+        double targetFrameMs = 1000.0 / 30.0;
+
+        // Weight of the newest measurement in the running average.
+        double smoothing = 0.2;
+
+        // A finer level is only chosen if its predicted time is below
+        // this fraction of the target.
+        double refineMargin = 0.8;
+
+        // Consecutive frames that must agree before the level changes.
+        uint32_t holdFrames = 10;
+    };
+
+    LevelOfDetailController();
+    explicit LevelOfDetailController(const Config &config);
+
+    // Report how long the last frame took to render at the current level.
+    void reportFrameTime(double milliseconds);
+
+    // Current level, 0 is full resolution.
+    uint32_t level() const { return m_level; }
+
+    // Draw every stride()-th point at the current level.
+    uint32_t stride() const;
+
+    double averageFrameMs() const { return m_averageMs; }
+
+    void reset();
+
+private:
+    static uint32_t strideForLevel(uint32_t level);
+
+    Config m_config;
+    uint32_t m_level;
+    double m_averageMs;
+    bool m_haveAverage;
+    uint32_t m_coarserVotes;
+    uint32_t m_finerVotes;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_LEVEL_OF_DETAIL_H
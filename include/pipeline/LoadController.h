@@ -0,0 +1,85 @@
+#ifndef PIPELINE_LOAD_CONTROLLER_H
+#define PIPELINE_LOAD_CONTROLLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pipeline {
+
+// Steps the sensor between operating points (resolution and frame rate)
+// so that processing keeps up with the incoming frames.
+//
+// The caller reports the processing time of every frame and how many
+// frames piled up or were skipped since the previous one.  Load is the
+// smoothed processing time as a fraction of the frame period.  When the
+// load stays above highLoad, or frames keep piling up, the controller
+// moves to the next cheaper operating point.  It moves back to a more
+// expensive one only once the load predicted there (scaled by pixels
+// per second) fits under lowLoad for a longer stretch.  After every
+// change the first settleFrames reports are ignored, since the sensor
+// and the pipeline need a moment to reconfigure.
+class LoadController {
+public:
+    struct OperatingPoint {
+        uint32_t width;
+        uint32_t height;
+        float fps;
+    };
+
+    struct Config {
+        // Step down above this load.
+        double highLoad = 0.9;
+
+        // Step up only if the predicted load stays below this.
+        double lowLoad = 0.6;
+
+        // Step down if at least this many frames piled up per frame.
+        uint32_t maxBacklog = 2;
+
+        // Weight of the newest measurement in the running average.
+        double smoothing = 0.1;
+
+        // Consecutive frames that must agree before stepping down or up.
+        uint32_t downFrames = 15;
+        uint32_t upFrames = 90;
+
+        // Reports ignored after a change.
+        uint32_t settleFrames = 30;
+    };
+
+    LoadController();
+    explicit LoadController(const Config &config);
+
+    // Operating points from the most to the least expensive, and the one
+    // the sensor starts in.  Points are sorted by pixels per second.
+    void setOperatingPoints(const std::vector<OperatingPoint> &points, uint32_t startIndex = 0);
+
+    // Report the processing time of the last frame, and the number of
+    // frames that were waiting or skipped when it arrived.  Returns true
+    // if the caller should switch the sensor to current().
+    bool reportFrame(double processingMs, uint32_t backlog);
+
+    const OperatingPoint &current() const { return m_points[m_index]; }
+    uint32_t index() const { return m_index; }
+    size_t size() const { return m_points.size(); }
+    double load() const { return m_load; }
+
+    void reset();
+
+private:
+    static double cost(const OperatingPoint &point);
+
+    Config m_config;
+    std::vector<OperatingPoint> m_points;
+    uint32_t m_index;
+    double m_load;
+    bool m_haveLoad;
+    uint32_t m_downVotes;
+    uint32_t m_upVotes;
+    uint32_t m_settle;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_LOAD_CONTROLLER_H
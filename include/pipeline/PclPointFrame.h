@@ -0,0 +1,132 @@
+#ifndef PIPELINE_PCL_POINT_FRAME_H
+#define PIPELINE_PCL_POINT_FRAME_H
+
+#include <pthread.h>
+
+#include <memory>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "pipeline/CloudKernels.h"
+#include "pipeline/PointFrame.h"
+#include "pipeline/ScopedLock.h"
+
+namespace pipeline {
+
+// Float offset of the color or intensity of a PCL point from its x.
+inline size_t cloudExtraOffset(const pcl::PointXYZ &) {
+    return 3;
+}
+
+inline size_t cloudExtraOffset(const pcl::PointXYZI &point) {
+    return &point.intensity - &point.x;
+}
+
+inline size_t cloudExtraOffset(const pcl::PointXYZRGB &point) {
+    return reinterpret_cast<const float *>(&point.rgba) - &point.x;
+}
+
+// Convert the points of sources into cloud through the cloud kernel for
+// config (see CloudKernels.h).  An organized layout gives the cloud the
+// shape of the image.  Returns false, leaving cloud empty, if the
+// configuration cannot be met.
+template <class Point>
+bool convertCloud(const CloudConfig &config, const CloudSources &sources, pcl::PointCloud<Point> &cloud) {
+    cloud.clear();
+    if (!sources.pointsP) {
+        return false;
+    }
+
+    cloud.points.resize(cloudCapacity(config, *sources.pointsP));
+    CloudOutput output;
+    output.pointsP = cloud.points.empty() ? 0 : &cloud.points[0].x;
+    output.capacity = cloud.points.size();
+    output.strideFloats = sizeof(Point) / sizeof(float);
+    output.extraOffset = cloudExtraOffset(Point());
+
+    size_t count = 0;
+    if (!convertCloud(config, sources, output, count)) {
+        cloud.clear();
+        return false;
+    }
+
+    cloud.points.resize(count);
+    if (CloudLayout_Organized == config.layout) {
+        cloud.width = sources.pointsP->width();
+        cloud.height = sources.pointsP->height();
+        cloud.is_dense = false;
+    } else {
+        cloud.width = static_cast<uint32_t>(count);
+        cloud.height = 1;
+    }
+    return true;
+}
+
+// PCL clouds of a PointFrame, made on first request.
+//
+// Stages that work on the point frame itself never pay for the padded
+// PCL layout.  The first consumer that asks for a cloud converts the
+// frame through the cloud kernel of its type, and every later one gets
+// the same cloud, so the conversion happens at most once per frame and
+// cloud type, on whichever thread needs it first.  The frame must not change while this object exists.
+// All members are thread safe.
+class PclPointFrame {
+public:
+    typedef pcl::PointCloud<pcl::PointXYZ> XyzCloud;
+    typedef pcl::PointCloud<pcl::PointXYZI> XyziCloud;
+
+    explicit PclPointFrame(std::shared_ptr<const PointFrame> frame)
+            : m_frame(std::move(frame)) {
+        pthread_mutex_init(&m_mutex, NULL);
+    }
+
+    ~PclPointFrame() {
+        pthread_mutex_destroy(&m_mutex);
+    }
+
+    const PointFrame &frame() const { return *m_frame; }
+
+    XyzCloud::ConstPtr xyz() {
+        ScopedLock lock(&m_mutex);
+        if (!m_xyz) {
+            m_xyz = convert<pcl::PointXYZ>(CloudPoint_Xyz);
+        }
+        return m_xyz;
+    }
+
+    // The intensity is the one the frame was reprojected with (see
+    // DisparityReprojector::reproject()); points without one get 0.
+    XyziCloud::ConstPtr xyzi() {
+        ScopedLock lock(&m_mutex);
+        if (!m_xyzi) {
+            m_xyzi = convert<pcl::PointXYZI>(CloudPoint_XyzI);
+        }
+        return m_xyzi;
+    }
+
+private:
+    PclPointFrame(const PclPointFrame &);
+    PclPointFrame &operator=(const PclPointFrame &);
+
+    template <class Point>
+    typename pcl::PointCloud<Point>::Ptr convert(CloudPointType pointType) const {
+        CloudConfig config;
+        config.pointType = pointType;
+        CloudSources sources;
+        sources.pointsP = m_frame.get();
+
+        typename pcl::PointCloud<Point>::Ptr cloud(new pcl::PointCloud<Point>);
+        convertCloud(config, sources, *cloud);
+        return cloud;
+    }
+
+    const std::shared_ptr<const PointFrame> m_frame;
+    pthread_mutex_t m_mutex;
+    XyzCloud::ConstPtr m_xyz;
+    XyziCloud::ConstPtr m_xyzi;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_PCL_POINT_FRAME_H
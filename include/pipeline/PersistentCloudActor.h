@@ -0,0 +1,98 @@
+#ifndef PIPELINE_PERSISTENT_CLOUD_ACTOR_H
+#define PIPELINE_PERSISTENT_CLOUD_ACTOR_H
+
+#include <cstddef>
+#include <vector>
+
+#include <vtkActor.h>
+#include <vtkCellArray.h>
+#include <vtkFloatArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkPolyDataMapper.h>
+#include <vtkSmartPointer.h>
+#include <vtkUnsignedCharArray.h>
+
+namespace pipeline {
+
+// VTK actor for a point cloud whose vertex buffers persist across
+// frames.
+//
+// PCL's CloudViewer::showCloud() and PCLVisualizer::addPointCloud()
+// build a new vtkPolyData, and with it new points, cells and GPU
+// buffers, for every cloud.  This actor instead owns pre-sized
+// coordinate and connectivity buffers that VTK references directly.
+// update() overwrites the coordinates in place and only changes the
+// number of points VTK looks at.  The buffers grow geometrically when a
+// larger cloud arrives and never shrink, so steady state updates do not
+// allocate.
+class PersistentCloudActor {
+public:
+    explicit PersistentCloudActor(size_t initialCapacity = 1024 * 544);
+
+    // The actor to add to a renderer, e.g.
+    // visualizer.getRendererCollection()->GetFirstRenderer()->AddActor().
+    vtkSmartPointer<vtkActor> actor() const { return m_actor; }
+
+    // Replace the displayed points with count points, strideFloats
+    // floats apart.  Only every step-th point is kept, which lets the
+    // viewer trade density for frame time.  If bgraP is given, points
+    // are colored from packed B, G, R, A words strideFloats words apart
+    // (the layout of pcl::PointXYZRGB::rgba); otherwise they are white.
+    void update(const float *xyzP, size_t count, size_t strideFloats, size_t step = 1,
+                const uint32_t *bgraP = 0);
+
+    // Convenience overload for pcl::PointCloud<> and friends.
+    template <class Cloud>
+    void update(const Cloud &cloud, size_t step = 1) {
+        if (cloud.points.empty()) {
+            update(0, 0, 0);
+        } else {
+            update(&cloud.points[0].x, cloud.points.size(),
+                   sizeof(cloud.points[0]) / sizeof(float), step);
+        }
+    }
+
+    // Same for clouds with an rgba field, such as pcl::PointXYZRGB.
+    template <class Cloud>
+    void updateColored(const Cloud &cloud, size_t step = 1) {
+        if (cloud.points.empty()) {
+            update(0, 0, 0);
+        } else {
+            update(&cloud.points[0].x, cloud.points.size(),
+                   sizeof(cloud.points[0]) / sizeof(float), step, &cloud.points[0].rgba);
+        }
+    }
+
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_capacity; }
+
+private:
+    void reserve(size_t capacity);
+    void bindBuffers();
+
+    size_t m_capacity;
+    size_t m_size;
+    bool m_hasColors;
+
+    // Storage that VTK references without copying.
+    std::vector<float> m_coordinateBuffer;
+    std::vector<uint8_t> m_colorBuffer;
+    std::vector<vtkIdType> m_connectivityBuffer;
+    std::vector<vtkIdType> m_offsetBuffer;
+
+    vtkSmartPointer<vtkFloatArray> m_coordinates;
+    vtkSmartPointer<vtkUnsignedCharArray> m_colors;
+    vtkSmartPointer<vtkIdTypeArray> m_connectivity;
+    vtkSmartPointer<vtkIdTypeArray> m_offsets;
+    vtkSmartPointer<vtkPoints> m_points;
+    vtkSmartPointer<vtkCellArray> m_vertices;
+    vtkSmartPointer<vtkPolyData> m_polyData;
+    vtkSmartPointer<vtkPolyDataMapper> m_mapper;
+    vtkSmartPointer<vtkActor> m_actor;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_PERSISTENT_CLOUD_ACTOR_H
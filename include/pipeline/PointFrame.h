@@ -0,0 +1,133 @@
+#ifndef PIPELINE_POINT_FRAME_H
+#define PIPELINE_POINT_FRAME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace pipeline {
+
+enum PointPrecision {
+    // 32-bit floats, readable in place.
+    PointPrecision_Float,
+    // IEEE half floats, for half the memory traffic.  Rounding moves
+    // points by up to about 1 mm at 2 m and 4 mm at 8 m.
+    PointPrecision_Half
+};
+
+// Points of one frame as separate x, y, z and intensity arrays.
+//
+// pcl::PointXYZ pads every point to 16 bytes, so a quarter of the
+// bandwidth of any pass over it is wasted, and kernels have to
+// deinterleave before they can work on 4 or 8 points at a time.  Here
+// every coordinate is its own dense array, stored as floats or as half
+// floats.  The image pixel (row * width + column) of every point is
+// kept too, so stages can go back to the images the frame came from.
+//
+// Storage is sized for a full image on reset() and never shrinks, so a
+// frame reused from one image to the next does not allocate.  PCL clouds
+// are made from it only on demand (see PclPointFrame.h).
+class PointFrame {
+public:
+    explicit PointFrame(PointPrecision precision = PointPrecision_Float);
+
+    // Drop all points and start the frame of a width x height image.
+    // Changing the precision also drops the storage.
+    void reset(int64_t frameId, uint32_t width, uint32_t height);
+    void setPrecision(PointPrecision precision);
+
+    // Append count points.  intensityP may be null, in which case the
+    // points have intensity 0 and the frame reports no intensity unless
+    // earlier points had one.  Points beyond width * height are dropped.
+    void append(const float *xP,
+                const float *yP,
+                const float *zP,
+                const float *intensityP,
+                const uint32_t *pixelsP,
+                size_t count);
+
+    // Keep the points of source whose mask entry is zero.
+    void assignUnmasked(const PointFrame &source, const uint8_t *maskP);
+
+    int64_t frameId() const { return m_frameId; }
+    uint32_t width() const { return m_width; }
+    uint32_t height() const { return m_height; }
+    PointPrecision precision() const { return m_precision; }
+    size_t size() const { return m_size; }
+    bool empty() const { return 0 == m_size; }
+    bool hasIntensity() const { return m_hasIntensity; }
+
+    // Coordinate arrays in the viewer convention (x right, y up, z
+    // negative in front).  The float accessors return null for half
+    // precision frames and vice versa.
+    const float *x() const { return floatChannel(0); }
+    const float *y() const { return floatChannel(1); }
+    const float *z() const { return floatChannel(2); }
+    const float *intensity() const { return floatChannel(3); }
+    const uint16_t *xHalf() const { return halfChannel(0); }
+    const uint16_t *yHalf() const { return halfChannel(1); }
+    const uint16_t *zHalf() const { return halfChannel(2); }
+    const uint16_t *intensityHalf() const { return halfChannel(3); }
+
+    const uint32_t *pixels() const { return m_pixels.data(); }
+
+    // Write x, y, z of every point, strideFloats floats apart, as floats
+    // whatever the precision (e.g. into the points of a PCL cloud).
+    void copyXyz(float *xyzP, size_t strideFloats) const;
+    void copyIntensity(float *intensityP, size_t strideFloats) const;
+
+private:
+    static const size_t CHANNELS = 4;
+
+    const float *floatChannel(size_t channel) const;
+    const uint16_t *halfChannel(size_t channel) const;
+    void copyChannel(size_t channel, float *outP, size_t strideFloats) const;
+
+    PointPrecision m_precision;
+    int64_t m_frameId;
+    uint32_t m_width;
+    uint32_t m_height;
+    size_t m_size;
+    bool m_hasIntensity;
+
+    // Only the vectors of the current precision are used.
+    std::vector<float> m_floats[CHANNELS];
+    std::vector<uint16_t> m_halves[CHANNELS];
+    std::vector<uint32_t> m_pixels;
+};
+
+// Recycles point frames, so steady state reprojection does not hit the
+// allocator for every frame.
+//
+// acquire() hands out a reference counted frame.  When the last
+// reference goes away the frame goes back to the pool, storage and all,
+// as long as the pool still exists and keeps fewer than maxIdle frames
+// around.  All members are thread safe.
+class PointFramePool {
+public:
+    explicit PointFramePool(size_t maxIdle = 4);
+    ~PointFramePool();
+
+    // An empty frame of the given precision; reset() it before use.
+    std::shared_ptr<PointFrame> acquire(PointPrecision precision = PointPrecision_Float);
+
+    // Frames allocated so far.
+    uint64_t allocations() const;
+
+private:
+    PointFramePool(const PointFramePool &);
+    PointFramePool &operator=(const PointFramePool &);
+
+    struct State;
+    std::shared_ptr<State> m_state;
+};
+
+// Convert count floats to IEEE half floats (round to nearest even) and
+// back.
+void floatToHalf(const float *inP, uint16_t *outP, size_t count);
+void halfToFloat(const uint16_t *inP, float *outP, size_t count);
+
+} // namespace pipeline
+
+#endif // PIPELINE_POINT_FRAME_H
@@ -0,0 +1,62 @@
+#ifndef PIPELINE_POSE_H
+#define PIPELINE_POSE_H
+
+namespace pipeline {
+
+// Rigid transform p' = rotation * p + translation, with the rotation in
+// row-major order.  Camera poses map points from the camera (in the
+// viewer convention: x right, y up, z negative in front) to the world.
+struct Pose {
+    float rotation[9] = {1.0f, 0.0f, 0.0f,
+                         0.0f, 1.0f, 0.0f,
+                         0.0f, 0.0f, 1.0f};
+    float translation[3] = {0.0f, 0.0f, 0.0f};
+
+    void apply(const float *p, float *out) const {
+        const float x = p[0], y = p[1], z = p[2];
+        for (int r = 0; r < 3; ++r) {
+            out[r] = rotation[3 * r] * x + rotation[3 * r + 1] * y + rotation[3 * r + 2] * z + translation[r];
+        }
+    }
+
+    // Rotate only, for directions and normals.
+    void rotate(const float *v, float *out) const {
+        const float x = v[0], y = v[1], z = v[2];
+        for (int r = 0; r < 3; ++r) {
+            out[r] = rotation[3 * r] * x + rotation[3 * r + 1] * y + rotation[3 * r + 2] * z;
+        }
+    }
+
+    Pose inverse() const {
+        Pose result;
+        for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 3; ++c) {
+                result.rotation[3 * r + c] = rotation[3 * c + r];
+            }
+        }
+        for (int r = 0; r < 3; ++r) {
+            result.translation[r] = -(result.rotation[3 * r] * translation[0] +
+                                      result.rotation[3 * r + 1] * translation[1] +
+                                      result.rotation[3 * r + 2] * translation[2]);
+        }
+        return result;
+    }
+
+    // this * other: apply other first.
+    Pose operator*(const Pose &other) const {
+        Pose result;
+        for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 3; ++c) {
+                result.rotation[3 * r + c] = rotation[3 * r] * other.rotation[c] +
+                                             rotation[3 * r + 1] * other.rotation[3 + c] +
+                                             rotation[3 * r + 2] * other.rotation[6 + c];
+            }
+        }
+        apply(other.translation, result.translation);
+        return result;
+    }
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_POSE_H
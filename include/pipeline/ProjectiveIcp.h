@@ -0,0 +1,135 @@
+#ifndef PIPELINE_PROJECTIVE_ICP_H
+#define PIPELINE_PROJECTIVE_ICP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "pipeline/Pose.h"
+
+namespace pipeline {
+
+class DisparityReprojector;
+class WorkerPool;
+
+// Frame-to-frame camera motion from consecutive disparity images.
+//
+// Every frame becomes a pyramid of organized clouds: each level averages
+// the valid disparities of 2x2 blocks of the level below (blocks that
+// straddle a depth edge are left invalid), and holds a vertex and a
+// normal per pixel.  Level 0 is already decimated by baseDecimation,
+// which is plenty for motion and keeps the cost down.
+//
+// Alignment is point-to-plane ICP with projective association: a point
+// of the new frame is paired with the point of the previous frame it
+// projects onto under the current estimate, so no search structure is
+// built.  It runs coarse to fine from the motion of the previous frame.
+// The normal equations are summed per worker over row tiles and reduced
+// at the end of every iteration.
+class ProjectiveIcp {
+public:
+    static const uint32_t MAX_LEVELS = 4;
+
+    struct Config {
+        // Decimation of level 0 relative to the disparity image.
+        uint32_t baseDecimation = 4;
+
+        uint32_t levels = 3;
+
+        // Iterations per level, finest first; the coarsest level runs
+        // first.
+        uint32_t iterations[MAX_LEVELS] = {4, 6, 8, 8};
+
+        // Pairs further apart than this, in meters, or with normals more
+        // than maxAngleDegrees apart, are rejected.
+        float maxDistance = 0.15f;
+        float maxAngleDegrees = 30.0f;
+
+        // Neighbouring disparities, in pixels, that differ by more than
+        // this are not averaged; the block is left invalid.
+        float maxDisparityStep = 1.0f;
+
+        // Normals are taken over about this many full resolution pixels.
+        uint32_t normalBaseline = 16;
+
+        // An estimate needs this many pairs at the finest level.
+        uint32_t minPairs = 500;
+
+        // Image rows per reduction task, at every level.
+        uint32_t rowsPerTile = 8;
+    };
+
+    ProjectiveIcp();
+    explicit ProjectiveIcp(const Config &config);
+
+    // Align a raw 16-bit disparity image the size of the reprojector's to
+    // the previous one.  The first frame, and frames that cannot be
+    // aligned, return false and restart from an identity motion; the
+    // frame still becomes the reference for the next one.
+    bool track(const DisparityReprojector &reprojector, const uint16_t *disparityP, WorkerPool *poolP = 0);
+
+    // Motion of the last frame: maps points of the current camera into
+    // the previous camera, in the viewer convention.
+    const Pose &motion() const { return m_motion; }
+
+    // Accumulated pose: maps points of the current camera into the camera
+    // of the first frame since reset().
+    const Pose &pose() const { return m_pose; }
+
+    // Pairs and RMS point-to-plane error of the last iteration.
+    uint32_t pairs() const { return m_pairs; }
+    float rmsError() const { return m_rmsError; }
+
+    void reset();
+
+private:
+    struct Level {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t scale = 1;
+        std::vector<float> disparity;
+        std::vector<float> vertices;
+        std::vector<float> normals;
+    };
+
+    struct Frame {
+        Level levels[MAX_LEVELS];
+    };
+
+    // Normal equations: upper triangle of J^T J, J^T r, squared error
+    // and pair count.
+    struct Sums {
+        double a[21];
+        double b[6];
+        double error;
+        uint32_t count;
+
+        void clear();
+        void add(const Sums &other);
+    };
+
+    void buildFrame(const DisparityReprojector &reprojector, const uint16_t *disparityP, Frame &frame,
+                    WorkerPool *poolP) const;
+    void buildGeometry(const DisparityReprojector &reprojector, Level &level) const;
+    void accumulate(const DisparityReprojector &reprojector, const Level &source, const Level &target,
+                    const Pose &estimate, uint32_t beginRow, uint32_t endRow, Sums &sums) const;
+    bool solve(const Sums &sums, Pose &increment) const;
+
+    Config m_config;
+    float m_minNormalDot;
+
+    Frame m_frames[2];
+    uint32_t m_current;
+    bool m_hasReference;
+
+    Pose m_motion;
+    Pose m_pose;
+    uint32_t m_pairs;
+    float m_rmsError;
+
+    std::vector<Sums> m_workerSums;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_PROJECTIVE_ICP_H
@@ -0,0 +1,78 @@
+#ifndef PIPELINE_RECTIFIED_COLOR_H
+#define PIPELINE_RECTIFIED_COLOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pipeline {
+
+// Looks up the color of rectified left image pixels directly in the raw
+// (unrectified) luma and 4:2:0 chroma buffers from libMultiSense.
+//
+// The rectification maps are turned into sample offsets and bilinear
+// luma weights once, so coloring a point costs a few table reads and a
+// gather, and rectifying and converting a whole image is a single pass
+// over the raw planes.  The chroma plane holds interleaved Cb, Cr pairs
+// at half resolution in both directions and is sampled at the nearest
+// position.
+class RectifiedColorLookup {
+public:
+    RectifiedColorLookup();
+
+    // mapXP and mapYP are the CV_32F rectification maps (e.g.
+    // m_leftCalibrationMapX/Y), width x height, giving the raw image
+    // position of every rectified pixel.  The raw image has the same
+    // size.
+    void build(const float *mapXP, const float *mapYP, uint32_t width, uint32_t height);
+
+    bool isValid() const { return m_width > 0; }
+
+    // Sample the colors of rectified pixels (row, columnsP[i]) from 8-bit
+    // luma and 16-bit CbCr buffers, writing packed B, G, R, A values (see
+    // ycbcrToBgra()).  Pixels that fall outside the raw image are black.
+    void sampleRow(const uint8_t *lumaP,
+                   const uint8_t *chromaP,
+                   uint32_t row,
+                   const uint32_t *columnsP,
+                   size_t count,
+                   uint32_t *bgraP);
+
+    // Rectify and convert one full row, or the whole image, to packed
+    // B, G, R bytes (CV_8UC3 layout).
+    void convertRow(const uint8_t *lumaP,
+                    const uint8_t *chromaP,
+                    uint32_t row,
+                    uint8_t *bgrRowP);
+    void convertImage(const uint8_t *lumaP,
+                      const uint8_t *chromaP,
+                      uint8_t *bgrP,
+                      size_t strideBytes);
+
+    uint32_t width() const { return m_width; }
+    uint32_t height() const { return m_height; }
+
+private:
+    // Interpolate rectified pixel index into scratch slot i.
+    void gather(const uint8_t *lumaP, const uint8_t *chromaP, size_t index, size_t i);
+
+    uint32_t m_width;
+    uint32_t m_height;
+
+    // Raw index of the top left luma neighbour and CbCr pair offset for
+    // every rectified pixel, or -1 if it maps outside the raw image.  The
+    // weights hold the Q7 x fraction in the low and y fraction in the
+    // high byte.
+    std::vector<int32_t> m_lumaOffsets;
+    std::vector<uint16_t> m_weights;
+    std::vector<int32_t> m_chromaOffsets;
+
+    // Scratch rows for the gathered samples.
+    std::vector<uint8_t> m_y;
+    std::vector<uint8_t> m_cb;
+    std::vector<uint8_t> m_cr;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_RECTIFIED_COLOR_H
@@ -0,0 +1,104 @@
+#ifndef PIPELINE_REGION_OF_INTEREST_H
+#define PIPELINE_REGION_OF_INTEREST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pipeline {
+
+// Half-open run [begin, end) of included columns in one image row.
+struct RoiSpan {
+    uint32_t begin;
+    uint32_t end;
+};
+
+// The part of the image, and of space, the disparity stages work on.
+//
+// The image-space part is the intersection of a rectangle and an
+// optional mask image (nonzero pixels are included), e.g. one that
+// blanks out parts of the robot in view of the camera.  It is stored as
+// runs of included columns per row, so stages visit only included
+// pixels and skip excluded ones entirely rather than testing each.
+//
+// The 3D part is an axis-aligned crop box in the viewer convention used
+// by DisparityReprojector (x right, y up, z negative in front of the
+// camera); points on or outside its faces are dropped.
+class RegionOfInterest {
+public:
+    RegionOfInterest();
+
+    // Include the whole width x height image and drop the rectangle, the
+    // mask and the crop box.
+    void reset(uint32_t width, uint32_t height);
+
+    // Restrict to a rectangle, clipped to the image.
+    void setRect(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+    // Restrict to the nonzero pixels of a width() x height() mask with the
+    // given row stride in bytes.  Pass 0 to drop the mask.
+    void setMask(const uint8_t *maskP, size_t strideBytes);
+
+    void setCropBox(const float minimum[3], const float maximum[3]);
+    void clearCropBox();
+
+    uint32_t width() const { return m_width; }
+    uint32_t height() const { return m_height; }
+
+    // Rows [firstRow(), endRow()) contain all included pixels.
+    uint32_t firstRow() const { return m_firstRow; }
+    uint32_t endRow() const { return m_endRow; }
+
+    // Included runs of a row; count is set to their number.
+    const RoiSpan *spans(uint32_t row, size_t &count) const {
+        count = m_rowStarts[row + 1] - m_rowStarts[row];
+        return m_spans.data() + m_rowStarts[row];
+    }
+
+    size_t pixelCount() const { return m_pixelCount; }
+
+    // True if every pixel is included.
+    bool isFull() const { return m_pixelCount == static_cast<size_t>(m_width) * m_height; }
+
+    bool hasCropBox() const { return m_hasCropBox; }
+    const float *cropMinimum() const { return m_cropMinimum; }
+    const float *cropMaximum() const { return m_cropMaximum; }
+
+    bool inCropBox(float x, float y, float z) const {
+        return !m_hasCropBox ||
+               (x > m_cropMinimum[0] && x < m_cropMaximum[0] &&
+                y > m_cropMinimum[1] && y < m_cropMaximum[1] &&
+                z > m_cropMinimum[2] && z < m_cropMaximum[2]);
+    }
+
+    // Changes whenever the region is modified, and is never shared by two
+    // different regions, so stages can cache state derived from it.
+    uint64_t serial() const { return m_serial; }
+
+private:
+    void rebuild();
+
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_rectX;
+    uint32_t m_rectY;
+    uint32_t m_rectWidth;
+    uint32_t m_rectHeight;
+    std::vector<uint8_t> m_mask;
+
+    std::vector<RoiSpan> m_spans;
+    std::vector<uint32_t> m_rowStarts;
+    uint32_t m_firstRow;
+    uint32_t m_endRow;
+    size_t m_pixelCount;
+
+    bool m_hasCropBox;
+    float m_cropMinimum[3];
+    float m_cropMaximum[3];
+
+    uint64_t m_serial;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_REGION_OF_INTEREST_H
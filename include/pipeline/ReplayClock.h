@@ -0,0 +1,72 @@
+#ifndef PIPELINE_REPLAY_CLOCK_H
+#define PIPELINE_REPLAY_CLOCK_H
+
+#include <chrono>
+#include <cstdint>
+
+namespace pipeline {
+
+// Paces the delivery of recorded frames, such as those of a frame log.
+//
+// A frame is due when the time since the first frame's delivery reaches
+// the time between the two frames' timestamps, divided by the speed
+// factor.  Due times follow from the first frame, not from the previous
+// delivery, so a late frame does not push back the ones after it and
+// the schedule is the same from run to run.  Speed 0 delivers frames as
+// fast as they are consumed.  Timestamps that go backwards, as the
+// images of different sources may, count as the latest one seen.
+//
+// Meant for a single replay thread; not thread safe.
+class ReplayClock {
+public:
+    struct Stats {
+        uint64_t frames = 0;
+
+        // Between the first and the last delivery, and between the
+        // timestamps of the first and the last frame.
+        double wallSeconds = 0.0;
+        double recordedSeconds = 0.0;
+
+        // Delivery after the due time, over all frames.  Frames more than
+        // a millisecond late count as late.
+        double meanLateMs = 0.0;
+        double maxLateMs = 0.0;
+        uint64_t lateFrames = 0;
+
+        double fps() const { return wallSeconds > 0.0 ? (frames - 1) / wallSeconds : 0.0; }
+        double recordedFps() const { return recordedSeconds > 0.0 ? (frames - 1) / recordedSeconds : 0.0; }
+    };
+
+    explicit ReplayClock(double speed = 1.0);
+
+    double speed() const { return m_speed; }
+
+    // Wait until the frame stamped logTime seconds is due.  Returns how
+    // late it is, in seconds, once the wait is over.
+    double waitFor(double logTime);
+
+    // Start over with the next frame as the first one.
+    void reset();
+
+    Stats stats() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    double m_speed;
+
+    bool m_started;
+    Clock::time_point m_start;
+    Clock::time_point m_lastDelivery;
+    double m_firstLogTime;
+    double m_lastLogTime;
+
+    uint64_t m_frames;
+    double m_lateSum;
+    double m_lateMax;
+    uint64_t m_lateFrames;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_REPLAY_CLOCK_H
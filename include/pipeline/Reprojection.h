@@ -0,0 +1,107 @@
+#ifndef PIPELINE_REPROJECTION_H
+#define PIPELINE_REPROJECTION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "pipeline/RegionOfInterest.h"
+
+namespace pipeline {
+
+class PointFrame;
+
+// Reprojects raw 16-bit disparity (1/16th pixel units) to 3D points
+// without going through a float disparity image and a full 3-channel
+// point image, as cv::reprojectImageTo3D() would.
+//
+// The reprojection matrix is expected in the form InitializeTransforms()
+// builds it: X only depends on the column, Y only on the row, Z is
+// constant and W is linear in disparity.  That lets the per-column and
+// per-row terms be tabulated once ("ray tables") so each pixel costs one
+// reciprocal and three multiplies.
+//
+// Output points use the viewer convention: x to the right, y up, and z
+// negative in front of the camera.
+class DisparityReprojector {
+public:
+    DisparityReprojector();
+
+    // q is the 4x4 reprojection matrix in row-major order, for images of
+    // width x height pixels.
+    void setQ(const float *q, uint32_t width, uint32_t height);
+
+    // Only reproject pixels of the region and keep points inside its crop
+    // box.  The pixel part of a region sized for a different image is
+    // ignored.
+    void setRegion(const RegionOfInterest &region);
+
+    // Reproject image row `row`.  Packed x, y, z of every valid point are
+    // written to xyzP (room for 3 * width floats) and the column of each
+    // point to columnsP (room for width entries).  Returns the number of
+    // points.  Excluded pixels are never read.
+    size_t reprojectRow(const uint16_t *disparityRowP,
+                        uint32_t row,
+                        float *xyzP,
+                        uint32_t *columnsP) const;
+
+    // Same, into separate x, y and z arrays (room for width floats each).
+    size_t reprojectRow(const uint16_t *disparityRowP,
+                        uint32_t row,
+                        float *xP,
+                        float *yP,
+                        float *zP,
+                        uint32_t *columnsP) const;
+
+    // Reproject a whole image into frame, which is reset for frameId.  If
+    // intensityP is given, an 8-bit image of the same size registered to
+    // the disparity (such as the rectified left luma), the points take
+    // their intensity from it.
+    void reproject(const uint16_t *disparityP,
+                   int64_t frameId,
+                   PointFrame &frame,
+                   const uint8_t *intensityP = 0) const;
+
+    uint32_t width() const { return m_width; }
+    uint32_t height() const { return m_height; }
+    uint32_t firstRow() const { return useRegion() ? m_region.firstRow() : 0; }
+    uint32_t endRow() const { return useRegion() ? m_region.endRow() : m_height; }
+    bool isValid() const { return m_width > 0; }
+
+    // Included runs of image row `row`: the region's spans, or the whole
+    // row when no region applies.
+    const RoiSpan *spans(uint32_t row, size_t &count) const;
+
+    const RegionOfInterest &region() const { return m_region; }
+
+    // Ray table terms, for stages that project without materializing
+    // points.  For raw disparity d: w = d * disparityScale() + wOffset(),
+    // X = columnTerm(c) / w, Y = rowTerm(r) / w, Z = depthTerm() / w, in
+    // the camera frame (before the viewer flips y and z).
+    float columnTerm(uint32_t column) const { return m_columnTerms[column]; }
+    float rowTerm(uint32_t row) const { return m_rowTerms[row]; }
+    float depthTerm() const { return m_depthTerm; }
+    float disparityScale() const { return m_disparityScale; }
+    float wOffset() const { return m_wOffset; }
+
+private:
+    bool useRegion() const { return m_region.width() == m_width && m_region.height() == m_height; }
+
+    template <class Output>
+    size_t reprojectRowTo(const uint16_t *disparityRowP, uint32_t row, Output &output) const;
+
+    uint32_t m_width;
+    uint32_t m_height;
+    std::vector<float> m_columnTerms;
+    std::vector<float> m_rowTerms;
+    float m_depthTerm;
+    float m_disparityScale;
+    float m_wOffset;
+
+    RegionOfInterest m_region;
+    RoiSpan m_fullRow;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_REPROJECTION_H
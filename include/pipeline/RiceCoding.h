@@ -0,0 +1,142 @@
+#ifndef PIPELINE_RICE_CODING_H
+#define PIPELINE_RICE_CODING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace pipeline {
+
+// Bit-level building blocks of the lossless codecs (CloudCodec,
+// DepthCodec): LSB-first bit streams and Rice codes for small unsigned
+// residuals, with an escape that bounds the cost of outliers.
+
+// Quotients at or above this are escaped and followed by the raw 16-bit
+// value, so no code is longer than a few bytes.
+const uint32_t RICE_ESCAPE = 24;
+
+// Worst case size in bytes of count escaped codes.
+inline size_t riceWorstCase(size_t count) {
+    return count * 5;
+}
+
+// Map signed residuals to unsigned ones, small magnitudes first.
+inline uint16_t zigzag(int16_t v) {
+    return static_cast<uint16_t>((static_cast<uint16_t>(v) << 1) ^ static_cast<uint16_t>(v >> 15));
+}
+
+inline int16_t unzigzag(uint16_t v) {
+    return static_cast<int16_t>((v >> 1) ^ static_cast<uint16_t>(-(v & 1)));
+}
+
+// Smallest k for which 2^k is not below the mean of the values, which
+// is close to the optimal Rice parameter for geometric residuals.
+uint32_t riceParameter(const uint16_t *valuesP, size_t count);
+
+// Throws the exception BitReader reports a truncated stream with.
+[[noreturn]] void throwTruncatedStream();
+
+// Appends bits LSB-first into a buffer that the caller has sized for
+// the worst case, flushing whole 32-bit words.
+class BitWriter {
+public:
+    explicit BitWriter(uint8_t *outP) : m_startP(outP), m_outP(outP), m_bits(0), m_count(0) {}
+
+    void put(uint32_t value, uint32_t bits) {
+        m_bits |= static_cast<uint64_t>(value) << m_count;
+        m_count += bits;
+        if (m_count >= 32) {
+            uint32_t word = static_cast<uint32_t>(m_bits);
+            std::memcpy(m_outP, &word, sizeof(word));
+            m_outP += sizeof(word);
+            m_bits >>= 32;
+            m_count -= 32;
+        }
+    }
+
+    void putRice(uint16_t value, uint32_t k) {
+        uint32_t q = value >> k;
+        if (q >= RICE_ESCAPE) {
+            put((1u << RICE_ESCAPE) - 1, RICE_ESCAPE);
+            put(value, 16);
+            return;
+        }
+        // q ones followed by a zero, then the k low bits, in one write
+        // whenever the code fits.
+        uint64_t code = ((1ull << q) - 1) | (static_cast<uint64_t>(value & ((1u << k) - 1)) << (q + 1));
+        uint32_t bits = q + 1 + k;
+        if (bits <= 32) {
+            put(static_cast<uint32_t>(code), bits);
+        } else {
+            put(static_cast<uint32_t>(code), 16);
+            put(static_cast<uint32_t>(code >> 16), bits - 16);
+        }
+    }
+
+    // Writes out any partial bytes and returns the number of bytes used.
+    size_t finish() {
+        while (m_count > 0) {
+            *m_outP++ = static_cast<uint8_t>(m_bits);
+            m_bits >>= 8;
+            m_count = m_count > 8 ? m_count - 8 : 0;
+        }
+        return static_cast<size_t>(m_outP - m_startP);
+    }
+
+private:
+    uint8_t *m_startP;
+    uint8_t *m_outP;
+    uint64_t m_bits;
+    uint32_t m_count;
+};
+
+class BitReader {
+public:
+    BitReader(const uint8_t *dataP, size_t length)
+            : m_dataP(dataP), m_end(dataP + length), m_bits(0), m_count(0) {}
+
+    uint32_t get(uint32_t bits) {
+        refill();
+        if (m_count < bits) {
+            throwTruncatedStream();
+        }
+        uint32_t value = static_cast<uint32_t>(m_bits & ((1ull << bits) - 1));
+        m_bits >>= bits;
+        m_count -= bits;
+        return value;
+    }
+
+    uint16_t getRice(uint32_t k) {
+        // Count the unary prefix in one go.  Bits above m_count are zero,
+        // so the count never runs past the buffered data.  A full buffer
+        // of ones (back to back escapes of 0xFFFF) has no zero to find and
+        // is an escape as well.
+        refill();
+        const uint64_t inverted = ~m_bits;
+        uint32_t q = inverted ? static_cast<uint32_t>(__builtin_ctzll(inverted)) : 64;
+        if (q >= RICE_ESCAPE) {
+            get(RICE_ESCAPE);
+            return static_cast<uint16_t>(get(16));
+        }
+        get(q + 1);
+        uint32_t low = k ? get(k) : 0;
+        return static_cast<uint16_t>((q << k) | low);
+    }
+
+private:
+    void refill() {
+        while (m_count <= 56 && m_dataP < m_end) {
+            m_bits |= static_cast<uint64_t>(*m_dataP++) << m_count;
+            m_count += 8;
+        }
+    }
+
+    const uint8_t *m_dataP;
+    const uint8_t *m_end;
+    uint64_t m_bits;
+    uint32_t m_count;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_RICE_CODING_H
@@ -0,0 +1,23 @@
+#ifndef PIPELINE_SCOPED_LOCK_H
+#define PIPELINE_SCOPED_LOCK_H
+
+#include <pthread.h>
+
+namespace pipeline {
+
+// Simple pthread-based lock class with RAII semantics, matching the one
+// used by the sample applications.
+class ScopedLock {
+public:
+    ScopedLock(pthread_mutex_t *mutexP)
+            : m_mutexP(mutexP) { if (m_mutexP) { pthread_mutex_lock(m_mutexP); }}
+
+    ~ScopedLock() { if (m_mutexP) { pthread_mutex_unlock(m_mutexP); }}
+
+private:
+    pthread_mutex_t *m_mutexP;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_SCOPED_LOCK_H
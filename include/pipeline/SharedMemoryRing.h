@@ -0,0 +1,151 @@
+#ifndef PIPELINE_SHARED_MEMORY_RING_H
+#define PIPELINE_SHARED_MEMORY_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace pipeline {
+
+// Single-writer, many-reader ring of frames in POSIX shared memory.
+//
+// The publishing process writes each frame once into the next slot of
+// the ring.  Subscribers in other processes map the same segment
+// read-only and read frames in place, without copies and without any
+// coordination with the publisher.  Every slot carries a sequence
+// number that is odd while the slot is being written (a seqlock), so a
+// subscriber can tell after reading whether the publisher lapped it and
+// the data changed underneath.
+//
+// One ring carries one kind of payload; the sample publishes disparity,
+// luma and clouds on separate rings.
+//
+// A publisher that is restarted creates a new segment under the same
+// name and retires the old one, which subscribers still have mapped.
+// Subscribers notice the retirement and map the new segment; see
+// ShmSubscriber::generation().
+enum ShmPayload {
+    ShmPayload_Image = 1,  // width x height pixels of bitsPerPixel
+    ShmPayload_Cloud = 2   // width points of packed float x, y, z
+};
+
+// Per-frame metadata that precedes the payload in each slot.
+struct ShmFrameInfo {
+    int64_t frameId;
+    uint64_t source;          // crl::multisense::DataSource of images
+    uint32_t payloadType;     // ShmPayload
+    uint32_t width;
+    uint32_t height;
+    uint32_t bitsPerPixel;
+    uint32_t timeSeconds;
+    uint32_t timeMicroSeconds;
+    uint64_t publishTimeNs;   // CLOCK_MONOTONIC at publish
+    uint64_t payloadLength;
+};
+
+// One piece of a payload that is published in several parts.
+struct ShmPiece {
+    const void *dataP;
+    size_t length;
+};
+
+class ShmPublisher {
+public:
+    ShmPublisher();
+    ~ShmPublisher();
+
+    // Create (or replace) the segment /name with slotCount slots of at
+    // most maxPayload bytes each.  A segment left by an earlier publisher
+    // is retired, so its subscribers move to the new one.  Throws on
+    // failure.
+    void open(const std::string &name, uint32_t slotCount, size_t maxPayload);
+    void close();
+
+    bool isOpen() const { return 0 != m_baseP; }
+
+    // Copy one frame into the next slot.  Returns false if the payload
+    // does not fit a slot.
+    bool publish(const ShmFrameInfo &info, const void *payloadP, size_t length);
+
+    // The same for a payload in several pieces (e.g. the rows of an image
+    // with padded rows), which are written back to back.
+    bool publish(const ShmFrameInfo &info, const ShmPiece *piecesP, size_t pieceCount);
+
+    // Zero-copy variant: returns the payload area of the next slot and
+    // marks it as being written; finish with commit().  Producers can
+    // compute straight into shared memory this way.
+    void *beginWrite(size_t maxLength);
+    void commit(const ShmFrameInfo &info);
+
+    uint64_t published() const;
+
+private:
+    std::string m_name;
+    void *m_baseP;
+    size_t m_mappedSize;
+    void *m_pendingSlotP;
+};
+
+// A frame as seen by a subscriber.  payloadP points into the shared
+// mapping; the frame is only valid while stillValid() returns true.
+struct ShmFrame {
+    ShmFrameInfo info;
+    const void *payloadP;
+    uint64_t sequence;  // Publish counter, increases by one per frame
+    const void *slotP;
+};
+
+class ShmSubscriber {
+public:
+    ShmSubscriber();
+    ~ShmSubscriber();
+
+    // Map the segment /name read-only.  Returns false if it does not
+    // exist (yet).
+    bool open(const std::string &name);
+    void close();
+
+    bool isOpen() const { return 0 != m_baseP; }
+
+    // Generation of the mapped segment, one more than that of the segment
+    // it replaced if that was still in place.  Once the publisher retires
+    // the mapped segment, latest() and next() map its replacement and
+    // start over with its first frame.
+    uint64_t generation() const;
+
+    // Fetch the newest complete frame.  Returns false if nothing has
+    // been published yet, or if the frame is no newer than the last one
+    // returned.
+    bool latest(ShmFrame &frame);
+
+    // Fetch the frame following the last one returned.  If the
+    // subscriber fell behind by more than the ring size it skips ahead
+    // to the oldest frame still available; dropped() counts the loss.
+    bool next(ShmFrame &frame);
+
+    // True if the publisher has not started overwriting the slot since
+    // the frame was fetched.  Call after consuming the payload.
+    bool stillValid(const ShmFrame &frame) const;
+
+    uint64_t dropped() const { return m_dropped; }
+
+private:
+    bool map(const std::string &segment);
+    bool current();
+    bool read(uint64_t sequence, ShmFrame &frame);
+
+    std::string m_name;
+    void *m_baseP;
+    size_t m_mappedSize;
+    uint64_t m_lastSequence;
+    uint64_t m_dropped;
+};
+
+// CLOCK_MONOTONIC in nanoseconds, which is shared by all processes on
+// the machine and used to stamp published frames.
+uint64_t monotonicNs();
+
+} // namespace pipeline
+
+#endif // PIPELINE_SHARED_MEMORY_RING_H
@@ -0,0 +1,93 @@
+#ifndef PIPELINE_STREAM_SUBSCRIPTIONS_H
+#define PIPELINE_STREAM_SUBSCRIPTIONS_H
+
+#include <pthread.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "MultiSense/MultiSenseTypes.hh"
+
+namespace pipeline {
+
+// Keeps only the sensor streams running that some consumer needs.
+//
+// Every stage subscribes with the data sources it consumes (a
+// crl::multisense::DataSource mask).  Whenever the union of all
+// subscriptions changes, sources nobody needs any more are stopped and
+// newly needed ones are started through the control functions, which
+// normally wrap Channel::stopStreams() and Channel::startStreams().
+// Subscriptions made before the controls are attached only take effect
+// once they are.
+//
+// The control functions are called without the internal lock held, so
+// they may take as long as the sensor needs and may call back into this
+// class.  Subscriptions a control changes take effect once the controls
+// running return.
+class StreamSubscriptions {
+public:
+    typedef crl::multisense::DataSource Mask;
+    typedef std::function<bool(Mask)> Control;
+
+    StreamSubscriptions();
+    ~StreamSubscriptions();
+
+    // Attach the functions that start and stop sources, and start every
+    // source subscribed so far.  Each returns false on failure.
+    void setControl(const Control &start, const Control &stop);
+
+    // Register a consumer of sources.  Returns an id for unsubscribe().
+    int subscribe(const std::string &name, Mask sources);
+    void unsubscribe(int id);
+
+    // Sources currently started, and sources some consumer asked for.
+    Mask active() const;
+    Mask wanted() const;
+
+    // Names of the consumers of any of the given sources, comma
+    // separated.
+    std::string consumers(Mask sources) const;
+
+    // Estimated link usage: bytes per frame of a single source, and the
+    // frame rate they are sent at.
+    void setFrameBytes(Mask source, double bytes);
+    void setFrameRate(double fps);
+    double bytesPerSecond(Mask sources) const;
+
+private:
+    StreamSubscriptions(const StreamSubscriptions &);
+    StreamSubscriptions &operator=(const StreamSubscriptions &);
+
+    struct Subscription {
+        int id;
+        std::string name;
+        Mask sources;
+    };
+
+    Mask wantedLocked() const;
+    void update();
+    void runControls();
+
+    mutable pthread_mutex_t m_mutex;
+    Control m_start;
+    Control m_stop;
+    std::vector<Subscription> m_subscriptions;
+    int m_nextId;
+    Mask m_active;
+
+    // Serializes update(), which runs the controls without m_mutex, and
+    // the thread running them, so controls calling back do not wait on
+    // themselves.
+    pthread_mutex_t m_controlMutex;
+    bool m_updating;
+    pthread_t m_updater;
+
+    double m_frameBytes[64];
+    double m_fps;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_STREAM_SUBSCRIPTIONS_H
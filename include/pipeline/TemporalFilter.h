@@ -0,0 +1,61 @@
+#ifndef PIPELINE_TEMPORAL_FILTER_H
+#define PIPELINE_TEMPORAL_FILTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pipeline {
+
+class RegionOfInterest;
+
+// Per-pixel exponential moving average over raw 16-bit disparity
+// (1/16th pixel units, as delivered by Source_Disparity).  The filter
+// keeps one state value per pixel in a persistent buffer that is
+// updated in place for every incoming frame.  Whenever a pixel changes
+// by more than the reset threshold, or becomes invalid (0), its history
+// is discarded and the new measurement is taken as-is.  That keeps
+// moving edges sharp while static surfaces settle.
+class TemporalFilter {
+public:
+    TemporalFilter();
+
+    // alpha is the weight given to the newest frame (0 < alpha <= 1).
+    // resetThreshold is the change in disparity pixels above which the
+    // history of a pixel is dropped.
+    void setParameters(float alpha, float resetThreshold);
+
+    // Fold a new disparity frame into the filter state.  Returns a
+    // pointer to the filtered disparity, which is owned by the filter
+    // and stays valid until the next call to apply() or reset().  The
+    // state is re-initialized from the input whenever the frame size
+    // changes.
+    //
+    // With a region of the same size, only its pixels are filtered; the
+    // others read as 0 (invalid) in the result.  Changing the region
+    // drops the history.
+    const uint16_t *apply(const uint16_t *disparityP,
+                          uint32_t width,
+                          uint32_t height,
+                          const RegionOfInterest *regionP = 0);
+
+    // Drop all history; the next frame passes through unfiltered.
+    void reset();
+
+private:
+    // Update state[begin, end) from the same range of disparityP.
+    void filter(uint16_t *stateP, const uint16_t *disparityP, size_t begin, size_t end) const;
+
+    std::vector<uint16_t> m_state;
+    uint32_t m_width;
+    uint32_t m_height;
+    uint64_t m_regionSerial;
+
+    // Fixed point parameters used by the update kernel.
+    int16_t m_alphaQ15;
+    int16_t m_resetThreshold;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_TEMPORAL_FILTER_H
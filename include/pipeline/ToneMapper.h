@@ -0,0 +1,62 @@
+#ifndef PIPELINE_TONE_MAPPER_H
+#define PIPELINE_TONE_MAPPER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pipeline {
+
+// Maps 12 or 16-bit luma to 8 bits for display and encoding.
+//
+// All tables are built by the setters, so apply() never allocates and
+// can run on every frame from the image callbacks.  The linear curve
+// runs as an SSE2 kernel; gamma and user curves go through a lookup
+// table of 2^inputBits entries, which stays in cache for 12-bit data.
+class ToneMapper {
+public:
+    enum Curve {
+        Curve_Linear,
+        Curve_Gamma,
+        Curve_Lut
+    };
+
+    ToneMapper();
+
+    // Map [black, white] linearly to [0, 255].  Values outside the range
+    // saturate.
+    void setLinear(uint32_t inputBits, uint16_t black, uint16_t white);
+
+    // Same range, followed by out = 255 * in^(1 / gamma).
+    void setGamma(uint32_t inputBits, uint16_t black, uint16_t white, float gamma);
+
+    // Use a caller supplied curve with 2^inputBits entries.  Inputs above
+    // the table are clamped to its last entry.
+    void setLut(uint32_t inputBits, const uint8_t *lutP);
+
+    // Map n samples.
+    void apply(const uint16_t *inP, uint8_t *outP, size_t n) const;
+
+    // Map an image with row strides given in elements.
+    void apply(const uint16_t *inP, size_t inStride,
+               uint8_t *outP, size_t outStride,
+               uint32_t width, uint32_t height) const;
+
+    Curve curve() const { return m_curve; }
+    uint32_t inputBits() const { return m_inputBits; }
+
+private:
+    Curve m_curve;
+    uint32_t m_inputBits;
+
+    // Linear curve: out = (min(max(in - black, 0), range) * gain) >> 16.
+    uint16_t m_black;
+    uint16_t m_range;
+    uint32_t m_gain;
+
+    std::vector<uint8_t> m_lut;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_TONE_MAPPER_H
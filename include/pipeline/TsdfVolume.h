@@ -0,0 +1,185 @@
+#ifndef PIPELINE_TSDF_VOLUME_H
+#define PIPELINE_TSDF_VOLUME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "pipeline/Pose.h"
+
+namespace pipeline {
+
+class DisparityReprojector;
+class WorkerPool;
+
+// Surface points of one voxel block, as returned by
+// TsdfVolume::extractChanged().  They replace any earlier points of the
+// same block.
+struct TsdfBlockPoints {
+    uint64_t key;
+    // Packed x, y, z in world coordinates.
+    std::vector<float> xyz;
+};
+
+// Sparse truncated signed distance volume fused from disparity frames.
+//
+// Space is split into blocks of 8x8x8 voxels that are only allocated
+// where surfaces were seen, and looked up through a hash of their block
+// coordinates.  Each frame first collects the blocks within truncation
+// distance of its measured points, in parallel over row tiles, then
+// updates the voxels of those blocks in parallel, one block per task, by
+// projecting every voxel into the disparity image.  Blocks are never
+// shared between tasks, so no locking is needed.
+//
+// Blocks updated since the last extraction are reported with their
+// surface points, so consumers rebuild only what changed.  A block's
+// points are the zero crossings of the distance between each of its
+// voxels and the next voxel along each axis, which for the last voxels
+// lies in the neighbouring block; a block is therefore also reported
+// when the first voxels of a neighbour change, or the neighbour goes.  Blocks
+// further than evictDistance from the camera, and the least recently
+// updated ones beyond maxBlocks, are dropped to bound memory.
+class TsdfVolume {
+public:
+    static const uint32_t BLOCK_SIZE = 8;
+    static const uint32_t BLOCK_VOXELS = BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE;
+
+    struct Config {
+        float voxelSize = 0.04f;
+
+        // Distances are truncated at this many meters either side of the
+        // surface.
+        float truncation = 0.12f;
+
+        // Measurements are only fused within this range of distances.
+        float minDistance = 0.3f;
+        float maxDistance = 8.0f;
+
+        // Weights saturate here, so the volume keeps following changes.
+        uint16_t maxWeight = 64;
+
+        // Surface points need at least this weight on both voxels.
+        uint16_t minExtractWeight = 2;
+
+        // Every pixelStride-th pixel in both directions allocates blocks.
+        uint32_t pixelStride = 2;
+
+        // Memory bounds.
+        float evictDistance = 12.0f;
+        size_t maxBlocks = 20000;
+    };
+
+    TsdfVolume();
+    explicit TsdfVolume(const Config &config);
+
+    // Fuse a raw 16-bit disparity image the size of the reprojector's,
+    // taken from cameraPose.  Pixels outside the reprojector's region are
+    // not used.  Without a pool the blocks are updated on the calling
+    // thread.
+    void integrate(const DisparityReprojector &reprojector,
+                   const uint16_t *disparityP,
+                   const Pose &cameraPose,
+                   WorkerPool *poolP = 0);
+
+    // Surface points of every block updated since the last call, and the
+    // keys of the blocks evicted since then.  Apply the evictions first:
+    // a block that was evicted and allocated again is in both.
+    void extractChanged(std::vector<TsdfBlockPoints> &updated,
+                        std::vector<uint64_t> &evicted,
+                        WorkerPool *poolP = 0);
+
+    // Drop all blocks.  Nothing is reported as evicted; consumers drop
+    // their blocks as well.
+    void reset();
+
+    size_t blockCount() const { return m_lookup.size(); }
+    const Config &config() const { return m_config; }
+
+private:
+    struct Voxel {
+        // Signed distance scaled so +/-32767 is +/-truncation.
+        int16_t distance;
+        uint16_t weight;
+    };
+
+    struct Block {
+        int32_t coordinates[3];
+        uint64_t updatedFrame;
+        bool changed;
+        // Voxels on the low face along each axis changed, which changes the
+        // points of the neighbouring block below.
+        bool faceChanged[3];
+        Voxel voxels[BLOCK_VOXELS];
+    };
+
+    static uint64_t keyOf(int32_t x, int32_t y, int32_t z);
+
+    void collectBlocks(const DisparityReprojector &reprojector, const uint16_t *disparityP, const Pose &cameraPose,
+                       uint32_t beginRow, uint32_t endRow, std::vector<uint64_t> &keys) const;
+    void allocate(const DisparityReprojector &reprojector, const uint16_t *disparityP, const Pose &cameraPose,
+                  WorkerPool *poolP);
+    void updateBlock(const DisparityReprojector &reprojector, const uint16_t *disparityP, const Pose &worldToCamera,
+                     Block &block) const;
+    const Block *findBlock(int32_t x, int32_t y, int32_t z) const;
+    void markNeighboursBelow(const int32_t coordinates[3], const bool faces[3]);
+    void extractBlock(const Block &block, std::vector<float> &xyz) const;
+    void evict(const Pose &cameraPose);
+    void release(uint64_t key);
+
+    Config m_config;
+    uint64_t m_frame;
+
+    // Blocks live in a pool and are found by key.  Released slots are
+    // reused before the pool grows.
+    std::vector<Block> m_blocks;
+    std::vector<size_t> m_freeBlocks;
+    std::unordered_map<uint64_t, size_t> m_lookup;
+
+    // Block keys seen by each worker, blocks touched by the current frame,
+    // and evictions not yet reported.
+    std::vector<std::vector<uint64_t> > m_workerKeys;
+    std::vector<size_t> m_touched;
+    std::vector<uint64_t> m_evicted;
+};
+
+// Surface points of a whole TsdfVolume, kept up to date from the
+// changes extractChanged() reports.
+//
+// All points sit in one packed x, y, z array that a consumer can copy or
+// draw in one go.  Every block owns a set of slots in it: a changed block
+// overwrites its slots in place and only adds or frees the difference,
+// and freed slots are refilled from the end of the array.  The work per
+// frame therefore follows the changed blocks, not the size of the
+// volume.
+class TsdfSurface {
+public:
+    // Apply the evictions and updates of one extractChanged() call.
+    void apply(const std::vector<TsdfBlockPoints> &updated, const std::vector<uint64_t> &evicted);
+
+    void clear();
+
+    size_t size() const { return m_owners.size(); }
+    bool empty() const { return m_owners.empty(); }
+
+    // Packed x, y, z of all points, in no particular order.
+    const float *xyz() const { return m_xyz.data(); }
+
+private:
+    // Block a point belongs to, and its position in the block's slots.
+    struct Owner {
+        uint64_t key;
+        uint32_t rank;
+    };
+
+    void assign(uint64_t key, const float *xyzP, size_t count);
+    void removeLast(std::vector<uint32_t> &slots);
+
+    std::vector<float> m_xyz;
+    std::vector<Owner> m_owners;
+    std::unordered_map<uint64_t, std::vector<uint32_t> > m_slots;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_TSDF_VOLUME_H
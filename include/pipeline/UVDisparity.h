@@ -0,0 +1,134 @@
+#ifndef PIPELINE_UV_DISPARITY_H
+#define PIPELINE_UV_DISPARITY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pipeline {
+
+class DisparityReprojector;
+class WorkerPool;
+
+// Obstacle found in disparity space, in image coordinates.
+struct ObstacleBox {
+    // Half-open column and row ranges.
+    uint32_t left;
+    uint32_t right;
+    uint32_t top;
+    uint32_t bottom;
+
+    // Largest (closest) disparity of the obstacle in pixels, and the
+    // distance in front of the camera it corresponds to, in meters.
+    float disparity;
+    float distance;
+};
+
+// Ground seen as a line in the V-disparity image: the ground disparity
+// in pixels of image row r is slope * r + offset.
+struct GroundProfile {
+    bool valid = false;
+    float slope = 0.0f;
+    float offset = 0.0f;
+
+    float disparity(uint32_t row) const { return slope * row + offset; }
+};
+
+// Obstacle detection on U- and V-disparity histograms.
+//
+// One pass over the raw disparity of the reprojector's region counts, per
+// integer disparity, the pixels of every column (U-disparity) and of
+// every row (V-disparity).  Rows are split into tiles that run on a
+// WorkerPool.  A tile owns its rows of the V histogram outright, and
+// bins columns into a U histogram of its worker, which are summed after
+// the pass.
+//
+// Ground is the dominant line of increasing disparity in V-disparity,
+// fitted by RANSAC over the peak of every row.  Upright obstacles are
+// U-disparity cells with more pixels than an obstacle of minHeight would
+// cover at that disparity, which a ground surface seen at a grazing
+// angle does not reach.  The closest such cell of every column is
+// grouped with its neighbours of similar disparity into boxes, whose
+// rows are the ones of the V histogram carrying the box's disparities.
+class UVDisparityDetector {
+public:
+    struct Config {
+        // Disparities from maxDisparity pixels up fall into the last bin.
+        uint32_t maxDisparity = 256;
+
+        // Disparities below this many pixels (far away) are ignored.
+        uint32_t minDisparity = 2;
+
+        // Smallest obstacle height in meters and width in columns.
+        float minHeight = 0.3f;
+        uint32_t minWidth = 8;
+
+        // Neighbouring columns belong to the same obstacle if their
+        // disparities differ by at most this many bins.
+        uint32_t disparityTolerance = 1;
+
+        // Ground fit: a row takes part if its peak bin holds this share of
+        // its pixels, and peaks within inlierBins of the line are inliers.
+        float groundPeakShare = 0.1f;
+        float inlierBins = 1.5f;
+        uint32_t groundIterations = 64;
+        uint32_t minGroundRows = 20;
+
+        // Image rows per task.
+        uint32_t rowsPerTile = 16;
+    };
+
+    UVDisparityDetector();
+    explicit UVDisparityDetector(const Config &config);
+
+    // Detect the obstacles of a raw 16-bit disparity image the size of the
+    // reprojector's.  Without a pool the tiles run on the calling thread.
+    const std::vector<ObstacleBox> &detect(const DisparityReprojector &reprojector,
+                                           const uint16_t *disparityP,
+                                           WorkerPool *poolP = 0);
+
+    const std::vector<ObstacleBox> &obstacles() const { return m_obstacles; }
+    const GroundProfile &ground() const { return m_ground; }
+
+    // The histograms of the last frame: U-disparity is bins() rows of
+    // width columns, V-disparity is height rows of bins() columns.
+    uint32_t bins() const { return m_config.maxDisparity; }
+    const std::vector<uint16_t> &uDisparity() const { return m_u; }
+    const std::vector<uint16_t> &vDisparity() const { return m_v; }
+
+private:
+    void binRows(const DisparityReprojector &reprojector,
+                 const uint16_t *disparityP,
+                 uint32_t beginRow,
+                 uint32_t endRow,
+                 std::vector<uint16_t> &u);
+    void fitGround(const DisparityReprojector &reprojector);
+    void findObstacles(const DisparityReprojector &reprojector);
+    uint32_t random();
+
+    Config m_config;
+
+    uint32_t m_width;
+    uint32_t m_height;
+    std::vector<uint16_t> m_u;
+    std::vector<uint16_t> m_v;
+
+    // U histograms of the workers, and the frame each was last cleared in.
+    std::vector<std::vector<uint16_t> > m_workerU;
+    std::vector<uint64_t> m_workerFrame;
+    uint64_t m_frame;
+
+    GroundProfile m_ground;
+    std::vector<ObstacleBox> m_obstacles;
+
+    // Scratch: ground peaks, column disparities, obstacle thresholds.
+    std::vector<float> m_peakRows;
+    std::vector<float> m_peakBins;
+    std::vector<int32_t> m_columnBins;
+    std::vector<uint32_t> m_thresholds;
+    uint32_t m_randomState;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_UV_DISPARITY_H
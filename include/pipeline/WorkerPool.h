@@ -0,0 +1,60 @@
+#ifndef PIPELINE_WORKER_POOL_H
+#define PIPELINE_WORKER_POOL_H
+
+#include <pthread.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace pipeline {
+
+// Fixed set of threads for data-parallel stages.
+//
+// run() splits a job into count independent tasks that the workers pick
+// up one at a time, and returns once all of them are done.  The calling
+// thread works along as worker 0, so a pool of size 1 runs everything
+// inline.  Tasks get the index of the worker running them, which stages
+// use to pick per-worker scratch state without locking.  Only one job
+// runs at a time; concurrent run() calls are serialized.
+class WorkerPool {
+public:
+    typedef std::function<void(size_t task, uint32_t worker)> Task;
+
+    // threads is the total number of workers including the caller; 0
+    // picks one per hardware thread.
+    explicit WorkerPool(uint32_t threads = 0);
+    ~WorkerPool();
+
+    uint32_t size() const { return static_cast<uint32_t>(m_threads.size()) + 1; }
+
+    void run(size_t count, const Task &task);
+
+private:
+    WorkerPool(const WorkerPool &);
+    WorkerPool &operator=(const WorkerPool &);
+
+    void workerLoop(uint32_t worker);
+    void work(uint32_t worker);
+
+    std::vector<std::thread> m_threads;
+
+    pthread_mutex_t m_runMutex;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_start;
+    pthread_cond_t m_done;
+    uint64_t m_generation;
+    uint32_t m_busy;
+    bool m_stopping;
+
+    const Task *m_taskP;
+    size_t m_count;
+    std::atomic<size_t> m_next;
+};
+
+} // namespace pipeline
+
+#endif // PIPELINE_WORKER_POOL_H
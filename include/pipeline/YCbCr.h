@@ -0,0 +1,32 @@
+#ifndef PIPELINE_YCBCR_H
+#define PIPELINE_YCBCR_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pipeline {
+
+// Convert n pixels from separate Y, Cb and Cr samples (ITU-R BT.601
+// full range, as delivered by the MultiSense luma and chroma streams)
+// to packed 32-bit pixels with bytes B, G, R, A in memory order and
+// alpha set to 255.  That is the layout of the rgba field of
+// pcl::PointXYZRGB and of a CV_8UC4 BGRA image.  Uses SSE2 when
+// available; the scalar path gives identical results.
+void ycbcrToBgra(const uint8_t *yP,
+                 const uint8_t *cbP,
+                 const uint8_t *crP,
+                 uint32_t *bgraP,
+                 size_t n);
+
+// Same conversion to packed 24-bit B, G, R pixels, the layout of a
+// CV_8UC3 image.  The alpha bytes are dropped with SSSE3 shuffles when
+// available.
+void ycbcrToBgr(const uint8_t *yP,
+                const uint8_t *cbP,
+                const uint8_t *crP,
+                uint8_t *bgrP,
+                size_t n);
+
+} // namespace pipeline
+
+#endif // PIPELINE_YCBCR_H
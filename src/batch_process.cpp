@@ -0,0 +1,348 @@
+// Processes a frame log (see pipeline/FrameLog.h, recorded with the 'b'
+// key of simple_viewer) again offline: every disparity frame goes through
+// the viewer's disparity to cloud pipeline, temporal filter, region of
+// interest, reprojection and ground plane, with the settings given here,
+// and the clouds are written as binary PCD or PLY files in frame order.
+//
+// The temporal filter carries state from frame to frame, so it runs in
+// order on the reading thread; it is a single pass over the image.  The
+// rest of a frame does not depend on other frames, so frames are handed
+// out to all cores a window at a time, one frame per worker.  While one
+// window is processed, the reading thread already reads, filters and
+// copies the frames of the next one.  The ground plane is searched from
+// scratch for every frame instead of starting from the previous one as in
+// the viewer, so the output does not depend on how the frames were spread
+// over the workers.
+//
+// Usage: batch_process <log> [options]
+//   --output <directory>   where the clouds go (default: .)
+//   --format pcd|ply       (default: pcd)
+//   --threads <n>[,<n>...] workers, 0 for one per hardware thread
+//                          (default: 0).  With several counts the log is
+//                          processed once per count, and frames/s are
+//                          compared at the end.
+//   --alpha <weight>       temporal filter weight of the newest frame
+//   --reset <pixels>       temporal filter reset threshold
+//   --no-temporal          skip the temporal filter
+//   --hide-ground          only write the points off the ground plane
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MultiSense/MultiSenseTypes.hh"
+#include "MultiSense/details/utility/Exception.hh"
+#include "pipeline/CloudKernels.h"
+#include "pipeline/CloudWriter.h"
+#include "pipeline/DisparityFrame.h"
+#include "pipeline/FrameLog.h"
+#include "pipeline/GroundPlane.h"
+#include "pipeline/PointFrame.h"
+#include "pipeline/RegionOfInterest.h"
+#include "pipeline/Reprojection.h"
+#include "pipeline/TemporalFilter.h"
+#include "pipeline/WorkerPool.h"
+
+namespace {
+
+// Frames handed out per worker and window.  More even out frames of
+// different cost; fewer keep less in memory.
+const size_t FRAMES_PER_WORKER = 4;
+
+struct Settings {
+    std::string log;
+    std::string output = ".";
+    pipeline::CloudWriter::Format format = pipeline::CloudWriter::Format_PCD;
+    std::vector<uint32_t> threads;
+    bool temporal = true;
+    float alpha = 0.3f;
+    float resetThreshold = 1.0f;
+    bool hideGround = false;
+};
+
+// Outcome of one pass over the log.
+struct Result {
+    uint32_t threads = 0;
+    uint64_t frames = 0;
+    double seconds = 0.0;
+    bool ok = true;
+};
+
+// A frame on its way through a window, and the points that come out.
+struct Job {
+    std::shared_ptr<pipeline::DisparityFrame> frame;
+    std::shared_ptr<std::vector<float> > xyz;
+    size_t count = 0;
+    bool ground = false;
+};
+
+void usage() {
+    fprintf(stderr, "Usage: batch_process <log> [--output <directory>] [--format pcd|ply] [--threads <n>[,<n>...]]\n"
+                    "                     [--alpha <weight>] [--reset <pixels>] [--no-temporal] [--hide-ground]\n");
+    exit(1);
+}
+
+Settings parseArguments(int argc, char **argv) {
+    Settings settings;
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if ("--output" == argument && hasValue) {
+            settings.output = argv[++i];
+        } else if ("--format" == argument && hasValue) {
+            const std::string format = argv[++i];
+            if ("pcd" == format) {
+                settings.format = pipeline::CloudWriter::Format_PCD;
+            } else if ("ply" == format) {
+                settings.format = pipeline::CloudWriter::Format_PLY;
+            } else {
+                usage();
+            }
+        } else if ("--threads" == argument && hasValue) {
+            const char *countP = argv[++i];
+            for (;;) {
+                settings.threads.push_back(static_cast<uint32_t>(std::atoi(countP)));
+                countP = std::strchr(countP, ',');
+                if (!countP) {
+                    break;
+                }
+                countP++;
+            }
+        } else if ("--alpha" == argument && hasValue) {
+            settings.alpha = static_cast<float>(std::atof(argv[++i]));
+        } else if ("--reset" == argument && hasValue) {
+            settings.resetThreshold = static_cast<float>(std::atof(argv[++i]));
+        } else if ("--no-temporal" == argument) {
+            settings.temporal = false;
+        } else if ("--hide-ground" == argument) {
+            settings.hideGround = true;
+        } else if ('-' != argument[0] && settings.log.empty()) {
+            settings.log = argument;
+        } else {
+            usage();
+        }
+    }
+    if (settings.log.empty()) {
+        usage();
+    }
+    if (settings.threads.empty()) {
+        settings.threads.push_back(0);
+    }
+    return settings;
+}
+
+// The viewer's region without its optional mask image: all but the top
+// 20 rows, and points within 10 m along each axis.
+void configureRegion(pipeline::RegionOfInterest &region, uint32_t width, uint32_t height) {
+    region.reset(width, height);
+    region.setRect(0, 20, width, height > 20 ? height - 20 : 0);
+
+    const float cropMinimum[3] = {-10.0f, -10.0f, -10.0f};
+    const float cropMaximum[3] = {10.0f, 10.0f, 10.0f};
+    region.setCropBox(cropMinimum, cropMaximum);
+}
+
+// Everything after the temporal filter, for one frame.
+void processFrame(const Settings &settings, pipeline::PointFramePool &pointPool, Job &job) {
+    std::shared_ptr<const pipeline::PointFrame> points = job.frame->points();
+
+    pipeline::GroundPlaneEstimator ground;
+    std::vector<uint8_t> groundMask;
+    job.ground = !points->empty() &&
+                 ground.estimate(points->x(), points->y(), points->z(), points->size(), &groundMask);
+
+    if (settings.hideGround && job.ground) {
+        std::shared_ptr<pipeline::PointFrame> obstacles = pointPool.acquire();
+        obstacles->assignUnmasked(*points, groundMask.data());
+        points = obstacles;
+    }
+
+    // Packed x, y, z, as the writer takes them.
+    const pipeline::CloudConfig config;
+    pipeline::CloudSources sources;
+    sources.pointsP = points.get();
+    job.xyz = std::make_shared<std::vector<float> >(3 * pipeline::cloudCapacity(config, *points));
+    pipeline::CloudOutput output;
+    output.pointsP = job.xyz->data();
+    output.capacity = job.xyz->size() / 3;
+    if (!pipeline::convertCloud(config, sources, output, job.count)) {
+        job.count = 0;
+    }
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Process the whole log once on the given number of workers.
+Result run(const Settings &settings, uint32_t threads) {
+    pipeline::FrameLogReader reader;
+    reader.open(settings.log);
+
+    pipeline::WorkerPool pool(threads);
+    const size_t window = FRAMES_PER_WORKER * pool.size();
+
+    pipeline::CloudWriter writer;
+    pipeline::CloudWriter::Config writerConfig;
+    writerConfig.directory = settings.output;
+    writerConfig.format = settings.format;
+    writerConfig.dropPolicy = pipeline::CloudWriter::Drop_Never;
+    writerConfig.queueDepth = window;
+    writer.start(writerConfig);
+
+    // Frames are processed on the workers, one each, so the products of
+    // a frame are computed inline rather than on the pool.  Two windows
+    // are in flight: one on the workers and the one being read.
+    pipeline::BufferPool disparityPool(2 * window + 1);
+    pipeline::PointFramePool pointPool(2 * window);
+    pipeline::DisparityFrameContext context;
+    context.disparityPoolP = &disparityPool;
+    context.pointPoolP = &pointPool;
+
+    pipeline::RegionOfInterest region;
+    pipeline::TemporalFilter temporalFilter;
+    temporalFilter.setParameters(settings.alpha, settings.resetThreshold);
+
+    printf("Processing %s on %u threads, %zu frames at a time\n", settings.log.c_str(), pool.size(), window);
+
+    // The window being read, and the one on the workers.
+    std::vector<Job> reading;
+    std::vector<Job> processing;
+    reading.reserve(window);
+    processing.reserve(window);
+    std::thread processThread;
+
+    uint64_t frames = 0, skipped = 0, withGround = 0, points = 0;
+    double processingSeconds = 0.0;
+    const auto start = std::chrono::steady_clock::now();
+
+    const pipeline::WorkerPool::Task processJob = [&](size_t i, uint32_t) {
+        processFrame(settings, pointPool, processing[i]);
+    };
+
+    // Wait for the window on the workers and queue its clouds.  The
+    // writer serializes and writes in submission order, and blocks here
+    // rather than dropping frames.
+    const auto finishWindow = [&]() {
+        if (processThread.joinable()) {
+            processThread.join();
+        }
+        for (Job &job : processing) {
+            writer.submit(job.frame->frameId(), job.xyz->data(), job.count, 3, job.xyz);
+            frames++;
+            withGround += job.ground;
+            points += job.count;
+        }
+        processing.clear();
+    };
+
+    pipeline::FrameLogRecord record;
+    bool more = true;
+    while (more) {
+        more = reader.next(record);
+
+        if (more && pipeline::FrameLogKind_Calibration == record.kind) {
+            // Frames already read keep the reprojector they were made
+            // with.
+            const pipeline::FrameLogCalibration &calibration = record.calibration;
+            std::shared_ptr<pipeline::DisparityReprojector> reprojector =
+                    std::make_shared<pipeline::DisparityReprojector>();
+            reprojector->setQ(calibration.q, calibration.width, calibration.height);
+            configureRegion(region, calibration.width, calibration.height);
+            reprojector->setRegion(region);
+            context.reprojector = reprojector;
+            temporalFilter.reset();
+            continue;
+        }
+
+        if (more) {
+            const pipeline::FrameLogImage &image = record.image;
+            if (crl::multisense::Source_Disparity != image.source) {
+                continue;
+            }
+            if (16 != image.bitsPerPixel || !context.reprojector ||
+                context.reprojector->width() != image.width || context.reprojector->height() != image.height ||
+                image.length < static_cast<size_t>(image.width) * image.height * sizeof(uint16_t)) {
+                skipped++;
+                continue;
+            }
+
+            const uint16_t *disparityP = reinterpret_cast<const uint16_t *>(image.data.get());
+            if (settings.temporal) {
+                disparityP = temporalFilter.apply(disparityP, image.width, image.height, &region);
+            }
+
+            // The frame keeps its own copy of the filtered disparity.
+            Job job;
+            job.frame = std::make_shared<pipeline::DisparityFrame>(context, image.frameId, disparityP,
+                                                                   image.width, image.height);
+            reading.push_back(job);
+            if (reading.size() < window) {
+                continue;
+            }
+        }
+
+        // The next window is complete; hand it to the workers once they
+        // are done with the previous one, and go on reading.
+        finishWindow();
+        if (reading.empty()) {
+            continue;
+        }
+        processing.swap(reading);
+        processThread = std::thread([&]() {
+            const auto windowStart = std::chrono::steady_clock::now();
+            pool.run(processing.size(), processJob);
+            processingSeconds += secondsSince(windowStart);
+        });
+    }
+    finishWindow();
+
+    const double readSeconds = secondsSince(start);
+    writer.stop();
+    const double totalSeconds = secondsSince(start);
+
+    const pipeline::CloudWriter::Stats stats = writer.stats();
+    printf("%lu frames (%lu skipped), ground found in %lu, %.0f points per frame\n",
+           static_cast<unsigned long>(frames), static_cast<unsigned long>(skipped),
+           static_cast<unsigned long>(withGround), frames > 0 ? static_cast<double>(points) / frames : 0.0);
+    printf("%.2f s processing on the workers, %.2f s until the last frame was queued, %.2f s in total\n",
+           processingSeconds, readSeconds, totalSeconds);
+    printf("%.1f frames/s, %lu files written (%.1f MB), %lu failed\n",
+           totalSeconds > 0.0 ? frames / totalSeconds : 0.0, static_cast<unsigned long>(stats.written),
+           stats.bytes / 1e6, static_cast<unsigned long>(stats.failed));
+
+    Result result;
+    result.threads = pool.size();
+    result.frames = frames;
+    result.seconds = totalSeconds;
+    result.ok = 0 == stats.failed;
+    return result;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    const Settings settings = parseArguments(argc, argv);
+
+    std::vector<Result> results;
+    bool ok = true;
+    for (uint32_t threads : settings.threads) {
+        results.push_back(run(settings, threads));
+        ok = ok && results.back().ok;
+    }
+
+    if (results.size() > 1) {
+        printf("\n%8s %10s %8s\n", "threads", "frames/s", "speedup");
+        const double base = results[0].seconds > 0.0 ? results[0].frames / results[0].seconds : 0.0;
+        for (const Result &result : results) {
+            const double rate = result.seconds > 0.0 ? result.frames / result.seconds : 0.0;
+            printf("%8u %10.1f %8.2f\n", result.threads, rate, base > 0.0 ? rate / base : 0.0);
+        }
+    }
+    return ok ? 0 : 1;
+}
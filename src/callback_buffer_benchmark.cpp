@@ -0,0 +1,252 @@
+// Replays simple_viewer's callback buffer holders against a simulated
+// libMultiSense: a fixed pool of image buffers and a bounded queue of
+// images waiting for the callback thread, which drops new images when
+// either is full.  The camera streams disparity, cost, luma and chroma
+// every frame; the callbacks keep their latest image of each, and a
+// matched luma/chroma pair, like the viewer does.  After a steady phase
+// the callback thread stalls for a while and then catches up again.
+//
+// Prints the frames lost and processed with and without load shedding.
+// Exits with 1 if the monitor sheds without a stall, does not shed
+// during it, is still shedding after it, or counts a different number
+// of lost frames per source than the simulation dropped.
+//
+// Usage: callback_buffer_benchmark [pool buffers] [queue images]
+
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <vector>
+
+#include "pipeline/CallbackBufferMonitor.h"
+
+namespace {
+
+// Streams in delivery order, as DataSource-style bits, and the work of
+// processing an image of each, in callback thread time units.
+enum Stream {
+    Stream_Disparity,
+    Stream_Cost,
+    Stream_Luma,
+    Stream_Chroma,
+    Stream_Count
+};
+
+const uint32_t SOURCES[Stream_Count] = {0x1, 0x2, 0x4, 0x8};
+const int WORK[Stream_Count] = {4, 1, 2, 1};
+
+// Callback thread time per camera frame: enough for all streams while
+// steady, far too little while stalled.
+const int STEADY_BUDGET = 12;
+const int STALLED_BUDGET = 2;
+
+const int64_t STEADY_FRAMES = 300;
+const int64_t STALL_FRAMES = 150;
+const int64_t RECOVERY_FRAMES = 300;
+
+// The viewer holds the latest image of every stream plus the matched
+// luma/chroma pair, so at most six buffers.
+const uint32_t HOLDERS = 6;
+
+struct Image {
+    Stream stream;
+    int64_t frameId;
+};
+
+// A callback buffer holder: the frame id of the latest image, and
+// whether its buffer is kept.
+struct Slot {
+    int64_t frameId = -1;
+    bool held = false;
+};
+
+struct Result {
+    uint64_t lost[Stream_Count] = {};
+    uint64_t lostTotal = 0;
+    uint64_t processed = 0;
+    uint32_t steadyHighWater = 0;
+    bool shedWhileSteady = false;
+    bool shedWhileStalled = false;
+    bool sheddingAtEnd = false;
+    std::vector<pipeline::CallbackBufferMonitor::SourceStats> sources;
+};
+
+class Simulation {
+public:
+    Simulation(uint32_t poolBuffers, uint32_t queueImages, bool shed)
+            : m_freeBuffers(poolBuffers),
+              m_queueImages(queueImages),
+              m_shed(shed) {
+    }
+
+    Result run() {
+        Result result;
+        const int64_t frames = STEADY_FRAMES + STALL_FRAMES + RECOVERY_FRAMES;
+        int budget = 0;
+
+        for (int64_t frameId = 0; frameId < frames; ++frameId) {
+            const bool steady = frameId < STEADY_FRAMES;
+            const bool stalled = !steady && frameId < STEADY_FRAMES + STALL_FRAMES;
+
+            // The camera delivers every stream; the library drops images
+            // it has no buffer or queue space for.
+            for (int s = 0; s < Stream_Count; ++s) {
+                if (0 == m_freeBuffers || m_queue.size() >= m_queueImages) {
+                    result.lost[s]++;
+                    result.lostTotal++;
+                    continue;
+                }
+                m_freeBuffers--;
+                m_queue.push_back(Image{static_cast<Stream>(s), frameId});
+            }
+
+            // Time left over is not saved up; time overrun is paid back.
+            budget = (budget < 0 ? budget : 0) + (stalled ? STALLED_BUDGET : STEADY_BUDGET);
+            while (budget > 0 && !m_queue.empty()) {
+                const Image image = m_queue.front();
+                m_queue.pop_front();
+
+                pipeline::CallbackBufferMonitor::Event event = pipeline::CallbackBufferMonitor::Event_None;
+                if (deliver(image, event)) {
+                    budget -= WORK[image.stream];
+                    result.processed++;
+                }
+
+                if (pipeline::CallbackBufferMonitor::Event_ShedStarted == event) {
+                    result.shedWhileSteady = result.shedWhileSteady || steady;
+                    result.shedWhileStalled = result.shedWhileStalled || stalled;
+                }
+            }
+
+            if (steady) {
+                result.steadyHighWater = m_monitor.highWater();
+            }
+        }
+
+        result.sheddingAtEnd = m_monitor.shedding();
+        result.sources = m_monitor.sources();
+        return result;
+    }
+
+private:
+    // The viewer's image callback for one image: updateImage() followed,
+    // for luma and chroma, by updateLumaAndChroma().  Returns whether the
+    // image is processed.
+    bool deliver(const Image &image, pipeline::CallbackBufferMonitor::Event &event) {
+        const uint32_t source = SOURCES[image.stream];
+        Slot &slot = m_latest[image.stream];
+
+        release(image.stream, slot);
+        const bool admitted = m_monitor.admit(source, image.frameId, &event) || !m_shed;
+        if (admitted) {
+            // The buffer moves from the library to the holder.
+            update(event, m_monitor.reserved(source, this));
+        } else {
+            // Back to the library once the callback returns.
+            m_freeBuffers++;
+        }
+        slot.frameId = image.frameId;
+        slot.held = admitted;
+
+        Slot &luma = m_latest[Stream_Luma];
+        Slot &chroma = m_latest[Stream_Chroma];
+        if ((Stream_Luma == image.stream || Stream_Chroma == image.stream) && luma.frameId == chroma.frameId) {
+            release(Stream_Luma, m_matchedLuma);
+            release(Stream_Chroma, m_matchedChroma);
+            m_matchedLuma = luma;
+            m_matchedChroma = chroma;
+            luma.held = false;
+            chroma.held = false;
+        }
+        return admitted;
+    }
+
+    void release(Stream stream, Slot &slot) {
+        if (slot.held) {
+            m_freeBuffers++;
+            slot.held = false;
+            m_monitor.released(SOURCES[stream]);
+        }
+    }
+
+    static void update(pipeline::CallbackBufferMonitor::Event &event, pipeline::CallbackBufferMonitor::Event next) {
+        if (pipeline::CallbackBufferMonitor::Event_None != next) {
+            event = next;
+        }
+    }
+
+    pipeline::CallbackBufferMonitor m_monitor;
+    uint32_t m_freeBuffers;
+    uint32_t m_queueImages;
+    bool m_shed;
+    std::deque<Image> m_queue;
+    Slot m_latest[Stream_Count];
+    Slot m_matchedLuma;
+    Slot m_matchedChroma;
+};
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    const uint32_t poolBuffers = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 16;
+    const uint32_t queueImages = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 8;
+    // The buffers held and one frame in flight have to fit, or frames are
+    // lost without a stall.
+    if (poolBuffers < HOLDERS + Stream_Count || queueImages < Stream_Count) {
+        fprintf(stderr, "Need %u pool buffers and room for %d queued images at least\n", HOLDERS + Stream_Count,
+                Stream_Count);
+        return 1;
+    }
+
+    const Result shedding = Simulation(poolBuffers, queueImages, true).run();
+    const Result holding = Simulation(poolBuffers, queueImages, false).run();
+
+    printf("%lld frames of %d streams, %u buffers, %u queued images, stalled for frames %lld-%lld\n",
+           static_cast<long long>(STEADY_FRAMES + STALL_FRAMES + RECOVERY_FRAMES), Stream_Count, poolBuffers,
+           queueImages, static_cast<long long>(STEADY_FRAMES),
+           static_cast<long long>(STEADY_FRAMES + STALL_FRAMES - 1));
+    printf("%-16s %10s %10s\n", "", "lost", "processed");
+    printf("%-16s %10lu %10lu\n", "holding", static_cast<unsigned long>(holding.lostTotal),
+           static_cast<unsigned long>(holding.processed));
+    printf("%-16s %10lu %10lu\n", "shedding", static_cast<unsigned long>(shedding.lostTotal),
+           static_cast<unsigned long>(shedding.processed));
+    printf("buffers held at most while steady: %u\n", shedding.steadyHighWater);
+
+    bool ok = true;
+    if (shedding.steadyHighWater != HOLDERS) {
+        fprintf(stderr, "Expected %u buffers held while steady, got %u\n", HOLDERS, shedding.steadyHighWater);
+        ok = false;
+    }
+    if (shedding.shedWhileSteady) {
+        fprintf(stderr, "Shedding started while the callbacks kept up\n");
+        ok = false;
+    }
+    if (!shedding.shedWhileStalled) {
+        fprintf(stderr, "Shedding did not start during the stall\n");
+        ok = false;
+    }
+    if (shedding.sheddingAtEnd) {
+        fprintf(stderr, "Shedding did not stop after the stall\n");
+        ok = false;
+    }
+
+    // Frames lost show up as gaps once the next image of the stream
+    // arrives, which it does after the stall.
+    for (const Result *resultP : {&shedding, &holding}) {
+        for (int s = 0; s < Stream_Count; ++s) {
+            uint64_t counted = 0;
+            for (const pipeline::CallbackBufferMonitor::SourceStats &stats : resultP->sources) {
+                if (SOURCES[s] == stats.source) {
+                    counted = stats.dropped;
+                }
+            }
+            if (counted != resultP->lost[s]) {
+                fprintf(stderr, "Source 0x%x: %lu frames lost, %lu counted\n", SOURCES[s],
+                        static_cast<unsigned long>(resultP->lost[s]), static_cast<unsigned long>(counted));
+                ok = false;
+            }
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+// Measures the depth image stage on a synthetic 1024x544 disparity image
+// like the ones simple_viewer gets: conversion time to float meters and
+// 16-bit millimeters, and the size and speed of the lossless depth codec
+// next to the cloud codec on the organized cloud of the same frame.
+//
+// Usage: depth_benchmark [iterations] [threads]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "pipeline/CloudCodec.h"
+#include "pipeline/DepthCodec.h"
+#include "pipeline/DepthImage.h"
+#include "pipeline/Reprojection.h"
+#include "pipeline/WorkerPool.h"
+
+namespace {
+
+const int WIDTH = 1024;
+const int HEIGHT = 544;
+const float FOCAL = 600.0f;
+const float BASELINE = 0.21f;
+
+// Ground plane 1.2m below the camera with a wall 6m ahead and a box in
+// between, with disparity noise and the unmatched patches stereo leaves
+// on textureless areas.
+std::vector<uint16_t> makeDisparity() {
+    std::mt19937 rng(42);
+    std::normal_distribution<float> noise(0.0f, 0.1f);
+    std::uniform_int_distribution<int> holeSize(2, 24);
+    std::uniform_real_distribution<float> chance(0.0f, 1.0f);
+
+    std::vector<uint16_t> disparity(static_cast<size_t>(WIDTH) * HEIGHT, 0);
+    for (int r = 20; r < HEIGHT; ++r) {
+        for (int c = 0; c < WIDTH; ++c) {
+            const float u = (c - WIDTH / 2.0f) / FOCAL;
+            const float v = (r - HEIGHT / 2.0f) / FOCAL;
+
+            float depth = 6.0f;
+            if (v > 0.0f) {
+                depth = std::min(depth, 1.2f / v);
+            }
+            if (std::fabs(u) < 0.15f && v > -0.1f) {
+                depth = std::min(depth, 3.0f);
+            }
+
+            const float d = FOCAL * BASELINE / depth + noise(rng);
+            disparity[static_cast<size_t>(r) * WIDTH + c] = static_cast<uint16_t>(std::lround(d * 16.0f));
+        }
+
+        // Punch a few holes into every row.
+        for (int c = 0; c < WIDTH; ++c) {
+            if (chance(rng) < 0.004f) {
+                const int end = std::min(WIDTH, c + holeSize(rng));
+                for (; c < end; ++c) {
+                    disparity[static_cast<size_t>(r) * WIDTH + c] = 0;
+                }
+            }
+        }
+    }
+    return disparity;
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    const int iterations = argc > 1 ? std::atoi(argv[1]) : 50;
+    const uint32_t threads = argc > 2 ? static_cast<uint32_t>(std::atoi(argv[2])) : 0;
+
+    const float q[16] = {1.0f, 0.0f, 0.0f, -WIDTH / 2.0f,
+                         0.0f, 1.0f, 0.0f, -HEIGHT / 2.0f,
+                         0.0f, 0.0f, 0.0f, FOCAL,
+                         0.0f, 0.0f, 1.0f / BASELINE, 0.0f};
+    pipeline::DisparityReprojector reprojector;
+    reprojector.setQ(q, WIDTH, HEIGHT);
+    const std::vector<uint16_t> disparity = makeDisparity();
+    pipeline::WorkerPool pool(threads);
+
+    printf("%dx%d disparity, %u threads\n", WIDTH, HEIGHT, pool.size());
+
+    const pipeline::DepthFormat formats[] = {pipeline::DepthFormat_Meters, pipeline::DepthFormat_Millimeters};
+    const char *formatNames[] = {"meters", "millimeters"};
+    pipeline::DepthImage millimeters;
+    for (int f = 0; f < 2; ++f) {
+        pipeline::DepthConverter::Config config;
+        config.format = formats[f];
+        pipeline::DepthConverter converter(config);
+        pipeline::DepthImage depth;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            converter.convert(reprojector, disparity.data(), i, depth);
+        }
+        const double serialMs = millisecondsSince(start) / iterations;
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            converter.convert(reprojector, disparity.data(), i, depth, &pool);
+        }
+        const double pooledMs = millisecondsSince(start) / iterations;
+
+        printf("convert to %-12s %6.2f ms, %6.2f ms pooled\n", formatNames[f], serialMs, pooledMs);
+        if (pipeline::DepthFormat_Millimeters == formats[f]) {
+            millimeters = depth;
+        }
+    }
+
+    // Lossless depth coding.
+    const size_t pixels = static_cast<size_t>(WIDTH) * HEIGHT;
+    std::vector<uint8_t> encoded;
+    std::vector<uint16_t> decoded;
+    uint32_t width = 0, height = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        pipeline::encodeDepth(millimeters.millimeters(), WIDTH, HEIGHT, encoded);
+    }
+    const double encodeMs = millisecondsSince(start) / iterations;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        pipeline::decodeDepth(encoded.data(), encoded.size(), decoded, width, height);
+    }
+    const double decodeMs = millisecondsSince(start) / iterations;
+
+    const bool lossless = width == WIDTH && height == HEIGHT &&
+                          0 == std::memcmp(decoded.data(), millimeters.millimeters(), pixels * sizeof(uint16_t));
+
+    // The organized cloud of the same frame through the cloud codec.
+    std::vector<float> organized(pixels * 3, std::numeric_limits<float>::quiet_NaN());
+    std::vector<float> rowPoints(3 * WIDTH);
+    std::vector<uint32_t> rowColumns(WIDTH);
+    for (uint32_t r = 0; r < HEIGHT; ++r) {
+        const size_t count = reprojector.reprojectRow(&disparity[static_cast<size_t>(r) * WIDTH], r,
+                                                      rowPoints.data(), rowColumns.data());
+        for (size_t i = 0; i < count; ++i) {
+            std::memcpy(&organized[3 * (static_cast<size_t>(r) * WIDTH + rowColumns[i])], &rowPoints[3 * i],
+                        3 * sizeof(float));
+        }
+    }
+    std::vector<uint8_t> encodedCloud;
+    pipeline::encodeCloud(organized.data(), pixels, 3, pipeline::CloudCodecOptions(), encodedCloud);
+
+    printf("%-28s %10s %12s\n", "", "bytes", "bytes/pixel");
+    printf("%-28s %10zu %12.2f\n", "organized cloud, float", pixels * 12, 12.0);
+    printf("%-28s %10zu %12.2f\n", "organized cloud, encoded", encodedCloud.size(),
+           static_cast<double>(encodedCloud.size()) / pixels);
+    printf("%-28s %10zu %12.2f\n", "depth, millimeters", pixels * 2, 2.0);
+    printf("%-28s %10zu %12.2f\n", "depth, encoded", encoded.size(), static_cast<double>(encoded.size()) / pixels);
+    printf("depth codec: %.2f ms encode, %.2f ms decode, %s, %.2fx smaller than the encoded cloud\n",
+           encodeMs, decodeMs, lossless ? "lossless" : "MISMATCH",
+           static_cast<double>(encodedCloud.size()) / encoded.size());
+    return lossless ? 0 : 1;
+}
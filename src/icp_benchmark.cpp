@@ -0,0 +1,194 @@
+// Replays a synthetic disparity sequence through the projective ICP and
+// reports its timing and accuracy against the known camera path.
+//
+// The scene is a room with three boxes on the floor, rendered at 1024x544
+// through a pinhole camera that walks forward while turning and swaying,
+// with disparity quantized to 1/16 pixel plus noise as on the sensor.
+//
+// Usage: icp_benchmark [frames] [threads]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "pipeline/Pose.h"
+#include "pipeline/ProjectiveIcp.h"
+#include "pipeline/Reprojection.h"
+#include "pipeline/WorkerPool.h"
+
+namespace {
+
+const int WIDTH = 1024;
+const int HEIGHT = 544;
+const float FOCAL = 600.0f;
+const float BASELINE = 0.21f;
+
+struct Box {
+    float minimum[3];
+    float maximum[3];
+};
+
+// Room interior, and solid boxes inside it, in world coordinates (viewer
+// convention: y up, -z forward).
+const Box ROOM = {{-4.0f, -1.2f, -12.0f}, {4.0f, 2.5f, 2.0f}};
+const Box OBSTACLES[] = {
+        {{-1.5f, -1.2f, -6.0f}, {-0.5f, -0.2f, -5.0f}},
+        {{1.0f, -1.2f, -8.5f}, {2.0f, 0.8f, -7.5f}},
+        {{-3.0f, -1.2f, -10.0f}, {-2.2f, 1.5f, -9.0f}},
+};
+
+// Distance along the ray to the nearest surface, or 0.
+float castRay(const float *origin, const float *direction) {
+    float exit = 1e30f;
+    for (int a = 0; a < 3; ++a) {
+        if (0.0f != direction[a]) {
+            const float t0 = (ROOM.minimum[a] - origin[a]) / direction[a];
+            const float t1 = (ROOM.maximum[a] - origin[a]) / direction[a];
+            exit = std::min(exit, std::max(t0, t1));
+        }
+    }
+
+    float nearest = exit;
+    for (const Box &box : OBSTACLES) {
+        float enter = -1e30f, leave = 1e30f;
+        for (int a = 0; a < 3; ++a) {
+            if (0.0f == direction[a]) {
+                if (origin[a] < box.minimum[a] || origin[a] > box.maximum[a]) {
+                    enter = 1e30f;
+                }
+                continue;
+            }
+            const float t0 = (box.minimum[a] - origin[a]) / direction[a];
+            const float t1 = (box.maximum[a] - origin[a]) / direction[a];
+            enter = std::max(enter, std::min(t0, t1));
+            leave = std::min(leave, std::max(t0, t1));
+        }
+        if (enter <= leave && enter > 0.0f) {
+            nearest = std::min(nearest, enter);
+        }
+    }
+    return nearest < 1e29f ? nearest : 0.0f;
+}
+
+void render(const pipeline::Pose &camera, std::mt19937 &rng, std::vector<uint16_t> &disparity) {
+    std::normal_distribution<float> noise(0.0f, 0.1f);
+    disparity.assign(static_cast<size_t>(WIDTH) * HEIGHT, 0);
+    for (int r = 0; r < HEIGHT; ++r) {
+        for (int c = 0; c < WIDTH; ++c) {
+            const float ray[3] = {(c - WIDTH / 2.0f) / FOCAL, -(r - HEIGHT / 2.0f) / FOCAL, -1.0f};
+            float direction[3];
+            camera.rotate(ray, direction);
+
+            // The ray has unit length along the optical axis, so the
+            // distance along it is the depth.
+            const float depth = castRay(camera.translation, direction);
+            if (depth <= 0.0f) {
+                continue;
+            }
+            const float d = FOCAL * BASELINE / depth + noise(rng);
+            if (d > 0.0f) {
+                disparity[static_cast<size_t>(r) * WIDTH + c] = static_cast<uint16_t>(std::lround(d * 16.0f));
+            }
+        }
+    }
+}
+
+pipeline::Pose cameraAt(int frame) {
+    const float yaw = 0.004f * frame;
+    const float c = std::cos(yaw), s = std::sin(yaw);
+    pipeline::Pose pose;
+    const float rotation[9] = {c, 0.0f, s, 0.0f, 1.0f, 0.0f, -s, 0.0f, c};
+    for (int i = 0; i < 9; ++i) {
+        pose.rotation[i] = rotation[i];
+    }
+    pose.translation[0] = 0.3f * std::sin(0.05f * frame);
+    pose.translation[1] = 0.02f * std::sin(0.2f * frame);
+    pose.translation[2] = -0.03f * frame;
+    return pose;
+}
+
+// Translation error in meters and rotation error in degrees of estimate
+// against truth.
+void poseError(const pipeline::Pose &estimate, const pipeline::Pose &truth, float &translation, float &rotation) {
+    const pipeline::Pose error = truth.inverse() * estimate;
+    translation = std::sqrt(error.translation[0] * error.translation[0] +
+                            error.translation[1] * error.translation[1] +
+                            error.translation[2] * error.translation[2]);
+    // Angle from both the sine (antisymmetric part) and the cosine
+    // (trace), which stays accurate for small angles.
+    const double x = error.rotation[7] - error.rotation[5];
+    const double y = error.rotation[2] - error.rotation[6];
+    const double z = error.rotation[3] - error.rotation[1];
+    const double trace = error.rotation[0] + error.rotation[4] + error.rotation[8];
+    rotation = static_cast<float>(std::atan2(0.5 * std::sqrt(x * x + y * y + z * z), 0.5 * (trace - 1.0)) *
+                                  180.0 / M_PI);
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    const int frames = argc > 1 ? std::atoi(argv[1]) : 100;
+    const uint32_t threads = argc > 2 ? static_cast<uint32_t>(std::atoi(argv[2])) : 0;
+
+    const float q[16] = {1.0f, 0.0f, 0.0f, -WIDTH / 2.0f,
+                         0.0f, 1.0f, 0.0f, -HEIGHT / 2.0f,
+                         0.0f, 0.0f, 0.0f, FOCAL,
+                         0.0f, 0.0f, 1.0f / BASELINE, 0.0f};
+    pipeline::DisparityReprojector reprojector;
+    reprojector.setQ(q, WIDTH, HEIGHT);
+
+    pipeline::WorkerPool pool(threads);
+    pipeline::ProjectiveIcp icp;
+    std::mt19937 rng(42);
+
+    // Render up front so only tracking is timed.
+    printf("Rendering %d frames...\n", frames);
+    std::vector<std::vector<uint16_t> > sequence(frames);
+    for (int i = 0; i < frames; ++i) {
+        render(cameraAt(i), rng, sequence[i]);
+    }
+
+    double totalMs = 0.0, maxMs = 0.0;
+    double totalTranslation = 0.0, totalRotation = 0.0;
+    float maxTranslation = 0.0f, maxRotation = 0.0f;
+    int tracked = 0;
+    for (int i = 0; i < frames; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        const bool ok = icp.track(reprojector, sequence[i].data(), &pool);
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (0 == i) {
+            continue;
+        }
+
+        totalMs += ms;
+        maxMs = std::max(maxMs, ms);
+        if (!ok) {
+            printf("frame %d: not aligned (%u pairs)\n", i, icp.pairs());
+            continue;
+        }
+
+        float translation, rotation;
+        poseError(icp.motion(), cameraAt(i - 1).inverse() * cameraAt(i), translation, rotation);
+        totalTranslation += translation;
+        totalRotation += rotation;
+        maxTranslation = std::max(maxTranslation, translation);
+        maxRotation = std::max(maxRotation, rotation);
+        tracked++;
+    }
+
+    float driftTranslation, driftRotation;
+    poseError(icp.pose(), cameraAt(0).inverse() * cameraAt(frames - 1), driftTranslation, driftRotation);
+
+    const int timed = frames > 1 ? frames - 1 : 1;
+    printf("%u threads, %d/%d frames aligned\n", pool.size(), tracked, frames - 1);
+    printf("time per frame:   %.2f ms mean, %.2f ms max\n", totalMs / timed, maxMs);
+    printf("frame-to-frame:   %.2f mm mean, %.2f mm max, %.4f deg mean, %.4f deg max\n",
+           tracked ? 1000.0 * totalTranslation / tracked : 0.0, 1000.0f * maxTranslation,
+           tracked ? totalRotation / tracked : 0.0, maxRotation);
+    printf("drift over %.2f m: %.1f mm, %.3f deg\n", 0.03f * (frames - 1), 1000.0f * driftTranslation,
+           driftRotation);
+    return 0;
+}
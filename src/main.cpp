@@ -1,10 +1,22 @@
 #include <iostream>
+#include <string>
 
 #include <LibMultiSense/include/MultiSense/MultiSenseChannel.hh>
 #include <LibMultiSense/include/MultiSense/MultiSenseTypes.hh>
 #include <cstring>
 #include "MultiSense/details/utility/Exception.hh"
 #include "opencv4/opencv2/opencv.hpp"
+#include "pipeline/BufferPool.h"
+#include "pipeline/CallbackBufferMonitor.h"
+#include "pipeline/FrameLog.h"
+#include "pipeline/FrameView.h"
+#include "pipeline/RectifiedColor.h"
+#include "pipeline/ReplayClock.h"
+#include "pipeline/Reprojection.h"
+#include "pipeline/StreamSubscriptions.h"
+#include "pipeline/ToneMapper.h"
+#include "pipeline/UVDisparity.h"
+#include "pipeline/WorkerPool.h"
 
 crl::multisense::Channel *m_channelP;
 crl::multisense::image::Header m_disparityHeader;
@@ -55,6 +67,46 @@ bool m_chromaSupported = true;
 // functions (above) and the copy*() functions (also above).
 pthread_mutex_t m_lumaAndChromaLeftMutex;
 
+// Rectified color output of the left camera. The lookup folds the
+// rectification maps into the YCbCr conversion, and the converted
+// images are written into recycled buffers.
+pipeline::RectifiedColorLookup m_leftColorLookup;
+pipeline::BufferPool m_rectifiedPool;
+int64_t m_lastRectifiedFrameId = -1;
+
+// Streams are only started while one of the displays uses them.
+pipeline::StreamSubscriptions m_streams;
+
+// 8-bit display of the left luma for monochrome units. 16-bit luma
+// carries 12 significant bits.
+pipeline::ToneMapper m_lumaToneMapper;
+cv::Mat m_lumaDisplay;
+
+// Obstacles found in U/V-disparity, drawn into the disparity display.
+// The reprojector only provides the ray tables of the current image size.
+pipeline::WorkerPool m_workerPool;
+pipeline::DisparityReprojector m_disparityRays;
+pipeline::UVDisparityDetector m_obstacleDetector;
+
+// Replay of a frame log instead of the sensor (see replayLog()). The
+// buffer of the image being delivered stands in for the libMultiSense
+// callback buffer that the callbacks reserve.
+pipeline::BufferPool::Buffer m_replayBuffer;
+
+// Callback buffers held and frames lost per source. While libMultiSense
+// drops frames because the callbacks fall behind, new images are dropped
+// in the callbacks instead of being held and processed (see
+// reserveCallbackBuffer()).
+pipeline::CallbackBufferMonitor m_callbackBuffers;
+
+// A converted image together with the pooled buffer backing it. The
+// buffer goes back to the pool once the last copy is destroyed.
+struct RectifiedImage {
+    int64_t frameId = -1;
+    pipeline::BufferPool::Buffer buffer;
+    cv::Mat bgr;
+};
+
 // Simple pthread-based lock class with RAII semantics.
 class ScopedLock {
 public:
@@ -69,6 +121,58 @@ private:
 
 float exposure = 0.1;
 
+void reportCallbackBuffers(const char *prefixP) {
+    for (const pipeline::CallbackBufferMonitor::SourceStats &stats : m_callbackBuffers.sources()) {
+        printf("%s0x%08x: %u held, %u at most, %lu reserved, %lu refused, %lu shed, %lu lost\n", prefixP,
+               stats.source, stats.outstanding, stats.highWater, static_cast<unsigned long>(stats.reserved),
+               static_cast<unsigned long>(stats.failed), static_cast<unsigned long>(stats.shed),
+               static_cast<unsigned long>(stats.dropped));
+    }
+}
+
+void logCallbackBufferEvent(pipeline::CallbackBufferMonitor::Event event) {
+    if (pipeline::CallbackBufferMonitor::Event_ShedStarted == event) {
+        printf("Callbacks falling behind (%u buffers held, %lu frames lost), dropping images\n",
+               m_callbackBuffers.outstanding(), static_cast<unsigned long>(m_callbackBuffers.droppedCount()));
+        reportCallbackBuffers("  ");
+    } else if (pipeline::CallbackBufferMonitor::Event_ShedStopped == event) {
+        printf("Callbacks caught up (%u buffers held), %lu images dropped so far\n",
+               m_callbackBuffers.outstanding(), static_cast<unsigned long>(m_callbackBuffers.shedCount()));
+    }
+}
+
+// Keep the data behind the image of source being delivered until
+// releaseCallbackBuffer(): the libMultiSense buffer live, and the frame
+// log image in replay. Returns 0 without keeping anything while frames
+// are being lost, and when libMultiSense has no buffer left.
+void *reserveCallbackBuffer(uint32_t source, int64_t frameId) {
+    // Replay delivers every logged frame, so gaps in a log are not losses.
+    pipeline::CallbackBufferMonitor::Event event;
+    const bool admitted = m_callbackBuffers.admit(source, m_channelP ? frameId : -1, &event);
+    logCallbackBufferEvent(event);
+    if (!admitted) {
+        return 0;
+    }
+
+    void *bufferP = 0;
+    if (m_channelP) {
+        bufferP = m_channelP->reserveCallbackBuffer();
+    } else {
+        bufferP = new pipeline::BufferPool::Buffer(m_replayBuffer);
+    }
+    logCallbackBufferEvent(m_callbackBuffers.reserved(source, bufferP));
+    return bufferP;
+}
+
+void releaseCallbackBuffer(uint32_t source, void *bufferP) {
+    if (m_channelP) {
+        m_channelP->releaseCallbackBuffer(bufferP);
+    } else {
+        delete static_cast<pipeline::BufferPool::Buffer *>(bufferP);
+    }
+    logCallbackBufferEvent(m_callbackBuffers.released(source));
+}
+
 void SetExpThresh(float ExpThresh)
 {
     printf("Setting exposure %f\n", ExpThresh);
@@ -104,19 +208,38 @@ void updateImage(const crl::multisense::image::Header &sourceHeader,
     // Return any previously reserved image data to the libMultiSense
     // library.
     if (0 != (*bufferP)) {
-        m_channelP->releaseCallbackBuffer(*bufferP);
+        releaseCallbackBuffer(targetHeader.source, *bufferP);
     }
 
     // Reserve the data that's backing the new image header.
-    *bufferP = m_channelP->reserveCallbackBuffer();
+    *bufferP = reserveCallbackBuffer(sourceHeader.source, sourceHeader.frameId);
 
     // And make a local copy, so that client code can access the image
     // later.
     targetHeader = sourceHeader;
+
+    // Without a reserved buffer the data goes away with this callback,
+    // so the image is dropped unprocessed.
+    if (0 == (*bufferP)) {
+        targetHeader.imageDataP = 0;
+        return;
+    }
+
     if (targetHeader.source == crl::multisense::Source_Luma_Left){
-        cv::Mat m = cv::Mat(272, 1024, CV_16U, (uchar*) targetHeader.imageDataP);
+        cv::Mat m = pipeline::frameView(targetHeader);
         if (!m.empty()){
-            //cv::imshow("luma left", m);
+            // Color units show the rectified color image instead.
+            if (!m_chromaSupported) {
+                if (CV_16UC1 == m.type()) {
+                    m_lumaDisplay.create(m.size(), CV_8UC1);
+                    m_lumaToneMapper.apply(m.ptr<uint16_t>(0), m.step1(),
+                                           m_lumaDisplay.ptr<uint8_t>(0), m_lumaDisplay.step1(),
+                                           m.cols, m.rows);
+                    cv::imshow("luma left", m_lumaDisplay);
+                } else {
+                    cv::imshow("luma left", m);
+                }
+            }
             if (cv::waitKey(1) == 27)
                 running = false;
 
@@ -125,7 +248,7 @@ void updateImage(const crl::multisense::image::Header &sourceHeader,
     }
 
     if (targetHeader.source == crl::multisense::Source_Luma_Right){
-        cv::Mat m = cv::Mat(272, 1024, CV_16U, (uchar*) targetHeader.imageDataP);
+        cv::Mat m = pipeline::frameView(targetHeader);
         if (!m.empty()){
             //cv::imshow("luma right", m);
             if (cv::waitKey(1) == 27)
@@ -155,6 +278,20 @@ void updateImage(const crl::multisense::image::Header &sourceHeader,
         if (!matdisplay.empty()){
             cv::normalize(matdisplay, matdisplay, 255, 1, cv::NORM_MINMAX);
             cv::applyColorMap(matdisplay, matdisplay, cv::COLORMAP_JET);
+
+            if (16 == targetHeader.bitsPerPixel) {
+                if (m_disparityRays.width() != targetHeader.width || m_disparityRays.height() != targetHeader.height) {
+                    m_disparityRays.setQ(m_qMatrix.ptr<float>(0), targetHeader.width, targetHeader.height);
+                }
+                const std::vector<pipeline::ObstacleBox> &obstacles =
+                        m_obstacleDetector.detect(m_disparityRays, disparityMat.ptr<uint16_t>(0), &m_workerPool);
+                for (const pipeline::ObstacleBox &box : obstacles) {
+                    const cv::Rect rect(box.left, box.top, box.right - box.left, box.bottom - box.top);
+                    cv::rectangle(matdisplay, rect, cv::Scalar(255, 255, 255), 2);
+                    cv::putText(matdisplay, cv::format("%.1f m", box.distance), rect.tl() + cv::Point(2, 14),
+                                cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(255, 255, 255), 1);
+                }
+            }
             cv::imshow("disparity", matdisplay);
             if (cv::waitKey(1) == 27)
                 running = false;
@@ -164,7 +301,7 @@ void updateImage(const crl::multisense::image::Header &sourceHeader,
 
 
     if (targetHeader.source == crl::multisense::Source_Disparity_Cost){
-        cv::Mat m = cv::Mat(544, 1024, CV_8U, (uchar*) targetHeader.imageDataP);
+        cv::Mat m = pipeline::frameView(targetHeader);
         if (!m.empty()){
             //cv::imshow("disparity cost", m);
             if (cv::waitKey(1) == 27)
@@ -194,7 +331,7 @@ void updateLumaAndChroma(const crl::multisense::image::Header& header)
     if(crl::multisense::Source_Luma_Left == header.source) {
         updateImage(header, m_lumaLeftHeader,
                           0, &m_lumaLeftBufferP);
-    } else if (crl::multisense::Source_Luma_Right == header.source) {
+    } else if (crl::multisense::Source_Chroma_Left == header.source) {
         updateImage(header, m_chromaLeftHeader,
                           0, &m_chromaLeftBufferP);
     } else {
@@ -227,12 +364,10 @@ void updateLumaAndChroma(const crl::multisense::image::Header& header)
 
             // Release any previously saved (and now obselete) luma/chroma data.
             if (0 != m_matchedLumaLeftBufferP) {
-                m_channelP->releaseCallbackBuffer(
-                        m_matchedLumaLeftBufferP);
+                releaseCallbackBuffer(m_matchedLumaLeftHeader.source, m_matchedLumaLeftBufferP);
             }
             if (0 != m_matchedChromaLeftBufferP) {
-                m_channelP->releaseCallbackBuffer(
-                        m_matchedChromaLeftBufferP);
+                releaseCallbackBuffer(m_matchedChromaLeftHeader.source, m_matchedChromaLeftBufferP);
             }
 
             // Transfer the new luma and chroma component into secondary
@@ -251,8 +386,7 @@ void updateLumaAndChroma(const crl::multisense::image::Header& header)
 
         // Release any previously saved (and now obsolete) luma data.
         if (0 != m_matchedLumaLeftBufferP) {
-            m_channelP->releaseCallbackBuffer(
-                    m_matchedLumaLeftBufferP);
+            releaseCallbackBuffer(m_matchedLumaLeftHeader.source, m_matchedLumaLeftBufferP);
         }
 
         // Unit is monochrome, so all we need to use is transfer the new luma component
@@ -263,11 +397,57 @@ void updateLumaAndChroma(const crl::multisense::image::Header& header)
     }
 }
 
+// Rectify the latest matched left luma/chroma pair and convert it to a
+// BGR image. Returns false if no matched pair is available yet.
+bool copyLeftRectifiedRGB(RectifiedImage &image)
+{
+    ScopedLock lock(&m_lumaAndChromaLeftMutex);
+
+    if (!m_chromaSupported || 0 == m_matchedLumaLeftBufferP || 0 == m_matchedChromaLeftBufferP)
+        return false;
+
+    const crl::multisense::image::Header &luma = m_matchedLumaLeftHeader;
+    if (8 != luma.bitsPerPixel ||
+        m_leftCalibrationMapX.size() != cv::Size(luma.width, luma.height)) {
+        fprintf(stderr, "Left luma image does not match the rectification maps\n");
+        return false;
+    }
+
+    if (m_leftColorLookup.width() != luma.width || m_leftColorLookup.height() != luma.height) {
+        m_leftColorLookup.build(m_leftCalibrationMapX.ptr<float>(0), m_leftCalibrationMapY.ptr<float>(0),
+                                luma.width, luma.height);
+    }
+
+    const size_t stride = 3 * static_cast<size_t>(luma.width);
+    image.buffer = m_rectifiedPool.acquire(stride * luma.height);
+    if (!image.buffer)
+        return false;
+
+    m_leftColorLookup.convertImage(static_cast<const uint8_t *>(luma.imageDataP),
+                                   static_cast<const uint8_t *>(m_matchedChromaLeftHeader.imageDataP),
+                                   image.buffer.get(), stride);
+    image.bgr = cv::Mat(luma.height, luma.width, CV_8UC3, image.buffer.get(), stride);
+    image.frameId = luma.frameId;
+    return true;
+}
+
 // Calls non-static method updateLumaAndChroma()
 void lumaChromaLeftCallback(const crl::multisense::image::Header& header,
                                                void *userDataP)
 {
      updateLumaAndChroma(header);
+
+     // Show every new matched pair once.
+     if (m_matchedLumaLeftHeader.frameId == m_lastRectifiedFrameId)
+         return;
+
+     RectifiedImage image;
+     if (copyLeftRectifiedRGB(image)) {
+         m_lastRectifiedFrameId = image.frameId;
+         cv::imshow("left rectified", image.bgr);
+         if (cv::waitKey(1) == 27)
+             running = false;
+     }
 }
 
 
@@ -388,18 +568,36 @@ void GetCalibration(float LeftM[3][3], float LeftD[8],
     return;
 }
 
+// Compute the rectification maps and the Q reprojection matrix from a
+// calibration scaled to the image size.
+void applyCalibration(const pipeline::FrameLogCalibration &calibration) {
+    // Mat takes Rows, Cols
+    // One-D matricies are setup with 1 row and N columns
+    const cv::Mat M1 = cv::Mat(3, 3, CV_32F, const_cast<float *>(&calibration.leftM[0][0])).clone();
+    const cv::Mat M2 = cv::Mat(3, 3, CV_32F, const_cast<float *>(&calibration.rightM[0][0])).clone();
+    const cv::Mat D1 = cv::Mat(1, 8, CV_32F, const_cast<float *>(calibration.leftD)).clone();
+    const cv::Mat D2 = cv::Mat(1, 8, CV_32F, const_cast<float *>(calibration.rightD)).clone();
+    const cv::Mat R1 = cv::Mat(3, 3, CV_32F, const_cast<float *>(&calibration.leftR[0][0])).clone();
+    const cv::Mat R2 = cv::Mat(3, 3, CV_32F, const_cast<float *>(&calibration.rightR[0][0])).clone();
+    const cv::Mat P1 = cv::Mat(3, 4, CV_32F, const_cast<float *>(&calibration.leftP[0][0])).clone();
+    const cv::Mat P2 = cv::Mat(3, 4, CV_32F, const_cast<float *>(&calibration.rightP[0][0])).clone();
+    m_qMatrix = cv::Mat(4, 4, CV_32F, const_cast<float *>(calibration.q)).clone();
+
+    m_leftCalibrationMapX = cv::Mat(calibration.height, calibration.width, CV_32F);
+    m_leftCalibrationMapY = cv::Mat(calibration.height, calibration.width, CV_32F);
+    m_rightCalibrationMapX = cv::Mat(calibration.height, calibration.width, CV_32F);
+    m_rightCalibrationMapY = cv::Mat(calibration.height, calibration.width, CV_32F);
+
+    // Compute rectification maps
+    initUndistortRectifyMap(M1, D1, R1, P1, m_leftCalibrationMapX.size(), CV_32FC1,
+                            m_leftCalibrationMapX, m_leftCalibrationMapY);
+    initUndistortRectifyMap(M2, D2, R2, P2, m_rightCalibrationMapX.size(), CV_32FC1,
+                            m_rightCalibrationMapX, m_rightCalibrationMapY);
+}
+
 // Load calibration information from S-7 camera and calculate
 // transform matrices
 void InitializeTransforms() {
-    float LeftM[3][3], LeftD[8], LeftR[3][3], LeftP[3][4];
-    float RightM[3][3], RightD[8], RightR[3][3], RightP[3][4];
-
-    cv::Mat M1, D1, M2, D2;
-    cv::Mat R, T;
-    cv::Mat R1, R2, P1, P2;
-
-    int i, j;
-
     crl::multisense::image::Config c;
 
     crl::multisense::Status status;
@@ -410,70 +608,28 @@ void InitializeTransforms() {
                       "MultiSenseWrapper::InitializeTransforms()\n");
     }
 
-    uint32_t ImgRows = c.height();
-    uint32_t ImgCols = c.width();
-
-    m_leftCalibrationMapX = cv::Mat(ImgRows, ImgCols, CV_32F);
-    m_leftCalibrationMapY = cv::Mat(ImgRows, ImgCols, CV_32F);
-    m_rightCalibrationMapX = cv::Mat(ImgRows, ImgCols, CV_32F);
-    m_rightCalibrationMapY = cv::Mat(ImgRows, ImgCols, CV_32F);
-
-    // Allocate space for matricies
-    // Mat takes Rows, Cols
-    // One-D matricies are setup with 1 row and N columns
-    M1 = cv::Mat(3, 3, CV_32F);
-    M2 = cv::Mat(3, 3, CV_32F);
-    D1 = cv::Mat(1, 8, CV_32F);
-    D2 = cv::Mat(1, 8, CV_32F);
-    R1 = cv::Mat(3, 3, CV_32F);
-    R2 = cv::Mat(3, 3, CV_32F);
-    P1 = cv::Mat(3, 4, CV_32F);
-    P2 = cv::Mat(3, 4, CV_32F);
-    T = cv::Mat(1, 3, CV_32F);
-    m_qMatrix = cv::Mat(4, 4, CV_32F, 0.0);
+    pipeline::FrameLogCalibration calibration;
+    calibration.width = c.width();
+    calibration.height = c.height();
 
     // Load values from camera
     // This routine also scales the camera values.
-    GetCalibration(LeftM, LeftD, LeftR, LeftP,
-                   RightM, RightD, RightR, RightP);
-
-    // Copy camera values into cvMats
-    for (j = 0; j < 3; j++) {
-        for (i = 0; i < 3; i++) {
-            M1.at<float>(j, i) = LeftM[j][i];
-            M2.at<float>(j, i) = RightM[j][i];
-            R1.at<float>(j, i) = LeftR[j][i];
-            R2.at<float>(j, i) = RightR[j][i];
-        }
-    }
-    for (j = 0; j < 3; j++) {
-        for (i = 0; i < 4; i++) {
-            P1.at<float>(j, i) = LeftP[j][i];
-            P2.at<float>(j, i) = RightP[j][i];
-        }
-    }
-    for (i = 0; i < 8; i++) {
-        // OpenCV only wants 5 elements for D1 but camera returns 8
-        D1.at<float>(0, i) = LeftD[i];
-        D2.at<float>(0, i) = RightD[i];
-    }
+    GetCalibration(calibration.leftM, calibration.leftD, calibration.leftR, calibration.leftP,
+                   calibration.rightM, calibration.rightD, calibration.rightR, calibration.rightP);
 
     //
     // Compute the Q reprojection matrix for non square pixels. Setting
     // fx = fy will result in the traditional Q matrix
-    m_qMatrix.at<float>(0, 0) = c.fy() * c.tx();
-    m_qMatrix.at<float>(1, 1) = c.fx() * c.tx();
-    m_qMatrix.at<float>(0, 3) = -c.fy() * c.cx() * c.tx();
-    m_qMatrix.at<float>(1, 3) = -c.fx() * c.cy() * c.tx();
-    m_qMatrix.at<float>(2, 3) = c.fx() * c.fy() * c.tx();
-    m_qMatrix.at<float>(3, 2) = -c.fy();
-    m_qMatrix.at<float>(3, 3) = c.fy() * (0.0);
-
-    // Compute rectification maps
-    initUndistortRectifyMap(M1, D1, R1, P1, m_leftCalibrationMapX.size(), CV_32FC1,
-                            m_leftCalibrationMapX, m_leftCalibrationMapY);
-    initUndistortRectifyMap(M2, D2, R2, P2, m_rightCalibrationMapX.size(), CV_32FC1,
-                            m_rightCalibrationMapX, m_rightCalibrationMapY);
+    float (&q)[16] = calibration.q;
+    q[0 * 4 + 0] = c.fy() * c.tx();
+    q[1 * 4 + 1] = c.fx() * c.tx();
+    q[0 * 4 + 3] = -c.fy() * c.cx() * c.tx();
+    q[1 * 4 + 3] = -c.fx() * c.cy() * c.tx();
+    q[2 * 4 + 3] = c.fx() * c.fy() * c.tx();
+    q[3 * 4 + 2] = -c.fy();
+    q[3 * 4 + 3] = c.fy() * (0.0);
+
+    applyCalibration(calibration);
 }
 
 // Set camera frames per second
@@ -498,10 +654,84 @@ void SetFPS(float FPS) {
 
 
 
-int main() {
+// Deliver the images of a frame log to the sensor callbacks, paced by
+// clock, until the log ends or escape is pressed in a display. Callbacks
+// are called one at a time in the order the images were logged.
+void replayLog(const std::string &path, pipeline::ReplayClock &clock) {
+    pipeline::FrameLogReader reader;
+    reader.open(path);
+
+    pipeline::FrameLogRecord record;
+    uint64_t disparityFrames = 0;
+    while (running && reader.next(record)) {
+        if (pipeline::FrameLogKind_Calibration == record.kind) {
+            m_grabbingCols = record.calibration.width;
+            m_grabbingRows = record.calibration.height;
+            applyCalibration(record.calibration);
+            continue;
+        }
+
+        const pipeline::FrameLogImage &image = record.image;
+        crl::multisense::image::Header header;
+        header.source = image.source;
+        header.bitsPerPixel = image.bitsPerPixel;
+        header.width = image.width;
+        header.height = image.height;
+        header.frameId = image.frameId;
+        header.timeSeconds = image.timeSeconds;
+        header.timeMicroSeconds = image.timeMicroSeconds;
+        header.imageLength = image.length;
+        header.imageDataP = image.data.get();
+
+        clock.waitFor(image.time());
+
+        m_replayBuffer = image.data;
+        if (crl::multisense::Source_Disparity == image.source) {
+            disparityCallback(header, 0);
+            disparityFrames++;
+        } else if (crl::multisense::Source_Disparity_Cost == image.source) {
+            disparityCostCallback(header, 0);
+        } else if (crl::multisense::Source_Luma_Left == image.source ||
+                   crl::multisense::Source_Chroma_Left == image.source) {
+            lumaChromaLeftCallback(header, 0);
+        }
+        m_replayBuffer.reset();
+    }
+
+    const pipeline::ReplayClock::Stats stats = clock.stats();
+    printf("Replayed %lu images in %.2f s: %.1f FPS, %.1f FPS recorded, %.1f disparity FPS\n",
+           static_cast<unsigned long>(stats.frames), stats.wallSeconds, stats.fps(), stats.recordedFps(),
+           stats.wallSeconds > 0.0 ? disparityFrames / stats.wallSeconds : 0.0);
+    if (clock.speed() > 0.0) {
+        printf("Delivered behind schedule by %.2f ms on average, %.2f ms at most, %lu images over 1 ms\n",
+               stats.meanLateMs, stats.maxLateMs, static_cast<unsigned long>(stats.lateFrames));
+    }
+}
+
+
+int main(int argc, char **argv) {
 
     std::cout << "Hello, World!" << std::endl;
 
+    // With --replay the images come from a frame log recorded by
+    // simple_viewer instead of the sensor, at the recorded pace, scaled by
+    // --speed, or as fast as they are processed with --fast.
+    std::string replayPath;
+    double replaySpeed = 1.0;
+    for (int i = 1; i < argc; i++) {
+        const std::string argument = argv[i];
+        if ("--replay" == argument && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if ("--speed" == argument && i + 1 < argc) {
+            replaySpeed = std::atof(argv[++i]);
+        } else if ("--fast" == argument) {
+            replaySpeed = 0.0;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--replay <log> [--speed <factor> | --fast]]\n";
+            exit(1);
+        }
+    }
+
     std::string currentAddress = "10.66.171.21";
     int Cols = 1024;
     int Rows = 512;
@@ -513,6 +743,28 @@ int main() {
     if (0 != pthread_mutex_init(&m_disparityCostMutex, NULL)) {
         CRL_EXCEPTION("pthread_mutex_init() failed: %s", strerror(errno));
     }
+    if (0 != pthread_mutex_init(&m_lumaAndChromaLeftMutex, NULL)) {
+        CRL_EXCEPTION("pthread_mutex_init() failed: %s", strerror(errno));
+    }
+    m_lumaToneMapper.setGamma(12, 0, 4095, 2.2f);
+
+    // Initialize frameId's so image data can be copied properly
+    // on startup. I.e. prevent the case where the image frame ids and
+    // the matched frame ids are both 0.
+    m_lumaLeftHeader.frameId = -1;
+    m_chromaLeftHeader.frameId = -1;
+    m_matchedLumaLeftHeader.frameId = -1;
+    m_matchedChromaLeftHeader.frameId = -1;
+
+    if (!replayPath.empty()) {
+        pipeline::ReplayClock clock(replaySpeed);
+        replayLog(replayPath, clock);
+        printf("Callback buffers: %u held at most\n", m_callbackBuffers.highWater());
+        reportCallbackBuffers("  ");
+        cv::destroyAllWindows();
+        return 0;
+    }
+
     // Initialize communications.
     m_channelP = crl::multisense::Channel::Create(currentAddress);
     if (NULL == m_channelP) {
@@ -579,41 +831,53 @@ int main() {
     // Read calibration data and compute rectification maps.
     InitializeTransforms();
 
-    // Initialize frameId's so image data can be copied properly
-    // on startup. I.e. prevent the case where the image frame ids and
-    // the matched frame ids are both 0.
-    m_lumaLeftHeader.frameId = -1;
-    m_chromaLeftHeader.frameId = -1;
-    m_matchedLumaLeftHeader.frameId = -1;
-    m_matchedChromaLeftHeader.frameId = -1;
-
-    status = m_channelP->startStreams(crl::multisense::Source_Disparity) != crl::multisense::Status_Ok;
-    if (status != crl::multisense::Status_Ok)
-        CRL_EXCEPTION("Unable to start Source_Disparity stream: %s",
-                      strerror(errno));
-
-    status = m_channelP->startStreams(crl::multisense::Source_Luma_Left);
-    if (status != crl::multisense::Status_Ok)
-        CRL_EXCEPTION("Unable to start Source_Chroma_Left stream: %s",
-                      strerror(errno));
-
-    status = m_channelP->startStreams(crl::multisense::Source_Luma_Right);
-    if (status != crl::multisense::Status_Ok)
-        CRL_EXCEPTION("Unable to start Source_Chroma_Left stream: %s",
-                      strerror(errno));
-    status = m_channelP->startStreams(crl::multisense::Source_Disparity_Cost);
-    if (status != crl::multisense::Status_Ok)
-        CRL_EXCEPTION("Unable to start Source_Chroma_Left stream: %s",
-                      strerror(errno));
-
-
     m_channelP->addIsolatedCallback(disparityCallback, crl::multisense::Source_Disparity);
     m_channelP->addIsolatedCallback(disparityCostCallback, crl::multisense::Source_Disparity_Cost);
 
-    m_channelP->addIsolatedCallback(lumaChromaLeftCallback, crl::multisense::Source_Luma_Left | crl::multisense::Source_Luma_Right);
+    m_channelP->addIsolatedCallback(lumaChromaLeftCallback, crl::multisense::Source_Luma_Left | crl::multisense::Source_Chroma_Left);
+
+    // Right luma and disparity cost are not displayed, so they are not
+    // started. Chroma is 4:2:0 and carries half the bytes of 8-bit luma.
+    const double pixels = static_cast<double>(m_grabbingCols) * m_grabbingRows;
+    m_streams.setFrameBytes(crl::multisense::Source_Disparity, 2 * pixels);
+    m_streams.setFrameBytes(crl::multisense::Source_Disparity_Cost, pixels);
+    m_streams.setFrameBytes(crl::multisense::Source_Luma_Left | crl::multisense::Source_Luma_Right, pixels);
+    m_streams.setFrameBytes(crl::multisense::Source_Chroma_Left, pixels / 2);
+    m_streams.setFrameRate(FPS);
+
+    m_streams.subscribe("disparity display", crl::multisense::Source_Disparity);
+    if (m_chromaSupported)
+        m_streams.subscribe("left rectified display",
+                            crl::multisense::Source_Luma_Left | crl::multisense::Source_Chroma_Left);
+    else
+        m_streams.subscribe("luma display", crl::multisense::Source_Luma_Left);
+
+    m_streams.setControl(
+            [](pipeline::StreamSubscriptions::Mask sources) {
+                m_callbackBuffers.restarted(sources);
+                return crl::multisense::Status_Ok == m_channelP->startStreams(sources);
+            },
+            [](pipeline::StreamSubscriptions::Mask sources) {
+                return crl::multisense::Status_Ok == m_channelP->stopStreams(sources);
+            });
+    if (m_streams.active() != m_streams.wanted())
+        CRL_EXCEPTION("Unable to start streams 0x%08llx: %s",
+                      static_cast<unsigned long long>(m_streams.wanted() & ~m_streams.active()),
+                      strerror(errno));
+
+    const crl::multisense::DataSource allStreams =
+            crl::multisense::Source_Disparity | crl::multisense::Source_Disparity_Cost |
+            crl::multisense::Source_Luma_Left | crl::multisense::Source_Luma_Right |
+            crl::multisense::Source_Chroma_Left;
+    printf("Streams 0x%08llx running: %.1f MB/s, %.1f MB/s saved\n",
+           static_cast<unsigned long long>(m_streams.active()),
+           m_streams.bytesPerSecond(m_streams.active()) / 1e6,
+           (m_streams.bytesPerSecond(allStreams) - m_streams.bytesPerSecond(m_streams.active())) / 1e6);
 
     while (running);
 
+    printf("Callback buffers: %u held at most\n", m_callbackBuffers.highWater());
+    reportCallbackBuffers("  ");
     cv::destroyAllWindows();
 
     return 0;
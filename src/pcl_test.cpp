@@ -7,6 +7,10 @@
 #include <pcl/features/normal_3d.h>
 #include <pcl/visualization/pcl_visualizer.h>
 #include <pcl/console/parse.h>
+#include <vtkRenderer.h>
+#include <vtkRendererCollection.h>
+
+#include "pipeline/PersistentCloudActor.h"
 
 using namespace std::chrono_literals;
 
@@ -27,6 +31,7 @@ printUsage (const char* progName)
               << "-a           Shapes visualisation example\n"
               << "-v           Viewports example\n"
               << "-i           Interaction Customization example\n"
+              << "-u           In-place buffer update example\n"
               << "\n\n";
 }
 
@@ -207,6 +212,23 @@ void mouseEventOccurred (const pcl::visualization::MouseEvent &event,
     }
 }
 
+pcl::visualization::PCLVisualizer::Ptr updateVis (pipeline::PersistentCloudActor &actor,
+                                                   pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud)
+{
+    // --------------------------------------------------------------
+    // -----Open 3D viewer and add an actor with persistent buffers-----
+    // --------------------------------------------------------------
+    pcl::visualization::PCLVisualizer::Ptr viewer (new pcl::visualization::PCLVisualizer ("3D Viewer"));
+    viewer->setBackgroundColor (0, 0, 0);
+    actor.update (*cloud);
+    viewer->getRendererCollection ()->GetFirstRenderer ()->AddActor (actor.actor ());
+    viewer->addCoordinateSystem (1.0);
+    viewer->initCameraParameters ();
+    viewer->resetCamera ();
+    return (viewer);
+}
+
+
 pcl::visualization::PCLVisualizer::Ptr interactionCustomizationVis ()
 {
     pcl::visualization::PCLVisualizer::Ptr viewer (new pcl::visualization::PCLVisualizer ("3D Viewer"));
@@ -235,7 +257,7 @@ main (int argc, char** argv)
         return 0;
     }
     bool simple(false), rgb(false), custom_c(false), normals(false),
-            shapes(false), viewports(false), interaction_customization(false);
+            shapes(false), viewports(false), interaction_customization(false), update(false);
     if (pcl::console::find_argument (argc, argv, "-s") >= 0)
     {
         simple = true;
@@ -271,6 +293,11 @@ main (int argc, char** argv)
         interaction_customization = true;
         std::cout << "Interaction Customization example\n";
     }
+    else if (pcl::console::find_argument (argc, argv, "-u") >= 0)
+    {
+        update = true;
+        std::cout << "In-place buffer update example\n";
+    }
     else
     {
         printUsage (argv[0]);
@@ -340,6 +367,7 @@ main (int argc, char** argv)
     ne.compute (*cloud_normals2);
 
     pcl::visualization::PCLVisualizer::Ptr viewer;
+    pipeline::PersistentCloudActor actor (basic_cloud_ptr->size ());
     if (simple)
     {
         viewer = simpleVis(basic_cloud_ptr);
@@ -368,12 +396,34 @@ main (int argc, char** argv)
     {
         viewer = interactionCustomizationVis();
     }
+    else if (update)
+    {
+        viewer = updateVis(actor, basic_cloud_ptr);
+    }
 
     //--------------------
     // -----Main loop-----
     //--------------------
+    pcl::PointCloud<pcl::PointXYZ> animated_cloud (*basic_cloud_ptr);
+    float phase (0.0);
     while (!viewer->wasStopped ())
     {
+        if (update)
+        {
+            // Let the ellipse breathe, overwriting the actor's buffers in
+            // place instead of removing and re-adding the cloud.
+            phase += 0.1f;
+            const float scale = 1.0f + 0.25f * std::sin (phase);
+            for (std::size_t i = 0; i < basic_cloud_ptr->size (); ++i)
+            {
+                animated_cloud[i].x = (*basic_cloud_ptr)[i].x * scale;
+                animated_cloud[i].y = (*basic_cloud_ptr)[i].y * scale;
+            }
+            actor.update (animated_cloud);
+            viewer->spinOnce (30, true);
+            continue;
+        }
+
         viewer->spinOnce (100);
         std::this_thread::sleep_for(100ms);
     }
@@ -0,0 +1,125 @@
+#include "pipeline/BufferPool.h"
+
+#include <pthread.h>
+
+#include <cstdlib>
+#include <vector>
+
+#include "pipeline/ScopedLock.h"
+
+namespace pipeline {
+
+namespace {
+
+const size_t BUFFER_ALIGNMENT = 64;
+
+} // anonymous namespace
+
+// Shared between the pool and every buffer it handed out, so buffers
+// released after the pool is gone are simply freed.
+struct BufferPool::State {
+    pthread_mutex_t mutex;
+    size_t maxIdle;
+    bool closed;
+    uint64_t allocations;
+    size_t idleSize;
+    std::vector<uint8_t *> idle;
+
+    State(size_t maxIdleBuffers)
+            : maxIdle(maxIdleBuffers),
+              closed(false),
+              allocations(0),
+              idleSize(0) {
+        pthread_mutex_init(&mutex, NULL);
+    }
+
+    ~State() {
+        for (uint8_t *bufferP : idle) {
+            std::free(bufferP);
+        }
+        pthread_mutex_destroy(&mutex);
+    }
+
+    // Deleter of the handed out buffers.
+    struct Recycler {
+        std::shared_ptr<State> state;
+        size_t size;
+
+        void operator()(uint8_t *bufferP) const {
+            {
+                ScopedLock lock(&state->mutex);
+                if (!state->closed && size == state->idleSize && state->idle.size() < state->maxIdle) {
+                    state->idle.push_back(bufferP);
+                    return;
+                }
+            }
+            std::free(bufferP);
+        }
+    };
+};
+
+BufferPool::BufferPool(size_t maxIdle)
+        : m_state(std::make_shared<State>(maxIdle)) {
+}
+
+BufferPool::~BufferPool() {
+    ScopedLock lock(&m_state->mutex);
+    m_state->closed = true;
+}
+
+BufferPool::Buffer BufferPool::acquire(size_t size) {
+    const size_t allocationSize = (size + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT * BUFFER_ALIGNMENT;
+    uint8_t *bufferP = 0;
+    std::vector<uint8_t *> stale;
+
+    {
+        ScopedLock lock(&m_state->mutex);
+        if (allocationSize != m_state->idleSize) {
+            stale.swap(m_state->idle);
+            m_state->idleSize = allocationSize;
+        } else if (!m_state->idle.empty()) {
+            bufferP = m_state->idle.back();
+            m_state->idle.pop_back();
+        }
+        if (!bufferP) {
+            m_state->allocations++;
+        }
+    }
+
+    for (uint8_t *staleP : stale) {
+        std::free(staleP);
+    }
+
+    if (!bufferP) {
+        bufferP = static_cast<uint8_t *>(std::aligned_alloc(BUFFER_ALIGNMENT, allocationSize));
+        if (!bufferP) {
+            return Buffer();
+        }
+    }
+
+    State::Recycler recycler = {m_state, allocationSize};
+    return Buffer(bufferP, recycler);
+}
+
+void BufferPool::trim() {
+    std::vector<uint8_t *> stale;
+    {
+        ScopedLock lock(&m_state->mutex);
+        stale.swap(m_state->idle);
+    }
+    for (uint8_t *bufferP : stale) {
+        std::free(bufferP);
+    }
+}
+
+uint64_t BufferPool::allocations() const {
+    ScopedLock lock(&m_state->mutex);
+    return m_state->allocations;
+}
+
+size_t BufferPool::idle() const {
+    ScopedLock lock(&m_state->mutex);
+    return m_state->idle.size();
+}
+
+} // namespace pipeline
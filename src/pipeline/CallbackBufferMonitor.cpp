@@ -0,0 +1,195 @@
+#include "pipeline/CallbackBufferMonitor.h"
+
+#include "pipeline/ScopedLock.h"
+
+namespace pipeline {
+
+CallbackBufferMonitor::CallbackBufferMonitor()
+        : CallbackBufferMonitor(Config()) {
+}
+
+CallbackBufferMonitor::CallbackBufferMonitor(const Config &config)
+        : m_config(config),
+          m_shedAt(0),
+          m_resumeAt(0),
+          m_outstanding(0),
+          m_highWater(0),
+          m_shed(0),
+          m_dropped(0),
+          m_cleanImages(0),
+          m_shedding(false) {
+    setCapacity(m_config.capacity);
+    pthread_mutex_init(&m_mutex, NULL);
+}
+
+CallbackBufferMonitor::~CallbackBufferMonitor() {
+    pthread_mutex_destroy(&m_mutex);
+}
+
+CallbackBufferMonitor::Config CallbackBufferMonitor::config() const {
+    ScopedLock lock(&m_mutex);
+    return m_config;
+}
+
+void CallbackBufferMonitor::setCapacity(uint32_t capacity) {
+    m_config.capacity = capacity;
+    if (0 == capacity) {
+        return;
+    }
+
+    m_shedAt = static_cast<uint32_t>(m_config.shedFraction * capacity + 0.5f);
+    m_resumeAt = static_cast<uint32_t>(m_config.resumeFraction * capacity + 0.5f);
+    if (m_shedAt < 1) {
+        m_shedAt = 1;
+    }
+    if (m_resumeAt >= m_shedAt) {
+        m_resumeAt = m_shedAt - 1;
+    }
+}
+
+bool CallbackBufferMonitor::mayResume() const {
+    if (m_cleanImages < m_config.resumeImages) {
+        return false;
+    }
+    return 0 == m_config.capacity || m_outstanding <= m_resumeAt;
+}
+
+bool CallbackBufferMonitor::admit(uint32_t source, int64_t frameId, Event *eventP) {
+    ScopedLock lock(&m_mutex);
+    if (eventP) {
+        *eventP = Event_None;
+    }
+
+    SourceStats &stats = m_sources[source];
+    stats.source = source;
+
+    // A frame id below the last one means the camera restarted.
+    const int64_t lost = stats.lastFrameId >= 0 && frameId > stats.lastFrameId ?
+                         frameId - stats.lastFrameId - 1 : 0;
+    stats.lastFrameId = frameId;
+
+    if (lost > 0) {
+        stats.dropped += lost;
+        m_dropped += lost;
+        m_cleanImages = 0;
+        if (!m_shedding) {
+            m_shedding = true;
+            if (eventP) {
+                *eventP = Event_ShedStarted;
+            }
+        }
+    } else if (m_cleanImages < m_config.resumeImages) {
+        m_cleanImages++;
+    }
+
+    if (m_shedding && mayResume()) {
+        m_shedding = false;
+        if (eventP) {
+            *eventP = Event_ShedStopped;
+        }
+    }
+    if (!m_shedding) {
+        return true;
+    }
+
+    stats.shed++;
+    m_shed++;
+    return false;
+}
+
+CallbackBufferMonitor::Event CallbackBufferMonitor::reserved(uint32_t source, const void *bufferP) {
+    ScopedLock lock(&m_mutex);
+    SourceStats &stats = m_sources[source];
+    stats.source = source;
+
+    if (!bufferP) {
+        stats.failed++;
+        if (0 == m_config.capacity && m_outstanding > 0) {
+            setCapacity(m_outstanding);
+        }
+    } else {
+        stats.reserved++;
+        stats.outstanding++;
+        m_outstanding++;
+        if (stats.outstanding > stats.highWater) {
+            stats.highWater = stats.outstanding;
+        }
+        if (m_outstanding > m_highWater) {
+            m_highWater = m_outstanding;
+        }
+    }
+
+    const bool full = 0 != m_config.capacity && m_outstanding >= m_shedAt;
+    if (!bufferP || full) {
+        m_cleanImages = 0;
+        if (!m_shedding) {
+            m_shedding = true;
+            return Event_ShedStarted;
+        }
+    }
+    return Event_None;
+}
+
+CallbackBufferMonitor::Event CallbackBufferMonitor::released(uint32_t source) {
+    ScopedLock lock(&m_mutex);
+    SourceStats &stats = m_sources[source];
+    stats.source = source;
+
+    // Releases of buffers reserved before monitoring began are ignored.
+    if (stats.outstanding > 0) {
+        stats.outstanding--;
+        m_outstanding--;
+    }
+
+    if (m_shedding && mayResume()) {
+        m_shedding = false;
+        return Event_ShedStopped;
+    }
+    return Event_None;
+}
+
+void CallbackBufferMonitor::restarted(uint64_t sources) {
+    ScopedLock lock(&m_mutex);
+    for (auto &entry : m_sources) {
+        if (0 != (sources & entry.first)) {
+            entry.second.lastFrameId = -1;
+        }
+    }
+}
+
+bool CallbackBufferMonitor::shedding() const {
+    ScopedLock lock(&m_mutex);
+    return m_shedding;
+}
+
+uint32_t CallbackBufferMonitor::outstanding() const {
+    ScopedLock lock(&m_mutex);
+    return m_outstanding;
+}
+
+uint32_t CallbackBufferMonitor::highWater() const {
+    ScopedLock lock(&m_mutex);
+    return m_highWater;
+}
+
+uint64_t CallbackBufferMonitor::shedCount() const {
+    ScopedLock lock(&m_mutex);
+    return m_shed;
+}
+
+uint64_t CallbackBufferMonitor::droppedCount() const {
+    ScopedLock lock(&m_mutex);
+    return m_dropped;
+}
+
+std::vector<CallbackBufferMonitor::SourceStats> CallbackBufferMonitor::sources() const {
+    ScopedLock lock(&m_mutex);
+    std::vector<SourceStats> sources;
+    sources.reserve(m_sources.size());
+    for (const auto &entry : m_sources) {
+        sources.push_back(entry.second);
+    }
+    return sources;
+}
+
+} // namespace pipeline
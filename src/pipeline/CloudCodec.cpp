@@ -0,0 +1,159 @@
+#include "pipeline/CloudCodec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "MultiSense/details/utility/Exception.hh"
+#include "pipeline/RiceCoding.h"
+
+namespace pipeline {
+
+namespace {
+
+const uint32_t CLOUD_MAGIC = 0x4343534d;  // "MSCC"
+const uint8_t CLOUD_VERSION = 1;
+const size_t HEADER_SIZE = 16;
+
+// Number of points that share one Rice parameter per axis.
+const size_t BLOCK_POINTS = 128;
+
+// Marks a NaN coordinate.  Quantization is clamped to +/-32767 so the
+// value is never produced by a real point.
+const int16_t NAN_CODE = std::numeric_limits<int16_t>::min();
+
+inline int16_t quantize(float v, float scale) {
+    if (v != v) {
+        return NAN_CODE;
+    }
+    float q = v * scale;
+    q = q > 32767.0f ? 32767.0f : (q < -32767.0f ? -32767.0f : q);
+    return static_cast<int16_t>(q + (q >= 0.0f ? 0.5f : -0.5f));
+}
+
+void writeU32(uint8_t *p, uint32_t v) { std::memcpy(p, &v, sizeof(v)); }
+uint32_t readU32(const uint8_t *p) { uint32_t v; std::memcpy(&v, p, sizeof(v)); return v; }
+
+} // anonymous namespace
+
+void encodeCloud(const float *xyzP,
+                 size_t count,
+                 size_t strideFloats,
+                 const CloudCodecOptions &options,
+                 std::vector<uint8_t> &output) {
+    if (count > std::numeric_limits<uint32_t>::max() || !(options.extent > 0.0f)) {
+        CRL_EXCEPTION("Invalid cloud encoding request (%zu points, extent %f)\n",
+                      count, options.extent);
+    }
+
+    // Size the buffer for the worst case, an escaped code for every
+    // value plus the per-block parameters, and trim it at the end.  The
+    // capacity is kept, so steady state encoding does not allocate.
+    const size_t blocks = (count + BLOCK_POINTS - 1) / BLOCK_POINTS;
+    output.resize(HEADER_SIZE + riceWorstCase(count * 3) + blocks * 2 + 8);
+
+    writeU32(&output[0], CLOUD_MAGIC);
+    output[4] = CLOUD_VERSION;
+    output[5] = static_cast<uint8_t>(options.entropy);
+    output[6] = 0;
+    output[7] = 0;
+    writeU32(&output[8], static_cast<uint32_t>(count));
+    std::memcpy(&output[12], &options.extent, sizeof(float));
+
+    const float scale = 32767.0f / options.extent;
+    int16_t previous[3] = {0, 0, 0};
+    uint16_t residuals[3][BLOCK_POINTS];
+
+    BitWriter writer(&output[HEADER_SIZE]);
+
+    for (size_t start = 0; start < count; start += BLOCK_POINTS) {
+        const size_t n = std::min(BLOCK_POINTS, count - start);
+
+        // Quantize and delta code one block, split per axis.
+        const float *pointP = xyzP + start * strideFloats;
+        for (size_t i = 0; i < n; ++i, pointP += strideFloats) {
+            for (int axis = 0; axis < 3; ++axis) {
+                int16_t q = quantize(pointP[axis], scale);
+                residuals[axis][i] = zigzag(static_cast<int16_t>(q - previous[axis]));
+                previous[axis] = q;
+            }
+        }
+
+        for (int axis = 0; axis < 3; ++axis) {
+            if (CloudEntropy_None == options.entropy) {
+                for (size_t i = 0; i < n; ++i) {
+                    writer.put(residuals[axis][i], 16);
+                }
+            } else {
+                uint32_t k = riceParameter(residuals[axis], n);
+                writer.put(k, 4);
+                for (size_t i = 0; i < n; ++i) {
+                    writer.putRice(residuals[axis][i], k);
+                }
+            }
+        }
+    }
+    output.resize(HEADER_SIZE + writer.finish());
+}
+
+void decodeCloud(const uint8_t *dataP,
+                 size_t length,
+                 std::vector<float> &xyz) {
+    if (length < HEADER_SIZE || CLOUD_MAGIC != readU32(dataP) || CLOUD_VERSION != dataP[4]) {
+        CRL_EXCEPTION("Not an encoded cloud stream\n");
+    }
+
+    const uint8_t entropy = dataP[5];
+    const size_t count = readU32(dataP + 8);
+    float extent;
+    std::memcpy(&extent, dataP + 12, sizeof(float));
+    if (entropy > CloudEntropy_Rice || !(extent > 0.0f)) {
+        CRL_EXCEPTION("Unsupported cloud stream (entropy %d)\n", entropy);
+    }
+
+    // Every point takes at least one bit per axis, or 16 without entropy
+    // coding, so a count the payload cannot hold is rejected before the
+    // output is sized from it.
+    const size_t payloadBits = (length - HEADER_SIZE) * 8;
+    const size_t blocks = (count + BLOCK_POINTS - 1) / BLOCK_POINTS;
+    const size_t minimumBits = CloudEntropy_None == entropy ? count * 48 : count * 3 + blocks * 12;
+    if (minimumBits > payloadBits) {
+        CRL_EXCEPTION("Truncated cloud stream (%zu points in %zu bytes)\n", count, length - HEADER_SIZE);
+    }
+
+    const float step = extent / 32767.0f;
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    int16_t previous[3] = {0, 0, 0};
+    uint16_t residuals[3][BLOCK_POINTS];
+
+    xyz.resize(count * 3);
+    BitReader reader(dataP + HEADER_SIZE, length - HEADER_SIZE);
+
+    for (size_t start = 0; start < count; start += BLOCK_POINTS) {
+        const size_t n = std::min(BLOCK_POINTS, count - start);
+
+        for (int axis = 0; axis < 3; ++axis) {
+            if (CloudEntropy_None == entropy) {
+                for (size_t i = 0; i < n; ++i) {
+                    residuals[axis][i] = static_cast<uint16_t>(reader.get(16));
+                }
+            } else {
+                uint32_t k = reader.get(4);
+                for (size_t i = 0; i < n; ++i) {
+                    residuals[axis][i] = reader.getRice(k);
+                }
+            }
+        }
+
+        float *outP = &xyz[start * 3];
+        for (size_t i = 0; i < n; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                previous[axis] = static_cast<int16_t>(previous[axis] + unzigzag(residuals[axis][i]));
+                *outP++ = (NAN_CODE == previous[axis]) ? nan : previous[axis] * step;
+            }
+        }
+    }
+}
+
+} // namespace pipeline
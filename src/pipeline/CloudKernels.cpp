@@ -0,0 +1,288 @@
+#include "pipeline/CloudKernels.h"
+
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "pipeline/PointFrame.h"
+#include "pipeline/RectifiedColor.h"
+
+namespace pipeline {
+
+namespace {
+
+// One image row of the frame's points, as floats.
+struct RowPoints {
+    uint32_t row;
+    const float *xP;
+    const float *yP;
+    const float *zP;
+    const float *intensityP;
+    const uint32_t *pixelsP;
+    size_t count;
+};
+
+//
+// Point types: what is written extraOffset floats after x.  add() is
+// called for every point written, finishRow() after the last point of a
+// row.
+
+struct XyzPoint {
+    static const bool INTENSITY = false;
+    static const bool EXTRA = false;
+
+    explicit XyzPoint(const CloudSources &, uint32_t) {
+    }
+
+    void add(float *, size_t, const RowPoints &, size_t, size_t) {
+    }
+
+    void finishRow(uint32_t, float *, size_t) {
+    }
+};
+
+struct XyzIPoint {
+    static const bool INTENSITY = true;
+    static const bool EXTRA = true;
+
+    explicit XyzIPoint(const CloudSources &, uint32_t) {
+    }
+
+    void add(float *pointP, size_t extraOffset, const RowPoints &points, size_t i, size_t) {
+        pointP[extraOffset] = points.intensityP[i];
+    }
+
+    void finishRow(uint32_t, float *, size_t) {
+    }
+};
+
+// Colors are sampled a row at a time, so the lookup gathers and converts
+// them in one go.
+struct XyzRgbPoint {
+    static const bool INTENSITY = false;
+    static const bool EXTRA = true;
+
+    XyzRgbPoint(const CloudSources &sources, uint32_t width)
+            : m_sources(sources),
+              m_width(width),
+              m_columns(width),
+              m_indices(width),
+              m_colors(width),
+              m_count(0) {
+    }
+
+    void add(float *, size_t, const RowPoints &points, size_t i, size_t index) {
+        m_columns[m_count] = points.pixelsP[i] - points.row * m_width;
+        m_indices[m_count] = index;
+        m_count++;
+    }
+
+    void finishRow(uint32_t row, float *outP, size_t strideFloats) {
+        if (0 == m_count) {
+            return;
+        }
+        m_sources.colorLookupP->sampleRow(m_sources.rawLumaP, m_sources.rawChromaP, row, m_columns.data(), m_count,
+                                          m_colors.data());
+        for (size_t i = 0; i < m_count; ++i) {
+            std::memcpy(outP + m_indices[i] * strideFloats, &m_colors[i], sizeof(float));
+        }
+        m_count = 0;
+    }
+
+    const CloudSources &m_sources;
+    uint32_t m_width;
+    std::vector<uint32_t> m_columns;
+    std::vector<size_t> m_indices;
+    std::vector<uint32_t> m_colors;
+    size_t m_count;
+};
+
+//
+// Layouts: where a point goes.
+
+struct CompactLayout {
+    explicit CompactLayout(const PointFrame &)
+            : m_count(0) {
+    }
+
+    template <class Point>
+    void prepare(const CloudOutput &) {
+    }
+
+    size_t next(uint32_t) { return m_count++; }
+    size_t count() const { return m_count; }
+
+    size_t m_count;
+};
+
+struct OrganizedLayout {
+    explicit OrganizedLayout(const PointFrame &points)
+            : m_count(static_cast<size_t>(points.width()) * points.height()) {
+    }
+
+    // Every pixel starts out without a point.
+    template <class Point>
+    void prepare(const CloudOutput &output) {
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        for (size_t i = 0; i < m_count; ++i) {
+            float *pointP = output.pointsP + i * output.strideFloats;
+            pointP[0] = nan;
+            pointP[1] = nan;
+            pointP[2] = nan;
+            if (Point::EXTRA) {
+                pointP[output.extraOffset] = 0.0f;
+            }
+        }
+    }
+
+    size_t next(uint32_t pixel) { return pixel; }
+    size_t count() const { return m_count; }
+
+    size_t m_count;
+};
+
+//
+// Filters: which points are kept.
+
+struct NoFilter {
+    explicit NoFilter(const CloudConfig &, const CloudSources &) {
+    }
+
+    bool keep(uint32_t) const { return true; }
+};
+
+struct CostFilter {
+    CostFilter(const CloudConfig &config, const CloudSources &sources)
+            : m_costP(sources.costP),
+              m_maxCost(config.maxCost) {
+    }
+
+    bool keep(uint32_t pixel) const { return m_costP[pixel] <= m_maxCost; }
+
+    const uint8_t *m_costP;
+    uint8_t m_maxCost;
+};
+
+template <class Point, class Layout, class Filter>
+size_t convertKernel(const CloudConfig &config, const CloudSources &sources, const CloudOutput &output) {
+    const PointFrame &frame = *sources.pointsP;
+    Point point(sources, frame.width());
+    Layout layout(frame);
+    const Filter filter(config, sources);
+    layout.template prepare<Point>(output);
+
+    // Half precision rows are converted into float scratch first.
+    const bool half = PointPrecision_Half == frame.precision();
+    std::vector<float> scratch(half ? 4 * static_cast<size_t>(frame.width()) : 0);
+
+    const uint32_t *pixelsP = frame.pixels();
+    const uint32_t width = frame.width();
+    size_t begin = 0;
+    while (begin < frame.size()) {
+        // The points are in image row order.
+        RowPoints row;
+        row.row = pixelsP[begin] / width;
+        const uint32_t rowEnd = (row.row + 1) * width;
+        size_t end = begin;
+        while (end < frame.size() && pixelsP[end] < rowEnd) {
+            end++;
+        }
+        row.count = end - begin;
+        row.pixelsP = pixelsP + begin;
+
+        if (half) {
+            float *rowP = scratch.data();
+            halfToFloat(frame.xHalf() + begin, rowP, row.count);
+            halfToFloat(frame.yHalf() + begin, rowP + width, row.count);
+            halfToFloat(frame.zHalf() + begin, rowP + 2 * width, row.count);
+            if (Point::INTENSITY) {
+                halfToFloat(frame.intensityHalf() + begin, rowP + 3 * width, row.count);
+            }
+            row.xP = rowP;
+            row.yP = rowP + width;
+            row.zP = rowP + 2 * width;
+            row.intensityP = rowP + 3 * width;
+        } else {
+            row.xP = frame.x() + begin;
+            row.yP = frame.y() + begin;
+            row.zP = frame.z() + begin;
+            row.intensityP = frame.intensity() + begin;
+        }
+
+        for (size_t i = 0; i < row.count; ++i) {
+            if (!filter.keep(row.pixelsP[i])) {
+                continue;
+            }
+            const size_t index = layout.next(row.pixelsP[i]);
+            float *pointP = output.pointsP + index * output.strideFloats;
+            pointP[0] = row.xP[i];
+            pointP[1] = row.yP[i];
+            pointP[2] = row.zP[i];
+            point.add(pointP, output.extraOffset, row, i, index);
+        }
+        point.finishRow(row.row, output.pointsP + output.extraOffset, output.strideFloats);
+        begin = end;
+    }
+    return layout.count();
+}
+
+// Indexed by point type, layout and whether the cost is filtered.
+const CloudKernel KERNELS[CloudPoint_Count][CloudLayout_Count][2] = {
+    {{&convertKernel<XyzPoint, CompactLayout, NoFilter>, &convertKernel<XyzPoint, CompactLayout, CostFilter>},
+     {&convertKernel<XyzPoint, OrganizedLayout, NoFilter>, &convertKernel<XyzPoint, OrganizedLayout, CostFilter>}},
+    {{&convertKernel<XyzRgbPoint, CompactLayout, NoFilter>, &convertKernel<XyzRgbPoint, CompactLayout, CostFilter>},
+     {&convertKernel<XyzRgbPoint, OrganizedLayout, NoFilter>,
+      &convertKernel<XyzRgbPoint, OrganizedLayout, CostFilter>}},
+    {{&convertKernel<XyzIPoint, CompactLayout, NoFilter>, &convertKernel<XyzIPoint, CompactLayout, CostFilter>},
+     {&convertKernel<XyzIPoint, OrganizedLayout, NoFilter>, &convertKernel<XyzIPoint, OrganizedLayout, CostFilter>}}
+};
+
+} // anonymous namespace
+
+CloudKernel cloudKernel(const CloudConfig &config) {
+    if (config.pointType < 0 || config.pointType >= CloudPoint_Count ||
+        config.layout < 0 || config.layout >= CloudLayout_Count) {
+        return 0;
+    }
+    return KERNELS[config.pointType][config.layout][config.filterCost ? 1 : 0];
+}
+
+size_t cloudCapacity(const CloudConfig &config, const PointFrame &points) {
+    if (CloudLayout_Organized == config.layout) {
+        return static_cast<size_t>(points.width()) * points.height();
+    }
+    return points.size();
+}
+
+bool convertCloud(const CloudConfig &config,
+                  const CloudSources &sources,
+                  const CloudOutput &output,
+                  size_t &count) {
+    const CloudKernel kernel = cloudKernel(config);
+    if (!kernel || !sources.pointsP || output.strideFloats < 3) {
+        return false;
+    }
+    if (config.filterCost && !sources.costP) {
+        return false;
+    }
+    if (CloudPoint_Xyz != config.pointType &&
+        (output.extraOffset < 3 || output.extraOffset >= output.strideFloats)) {
+        return false;
+    }
+    if (CloudPoint_XyzRgb == config.pointType &&
+        (!sources.colorLookupP || !sources.rawLumaP || !sources.rawChromaP ||
+         sources.colorLookupP->width() != sources.pointsP->width() ||
+         sources.colorLookupP->height() != sources.pointsP->height())) {
+        return false;
+    }
+
+    const size_t needed = cloudCapacity(config, *sources.pointsP);
+    if (needed > output.capacity || (needed > 0 && !output.pointsP)) {
+        return false;
+    }
+
+    count = kernel(config, sources, output);
+    return true;
+}
+
+} // namespace pipeline
@@ -0,0 +1,373 @@
+#include "pipeline/CloudWriter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "MultiSense/details/utility/Exception.hh"
+#include "pipeline/ScopedLock.h"
+
+namespace pipeline {
+
+namespace {
+
+// Alignment required for O_DIRECT, and the granularity the staging
+// buffers grow in.
+const size_t IO_ALIGNMENT = 4096;
+
+// Size of the individual write() calls.
+const size_t IO_CHUNK = 8 * 1024 * 1024;
+
+const size_t MAX_HEADER = 512;
+
+size_t alignUp(size_t value) {
+    return (value + IO_ALIGNMENT - 1) & ~(IO_ALIGNMENT - 1);
+}
+
+} // anonymous namespace
+
+CloudWriter::CloudWriter()
+        : m_running(false),
+          m_stopping(false),
+          m_serializerDone(false) {
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_cond, NULL);
+}
+
+CloudWriter::~CloudWriter() {
+    stop();
+    for (auto &staging : m_staging) {
+        free(staging.dataP);
+    }
+    pthread_cond_destroy(&m_cond);
+    pthread_mutex_destroy(&m_mutex);
+}
+
+void CloudWriter::start(const Config &config) {
+    if (isRunning()) {
+        CRL_EXCEPTION("CloudWriter::start() called while already running\n");
+    }
+
+    {
+        ScopedLock lock(&m_mutex);
+        m_config = config;
+        if (0 == m_config.queueDepth) {
+            m_config.queueDepth = 1;
+        }
+        m_stopping = false;
+        m_serializerDone = false;
+        m_running = true;
+    }
+
+    m_serializeThread = std::thread(&CloudWriter::serializeThread, this);
+    m_ioThread = std::thread(&CloudWriter::ioThread, this);
+}
+
+void CloudWriter::stop() {
+    {
+        ScopedLock lock(&m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_stopping = true;
+        pthread_cond_broadcast(&m_cond);
+    }
+
+    m_serializeThread.join();
+    m_ioThread.join();
+
+    ScopedLock lock(&m_mutex);
+    m_running = false;
+}
+
+bool CloudWriter::isRunning() const {
+    ScopedLock lock(&m_mutex);
+    return m_running;
+}
+
+bool CloudWriter::submit(int64_t frameId,
+                         const float *xyzP,
+                         size_t count,
+                         size_t strideFloats,
+                         std::shared_ptr<const void> owner) {
+    ScopedLock lock(&m_mutex);
+
+    if (!m_running || m_stopping) {
+        return false;
+    }
+
+    m_stats.submitted++;
+
+    if (m_queue.size() >= m_config.queueDepth) {
+        switch (m_config.dropPolicy) {
+            case Drop_Newest:
+                m_stats.dropped++;
+                return false;
+            case Drop_Oldest:
+                m_queue.pop_front();
+                m_stats.dropped++;
+                break;
+            case Drop_Never:
+                while (m_queue.size() >= m_config.queueDepth && !m_stopping) {
+                    pthread_cond_wait(&m_cond, &m_mutex);
+                }
+                if (m_stopping) {
+                    return false;
+                }
+                break;
+        }
+    }
+
+    m_queue.push_back({frameId, xyzP, count, strideFloats, std::move(owner)});
+    pthread_cond_broadcast(&m_cond);
+    return true;
+}
+
+CloudWriter::Stats CloudWriter::stats() const {
+    ScopedLock lock(&m_mutex);
+    Stats stats = m_stats;
+    stats.queued = m_queue.size();
+    return stats;
+}
+
+void CloudWriter::serializeThread() {
+    size_t index = 0;
+
+    for (;;) {
+        Job job;
+        {
+            ScopedLock lock(&m_mutex);
+
+            // Wait for a frame, and for the staging buffer we are about to
+            // fill to come back from the I/O thread.
+            while ((m_queue.empty() || m_staging[index].filled) &&
+                   !(m_stopping && m_queue.empty())) {
+                pthread_cond_wait(&m_cond, &m_mutex);
+            }
+            if (m_queue.empty()) {
+                m_serializerDone = true;
+                pthread_cond_broadcast(&m_cond);
+                break;
+            }
+
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+            pthread_cond_broadcast(&m_cond);
+        }
+
+        // The staging buffer belongs to this thread until it is marked
+        // as filled, so the formatting runs without the lock held.
+        const bool ok = serialize(job, m_staging[index]);
+        job.owner.reset();
+
+        // A frame that could not be serialized is dropped; the staging
+        // buffer stays with this thread for the next one.
+        ScopedLock lock(&m_mutex);
+        if (!ok) {
+            m_stats.dropped++;
+            continue;
+        }
+        m_staging[index].filled = true;
+        pthread_cond_broadcast(&m_cond);
+        index ^= 1;
+    }
+}
+
+void CloudWriter::ioThread() {
+    size_t index = 0;
+
+    for (;;) {
+        {
+            ScopedLock lock(&m_mutex);
+
+            // Exit once the serializer has finished and nothing is left in
+            // the staging buffers.
+            while (!m_staging[index].filled &&
+                   !(m_serializerDone && !m_staging[index ^ 1].filled)) {
+                pthread_cond_wait(&m_cond, &m_mutex);
+            }
+            if (!m_staging[index].filled) {
+                break;
+            }
+        }
+
+        const Staging &staging = m_staging[index];
+
+        char name[64];
+        snprintf(name, sizeof(name), "_%010lld.%s", static_cast<long long>(staging.frameId),
+                 Format_PCD == m_config.format ? "pcd" : "ply");
+        const std::string path = m_config.directory + "/" + m_config.prefix + name;
+
+        const bool ok = writeFile(staging, path);
+
+        {
+            ScopedLock lock(&m_mutex);
+            if (ok) {
+                m_stats.written++;
+                m_stats.bytes += staging.length;
+            } else {
+                m_stats.failed++;
+            }
+            m_staging[index].filled = false;
+            pthread_cond_broadcast(&m_cond);
+        }
+
+        if (ok) {
+            rotate(path);
+        }
+        index ^= 1;
+    }
+}
+
+bool CloudWriter::serialize(const Job &job, Staging &staging) {
+    char header[MAX_HEADER];
+    int headerLength;
+
+    if (Format_PCD == m_config.format) {
+        headerLength = snprintf(header, sizeof(header),
+                                "# .PCD v0.7 - Point Cloud Data file format\n"
+                                "VERSION 0.7\n"
+                                "FIELDS x y z\n"
+                                "SIZE 4 4 4\n"
+                                "TYPE F F F\n"
+                                "COUNT 1 1 1\n"
+                                "WIDTH %zu\n"
+                                "HEIGHT 1\n"
+                                "VIEWPOINT 0 0 0 1 0 0 0\n"
+                                "POINTS %zu\n"
+                                "DATA binary\n",
+                                job.count, job.count);
+    } else {
+        headerLength = snprintf(header, sizeof(header),
+                                "ply\n"
+                                "format binary_little_endian 1.0\n"
+                                "comment frame %lld\n"
+                                "element vertex %zu\n"
+                                "property float x\n"
+                                "property float y\n"
+                                "property float z\n"
+                                "end_header\n",
+                                static_cast<long long>(job.frameId), job.count);
+    }
+
+    const size_t length = headerLength + job.count * 3 * sizeof(float);
+
+    // Grow the staging buffer in aligned steps.  The padding lets the I/O
+    // thread issue whole-block writes when O_DIRECT is in use.
+    // This runs on the serializer thread, so a failed allocation drops
+    // the frame instead of throwing.
+    if (alignUp(length) > staging.capacity) {
+        free(staging.dataP);
+        staging.dataP = 0;
+        staging.capacity = 0;
+
+        const size_t capacity = alignUp(length + length / 4);
+        if (0 != posix_memalign(reinterpret_cast<void **>(&staging.dataP), IO_ALIGNMENT, capacity)) {
+            staging.dataP = 0;
+            fprintf(stderr, "Failed to allocate %zu byte staging buffer\n", capacity);
+            return false;
+        }
+        staging.capacity = capacity;
+    }
+
+    std::memcpy(staging.dataP, header, headerLength);
+    float *outP = reinterpret_cast<float *>(staging.dataP + headerLength);
+    const float *inP = job.xyzP;
+    for (size_t i = 0; i < job.count; ++i, inP += job.strideFloats) {
+        *outP++ = inP[0];
+        *outP++ = inP[1];
+        *outP++ = inP[2];
+    }
+
+    // Zero the tail of the last block so no stale data hits the disk.
+    std::memset(staging.dataP + length, 0, alignUp(length) - length);
+
+    staging.length = length;
+    staging.frameId = job.frameId;
+    return true;
+}
+
+bool CloudWriter::writeFile(const Staging &staging, const std::string &path) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    bool direct = false;
+    int fd = -1;
+
+#ifdef O_DIRECT
+    if (m_config.directIo) {
+        fd = open(path.c_str(), flags | O_DIRECT, 0644);
+        direct = (fd >= 0);
+    }
+#endif
+    // Not every file system supports O_DIRECT; fall back to buffered I/O.
+    if (fd < 0) {
+        fd = open(path.c_str(), flags, 0644);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Direct writes must cover whole blocks; the file is trimmed to its
+    // real length afterwards.
+    const size_t total = direct ? alignUp(staging.length) : staging.length;
+    size_t offset = 0;
+    bool ok = true;
+
+    while (offset < total) {
+        const size_t chunk = std::min(IO_CHUNK, total - offset);
+        ssize_t written = write(fd, staging.dataP + offset, chunk);
+        if (written < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            fprintf(stderr, "Failed to write %s: %s\n", path.c_str(), strerror(errno));
+            ok = false;
+            break;
+        }
+        if (0 == written) {
+            fprintf(stderr, "Failed to write %s: no progress\n", path.c_str());
+            ok = false;
+            break;
+        }
+        offset += written;
+
+        // A short direct write leaves the next one misaligned, so the rest
+        // of the file goes through the page cache.
+#ifdef O_DIRECT
+        if (direct && 0 != offset % IO_ALIGNMENT) {
+            if (0 != fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT)) {
+                fprintf(stderr, "Failed to write %s: %s\n", path.c_str(), strerror(errno));
+                ok = false;
+                break;
+            }
+        }
+#endif
+    }
+
+    if (ok && direct && 0 != ftruncate(fd, staging.length)) {
+        fprintf(stderr, "Failed to truncate %s: %s\n", path.c_str(), strerror(errno));
+        ok = false;
+    }
+
+    close(fd);
+    return ok;
+}
+
+void CloudWriter::rotate(const std::string &path) {
+    if (0 == m_config.maxFiles) {
+        return;
+    }
+
+    m_files.push_back(path);
+    while (m_files.size() > m_config.maxFiles) {
+        unlink(m_files.front().c_str());
+        m_files.pop_front();
+    }
+}
+
+} // namespace pipeline
@@ -0,0 +1,203 @@
+#include "pipeline/DepthCodec.h"
+
+#include <cstring>
+#include <limits>
+
+#include "MultiSense/details/utility/Exception.hh"
+#include "pipeline/RiceCoding.h"
+
+namespace pipeline {
+
+namespace {
+
+const uint32_t DEPTH_MAGIC = 0x4344534d;  // "MSDC"
+const uint8_t DEPTH_VERSION = 1;
+const size_t HEADER_SIZE = 16;
+
+// Number of residuals that share one Rice parameter.
+const size_t BLOCK_PIXELS = 64;
+
+// Prediction of the pixel at column c from the pixels around it that
+// have depth; last is the last pixel with depth coded before it.
+inline uint16_t predict(const uint16_t *rowP, const uint16_t *upP, uint32_t c, uint16_t last) {
+    const int a = c > 0 ? rowP[c - 1] : 0;
+    const int b = upP ? upP[c] : 0;
+    const int d = upP && c > 0 ? upP[c - 1] : 0;
+
+    if (a && b && d) {
+        // Median edge detector: take the neighbour across an edge, and
+        // the plane through all three otherwise.
+        const int low = a < b ? a : b;
+        const int high = a < b ? b : a;
+        if (d >= high) {
+            return static_cast<uint16_t>(low);
+        }
+        if (d <= low) {
+            return static_cast<uint16_t>(high);
+        }
+        return static_cast<uint16_t>(a + b - d);
+    }
+    if (a && b) {
+        return static_cast<uint16_t>((a + b + 1) >> 1);
+    }
+    if (a) {
+        return static_cast<uint16_t>(a);
+    }
+    if (b) {
+        return static_cast<uint16_t>(b);
+    }
+    return last;
+}
+
+void writeU32(uint8_t *p, uint32_t v) { std::memcpy(p, &v, sizeof(v)); }
+uint32_t readU32(const uint8_t *p) { uint32_t v; std::memcpy(&v, p, sizeof(v)); return v; }
+
+} // anonymous namespace
+
+void encodeDepth(const uint16_t *depthP,
+                 uint32_t width,
+                 uint32_t height,
+                 std::vector<uint8_t> &output) {
+    if (width > std::numeric_limits<uint16_t>::max()) {
+        CRL_EXCEPTION("Invalid depth encoding request (%u x %u pixels)\n", width, height);
+    }
+
+    // Size the buffer for the worst case, escaped codes for every pixel
+    // and run plus the Rice parameters, and trim it at the end.  The
+    // capacity is kept, so steady state encoding does not allocate.
+    const size_t pixels = static_cast<size_t>(width) * height;
+    const size_t blocksPerRow = width / BLOCK_PIXELS + 2;
+    output.resize(HEADER_SIZE + riceWorstCase(2 * pixels + height) + height * blocksPerRow + 8);
+
+    writeU32(&output[0], DEPTH_MAGIC);
+    output[4] = DEPTH_VERSION;
+    output[5] = 0;
+    output[6] = 0;
+    output[7] = 0;
+    writeU32(&output[8], width);
+    writeU32(&output[12], height);
+
+    std::vector<uint16_t> runs(width + 1);
+    std::vector<uint16_t> residuals(width);
+    uint16_t last = 0;
+
+    BitWriter writer(&output[HEADER_SIZE]);
+
+    for (uint32_t r = 0; r < height; ++r) {
+        const uint16_t *rowP = depthP + static_cast<size_t>(r) * width;
+        const uint16_t *upP = r > 0 ? rowP - width : 0;
+
+        // Alternating runs of pixels without and with depth, starting
+        // with pixels without (possibly none).
+        size_t runCount = 0;
+        size_t count = 0;
+        uint32_t c = 0;
+        while (c < width) {
+            uint32_t start = c;
+            while (c < width && 0 == rowP[c]) {
+                ++c;
+            }
+            runs[runCount++] = static_cast<uint16_t>(c - start);
+            if (c == width) {
+                break;
+            }
+
+            start = c;
+            for (; c < width && 0 != rowP[c]; ++c) {
+                const uint16_t prediction = predict(rowP, upP, c, last);
+                residuals[count++] = zigzag(static_cast<int16_t>(rowP[c] - prediction));
+                last = rowP[c];
+            }
+            runs[runCount++] = static_cast<uint16_t>(c - start);
+        }
+
+        const uint32_t runK = riceParameter(runs.data(), runCount);
+        writer.put(runK, 4);
+        for (size_t i = 0; i < runCount; ++i) {
+            writer.putRice(runs[i], runK);
+        }
+
+        for (size_t start = 0; start < count; start += BLOCK_PIXELS) {
+            const size_t n = count - start < BLOCK_PIXELS ? count - start : BLOCK_PIXELS;
+            const uint32_t k = riceParameter(&residuals[start], n);
+            writer.put(k, 4);
+            for (size_t i = 0; i < n; ++i) {
+                writer.putRice(residuals[start + i], k);
+            }
+        }
+    }
+    output.resize(HEADER_SIZE + writer.finish());
+}
+
+void decodeDepth(const uint8_t *dataP,
+                 size_t length,
+                 std::vector<uint16_t> &depth,
+                 uint32_t &width,
+                 uint32_t &height) {
+    if (length < HEADER_SIZE || DEPTH_MAGIC != readU32(dataP) || DEPTH_VERSION != dataP[4]) {
+        CRL_EXCEPTION("Not an encoded depth stream\n");
+    }
+
+    width = readU32(dataP + 8);
+    height = readU32(dataP + 12);
+    // Every row takes at least 5 bits, which bounds the size a damaged
+    // header can make us allocate.
+    if (width > std::numeric_limits<uint16_t>::max() ||
+        height > (length - HEADER_SIZE) * 2) {
+        CRL_EXCEPTION("Unsupported depth stream (%u x %u pixels)\n", width, height);
+    }
+
+    depth.resize(static_cast<size_t>(width) * height);
+    std::vector<uint16_t> residuals(width);
+    uint16_t last = 0;
+
+    BitReader reader(dataP + HEADER_SIZE, length - HEADER_SIZE);
+
+    for (uint32_t r = 0; r < height; ++r) {
+        uint16_t *rowP = &depth[static_cast<size_t>(r) * width];
+        const uint16_t *upP = r > 0 ? rowP - width : 0;
+
+        // Runs first, marking the pixels with depth for the second pass.
+        const uint32_t runK = reader.get(4);
+        size_t count = 0;
+        uint32_t c = 0;
+        bool valid = false;
+        while (c < width) {
+            const uint32_t run = reader.getRice(runK);
+            if (run > width - c || (valid && 0 == run)) {
+                CRL_EXCEPTION("Corrupt depth stream (row %u)\n", r);
+            }
+            std::memset(rowP + c, 0, run * sizeof(uint16_t));
+            if (valid) {
+                for (uint32_t i = c; i < c + run; ++i) {
+                    rowP[i] = 1;
+                }
+                count += run;
+            }
+            c += run;
+            valid = !valid;
+        }
+
+        for (size_t start = 0; start < count; start += BLOCK_PIXELS) {
+            const size_t n = count - start < BLOCK_PIXELS ? count - start : BLOCK_PIXELS;
+            const uint32_t k = reader.get(4);
+            for (size_t i = 0; i < n; ++i) {
+                residuals[start + i] = reader.getRice(k);
+            }
+        }
+
+        // Predict in the same order as the encoder; pixels to the right
+        // are still 0 or 1 and are never looked at.
+        size_t i = 0;
+        for (c = 0; c < width; ++c) {
+            if (0 == rowP[c]) {
+                continue;
+            }
+            const uint16_t prediction = predict(rowP, upP, c, last);
+            rowP[c] = static_cast<uint16_t>(prediction + unzigzag(residuals[i++]));
+            last = rowP[c];
+        }
+    }
+}
+
+} // namespace pipeline
@@ -0,0 +1,172 @@
+#include "pipeline/DepthImage.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pipeline/Reprojection.h"
+#include "pipeline/WorkerPool.h"
+
+namespace pipeline {
+
+namespace {
+
+// Largest depth in millimeters that still fits, plus half a unit for
+// rounding.
+const float MAX_MILLIMETERS = 65535.5f;
+
+struct DepthTerms {
+    float disparityScale;
+    float wOffset;
+    float depthTerm;
+
+    float depth(uint16_t d) const {
+        if (0 == d) {
+            return 0.0f;
+        }
+        const float depth = depthTerm / (d * disparityScale + wOffset);
+        // Also rejects NaN and infinity from a zero w.
+        return depth > 0.0f && depth < 1e30f ? depth : 0.0f;
+    }
+};
+
+void convertSpanMeters(const DepthTerms &terms, const uint16_t *disparityP, float *depthP,
+                       uint32_t begin, uint32_t end) {
+    uint32_t c = begin;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(terms.disparityScale);
+    const __m128 offset = _mm_set1_ps(terms.wOffset);
+    const __m128 depthTerm = _mm_set1_ps(terms.depthTerm);
+    const __m128 limit = _mm_set1_ps(1e30f);
+    for (; c + 4 <= end; c += 4) {
+        const __m128i d = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(disparityP + c)),
+                                             zero);
+        const __m128 disparity = _mm_cvtepi32_ps(d);
+        const __m128 depth = _mm_div_ps(depthTerm, _mm_add_ps(_mm_mul_ps(disparity, scale), offset));
+        const __m128 valid = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(disparity, _mm_setzero_ps()),
+                                                   _mm_cmpgt_ps(depth, _mm_setzero_ps())),
+                                        _mm_cmplt_ps(depth, limit));
+        _mm_storeu_ps(depthP + c, _mm_and_ps(depth, valid));
+    }
+#endif
+    for (; c < end; ++c) {
+        depthP[c] = terms.depth(disparityP[c]);
+    }
+}
+
+void convertSpanMillimeters(const DepthTerms &terms, const uint16_t *disparityP, uint16_t *depthP,
+                            uint32_t begin, uint32_t end) {
+    uint32_t c = begin;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(terms.disparityScale);
+    const __m128 offset = _mm_set1_ps(terms.wOffset);
+    const __m128 depthTerm = _mm_set1_ps(terms.depthTerm * 1000.0f);
+    const __m128 limit = _mm_set1_ps(MAX_MILLIMETERS);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128i flip = _mm_set1_epi16(static_cast<short>(0x8000));
+    for (; c + 4 <= end; c += 4) {
+        const __m128i d = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(disparityP + c)),
+                                             zero);
+        const __m128 disparity = _mm_cvtepi32_ps(d);
+        const __m128 depth = _mm_div_ps(depthTerm, _mm_add_ps(_mm_mul_ps(disparity, scale), offset));
+        const __m128 valid = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(disparity, _mm_setzero_ps()),
+                                                   _mm_cmpgt_ps(depth, _mm_setzero_ps())),
+                                        _mm_cmplt_ps(depth, limit));
+        const __m128i rounded = _mm_cvttps_epi32(_mm_and_ps(_mm_add_ps(depth, half), valid));
+
+        // SSE2 only packs with signed saturation, so shift into the
+        // signed range and back.
+        const __m128i packed = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(rounded, bias), zero), flip);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(depthP + c), packed);
+    }
+#endif
+    for (; c < end; ++c) {
+        const float depth = terms.depth(disparityP[c]) * 1000.0f;
+        depthP[c] = depth < MAX_MILLIMETERS ? static_cast<uint16_t>(depth + 0.5f) : 0;
+    }
+}
+
+} // anonymous namespace
+
+DepthConverter::DepthConverter()
+        : DepthConverter(Config()) {
+}
+
+DepthConverter::DepthConverter(const Config &config)
+        : m_config(config) {
+    if (0 == m_config.rowsPerTile) {
+        m_config.rowsPerTile = 1;
+    }
+}
+
+bool DepthConverter::convert(const DisparityReprojector &reprojector,
+                             const uint16_t *disparityP,
+                             int64_t frameId,
+                             DepthImage &depth,
+                             WorkerPool *poolP) {
+    if (!reprojector.isValid()) {
+        return false;
+    }
+
+    depth.frameId = frameId;
+    depth.width = reprojector.width();
+    depth.height = reprojector.height();
+    depth.format = m_config.format;
+    depth.buffer = m_pool.acquire(depth.sizeBytes());
+    if (!depth.buffer) {
+        return false;
+    }
+
+    const DepthTerms terms = {reprojector.disparityScale(), reprojector.wOffset(), reprojector.depthTerm()};
+    const uint32_t width = depth.width;
+    const size_t rowBytes = width * depth.bytesPerPixel();
+    uint8_t *outP = depth.buffer.get();
+    const bool meters = DepthFormat_Meters == depth.format;
+
+    const uint32_t tileRows = m_config.rowsPerTile;
+    const size_t tiles = (depth.height + tileRows - 1) / tileRows;
+
+    WorkerPool::Task convertTile = [&](size_t tile, uint32_t) {
+        const uint32_t begin = static_cast<uint32_t>(tile) * tileRows;
+        const uint32_t end = begin + tileRows < depth.height ? begin + tileRows : depth.height;
+        for (uint32_t r = begin; r < end; ++r) {
+            uint8_t *rowP = outP + r * rowBytes;
+            const uint16_t *disparityRowP = disparityP + static_cast<size_t>(r) * width;
+
+            // Pixels outside the region's spans stay 0.
+            size_t spanCount = 0;
+            const RoiSpan *spansP = 0;
+            if (r >= reprojector.firstRow() && r < reprojector.endRow()) {
+                spansP = reprojector.spans(r, spanCount);
+            }
+            if (1 != spanCount || 0 != spansP[0].begin || width != spansP[0].end) {
+                std::memset(rowP, 0, rowBytes);
+            }
+
+            for (size_t k = 0; k < spanCount; ++k) {
+                if (meters) {
+                    convertSpanMeters(terms, disparityRowP, reinterpret_cast<float *>(rowP),
+                                      spansP[k].begin, spansP[k].end);
+                } else {
+                    convertSpanMillimeters(terms, disparityRowP, reinterpret_cast<uint16_t *>(rowP),
+                                           spansP[k].begin, spansP[k].end);
+                }
+            }
+        }
+    };
+    if (poolP) {
+        poolP->run(tiles, convertTile);
+    } else {
+        for (size_t tile = 0; tile < tiles; ++tile) {
+            convertTile(tile, 0);
+        }
+    }
+    return true;
+}
+
+} // namespace pipeline
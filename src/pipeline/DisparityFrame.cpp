@@ -0,0 +1,256 @@
+#include "pipeline/DisparityFrame.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "pipeline/PointFrame.h"
+#include "pipeline/Reprojection.h"
+#include "pipeline/ScopedLock.h"
+#include "pipeline/WorkerPool.h"
+
+namespace pipeline {
+
+namespace {
+
+// Image rows per task of the parallel products.
+const uint32_t ROWS_PER_TILE = 32;
+
+// Run task over the row tiles of an image height rows high.
+void forEachTile(WorkerPool *poolP, uint32_t height, const WorkerPool::Task &task) {
+    const size_t tiles = (height + ROWS_PER_TILE - 1) / ROWS_PER_TILE;
+    if (poolP) {
+        poolP->run(tiles, task);
+    } else {
+        for (size_t tile = 0; tile < tiles; ++tile) {
+            task(tile, 0);
+        }
+    }
+}
+
+// OpenCV's COLORMAP_JET as a BGR lookup table.
+struct JetTable {
+    uint8_t bgr[256][3];
+
+    JetTable() {
+        for (int i = 0; i < 256; ++i) {
+            const float v = i / 255.0f;
+            bgr[i][0] = channel(v, 1.0f);
+            bgr[i][1] = channel(v, 2.0f);
+            bgr[i][2] = channel(v, 3.0f);
+        }
+    }
+
+    static uint8_t channel(float v, float center) {
+        const float value = 1.5f - std::fabs(4.0f * v - center);
+        return static_cast<uint8_t>(255.0f * (value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value) + 0.5f);
+    }
+};
+
+} // anonymous namespace
+
+DisparityFrame::DisparityFrame(const DisparityFrameContext &context,
+                               int64_t frameId,
+                               const uint16_t *disparityP,
+                               uint32_t width,
+                               uint32_t height)
+        : m_context(context),
+          m_frameId(frameId),
+          m_width(width),
+          m_height(height) {
+    const size_t bytes = static_cast<size_t>(width) * height * sizeof(uint16_t);
+    if (m_context.disparityPoolP) {
+        m_disparity = m_context.disparityPoolP->acquire(bytes);
+    } else {
+        m_disparity = BufferPool::Buffer(new uint8_t[bytes], std::default_delete<uint8_t[]>());
+    }
+    if (m_disparity) {
+        std::memcpy(m_disparity.get(), disparityP, bytes);
+    } else {
+        m_width = 0;
+        m_height = 0;
+    }
+
+    for (int i = 0; i < Product_Count; ++i) {
+        pthread_mutex_init(&m_mutexes[i], NULL);
+        m_computed[i] = false;
+    }
+}
+
+DisparityFrame::~DisparityFrame() {
+    for (int i = 0; i < Product_Count; ++i) {
+        pthread_mutex_destroy(&m_mutexes[i]);
+    }
+}
+
+template <class Compute>
+void DisparityFrame::once(Product product, Compute compute) {
+    ScopedLock lock(&m_mutexes[product]);
+    if (!m_computed[product]) {
+        compute();
+        m_computed[product] = true;
+    }
+}
+
+bool DisparityFrame::matchesReprojector() const {
+    const DisparityReprojector *reprojectorP = m_context.reprojector.get();
+    return reprojectorP && reprojectorP->isValid() && m_width > 0 &&
+           reprojectorP->width() == m_width && reprojectorP->height() == m_height;
+}
+
+const std::vector<float> &DisparityFrame::floatDisparity() {
+    once(Product_FloatDisparity, [this]() {
+        const size_t pixels = static_cast<size_t>(m_width) * m_height;
+        const uint16_t *disparityP = disparity();
+        m_floatDisparity.resize(pixels);
+        for (size_t i = 0; i < pixels; ++i) {
+            m_floatDisparity[i] = disparityP[i] * (1.0f / 16.0f);
+        }
+    });
+    return m_floatDisparity;
+}
+
+const DepthImage &DisparityFrame::depth() {
+    once(Product_Depth, [this]() {
+        if (m_context.depthConverterP && matchesReprojector()) {
+            m_context.depthConverterP->convert(*m_context.reprojector, disparity(), m_frameId, m_depth,
+                                               m_context.workerPoolP);
+        }
+    });
+    return m_depth;
+}
+
+std::shared_ptr<const PointFrame> DisparityFrame::points() {
+    once(Product_Points, [this]() {
+        m_points = m_context.pointPoolP ? m_context.pointPoolP->acquire() : std::make_shared<PointFrame>();
+        if (matchesReprojector()) {
+            m_context.reprojector->reproject(disparity(), m_frameId, *m_points);
+        } else {
+            m_points->reset(m_frameId, m_width, m_height);
+        }
+    });
+    return m_points;
+}
+
+const std::vector<uint8_t> &DisparityFrame::display() {
+    once(Product_Display, [this]() {
+        m_display.assign(static_cast<size_t>(m_width) * m_height, 0);
+        if (!matchesReprojector()) {
+            return;
+        }
+
+        const DisparityReprojector &reprojector = *m_context.reprojector;
+        const uint16_t *disparityP = disparity();
+        for (uint32_t r = reprojector.firstRow(); r < reprojector.endRow(); ++r) {
+            const size_t rowStart = static_cast<size_t>(r) * m_width;
+            size_t spanCount;
+            const RoiSpan *spansP = reprojector.spans(r, spanCount);
+            for (size_t k = 0; k < spanCount; ++k) {
+                for (uint32_t c = spansP[k].begin; c < spansP[k].end; ++c) {
+                    // Rounded to whole pixels and saturated.
+                    const int value = (disparityP[rowStart + c] + 8) >> 4;
+                    m_display[rowStart + c] = static_cast<uint8_t>(value < 255 ? value : 255);
+                }
+            }
+        }
+    });
+    return m_display;
+}
+
+const std::vector<uint8_t> &DisparityFrame::colorized() {
+    once(Product_Colorized, [this]() {
+        static const JetTable jet;
+
+        const std::vector<uint8_t> &gray = display();
+        m_colorized.assign(gray.size() * 3, 0);
+        const uint16_t *disparityP = disparity();
+        for (size_t i = 0; i < gray.size(); ++i) {
+            if (disparityP[i]) {
+                std::memcpy(&m_colorized[3 * i], jet.bgr[gray[i]], 3);
+            }
+        }
+    });
+    return m_colorized;
+}
+
+const std::vector<float> &DisparityFrame::normals() {
+    once(Product_Normals, [this]() {
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        const size_t pixels = static_cast<size_t>(m_width) * m_height;
+        m_normals.assign(3 * pixels, nan);
+        if (!matchesReprojector()) {
+            return;
+        }
+
+        // Organized points first, so every pixel can look at its
+        // neighbours.
+        const DisparityReprojector &reprojector = *m_context.reprojector;
+        const uint16_t *disparityP = disparity();
+        std::vector<float> organized(3 * pixels, nan);
+        const uint32_t workers = m_context.workerPoolP ? m_context.workerPoolP->size() : 1;
+        std::vector<std::vector<float> > rowPoints(workers, std::vector<float>(3 * m_width));
+        std::vector<std::vector<uint32_t> > rowColumns(workers, std::vector<uint32_t>(m_width));
+
+        forEachTile(m_context.workerPoolP, m_height, [&](size_t tile, uint32_t worker) {
+            const uint32_t begin = static_cast<uint32_t>(tile) * ROWS_PER_TILE;
+            const uint32_t end = begin + ROWS_PER_TILE < m_height ? begin + ROWS_PER_TILE : m_height;
+            float *pointsP = rowPoints[worker].data();
+            uint32_t *columnsP = rowColumns[worker].data();
+            for (uint32_t r = begin < reprojector.firstRow() ? reprojector.firstRow() : begin;
+                 r < end && r < reprojector.endRow(); ++r) {
+                const size_t rowStart = static_cast<size_t>(r) * m_width;
+                const size_t count = reprojector.reprojectRow(disparityP + rowStart, r, pointsP, columnsP);
+                for (size_t i = 0; i < count; ++i) {
+                    std::memcpy(&organized[3 * (rowStart + columnsP[i])], &pointsP[3 * i], 3 * sizeof(float));
+                }
+            }
+        });
+
+        // Cross product of the central differences across and down the
+        // image.  A NaN neighbour fails every comparison below.
+        const uint32_t step = m_context.normalStep > 0 ? m_context.normalStep : 1;
+        const float maxJump = m_context.maxDepthJump;
+        forEachTile(m_context.workerPoolP, m_height, [&](size_t tile, uint32_t) {
+            const uint32_t begin = static_cast<uint32_t>(tile) * ROWS_PER_TILE;
+            const uint32_t end = begin + ROWS_PER_TILE < m_height ? begin + ROWS_PER_TILE : m_height;
+            for (uint32_t r = begin < step ? step : begin; r < end && r + step < m_height; ++r) {
+                for (uint32_t c = step; c + step < m_width; ++c) {
+                    const size_t i = static_cast<size_t>(r) * m_width + c;
+                    const float *pP = &organized[3 * i];
+                    const float *leftP = pP - 3 * step;
+                    const float *rightP = pP + 3 * step;
+                    const float *upP = pP - 3 * static_cast<size_t>(step) * m_width;
+                    const float *downP = pP + 3 * static_cast<size_t>(step) * m_width;
+
+                    const float jump = maxJump * std::fabs(pP[2]);
+                    if (!(std::fabs(leftP[2] - pP[2]) <= jump && std::fabs(rightP[2] - pP[2]) <= jump &&
+                          std::fabs(upP[2] - pP[2]) <= jump && std::fabs(downP[2] - pP[2]) <= jump)) {
+                        continue;
+                    }
+
+                    const float ax = rightP[0] - leftP[0], ay = rightP[1] - leftP[1], az = rightP[2] - leftP[2];
+                    const float bx = downP[0] - upP[0], by = downP[1] - upP[1], bz = downP[2] - upP[2];
+                    float nx = ay * bz - az * by;
+                    float ny = az * bx - ax * bz;
+                    float nz = ax * by - ay * bx;
+                    const float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+                    if (!(length > 0.0f)) {
+                        continue;
+                    }
+
+                    // Face the camera at the origin.
+                    float scale = 1.0f / length;
+                    if (nx * pP[0] + ny * pP[1] + nz * pP[2] > 0.0f) {
+                        scale = -scale;
+                    }
+                    m_normals[3 * i] = nx * scale;
+                    m_normals[3 * i + 1] = ny * scale;
+                    m_normals[3 * i + 2] = nz * scale;
+                }
+            }
+        });
+    });
+    return m_normals;
+}
+
+} // namespace pipeline
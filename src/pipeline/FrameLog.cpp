@@ -0,0 +1,349 @@
+#include "pipeline/FrameLog.h"
+
+#include <errno.h>
+
+#include <cstddef>
+#include <cstring>
+
+#include "MultiSense/details/utility/Exception.hh"
+#include "pipeline/ScopedLock.h"
+
+namespace pipeline {
+
+namespace {
+
+const uint32_t LOG_MAGIC = 0x4c46534d;  // "MSFL"
+const uint8_t LOG_VERSION = 1;
+const size_t FILE_HEADER_SIZE = 8;
+
+// Every record starts with its kind and the length of what follows.
+const size_t RECORD_HEADER_SIZE = 8;
+
+// Image fields ahead of the pixels.
+const size_t IMAGE_HEADER_SIZE = 32;
+
+const size_t CALIBRATION_SIZE = 2 * sizeof(uint32_t) + sizeof(float) * (16 + 2 * (9 + 8 + 9 + 12));
+
+// Larger images are taken for damage.
+const uint32_t MAX_IMAGE_BYTES = 256u * 1024 * 1024;
+
+void writeU32(uint8_t *p, uint32_t v) { std::memcpy(p, &v, sizeof(v)); }
+uint32_t readU32(const uint8_t *p) { uint32_t v; std::memcpy(&v, p, sizeof(v)); return v; }
+
+// The calibration fields in the order they are stored.
+struct CalibrationField {
+    size_t offset;
+    size_t count;
+};
+
+const CalibrationField CALIBRATION_FIELDS[] = {
+    {offsetof(FrameLogCalibration, q), 16},
+    {offsetof(FrameLogCalibration, leftM), 9},
+    {offsetof(FrameLogCalibration, leftD), 8},
+    {offsetof(FrameLogCalibration, leftR), 9},
+    {offsetof(FrameLogCalibration, leftP), 12},
+    {offsetof(FrameLogCalibration, rightM), 9},
+    {offsetof(FrameLogCalibration, rightD), 8},
+    {offsetof(FrameLogCalibration, rightR), 9},
+    {offsetof(FrameLogCalibration, rightP), 12},
+};
+
+BufferPool &poolFor(std::map<uint32_t, std::unique_ptr<BufferPool> > &pools, uint32_t source) {
+    std::unique_ptr<BufferPool> &poolP = pools[source];
+    if (!poolP) {
+        poolP.reset(new BufferPool(8));
+    }
+    return *poolP;
+}
+
+} // anonymous namespace
+
+FrameLogWriter::FrameLogWriter(size_t queueDepth)
+        : m_queueDepth(queueDepth > 0 ? queueDepth : 1),
+          m_running(false),
+          m_stopping(false),
+          m_fileP(0) {
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_cond, NULL);
+}
+
+FrameLogWriter::~FrameLogWriter() {
+    stop();
+    pthread_cond_destroy(&m_cond);
+    pthread_mutex_destroy(&m_mutex);
+}
+
+void FrameLogWriter::start(const std::string &path, const FrameLogCalibration &calibration) {
+    ScopedLock lock(&m_mutex);
+    if (m_running) {
+        CRL_EXCEPTION("FrameLogWriter::start() called while already running\n");
+    }
+
+    m_fileP = fopen(path.c_str(), "wb");
+    if (!m_fileP) {
+        CRL_EXCEPTION("Failed to create %s: %s\n", path.c_str(), strerror(errno));
+    }
+
+    uint8_t header[FILE_HEADER_SIZE] = {};
+    writeU32(header, LOG_MAGIC);
+    header[4] = LOG_VERSION;
+    if (1 != fwrite(header, sizeof(header), 1, m_fileP)) {
+        fclose(m_fileP);
+        m_fileP = 0;
+        CRL_EXCEPTION("Failed to write %s: %s\n", path.c_str(), strerror(errno));
+    }
+
+    m_stats = Stats();
+
+    FrameLogRecord record;
+    record.kind = FrameLogKind_Calibration;
+    record.calibration = calibration;
+    m_queue.push_back(record);
+
+    m_stopping = false;
+    m_running = true;
+    m_thread = std::thread(&FrameLogWriter::writeThread, this);
+}
+
+void FrameLogWriter::stop() {
+    {
+        ScopedLock lock(&m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_stopping = true;
+        pthread_cond_broadcast(&m_cond);
+    }
+
+    m_thread.join();
+
+    ScopedLock lock(&m_mutex);
+    fclose(m_fileP);
+    m_fileP = 0;
+    m_running = false;
+}
+
+bool FrameLogWriter::isRunning() const {
+    ScopedLock lock(&m_mutex);
+    return m_running && !m_stopping;
+}
+
+void FrameLogWriter::writeCalibration(const FrameLogCalibration &calibration) {
+    ScopedLock lock(&m_mutex);
+    if (!m_running || m_stopping) {
+        return;
+    }
+
+    FrameLogRecord record;
+    record.kind = FrameLogKind_Calibration;
+    record.calibration = calibration;
+    m_queue.push_back(record);
+    pthread_cond_broadcast(&m_cond);
+}
+
+bool FrameLogWriter::submit(const FrameLogImage &image, const void *dataP) {
+    BufferPool *poolP = 0;
+    {
+        ScopedLock lock(&m_mutex);
+        if (!m_running || m_stopping) {
+            return false;
+        }
+        size_t images = 0;
+        for (const FrameLogRecord &queued : m_queue) {
+            images += FrameLogKind_Image == queued.kind;
+        }
+        if (images >= m_queueDepth) {
+            m_stats.dropped++;
+            return false;
+        }
+        poolP = &poolFor(m_pools, image.source);
+    }
+
+    // Copy outside the lock; pools are thread safe and never go away
+    // while the writer exists.
+    FrameLogRecord record;
+    record.kind = FrameLogKind_Image;
+    record.image = image;
+    record.image.data = poolP->acquire(image.length);
+    if (!record.image.data) {
+        ScopedLock lock(&m_mutex);
+        m_stats.dropped++;
+        return false;
+    }
+    std::memcpy(record.image.data.get(), dataP, image.length);
+
+    ScopedLock lock(&m_mutex);
+    if (!m_running || m_stopping) {
+        return false;
+    }
+    m_queue.push_back(std::move(record));
+    pthread_cond_broadcast(&m_cond);
+    return true;
+}
+
+FrameLogWriter::Stats FrameLogWriter::stats() const {
+    ScopedLock lock(&m_mutex);
+    return m_stats;
+}
+
+void FrameLogWriter::writeThread() {
+    for (;;) {
+        FrameLogRecord record;
+        {
+            ScopedLock lock(&m_mutex);
+            while (m_queue.empty() && !m_stopping) {
+                pthread_cond_wait(&m_cond, &m_mutex);
+            }
+            if (m_queue.empty()) {
+                break;
+            }
+            record = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+
+        const bool ok = writeRecord(record);
+
+        ScopedLock lock(&m_mutex);
+        if (ok) {
+            m_stats.written++;
+            m_stats.bytes += RECORD_HEADER_SIZE + (FrameLogKind_Image == record.kind ?
+                                                   IMAGE_HEADER_SIZE + record.image.length : CALIBRATION_SIZE);
+        } else {
+            m_stats.dropped++;
+        }
+    }
+    fflush(m_fileP);
+}
+
+bool FrameLogWriter::writeRecord(const FrameLogRecord &record) {
+    uint8_t header[RECORD_HEADER_SIZE + IMAGE_HEADER_SIZE];
+    writeU32(header, record.kind);
+
+    if (FrameLogKind_Calibration == record.kind) {
+        uint8_t calibration[CALIBRATION_SIZE];
+        writeU32(calibration, record.calibration.width);
+        writeU32(calibration + 4, record.calibration.height);
+        size_t offset = 8;
+        for (const CalibrationField &field : CALIBRATION_FIELDS) {
+            const size_t bytes = field.count * sizeof(float);
+            std::memcpy(calibration + offset, reinterpret_cast<const uint8_t *>(&record.calibration) + field.offset,
+                        bytes);
+            offset += bytes;
+        }
+
+        writeU32(header + 4, static_cast<uint32_t>(CALIBRATION_SIZE));
+        return 1 == fwrite(header, RECORD_HEADER_SIZE, 1, m_fileP) &&
+               1 == fwrite(calibration, CALIBRATION_SIZE, 1, m_fileP);
+    }
+
+    const FrameLogImage &image = record.image;
+    writeU32(header + 4, static_cast<uint32_t>(IMAGE_HEADER_SIZE + image.length));
+    uint8_t *fieldsP = header + RECORD_HEADER_SIZE;
+    writeU32(fieldsP, image.source);
+    std::memcpy(fieldsP + 4, &image.frameId, sizeof(image.frameId));
+    writeU32(fieldsP + 12, image.timeSeconds);
+    writeU32(fieldsP + 16, image.timeMicroSeconds);
+    writeU32(fieldsP + 20, image.width);
+    writeU32(fieldsP + 24, image.height);
+    writeU32(fieldsP + 28, image.bitsPerPixel);
+    return 1 == fwrite(header, sizeof(header), 1, m_fileP) &&
+           (0 == image.length || 1 == fwrite(image.data.get(), image.length, 1, m_fileP));
+}
+
+FrameLogReader::FrameLogReader()
+        : m_fileP(0) {
+}
+
+FrameLogReader::~FrameLogReader() {
+    close();
+}
+
+void FrameLogReader::open(const std::string &path) {
+    close();
+
+    m_fileP = fopen(path.c_str(), "rb");
+    if (!m_fileP) {
+        CRL_EXCEPTION("Failed to open %s: %s\n", path.c_str(), strerror(errno));
+    }
+
+    uint8_t header[FILE_HEADER_SIZE];
+    if (1 != fread(header, sizeof(header), 1, m_fileP) ||
+        LOG_MAGIC != readU32(header) || LOG_VERSION != header[4]) {
+        close();
+        CRL_EXCEPTION("%s is not a frame log\n", path.c_str());
+    }
+}
+
+void FrameLogReader::close() {
+    if (m_fileP) {
+        fclose(m_fileP);
+        m_fileP = 0;
+    }
+}
+
+bool FrameLogReader::next(FrameLogRecord &record) {
+    if (!m_fileP) {
+        return false;
+    }
+
+    uint8_t header[RECORD_HEADER_SIZE];
+    if (1 != fread(header, sizeof(header), 1, m_fileP)) {
+        return false;
+    }
+    const uint32_t kind = readU32(header);
+    const uint32_t length = readU32(header + 4);
+
+    if (FrameLogKind_Calibration == kind) {
+        uint8_t calibration[CALIBRATION_SIZE];
+        if (CALIBRATION_SIZE != length) {
+            CRL_EXCEPTION("Corrupt frame log (calibration of %u bytes)\n", length);
+        }
+        if (1 != fread(calibration, sizeof(calibration), 1, m_fileP)) {
+            return false;
+        }
+
+        record.kind = FrameLogKind_Calibration;
+        record.image = FrameLogImage();
+        record.calibration.width = readU32(calibration);
+        record.calibration.height = readU32(calibration + 4);
+        size_t offset = 8;
+        for (const CalibrationField &field : CALIBRATION_FIELDS) {
+            const size_t bytes = field.count * sizeof(float);
+            std::memcpy(reinterpret_cast<uint8_t *>(&record.calibration) + field.offset, calibration + offset,
+                        bytes);
+            offset += bytes;
+        }
+        return true;
+    }
+
+    if (FrameLogKind_Image != kind || length < IMAGE_HEADER_SIZE || length - IMAGE_HEADER_SIZE > MAX_IMAGE_BYTES) {
+        CRL_EXCEPTION("Corrupt frame log (record kind %u, %u bytes)\n", kind, length);
+    }
+
+    uint8_t fields[IMAGE_HEADER_SIZE];
+    if (1 != fread(fields, sizeof(fields), 1, m_fileP)) {
+        return false;
+    }
+
+    FrameLogImage &image = record.image;
+    record.kind = FrameLogKind_Image;
+    image.source = readU32(fields);
+    std::memcpy(&image.frameId, fields + 4, sizeof(image.frameId));
+    image.timeSeconds = readU32(fields + 12);
+    image.timeMicroSeconds = readU32(fields + 16);
+    image.width = readU32(fields + 20);
+    image.height = readU32(fields + 24);
+    image.bitsPerPixel = readU32(fields + 28);
+    image.length = length - static_cast<uint32_t>(IMAGE_HEADER_SIZE);
+    image.data.reset();
+    if (0 == image.length) {
+        return true;
+    }
+    image.data = poolFor(m_pools, image.source).acquire(image.length);
+    if (!image.data) {
+        CRL_EXCEPTION("Out of memory reading a frame log image of %u bytes\n", image.length);
+    }
+    return 1 == fread(image.data.get(), image.length, 1, m_fileP);
+}
+
+} // namespace pipeline
@@ -0,0 +1,329 @@
+#include "pipeline/GroundPlane.h"
+
+#include <cmath>
+
+namespace pipeline {
+
+namespace {
+
+// Eigenvector of the smallest eigenvalue of a symmetric 3x3 matrix, by
+// cyclic Jacobi rotations.  a is destroyed.
+void smallestEigenvector(double a[3][3], double vector[3]) {
+    double v[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+
+    for (int sweep = 0; sweep < 16; ++sweep) {
+        const double offDiagonal = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+        if (offDiagonal < 1e-24) {
+            break;
+        }
+
+        for (int p = 0; p < 2; ++p) {
+            for (int q = p + 1; q < 3; ++q) {
+                if (0.0 == a[p][q]) {
+                    continue;
+                }
+                const double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                const double t = (theta >= 0 ? 1.0 : -1.0) / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+                const double c = 1.0 / std::sqrt(t * t + 1.0);
+                const double s = t * c;
+
+                for (int k = 0; k < 3; ++k) {
+                    const double akp = a[k][p];
+                    const double akq = a[k][q];
+                    a[k][p] = c * akp - s * akq;
+                    a[k][q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < 3; ++k) {
+                    const double apk = a[p][k];
+                    const double aqk = a[q][k];
+                    a[p][k] = c * apk - s * aqk;
+                    a[q][k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < 3; ++k) {
+                    const double vkp = v[k][p];
+                    const double vkq = v[k][q];
+                    v[k][p] = c * vkp - s * vkq;
+                    v[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    int smallest = 0;
+    for (int i = 1; i < 3; ++i) {
+        if (a[i][i] < a[smallest][smallest]) {
+            smallest = i;
+        }
+    }
+    for (int k = 0; k < 3; ++k) {
+        vector[k] = v[k][smallest];
+    }
+}
+
+// Mark the points within threshold of the plane.  The stride is a
+// template parameter for the common packed and PCL layouts, so the loop
+// vectorizes.
+template <size_t Stride>
+void markStridedInliers(const Plane &plane, float threshold, const float *xyzP, size_t count, size_t stride,
+                        uint8_t *maskP) {
+    const size_t step = Stride ? Stride : stride;
+    for (size_t i = 0; i < count; ++i) {
+        const float *p = xyzP + i * step;
+        const float distance = plane.normal[0] * p[0] + plane.normal[1] * p[1] + plane.normal[2] * p[2] + plane.d;
+        maskP[i] = std::fabs(distance) < threshold;
+    }
+}
+
+// Point layouts estimatePoints() reads: x, y, z interleaved with a
+// stride, or in separate arrays.
+struct StridedPoints {
+    const float *xyzP;
+    size_t stride;
+
+    void get(size_t i, float *p) const {
+        const float *pointP = xyzP + i * stride;
+        p[0] = pointP[0];
+        p[1] = pointP[1];
+        p[2] = pointP[2];
+    }
+
+    void markInliers(const Plane &plane, float threshold, size_t count, uint8_t *maskP) const {
+        if (4 == stride) {
+            markStridedInliers<4>(plane, threshold, xyzP, count, stride, maskP);
+        } else if (3 == stride) {
+            markStridedInliers<3>(plane, threshold, xyzP, count, stride, maskP);
+        } else {
+            markStridedInliers<0>(plane, threshold, xyzP, count, stride, maskP);
+        }
+    }
+};
+
+struct PlanarPoints {
+    const float *xP;
+    const float *yP;
+    const float *zP;
+
+    void get(size_t i, float *p) const {
+        p[0] = xP[i];
+        p[1] = yP[i];
+        p[2] = zP[i];
+    }
+
+    void markInliers(const Plane &plane, float threshold, size_t count, uint8_t *maskP) const {
+        for (size_t i = 0; i < count; ++i) {
+            const float distance = plane.normal[0] * xP[i] + plane.normal[1] * yP[i] + plane.normal[2] * zP[i] +
+                                   plane.d;
+            maskP[i] = std::fabs(distance) < threshold;
+        }
+    }
+};
+
+} // anonymous namespace
+
+GroundPlaneEstimator::GroundPlaneEstimator()
+        : GroundPlaneEstimator(Config()) {
+}
+
+GroundPlaneEstimator::GroundPlaneEstimator(const Config &config)
+        : m_config(config),
+          m_randomState(0x9e3779b9u) {
+    const float upLength = std::sqrt(m_config.up[0] * m_config.up[0] +
+                                     m_config.up[1] * m_config.up[1] +
+                                     m_config.up[2] * m_config.up[2]);
+    for (int i = 0; i < 3; ++i) {
+        m_config.up[i] = upLength > 0.0f ? m_config.up[i] / upLength : (1 == i ? 1.0f : 0.0f);
+    }
+    m_minUpDot = std::cos(m_config.maxTiltDegrees * static_cast<float>(M_PI) / 180.0f);
+    reset();
+}
+
+void GroundPlaneEstimator::reset() {
+    m_hasPlane = false;
+    m_inlierFraction = 0.0f;
+    m_warmStarted = false;
+}
+
+uint32_t GroundPlaneEstimator::random() {
+    // xorshift32; quality is plenty for picking sample points.
+    m_randomState ^= m_randomState << 13;
+    m_randomState ^= m_randomState >> 17;
+    m_randomState ^= m_randomState << 5;
+    return m_randomState;
+}
+
+bool GroundPlaneEstimator::planeFromPoints(const float *a, const float *b, const float *c, Plane &plane) const {
+    const float u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    const float v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    float n[3] = {u[1] * v[2] - u[2] * v[1],
+                  u[2] * v[0] - u[0] * v[2],
+                  u[0] * v[1] - u[1] * v[0]};
+    const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length < 1e-9f) {
+        return false;
+    }
+
+    // Orient the normal up, and reject planes that are too steep to be
+    // ground.
+    float upDot = (n[0] * m_config.up[0] + n[1] * m_config.up[1] + n[2] * m_config.up[2]) / length;
+    const float sign = upDot < 0.0f ? -1.0f : 1.0f;
+    if (sign * upDot < m_minUpDot) {
+        return false;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        plane.normal[i] = sign * n[i] / length;
+    }
+    plane.d = -(plane.normal[0] * a[0] + plane.normal[1] * a[1] + plane.normal[2] * a[2]);
+    return true;
+}
+
+uint32_t GroundPlaneEstimator::countInliers(const Plane &plane) const {
+    const float threshold = m_config.inlierDistance;
+    const size_t count = m_samples.size() / 3;
+    uint32_t inliers = 0;
+    for (size_t i = 0; i < count; ++i) {
+        inliers += std::fabs(plane.distance(&m_samples[3 * i])) < threshold;
+    }
+    return inliers;
+}
+
+bool GroundPlaneEstimator::refine(Plane &plane) const {
+    const float threshold = m_config.inlierDistance;
+    const size_t count = m_samples.size() / 3;
+
+    for (uint32_t iteration = 0; iteration < m_config.refineIterations; ++iteration) {
+        double sum[3] = {0, 0, 0};
+        double products[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+        size_t inliers = 0;
+
+        for (size_t i = 0; i < count; ++i) {
+            const float *p = &m_samples[3 * i];
+            if (std::fabs(plane.distance(p)) >= threshold) {
+                continue;
+            }
+            for (int r = 0; r < 3; ++r) {
+                sum[r] += p[r];
+                for (int c = r; c < 3; ++c) {
+                    products[r][c] += static_cast<double>(p[r]) * p[c];
+                }
+            }
+            inliers++;
+        }
+        if (inliers < 3) {
+            return false;
+        }
+
+        // Covariance of the inliers; the normal of the best fitting plane
+        // is the direction of least variance.
+        double centroid[3];
+        for (int r = 0; r < 3; ++r) {
+            centroid[r] = sum[r] / inliers;
+        }
+        double covariance[3][3];
+        for (int r = 0; r < 3; ++r) {
+            for (int c = r; c < 3; ++c) {
+                covariance[r][c] = products[r][c] / inliers - centroid[r] * centroid[c];
+                covariance[c][r] = covariance[r][c];
+            }
+        }
+
+        double normal[3];
+        smallestEigenvector(covariance, normal);
+        const double upDot = normal[0] * m_config.up[0] + normal[1] * m_config.up[1] + normal[2] * m_config.up[2];
+        const double sign = upDot < 0.0 ? -1.0 : 1.0;
+        if (sign * upDot < m_minUpDot) {
+            return false;
+        }
+
+        for (int r = 0; r < 3; ++r) {
+            plane.normal[r] = static_cast<float>(sign * normal[r]);
+        }
+        plane.d = static_cast<float>(-(plane.normal[0] * centroid[0] +
+                                       plane.normal[1] * centroid[1] +
+                                       plane.normal[2] * centroid[2]));
+    }
+    return true;
+}
+
+bool GroundPlaneEstimator::estimate(const float *xyzP, size_t count, size_t strideFloats,
+                                    std::vector<uint8_t> *inlierMaskP) {
+    const StridedPoints points = {xyzP, strideFloats};
+    return estimatePoints(points, count, inlierMaskP);
+}
+
+bool GroundPlaneEstimator::estimate(const float *xP, const float *yP, const float *zP, size_t count,
+                                    std::vector<uint8_t> *inlierMaskP) {
+    const PlanarPoints points = {xP, yP, zP};
+    return estimatePoints(points, count, inlierMaskP);
+}
+
+template <class Points>
+bool GroundPlaneEstimator::estimatePoints(const Points &points, size_t count, std::vector<uint8_t> *inlierMaskP) {
+    m_warmStarted = false;
+
+    if (count < 3) {
+        if (inlierMaskP) {
+            inlierMaskP->assign(count, 0);
+        }
+        reset();
+        return false;
+    }
+
+    // Spread the samples evenly over the cloud, which is in image row
+    // order, starting at a random offset.
+    const size_t sampleCount = count < m_config.sampleCount ? count : m_config.sampleCount;
+    const double step = static_cast<double>(count) / sampleCount;
+    double position = (random() % 1024) / 1024.0 * step;
+    m_samples.resize(3 * sampleCount);
+    for (size_t i = 0; i < sampleCount; ++i, position += step) {
+        points.get(static_cast<size_t>(position), &m_samples[3 * i]);
+    }
+
+    Plane best = m_plane;
+    uint32_t bestInliers = 0;
+    uint32_t iterations = m_config.coldIterations;
+
+    if (m_hasPlane) {
+        bestInliers = countInliers(m_plane);
+        if (bestInliers >= m_config.warmKeep * m_inlierFraction * sampleCount) {
+            iterations = m_config.warmIterations;
+            m_warmStarted = true;
+        }
+    }
+
+    for (uint32_t iteration = 0; iteration < iterations; ++iteration) {
+        Plane candidate;
+        if (!planeFromPoints(&m_samples[3 * (random() % sampleCount)],
+                             &m_samples[3 * (random() % sampleCount)],
+                             &m_samples[3 * (random() % sampleCount)],
+                             candidate)) {
+            continue;
+        }
+        const uint32_t inliers = countInliers(candidate);
+        if (inliers > bestInliers) {
+            best = candidate;
+            bestInliers = inliers;
+        }
+    }
+
+    if (bestInliers < 3 || !refine(best) ||
+        countInliers(best) < m_config.minInlierFraction * sampleCount) {
+        if (inlierMaskP) {
+            inlierMaskP->assign(count, 0);
+        }
+        reset();
+        return false;
+    }
+
+    m_inlierFraction = static_cast<float>(countInliers(best)) / sampleCount;
+    m_plane = best;
+    m_hasPlane = true;
+
+    if (inlierMaskP) {
+        inlierMaskP->resize(count);
+        points.markInliers(m_plane, m_config.inlierDistance, count, inlierMaskP->data());
+    }
+    return true;
+}
+
+} // namespace pipeline
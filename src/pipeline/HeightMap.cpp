@@ -0,0 +1,170 @@
+#include "pipeline/HeightMap.h"
+
+#include <limits>
+
+#include "pipeline/Reprojection.h"
+#include "pipeline/WorkerPool.h"
+
+namespace pipeline {
+
+namespace {
+
+// Cells per merge task.
+const size_t MERGE_CELLS = 4096;
+
+} // anonymous namespace
+
+HeightMapBuilder::HeightMapBuilder()
+        : HeightMapBuilder(Config()) {
+}
+
+HeightMapBuilder::HeightMapBuilder(const Config &config)
+        : m_config(config),
+          m_frame(0) {
+    if (0 == m_config.rowsPerTile) {
+        m_config.rowsPerTile = 1;
+    }
+}
+
+void HeightMapBuilder::binRows(const DisparityReprojector &reprojector,
+                               const uint16_t *disparityP,
+                               uint32_t beginRow,
+                               uint32_t endRow,
+                               Grid &grid) const {
+    const size_t cells = static_cast<size_t>(m_config.columns) * m_config.rows;
+    if (grid.frame != m_frame) {
+        grid.maxHeight.assign(cells, -std::numeric_limits<float>::infinity());
+        grid.minHeight.assign(cells, std::numeric_limits<float>::infinity());
+        grid.hits.assign(cells, 0);
+        grid.frame = m_frame;
+    }
+
+    const RegionOfInterest &region = reprojector.region();
+    const bool crop = region.hasCropBox();
+    const float inverseCell = 1.0f / m_config.cellSize;
+    const float columns = static_cast<float>(m_config.columns);
+    const float rows = static_cast<float>(m_config.rows);
+    const float scale = reprojector.disparityScale();
+    const float offset = reprojector.wOffset();
+    const float depthTerm = reprojector.depthTerm();
+    const uint32_t width = reprojector.width();
+
+    for (uint32_t r = beginRow; r < endRow; ++r) {
+        const uint16_t *rowP = disparityP + static_cast<size_t>(r) * width;
+        const float rowTerm = reprojector.rowTerm(r);
+
+        size_t spanCount;
+        const RoiSpan *spansP = reprojector.spans(r, spanCount);
+        for (size_t k = 0; k < spanCount; ++k) {
+            for (uint32_t c = spansP[k].begin; c < spansP[k].end; ++c) {
+                const uint16_t d = rowP[c];
+                if (0 == d) {
+                    continue;
+                }
+
+                const float inverseW = 1.0f / (d * scale + offset);
+                const float x = reprojector.columnTerm(c) * inverseW;
+                const float y = -rowTerm * inverseW;
+                const float forward = depthTerm * inverseW;
+                if (crop && !region.inCropBox(x, y, -forward)) {
+                    continue;
+                }
+
+                const float height = y + m_config.heightOffset;
+                const float column = (x - m_config.originX) * inverseCell;
+                const float row = (forward - m_config.originForward) * inverseCell;
+                if (!(column >= 0.0f && column < columns && row >= 0.0f && row < rows &&
+                      height >= m_config.minHeight && height <= m_config.maxHeight)) {
+                    continue;
+                }
+
+                const size_t cell = static_cast<size_t>(row) * m_config.columns + static_cast<size_t>(column);
+                if (height > grid.maxHeight[cell]) {
+                    grid.maxHeight[cell] = height;
+                }
+                if (height < grid.minHeight[cell]) {
+                    grid.minHeight[cell] = height;
+                }
+                grid.hits[cell]++;
+            }
+        }
+    }
+}
+
+void HeightMapBuilder::merge(const std::vector<const Grid *> &grids, HeightMap &map, size_t begin, size_t end) const {
+    for (size_t cell = begin; cell < end; ++cell) {
+        float maxHeight = -std::numeric_limits<float>::infinity();
+        float minHeight = std::numeric_limits<float>::infinity();
+        uint32_t hits = 0;
+        for (const Grid *gridP : grids) {
+            maxHeight = gridP->maxHeight[cell] > maxHeight ? gridP->maxHeight[cell] : maxHeight;
+            minHeight = gridP->minHeight[cell] < minHeight ? gridP->minHeight[cell] : minHeight;
+            hits += gridP->hits[cell];
+        }
+        map.maxHeight[cell] = hits ? maxHeight : 0.0f;
+        map.minHeight[cell] = hits ? minHeight : 0.0f;
+        map.hits[cell] = hits;
+    }
+}
+
+void HeightMapBuilder::build(const DisparityReprojector &reprojector,
+                             const uint16_t *disparityP,
+                             HeightMap &map,
+                             WorkerPool *poolP) {
+    const size_t cells = static_cast<size_t>(m_config.columns) * m_config.rows;
+    map.columns = m_config.columns;
+    map.rows = m_config.rows;
+    map.cellSize = m_config.cellSize;
+    map.originX = m_config.originX;
+    map.originForward = m_config.originForward;
+    map.maxHeight.resize(cells);
+    map.minHeight.resize(cells);
+    map.hits.resize(cells);
+
+    const uint32_t workers = poolP ? poolP->size() : 1;
+    if (m_grids.size() < workers) {
+        m_grids.resize(workers);
+    }
+    m_frame++;
+
+    const uint32_t firstRow = reprojector.isValid() ? reprojector.firstRow() : 0;
+    const uint32_t endRow = reprojector.isValid() ? reprojector.endRow() : 0;
+    const uint32_t tileRows = m_config.rowsPerTile;
+    const size_t tiles = endRow > firstRow ? (endRow - firstRow + tileRows - 1) / tileRows : 0;
+
+    WorkerPool::Task binTile = [&](size_t tile, uint32_t worker) {
+        const uint32_t begin = firstRow + static_cast<uint32_t>(tile) * tileRows;
+        const uint32_t end = begin + tileRows < endRow ? begin + tileRows : endRow;
+        binRows(reprojector, disparityP, begin, end, m_grids[worker]);
+    };
+    if (poolP) {
+        poolP->run(tiles, binTile);
+    } else {
+        for (size_t tile = 0; tile < tiles; ++tile) {
+            binTile(tile, 0);
+        }
+    }
+
+    // Only the grids of workers that got a tile hold this frame.
+    std::vector<const Grid *> grids;
+    for (uint32_t worker = 0; worker < workers; ++worker) {
+        if (m_grids[worker].frame == m_frame) {
+            grids.push_back(&m_grids[worker]);
+        }
+    }
+
+    const size_t mergeTasks = (cells + MERGE_CELLS - 1) / MERGE_CELLS;
+    WorkerPool::Task mergeCells = [&](size_t task, uint32_t) {
+        const size_t begin = task * MERGE_CELLS;
+        merge(grids, map, begin, begin + MERGE_CELLS < cells ? begin + MERGE_CELLS : cells);
+    };
+    if (poolP) {
+        poolP->run(mergeTasks, mergeCells);
+    } else {
+        for (size_t task = 0; task < mergeTasks; ++task) {
+            mergeCells(task, 0);
+        }
+    }
+}
+
+} // namespace pipeline
@@ -0,0 +1,72 @@
+#include "pipeline/LevelOfDetail.h"
+
+namespace pipeline {
+
+namespace {
+
+// Every level roughly halves or thirds the number of drawn points
+// compared to the previous one.
+const uint32_t LEVEL_STRIDES[] = {1, 2, 3, 4, 6, 8, 12, 16};
+const uint32_t LEVEL_COUNT = sizeof(LEVEL_STRIDES) / sizeof(LEVEL_STRIDES[0]);
+
+} // anonymous namespace
+
+LevelOfDetailController::LevelOfDetailController()
+        : LevelOfDetailController(Config()) {
+}
+
+LevelOfDetailController::LevelOfDetailController(const Config &config)
+        : m_config(config) {
+    reset();
+}
+
+void LevelOfDetailController::reset() {
+    m_level = 0;
+    m_averageMs = 0.0;
+    m_haveAverage = false;
+    m_coarserVotes = 0;
+    m_finerVotes = 0;
+}
+
+uint32_t LevelOfDetailController::strideForLevel(uint32_t level) {
+    return LEVEL_STRIDES[level < LEVEL_COUNT ? level : LEVEL_COUNT - 1];
+}
+
+uint32_t LevelOfDetailController::stride() const {
+    return strideForLevel(m_level);
+}
+
+void LevelOfDetailController::reportFrameTime(double milliseconds) {
+    if (!m_haveAverage) {
+        m_averageMs = milliseconds;
+        m_haveAverage = true;
+    } else {
+        m_averageMs += m_config.smoothing * (milliseconds - m_averageMs);
+    }
+
+    // Render time is dominated by the number of points, so the time at
+    // the next finer level is predicted by scaling with the stride ratio.
+    const bool tooSlow = m_averageMs > m_config.targetFrameMs;
+    bool finerFits = false;
+    if (m_level > 0) {
+        double predicted = m_averageMs * strideForLevel(m_level) / strideForLevel(m_level - 1);
+        finerFits = predicted < m_config.targetFrameMs * m_config.refineMargin;
+    }
+
+    m_coarserVotes = (tooSlow && m_level + 1 < LEVEL_COUNT) ? m_coarserVotes + 1 : 0;
+    m_finerVotes = finerFits ? m_finerVotes + 1 : 0;
+
+    if (m_coarserVotes >= m_config.holdFrames || m_finerVotes >= m_config.holdFrames) {
+        double scale = static_cast<double>(strideForLevel(m_level));
+        m_level = m_coarserVotes ? m_level + 1 : m_level - 1;
+        scale /= strideForLevel(m_level);
+
+        // Carry the average over to the new level so the next decision
+        // does not start from scratch.
+        m_averageMs *= scale;
+        m_coarserVotes = 0;
+        m_finerVotes = 0;
+    }
+}
+
+} // namespace pipeline
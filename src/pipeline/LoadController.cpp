@@ -0,0 +1,86 @@
+#include "pipeline/LoadController.h"
+
+#include <algorithm>
+
+namespace pipeline {
+
+LoadController::LoadController()
+        : LoadController(Config()) {
+}
+
+LoadController::LoadController(const Config &config)
+        : m_config(config),
+          m_points(1, OperatingPoint{0, 0, 0.0f}),
+          m_index(0) {
+    reset();
+}
+
+double LoadController::cost(const OperatingPoint &point) {
+    return static_cast<double>(point.width) * point.height * point.fps;
+}
+
+void LoadController::setOperatingPoints(const std::vector<OperatingPoint> &points, uint32_t startIndex) {
+    if (points.empty()) {
+        return;
+    }
+
+    const OperatingPoint start = points[std::min<size_t>(startIndex, points.size() - 1)];
+    m_points = points;
+    std::stable_sort(m_points.begin(), m_points.end(),
+                     [](const OperatingPoint &a, const OperatingPoint &b) { return cost(a) > cost(b); });
+
+    m_index = 0;
+    for (size_t i = 0; i < m_points.size(); ++i) {
+        if (m_points[i].width == start.width && m_points[i].height == start.height && m_points[i].fps == start.fps) {
+            m_index = static_cast<uint32_t>(i);
+            break;
+        }
+    }
+    reset();
+}
+
+void LoadController::reset() {
+    m_load = 0.0;
+    m_haveLoad = false;
+    m_downVotes = 0;
+    m_upVotes = 0;
+    m_settle = m_config.settleFrames;
+}
+
+bool LoadController::reportFrame(double processingMs, uint32_t backlog) {
+    if (m_points.size() < 2 || m_points[m_index].fps <= 0.0f) {
+        return false;
+    }
+    if (m_settle > 0) {
+        m_settle--;
+        return false;
+    }
+
+    const double load = processingMs * m_points[m_index].fps / 1000.0;
+    if (!m_haveLoad) {
+        m_load = load;
+        m_haveLoad = true;
+    } else {
+        m_load += m_config.smoothing * (load - m_load);
+    }
+
+    const bool overloaded = m_load > m_config.highLoad || backlog >= m_config.maxBacklog;
+    bool upFits = false;
+    if (m_index > 0 && !overloaded) {
+        const double predicted = m_load * cost(m_points[m_index - 1]) / cost(m_points[m_index]);
+        upFits = predicted < m_config.lowLoad && 0 == backlog;
+    }
+
+    m_downVotes = (overloaded && m_index + 1 < m_points.size()) ? m_downVotes + 1 : 0;
+    m_upVotes = upFits ? m_upVotes + 1 : 0;
+
+    if (m_downVotes < m_config.downFrames && m_upVotes < m_config.upFrames) {
+        return false;
+    }
+
+    m_index = m_downVotes ? m_index + 1 : m_index - 1;
+    reset();
+    return true;
+}
+
+} // namespace pipeline
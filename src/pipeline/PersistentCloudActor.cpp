@@ -0,0 +1,128 @@
+#include "pipeline/PersistentCloudActor.h"
+
+#include <algorithm>
+
+#include <vtkPointData.h>
+#include <vtkProperty.h>
+#include <vtkVersion.h>
+
+namespace pipeline {
+
+PersistentCloudActor::PersistentCloudActor(size_t initialCapacity)
+        : m_capacity(0),
+          m_size(0),
+          m_hasColors(false),
+          m_offsetBuffer(2, 0),
+          m_coordinates(vtkSmartPointer<vtkFloatArray>::New()),
+          m_colors(vtkSmartPointer<vtkUnsignedCharArray>::New()),
+          m_connectivity(vtkSmartPointer<vtkIdTypeArray>::New()),
+          m_offsets(vtkSmartPointer<vtkIdTypeArray>::New()),
+          m_points(vtkSmartPointer<vtkPoints>::New()),
+          m_vertices(vtkSmartPointer<vtkCellArray>::New()),
+          m_polyData(vtkSmartPointer<vtkPolyData>::New()),
+          m_mapper(vtkSmartPointer<vtkPolyDataMapper>::New()),
+          m_actor(vtkSmartPointer<vtkActor>::New()) {
+    m_coordinates->SetNumberOfComponents(3);
+    m_colors->SetNumberOfComponents(3);
+    reserve(std::max<size_t>(initialCapacity, 1));
+
+    m_polyData->SetPoints(m_points);
+    m_polyData->SetVerts(m_vertices);
+
+    m_mapper->SetInputData(m_polyData);
+    m_mapper->ScalarVisibilityOff();
+
+    m_actor->SetMapper(m_mapper);
+    m_actor->GetProperty()->SetPointSize(1);
+    m_actor->GetProperty()->SetColor(1.0, 1.0, 1.0);
+}
+
+void PersistentCloudActor::reserve(size_t capacity) {
+    m_coordinateBuffer.resize(capacity * 3);
+    m_colorBuffer.resize(capacity * 3);
+
+    // All points are drawn by one poly-vertex cell.  Its connectivity is
+    // the identity, so it is filled in once per growth and only its
+    // length changes between frames.  VTK 9 keeps offsets separately;
+    // older versions expect the point count in front of the ids.
+#if VTK_MAJOR_VERSION >= 9
+    m_connectivityBuffer.resize(capacity);
+    for (size_t i = 0; i < capacity; ++i) {
+        m_connectivityBuffer[i] = static_cast<vtkIdType>(i);
+    }
+#else
+    m_connectivityBuffer.resize(capacity + 1);
+    for (size_t i = 0; i < capacity; ++i) {
+        m_connectivityBuffer[i + 1] = static_cast<vtkIdType>(i);
+    }
+#endif
+
+    m_capacity = capacity;
+    bindBuffers();
+}
+
+void PersistentCloudActor::bindBuffers() {
+    // save = 1: the buffers belong to this object, VTK must not free them.
+    m_coordinates->SetArray(m_coordinateBuffer.data(), m_size * 3, 1);
+    m_points->SetData(m_coordinates);
+
+#if VTK_MAJOR_VERSION >= 9
+    m_offsetBuffer[1] = static_cast<vtkIdType>(m_size);
+    m_offsets->SetArray(m_offsetBuffer.data(), m_size ? 2 : 1, 1);
+    m_connectivity->SetArray(m_connectivityBuffer.data(), m_size, 1);
+    m_vertices->SetData(m_offsets, m_connectivity);
+#else
+    m_connectivityBuffer[0] = static_cast<vtkIdType>(m_size);
+    m_connectivity->SetArray(m_connectivityBuffer.data(), m_size + 1, 1);
+    m_vertices->SetCells(m_size ? 1 : 0, m_connectivity);
+#endif
+
+    if (m_hasColors) {
+        m_colors->SetArray(m_colorBuffer.data(), m_size * 3, 1);
+        m_polyData->GetPointData()->SetScalars(m_colors);
+        m_mapper->ScalarVisibilityOn();
+        m_colors->Modified();
+    } else {
+        m_polyData->GetPointData()->SetScalars(0);
+        m_mapper->ScalarVisibilityOff();
+    }
+
+    m_coordinates->Modified();
+    m_points->Modified();
+    m_vertices->Modified();
+    m_polyData->Modified();
+}
+
+void PersistentCloudActor::update(const float *xyzP, size_t count, size_t strideFloats, size_t step,
+                                  const uint32_t *bgraP) {
+    step = std::max<size_t>(step, 1);
+    const size_t kept = (count + step - 1) / step;
+    if (kept > m_capacity) {
+        reserve(std::max(kept, m_capacity + m_capacity / 2));
+    }
+
+    const size_t advance = strideFloats * step;
+    float *outP = m_coordinateBuffer.data();
+    for (size_t i = 0; i < kept; ++i, xyzP += advance) {
+        *outP++ = xyzP[0];
+        *outP++ = xyzP[1];
+        *outP++ = xyzP[2];
+    }
+
+    // VTK wants R, G, B bytes.
+    m_hasColors = (0 != bgraP);
+    if (m_hasColors) {
+        uint8_t *colorP = m_colorBuffer.data();
+        for (size_t i = 0; i < kept; ++i, bgraP += advance) {
+            const uint32_t bgra = *bgraP;
+            *colorP++ = static_cast<uint8_t>(bgra >> 16);
+            *colorP++ = static_cast<uint8_t>(bgra >> 8);
+            *colorP++ = static_cast<uint8_t>(bgra);
+        }
+    }
+
+    m_size = kept;
+    bindBuffers();
+}
+
+} // namespace pipeline
@@ -0,0 +1,363 @@
+#include "pipeline/PointFrame.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <pthread.h>
+
+// The build targets plain x86-64, so the F16C conversions are compiled
+// through a target attribute and only taken when the CPU has F16C.
+#if defined(__SSE2__) && defined(__GNUC__)
+#define POINT_FRAME_F16C 1
+#include <immintrin.h>
+#endif
+
+#include "pipeline/ScopedLock.h"
+
+namespace pipeline {
+
+namespace {
+
+uint16_t toHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000u);
+    const uint32_t magnitude = bits & 0x7fffffffu;
+
+    // Infinity and NaN (kept quiet).
+    if (magnitude >= 0x7f800000u) {
+        return sign | 0x7c00u | (magnitude > 0x7f800000u ? 0x0200u : 0u);
+    }
+    // Anything that rounds to 65520 or more overflows.
+    if (magnitude >= 0x477ff000u) {
+        return sign | 0x7c00u;
+    }
+    // Below the smallest normal half the value is a multiple of 2^-24;
+    // the float multiply is exact and lrint() rounds to nearest even.
+    if (magnitude < 0x38800000u) {
+        float absolute;
+        std::memcpy(&absolute, &magnitude, sizeof(absolute));
+        return sign | static_cast<uint16_t>(std::lrint(absolute * 16777216.0f));
+    }
+    // Rebias the exponent and round the 13 dropped mantissa bits to
+    // nearest even.  A carry out of the mantissa bumps the exponent,
+    // which is the correct result.
+    const uint32_t rounded = magnitude + 0x0fffu + ((magnitude >> 13) & 1u);
+    return sign | static_cast<uint16_t>((rounded - 0x38000000u) >> 13);
+}
+
+float fromHalf(uint16_t half) {
+    const uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+    const uint32_t exponent = (half >> 10) & 0x1fu;
+    const uint32_t mantissa = half & 0x03ffu;
+
+    uint32_t bits;
+    if (0 == exponent) {
+        const float absolute = mantissa * (1.0f / 16777216.0f);
+        std::memcpy(&bits, &absolute, sizeof(bits));
+        bits |= sign;
+    } else if (0x1fu == exponent) {
+        bits = sign | 0x7f800000u | (mantissa << 13);
+    } else {
+        bits = sign | ((exponent + 112u) << 23) | (mantissa << 13);
+    }
+
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+#ifdef POINT_FRAME_F16C
+bool haveF16c() {
+    static const bool have = __builtin_cpu_supports("f16c");
+    return have;
+}
+
+// Both return the number of values converted, a multiple of four.
+__attribute__((target("f16c")))
+size_t floatToHalfF16c(const float *inP, uint16_t *outP, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i halves = _mm_cvtps_ph(_mm_loadu_ps(inP + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(outP + i), halves);
+    }
+    return i;
+}
+
+__attribute__((target("f16c")))
+size_t halfToFloatF16c(const uint16_t *inP, float *outP, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i halves = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(inP + i));
+        _mm_storeu_ps(outP + i, _mm_cvtph_ps(halves));
+    }
+    return i;
+}
+#endif
+
+} // anonymous namespace
+
+void floatToHalf(const float *inP, uint16_t *outP, size_t count) {
+    size_t i = 0;
+#ifdef POINT_FRAME_F16C
+    if (haveF16c()) {
+        i = floatToHalfF16c(inP, outP, count);
+    }
+#endif
+    for (; i < count; ++i) {
+        outP[i] = toHalf(inP[i]);
+    }
+}
+
+void halfToFloat(const uint16_t *inP, float *outP, size_t count) {
+    size_t i = 0;
+#ifdef POINT_FRAME_F16C
+    if (haveF16c()) {
+        i = halfToFloatF16c(inP, outP, count);
+    }
+#endif
+    for (; i < count; ++i) {
+        outP[i] = fromHalf(inP[i]);
+    }
+}
+
+PointFrame::PointFrame(PointPrecision precision)
+        : m_precision(precision),
+          m_frameId(-1),
+          m_width(0),
+          m_height(0),
+          m_size(0),
+          m_hasIntensity(false) {
+}
+
+void PointFrame::setPrecision(PointPrecision precision) {
+    if (precision == m_precision) {
+        return;
+    }
+    m_precision = precision;
+    m_size = 0;
+    m_hasIntensity = false;
+    for (size_t channel = 0; channel < CHANNELS; ++channel) {
+        std::vector<float>().swap(m_floats[channel]);
+        std::vector<uint16_t>().swap(m_halves[channel]);
+    }
+}
+
+void PointFrame::reset(int64_t frameId, uint32_t width, uint32_t height) {
+    m_frameId = frameId;
+    m_width = width;
+    m_height = height;
+    m_size = 0;
+    m_hasIntensity = false;
+
+    const size_t capacity = static_cast<size_t>(width) * height;
+    for (size_t channel = 0; channel < CHANNELS; ++channel) {
+        if (PointPrecision_Float == m_precision) {
+            if (m_floats[channel].size() < capacity) {
+                m_floats[channel].resize(capacity);
+            }
+        } else if (m_halves[channel].size() < capacity) {
+            m_halves[channel].resize(capacity);
+        }
+    }
+    if (m_pixels.size() < capacity) {
+        m_pixels.resize(capacity);
+    }
+}
+
+void PointFrame::append(const float *xP,
+                        const float *yP,
+                        const float *zP,
+                        const float *intensityP,
+                        const uint32_t *pixelsP,
+                        size_t count) {
+    const size_t capacity = static_cast<size_t>(m_width) * m_height;
+    if (count > capacity - m_size) {
+        count = capacity - m_size;
+    }
+    if (0 == count) {
+        return;
+    }
+
+    const float *sourcesP[CHANNELS] = {xP, yP, zP, intensityP};
+    for (size_t channel = 0; channel < CHANNELS; ++channel) {
+        if (PointPrecision_Float == m_precision) {
+            float *outP = m_floats[channel].data() + m_size;
+            if (sourcesP[channel]) {
+                std::memcpy(outP, sourcesP[channel], count * sizeof(float));
+            } else {
+                std::fill(outP, outP + count, 0.0f);
+            }
+        } else {
+            uint16_t *outP = m_halves[channel].data() + m_size;
+            if (sourcesP[channel]) {
+                floatToHalf(sourcesP[channel], outP, count);
+            } else {
+                std::fill(outP, outP + count, static_cast<uint16_t>(0));
+            }
+        }
+    }
+    std::memcpy(m_pixels.data() + m_size, pixelsP, count * sizeof(uint32_t));
+
+    m_hasIntensity = m_hasIntensity || 0 != intensityP;
+    m_size += count;
+}
+
+void PointFrame::assignUnmasked(const PointFrame &source, const uint8_t *maskP) {
+    setPrecision(source.m_precision);
+    reset(source.m_frameId, source.m_width, source.m_height);
+    m_hasIntensity = source.m_hasIntensity;
+
+    // One pass per array keeps every loop a simple compaction.
+    for (size_t channel = 0; channel < CHANNELS; ++channel) {
+        size_t kept = 0;
+        if (PointPrecision_Float == m_precision) {
+            const float *inP = source.m_floats[channel].data();
+            float *outP = m_floats[channel].data();
+            for (size_t i = 0; i < source.m_size; ++i) {
+                outP[kept] = inP[i];
+                kept += !maskP[i];
+            }
+        } else {
+            const uint16_t *inP = source.m_halves[channel].data();
+            uint16_t *outP = m_halves[channel].data();
+            for (size_t i = 0; i < source.m_size; ++i) {
+                outP[kept] = inP[i];
+                kept += !maskP[i];
+            }
+        }
+        m_size = kept;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < source.m_size; ++i) {
+        m_pixels[kept] = source.m_pixels[i];
+        kept += !maskP[i];
+    }
+}
+
+const float *PointFrame::floatChannel(size_t channel) const {
+    return PointPrecision_Float == m_precision ? m_floats[channel].data() : 0;
+}
+
+const uint16_t *PointFrame::halfChannel(size_t channel) const {
+    return PointPrecision_Half == m_precision ? m_halves[channel].data() : 0;
+}
+
+void PointFrame::copyChannel(size_t channel, float *outP, size_t strideFloats) const {
+    if (PointPrecision_Float == m_precision) {
+        const float *inP = m_floats[channel].data();
+        for (size_t i = 0; i < m_size; ++i) {
+            outP[i * strideFloats] = inP[i];
+        }
+        return;
+    }
+
+    // Convert in blocks that stay in L1, then scatter.
+    const size_t BLOCK = 256;
+    float block[BLOCK];
+    const uint16_t *inP = m_halves[channel].data();
+    for (size_t begin = 0; begin < m_size; begin += BLOCK) {
+        const size_t count = m_size - begin < BLOCK ? m_size - begin : BLOCK;
+        halfToFloat(inP + begin, block, count);
+        for (size_t i = 0; i < count; ++i) {
+            outP[(begin + i) * strideFloats] = block[i];
+        }
+    }
+}
+
+void PointFrame::copyXyz(float *xyzP, size_t strideFloats) const {
+    for (size_t channel = 0; channel < 3; ++channel) {
+        copyChannel(channel, xyzP + channel, strideFloats);
+    }
+}
+
+void PointFrame::copyIntensity(float *intensityP, size_t strideFloats) const {
+    copyChannel(3, intensityP, strideFloats);
+}
+
+// Shared between the pool and every frame it handed out, so frames
+// released after the pool is gone are simply deleted.
+struct PointFramePool::State {
+    pthread_mutex_t mutex;
+    size_t maxIdle;
+    bool closed;
+    uint64_t allocations;
+    std::vector<PointFrame *> idle;
+
+    State(size_t maxIdleFrames)
+            : maxIdle(maxIdleFrames),
+              closed(false),
+              allocations(0) {
+        pthread_mutex_init(&mutex, NULL);
+    }
+
+    ~State() {
+        for (PointFrame *frameP : idle) {
+            delete frameP;
+        }
+        pthread_mutex_destroy(&mutex);
+    }
+
+    // Deleter of the handed out frames.
+    struct Recycler {
+        std::shared_ptr<State> state;
+
+        void operator()(PointFrame *frameP) const {
+            {
+                ScopedLock lock(&state->mutex);
+                if (!state->closed && state->idle.size() < state->maxIdle) {
+                    state->idle.push_back(frameP);
+                    return;
+                }
+            }
+            delete frameP;
+        }
+    };
+};
+
+PointFramePool::PointFramePool(size_t maxIdle)
+        : m_state(std::make_shared<State>(maxIdle)) {
+}
+
+PointFramePool::~PointFramePool() {
+    std::vector<PointFrame *> idle;
+    {
+        ScopedLock lock(&m_state->mutex);
+        m_state->closed = true;
+        idle.swap(m_state->idle);
+    }
+    for (PointFrame *frameP : idle) {
+        delete frameP;
+    }
+}
+
+std::shared_ptr<PointFrame> PointFramePool::acquire(PointPrecision precision) {
+    PointFrame *frameP = 0;
+    {
+        ScopedLock lock(&m_state->mutex);
+        if (!m_state->idle.empty()) {
+            frameP = m_state->idle.back();
+            m_state->idle.pop_back();
+        } else {
+            m_state->allocations++;
+        }
+    }
+
+    if (frameP) {
+        frameP->setPrecision(precision);
+    } else {
+        frameP = new PointFrame(precision);
+    }
+
+    State::Recycler recycler = {m_state};
+    return std::shared_ptr<PointFrame>(frameP, recycler);
+}
+
+uint64_t PointFramePool::allocations() const {
+    ScopedLock lock(&m_state->mutex);
+    return m_state->allocations;
+}
+
+} // namespace pipeline
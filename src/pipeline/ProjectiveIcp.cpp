@@ -0,0 +1,520 @@
+#include "pipeline/ProjectiveIcp.h"
+
+#include <cmath>
+#include <limits>
+
+#include "pipeline/Reprojection.h"
+#include "pipeline/WorkerPool.h"
+
+namespace pipeline {
+
+namespace {
+
+// Increments below these sizes end the iterations of a level early.
+const double MIN_ROTATION = 1e-5;
+const double MIN_TRANSLATION = 1e-5;
+
+// Ray table terms at a continuous full resolution pixel position.
+struct Rays {
+    explicit Rays(const DisparityReprojector &reprojector)
+            : columnZero(reprojector.columnTerm(0)),
+              columnStep(reprojector.width() > 1 ? reprojector.columnTerm(1) - reprojector.columnTerm(0) : 1.0f),
+              rowZero(reprojector.rowTerm(0)),
+              rowStep(reprojector.height() > 1 ? reprojector.rowTerm(1) - reprojector.rowTerm(0) : 1.0f),
+              depthTerm(reprojector.depthTerm()),
+              pixelScale(16.0f * reprojector.disparityScale()),
+              wOffset(reprojector.wOffset()) {
+    }
+
+    float columnZero;
+    float columnStep;
+    float rowZero;
+    float rowStep;
+    float depthTerm;
+    float pixelScale;
+    float wOffset;
+};
+
+bool valid(const float *p) {
+    return p[0] == p[0];
+}
+
+void cross(const float *a, const float *b, float *out) {
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// Solve the symmetric positive definite system a x = b in place by
+// Cholesky decomposition.
+bool choleskySolve(double a[6][6], double b[6], double x[6]) {
+    for (int j = 0; j < 6; ++j) {
+        double diagonal = a[j][j];
+        for (int k = 0; k < j; ++k) {
+            diagonal -= a[j][k] * a[j][k];
+        }
+        if (diagonal <= 1e-12) {
+            return false;
+        }
+        a[j][j] = std::sqrt(diagonal);
+        for (int i = j + 1; i < 6; ++i) {
+            double value = a[i][j];
+            for (int k = 0; k < j; ++k) {
+                value -= a[i][k] * a[j][k];
+            }
+            a[i][j] = value / a[j][j];
+        }
+    }
+    double y[6];
+    for (int i = 0; i < 6; ++i) {
+        double value = b[i];
+        for (int k = 0; k < i; ++k) {
+            value -= a[i][k] * y[k];
+        }
+        y[i] = value / a[i][i];
+    }
+    for (int i = 5; i >= 0; --i) {
+        double value = y[i];
+        for (int k = i + 1; k < 6; ++k) {
+            value -= a[k][i] * x[k];
+        }
+        x[i] = value / a[i][i];
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+void ProjectiveIcp::Sums::clear() {
+    for (double &value : a) {
+        value = 0.0;
+    }
+    for (double &value : b) {
+        value = 0.0;
+    }
+    error = 0.0;
+    count = 0;
+}
+
+void ProjectiveIcp::Sums::add(const Sums &other) {
+    for (int i = 0; i < 21; ++i) {
+        a[i] += other.a[i];
+    }
+    for (int i = 0; i < 6; ++i) {
+        b[i] += other.b[i];
+    }
+    error += other.error;
+    count += other.count;
+}
+
+ProjectiveIcp::ProjectiveIcp()
+        : ProjectiveIcp(Config()) {
+}
+
+ProjectiveIcp::ProjectiveIcp(const Config &config)
+        : m_config(config),
+          m_current(0),
+          m_hasReference(false),
+          m_pairs(0),
+          m_rmsError(0.0f) {
+    m_config.levels = m_config.levels < 1 ? 1 : (m_config.levels > MAX_LEVELS ? MAX_LEVELS : m_config.levels);
+    m_config.baseDecimation = m_config.baseDecimation < 1 ? 1 : m_config.baseDecimation;
+    m_config.rowsPerTile = m_config.rowsPerTile < 1 ? 1 : m_config.rowsPerTile;
+    m_minNormalDot = std::cos(m_config.maxAngleDegrees * static_cast<float>(M_PI) / 180.0f);
+}
+
+void ProjectiveIcp::reset() {
+    m_hasReference = false;
+    m_motion = Pose();
+    m_pose = Pose();
+    m_pairs = 0;
+    m_rmsError = 0.0f;
+}
+
+void ProjectiveIcp::buildGeometry(const DisparityReprojector &reprojector, Level &level) const {
+    const Rays rays(reprojector);
+    const size_t pixels = static_cast<size_t>(level.width) * level.height;
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float center = (level.scale - 1) * 0.5f;
+
+    level.vertices.resize(3 * pixels);
+    for (uint32_t r = 0; r < level.height; ++r) {
+        const float rowTerm = rays.rowZero + rays.rowStep * (level.scale * r + center);
+        for (uint32_t c = 0; c < level.width; ++c) {
+            const size_t i = static_cast<size_t>(r) * level.width + c;
+            float *vertexP = &level.vertices[3 * i];
+            const float d = level.disparity[i];
+            if (0.0f == d) {
+                vertexP[0] = vertexP[1] = vertexP[2] = nan;
+                continue;
+            }
+            const float inverseW = 1.0f / (d * rays.pixelScale + rays.wOffset);
+            vertexP[0] = (rays.columnZero + rays.columnStep * (level.scale * c + center)) * inverseW;
+            vertexP[1] = -rowTerm * inverseW;
+            vertexP[2] = -rays.depthTerm * inverseW;
+        }
+    }
+
+    // Normals by central differences over about normalBaseline full
+    // resolution pixels, since neighbouring pixels are too close for the
+    // disparity noise.  Differences across a depth edge give no normal.
+    const uint32_t span = m_config.normalBaseline / (2 * level.scale) > 1 ?
+                          m_config.normalBaseline / (2 * level.scale) : 1;
+    const float maxStep = m_config.maxDisparityStep * span;
+    level.normals.assign(3 * pixels, nan);
+    for (uint32_t r = span; r + span < level.height; ++r) {
+        for (uint32_t c = span; c + span < level.width; ++c) {
+            const size_t i = static_cast<size_t>(r) * level.width + c;
+            const size_t left = i - span, right = i + span;
+            const size_t up = i - span * level.width, down = i + span * level.width;
+            const float d = level.disparity[i];
+            if (0.0f == d || 0.0f == level.disparity[left] || 0.0f == level.disparity[right] ||
+                0.0f == level.disparity[up] || 0.0f == level.disparity[down] ||
+                std::fabs(level.disparity[right] - d) > maxStep || std::fabs(level.disparity[left] - d) > maxStep ||
+                std::fabs(level.disparity[down] - d) > maxStep || std::fabs(level.disparity[up] - d) > maxStep) {
+                continue;
+            }
+
+            const float *p = &level.vertices[3 * i];
+            const float *pl = &level.vertices[3 * left];
+            const float *pr = &level.vertices[3 * right];
+            const float *pu = &level.vertices[3 * up];
+            const float *pd = &level.vertices[3 * down];
+            const float u[3] = {pr[0] - pl[0], pr[1] - pl[1], pr[2] - pl[2]};
+            const float v[3] = {pd[0] - pu[0], pd[1] - pu[1], pd[2] - pu[2]};
+            float n[3];
+            cross(u, v, n);
+            const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (length <= 0.0f) {
+                continue;
+            }
+            const float sign = n[0] * p[0] + n[1] * p[1] + n[2] * p[2] > 0.0f ? -1.0f : 1.0f;
+            float *normalP = &level.normals[3 * i];
+            normalP[0] = sign * n[0] / length;
+            normalP[1] = sign * n[1] / length;
+            normalP[2] = sign * n[2] / length;
+        }
+    }
+}
+
+void ProjectiveIcp::buildFrame(const DisparityReprojector &reprojector,
+                               const uint16_t *disparityP,
+                               Frame &frame,
+                               WorkerPool *poolP) const {
+    const uint32_t base = m_config.baseDecimation;
+    const float maxStep = m_config.maxDisparityStep;
+
+    // Level 0: average the included, valid disparities of every base x
+    // base block.  Tasks own whole rows of level 0.
+    Level &first = frame.levels[0];
+    first.scale = base;
+    first.width = reprojector.width() / base;
+    first.height = reprojector.height() / base;
+    first.disparity.assign(static_cast<size_t>(first.width) * first.height, 0.0f);
+
+    WorkerPool::Task averageRows = [&](size_t task, uint32_t) {
+        const uint32_t row = static_cast<uint32_t>(task);
+        std::vector<float> sums(first.width, 0.0f);
+        std::vector<float> minimum(first.width, std::numeric_limits<float>::max());
+        std::vector<float> maximum(first.width, 0.0f);
+        std::vector<uint32_t> counts(first.width, 0);
+
+        for (uint32_t r = row * base; r < (row + 1) * base; ++r) {
+            if (r < reprojector.firstRow() || r >= reprojector.endRow()) {
+                continue;
+            }
+            const uint16_t *rowP = disparityP + static_cast<size_t>(r) * reprojector.width();
+            size_t spanCount;
+            const RoiSpan *spansP = reprojector.spans(r, spanCount);
+            for (size_t k = 0; k < spanCount; ++k) {
+                const uint32_t end = spansP[k].end < first.width * base ? spansP[k].end : first.width * base;
+                for (uint32_t c = spansP[k].begin; c < end; ++c) {
+                    if (0 == rowP[c]) {
+                        continue;
+                    }
+                    const float d = rowP[c] / 16.0f;
+                    const uint32_t cell = c / base;
+                    sums[cell] += d;
+                    minimum[cell] = d < minimum[cell] ? d : minimum[cell];
+                    maximum[cell] = d > maximum[cell] ? d : maximum[cell];
+                    counts[cell]++;
+                }
+            }
+        }
+
+        float *outP = &first.disparity[static_cast<size_t>(row) * first.width];
+        for (uint32_t c = 0; c < first.width; ++c) {
+            if (2 * counts[c] >= base * base && maximum[c] - minimum[c] <= maxStep) {
+                outP[c] = sums[c] / counts[c];
+            }
+        }
+    };
+
+    // Coarser levels: the same over 2x2 blocks of the level below.
+    auto halve = [&](const Level &fine, Level &coarse) {
+        coarse.scale = 2 * fine.scale;
+        coarse.width = fine.width / 2;
+        coarse.height = fine.height / 2;
+        coarse.disparity.assign(static_cast<size_t>(coarse.width) * coarse.height, 0.0f);
+        for (uint32_t r = 0; r < coarse.height; ++r) {
+            const float *topP = &fine.disparity[static_cast<size_t>(2 * r) * fine.width];
+            const float *bottomP = topP + fine.width;
+            float *outP = &coarse.disparity[static_cast<size_t>(r) * coarse.width];
+            for (uint32_t c = 0; c < coarse.width; ++c) {
+                const float values[4] = {topP[2 * c], topP[2 * c + 1], bottomP[2 * c], bottomP[2 * c + 1]};
+                float sum = 0.0f, minimum = std::numeric_limits<float>::max(), maximum = 0.0f;
+                uint32_t count = 0;
+                for (float value : values) {
+                    if (0.0f != value) {
+                        sum += value;
+                        minimum = value < minimum ? value : minimum;
+                        maximum = value > maximum ? value : maximum;
+                        count++;
+                    }
+                }
+                if (count >= 2 && maximum - minimum <= maxStep) {
+                    outP[c] = sum / count;
+                }
+            }
+        }
+    };
+
+    WorkerPool::Task geometry = [&](size_t level, uint32_t) {
+        buildGeometry(reprojector, frame.levels[level]);
+    };
+
+    if (poolP) {
+        poolP->run(first.height, averageRows);
+    } else {
+        for (uint32_t row = 0; row < first.height; ++row) {
+            averageRows(row, 0);
+        }
+    }
+    for (uint32_t level = 1; level < m_config.levels; ++level) {
+        halve(frame.levels[level - 1], frame.levels[level]);
+    }
+    if (poolP) {
+        poolP->run(m_config.levels, geometry);
+    } else {
+        for (uint32_t level = 0; level < m_config.levels; ++level) {
+            geometry(level, 0);
+        }
+    }
+}
+
+void ProjectiveIcp::accumulate(const DisparityReprojector &reprojector,
+                               const Level &source,
+                               const Level &target,
+                               const Pose &estimate,
+                               uint32_t beginRow,
+                               uint32_t endRow,
+                               Sums &sums) const {
+    const Rays rays(reprojector);
+    const float maxDistanceSquared = m_config.maxDistance * m_config.maxDistance;
+
+    // Target pixel of a point: column = x / forward * columnScale +
+    // columnOffset, likewise for rows with -y.
+    const float center = (target.scale - 1) * 0.5f;
+    const float columnScale = rays.depthTerm / (rays.columnStep * target.scale);
+    const float columnOffset = (-rays.columnZero / rays.columnStep - center) / target.scale + 0.5f;
+    const float rowScale = rays.depthTerm / (rays.rowStep * target.scale);
+    const float rowOffset = (-rays.rowZero / rays.rowStep - center) / target.scale + 0.5f;
+    const float width = static_cast<float>(target.width);
+    const float height = static_cast<float>(target.height);
+
+    for (uint32_t r = beginRow; r < endRow; ++r) {
+        // A row is summed in float, which is exact enough for a few
+        // hundred terms, and then added to the double totals.
+        float a[21] = {0};
+        float b[6] = {0};
+        float error = 0.0f;
+        uint32_t count = 0;
+
+        for (uint32_t c = 0; c < source.width; ++c) {
+            const size_t i = static_cast<size_t>(r) * source.width + c;
+            const float *sourceNormalP = &source.normals[3 * i];
+            if (!valid(sourceNormalP)) {
+                continue;
+            }
+
+            // Where the point lands in the previous frame.
+            float p[3];
+            estimate.apply(&source.vertices[3 * i], p);
+            if (p[2] >= 0.0f) {
+                continue;
+            }
+            const float inverseForward = -1.0f / p[2];
+            const float tc = p[0] * inverseForward * columnScale + columnOffset;
+            const float tr = -p[1] * inverseForward * rowScale + rowOffset;
+            if (!(tc >= 0.0f && tc < width && tr >= 0.0f && tr < height)) {
+                continue;
+            }
+            const size_t j = static_cast<size_t>(tr) * target.width + static_cast<size_t>(tc);
+            const float *n = &target.normals[3 * j];
+            if (!valid(n)) {
+                continue;
+            }
+            const float *q = &target.vertices[3 * j];
+
+            const float difference[3] = {p[0] - q[0], p[1] - q[1], p[2] - q[2]};
+            if (difference[0] * difference[0] + difference[1] * difference[1] + difference[2] * difference[2] >
+                maxDistanceSquared) {
+                continue;
+            }
+            float rotatedNormal[3];
+            estimate.rotate(sourceNormalP, rotatedNormal);
+            if (rotatedNormal[0] * n[0] + rotatedNormal[1] * n[1] + rotatedNormal[2] * n[2] < m_minNormalDot) {
+                continue;
+            }
+
+            // Residual n . (p - q) and its derivative for a small rotation
+            // w and translation t applied after the estimate: (p x n, n).
+            const float residual = n[0] * difference[0] + n[1] * difference[1] + n[2] * difference[2];
+            float jacobian[6];
+            cross(p, n, jacobian);
+            jacobian[3] = n[0];
+            jacobian[4] = n[1];
+            jacobian[5] = n[2];
+
+            int k = 0;
+            for (int row = 0; row < 6; ++row) {
+                for (int column = row; column < 6; ++column) {
+                    a[k++] += jacobian[row] * jacobian[column];
+                }
+                b[row] += jacobian[row] * residual;
+            }
+            error += residual * residual;
+            count++;
+        }
+
+        for (int k = 0; k < 21; ++k) {
+            sums.a[k] += a[k];
+        }
+        for (int k = 0; k < 6; ++k) {
+            sums.b[k] += b[k];
+        }
+        sums.error += error;
+        sums.count += count;
+    }
+}
+
+bool ProjectiveIcp::solve(const Sums &sums, Pose &increment) const {
+    double a[6][6];
+    int k = 0;
+    for (int row = 0; row < 6; ++row) {
+        for (int column = row; column < 6; ++column) {
+            a[row][column] = a[column][row] = sums.a[k++];
+        }
+    }
+    double b[6];
+    for (int i = 0; i < 6; ++i) {
+        b[i] = -sums.b[i];
+    }
+    double x[6];
+    if (!choleskySolve(a, b, x)) {
+        return false;
+    }
+
+    // Rotation vector to matrix (Rodrigues).
+    const double angle = std::sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
+    double axis[3] = {1.0, 0.0, 0.0};
+    if (angle > 1e-12) {
+        axis[0] = x[0] / angle;
+        axis[1] = x[1] / angle;
+        axis[2] = x[2] / angle;
+    }
+    const double s = std::sin(angle);
+    const double c = std::cos(angle);
+    const double t = 1.0 - c;
+    const double rotation[9] = {
+            t * axis[0] * axis[0] + c, t * axis[0] * axis[1] - s * axis[2], t * axis[0] * axis[2] + s * axis[1],
+            t * axis[0] * axis[1] + s * axis[2], t * axis[1] * axis[1] + c, t * axis[1] * axis[2] - s * axis[0],
+            t * axis[0] * axis[2] - s * axis[1], t * axis[1] * axis[2] + s * axis[0], t * axis[2] * axis[2] + c};
+    for (int i = 0; i < 9; ++i) {
+        increment.rotation[i] = static_cast<float>(rotation[i]);
+    }
+    for (int i = 0; i < 3; ++i) {
+        increment.translation[i] = static_cast<float>(x[3 + i]);
+    }
+    return angle > MIN_ROTATION ||
+           std::sqrt(x[3] * x[3] + x[4] * x[4] + x[5] * x[5]) > MIN_TRANSLATION;
+}
+
+bool ProjectiveIcp::track(const DisparityReprojector &reprojector, const uint16_t *disparityP, WorkerPool *poolP) {
+    if (!reprojector.isValid()) {
+        return false;
+    }
+
+    Frame &current = m_frames[m_current];
+    const Frame &previous = m_frames[1 - m_current];
+    buildFrame(reprojector, disparityP, current, poolP);
+    m_current = 1 - m_current;
+
+    if (!m_hasReference || previous.levels[0].width != current.levels[0].width ||
+        previous.levels[0].height != current.levels[0].height) {
+        m_hasReference = true;
+        m_motion = Pose();
+        return false;
+    }
+
+    const uint32_t workers = poolP ? poolP->size() : 1;
+    m_workerSums.resize(workers);
+
+    // Start from the motion of the previous frame.
+    Pose estimate = m_motion;
+    Sums total;
+    total.clear();
+
+    for (uint32_t level = m_config.levels; level-- > 0;) {
+        const Level &source = current.levels[level];
+        const Level &target = previous.levels[level];
+        const uint32_t tileRows = m_config.rowsPerTile;
+        const size_t tiles = (source.height + tileRows - 1) / tileRows;
+
+        for (uint32_t iteration = 0; iteration < m_config.iterations[level]; ++iteration) {
+            for (Sums &sums : m_workerSums) {
+                sums.clear();
+            }
+            WorkerPool::Task reduceTile = [&](size_t tile, uint32_t worker) {
+                const uint32_t begin = static_cast<uint32_t>(tile) * tileRows;
+                const uint32_t end = begin + tileRows < source.height ? begin + tileRows : source.height;
+                accumulate(reprojector, source, target, estimate, begin, end, m_workerSums[worker]);
+            };
+            if (poolP) {
+                poolP->run(tiles, reduceTile);
+            } else {
+                for (size_t tile = 0; tile < tiles; ++tile) {
+                    reduceTile(tile, 0);
+                }
+            }
+
+            total.clear();
+            for (const Sums &sums : m_workerSums) {
+                total.add(sums);
+            }
+            if (total.count < 6) {
+                break;
+            }
+
+            Pose increment;
+            const bool moved = solve(total, increment);
+            estimate = increment * estimate;
+            if (!moved) {
+                break;
+            }
+        }
+    }
+
+    m_pairs = total.count;
+    m_rmsError = total.count ? static_cast<float>(std::sqrt(total.error / total.count)) : 0.0f;
+    if (total.count < m_config.minPairs) {
+        m_motion = Pose();
+        return false;
+    }
+
+    m_motion = estimate;
+    m_pose = m_pose * m_motion;
+    return true;
+}
+
+} // namespace pipeline
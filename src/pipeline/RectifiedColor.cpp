@@ -0,0 +1,126 @@
+#include "pipeline/RectifiedColor.h"
+
+#include <cmath>
+
+#include "pipeline/YCbCr.h"
+
+namespace pipeline {
+
+namespace {
+
+// Bilinear weights are kept in Q7, so the two interpolation passes fit
+// in 32 bits.
+const int32_t WEIGHT_ONE = 128;
+
+} // anonymous namespace
+
+RectifiedColorLookup::RectifiedColorLookup()
+        : m_width(0),
+          m_height(0) {
+}
+
+void RectifiedColorLookup::build(const float *mapXP, const float *mapYP, uint32_t width, uint32_t height) {
+    m_width = width;
+    m_height = height;
+    m_lumaOffsets.resize(static_cast<size_t>(width) * height);
+    m_weights.resize(m_lumaOffsets.size());
+    m_chromaOffsets.resize(m_lumaOffsets.size());
+
+    const long chromaWidth = width / 2;
+    for (size_t i = 0; i < m_lumaOffsets.size(); ++i) {
+        const float x = mapXP[i];
+        const float y = mapYP[i];
+        if (!(x >= 0.0f && y >= 0.0f && x <= width - 1.0f && y <= height - 1.0f) || width < 2 || height < 2) {
+            m_lumaOffsets[i] = -1;
+            m_weights[i] = 0;
+            m_chromaOffsets[i] = -1;
+            continue;
+        }
+
+        // Top left neighbour of the 2x2 interpolation window, kept inside
+        // the image on the last row and column.
+        long x0 = static_cast<long>(x);
+        long y0 = static_cast<long>(y);
+        x0 = x0 > static_cast<long>(width) - 2 ? static_cast<long>(width) - 2 : x0;
+        y0 = y0 > static_cast<long>(height) - 2 ? static_cast<long>(height) - 2 : y0;
+        const long fx = std::lround((x - x0) * WEIGHT_ONE);
+        const long fy = std::lround((y - y0) * WEIGHT_ONE);
+
+        // Chroma is sampled at the nearest 2x2 block; at half resolution
+        // interpolating it is not worth the extra gathers.
+        const long xn = std::lround(x);
+        const long yn = std::lround(y);
+
+        m_lumaOffsets[i] = static_cast<int32_t>(y0 * width + x0);
+        m_weights[i] = static_cast<uint16_t>(fx | (fy << 8));
+        m_chromaOffsets[i] = static_cast<int32_t>(2 * ((yn / 2) * chromaWidth + xn / 2));
+    }
+
+    m_y.resize(width);
+    m_cb.resize(width);
+    m_cr.resize(width);
+}
+
+inline void RectifiedColorLookup::gather(const uint8_t *lumaP,
+                                         const uint8_t *chromaP,
+                                         size_t index,
+                                         size_t i) {
+    const int32_t offset = m_lumaOffsets[index];
+    if (offset < 0) {
+        m_y[i] = 0;
+        m_cb[i] = 128;
+        m_cr[i] = 128;
+        return;
+    }
+
+    const uint8_t *topP = lumaP + offset;
+    const uint8_t *bottomP = topP + m_width;
+    const int32_t fx = m_weights[index] & 0xff;
+    const int32_t fy = m_weights[index] >> 8;
+    const int32_t top = topP[0] * (WEIGHT_ONE - fx) + topP[1] * fx;
+    const int32_t bottom = bottomP[0] * (WEIGHT_ONE - fx) + bottomP[1] * fx;
+    m_y[i] = static_cast<uint8_t>((top * (WEIGHT_ONE - fy) + bottom * fy + WEIGHT_ONE * WEIGHT_ONE / 2) >> 14);
+
+    const uint8_t *pairP = chromaP + m_chromaOffsets[index];
+    m_cb[i] = pairP[0];
+    m_cr[i] = pairP[1];
+}
+
+void RectifiedColorLookup::sampleRow(const uint8_t *lumaP,
+                                     const uint8_t *chromaP,
+                                     uint32_t row,
+                                     const uint32_t *columnsP,
+                                     size_t count,
+                                     uint32_t *bgraP) {
+    const size_t rowStart = static_cast<size_t>(row) * m_width;
+
+    // Gather the samples of this row, then convert them in one go.
+    for (size_t i = 0; i < count; ++i) {
+        gather(lumaP, chromaP, rowStart + columnsP[i], i);
+    }
+
+    ycbcrToBgra(m_y.data(), m_cb.data(), m_cr.data(), bgraP, count);
+}
+
+void RectifiedColorLookup::convertRow(const uint8_t *lumaP,
+                                      const uint8_t *chromaP,
+                                      uint32_t row,
+                                      uint8_t *bgrRowP) {
+    const size_t rowStart = static_cast<size_t>(row) * m_width;
+    for (uint32_t c = 0; c < m_width; ++c) {
+        gather(lumaP, chromaP, rowStart + c, c);
+    }
+
+    ycbcrToBgr(m_y.data(), m_cb.data(), m_cr.data(), bgrRowP, m_width);
+}
+
+void RectifiedColorLookup::convertImage(const uint8_t *lumaP,
+                                        const uint8_t *chromaP,
+                                        uint8_t *bgrP,
+                                        size_t strideBytes) {
+    for (uint32_t r = 0; r < m_height; ++r) {
+        convertRow(lumaP, chromaP, r, bgrP + r * strideBytes);
+    }
+}
+
+} // namespace pipeline
@@ -0,0 +1,116 @@
+#include "pipeline/RegionOfInterest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace pipeline {
+
+namespace {
+
+uint64_t nextSerial() {
+    static std::atomic<uint64_t> serial(0);
+    return ++serial;
+}
+
+} // anonymous namespace
+
+RegionOfInterest::RegionOfInterest() {
+    reset(0, 0);
+}
+
+void RegionOfInterest::reset(uint32_t width, uint32_t height) {
+    m_width = width;
+    m_height = height;
+    m_rectX = 0;
+    m_rectY = 0;
+    m_rectWidth = width;
+    m_rectHeight = height;
+    m_mask.clear();
+    m_hasCropBox = false;
+    rebuild();
+}
+
+void RegionOfInterest::setRect(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    m_rectX = std::min(x, m_width);
+    m_rectY = std::min(y, m_height);
+    m_rectWidth = std::min(width, m_width - m_rectX);
+    m_rectHeight = std::min(height, m_height - m_rectY);
+    rebuild();
+}
+
+void RegionOfInterest::setMask(const uint8_t *maskP, size_t strideBytes) {
+    m_mask.clear();
+    if (maskP) {
+        m_mask.resize(static_cast<size_t>(m_width) * m_height);
+        for (uint32_t r = 0; r < m_height; ++r) {
+            std::memcpy(&m_mask[static_cast<size_t>(r) * m_width], maskP + r * strideBytes, m_width);
+        }
+    }
+    rebuild();
+}
+
+void RegionOfInterest::setCropBox(const float minimum[3], const float maximum[3]) {
+    m_hasCropBox = true;
+    for (int i = 0; i < 3; ++i) {
+        m_cropMinimum[i] = minimum[i];
+        m_cropMaximum[i] = maximum[i];
+    }
+    m_serial = nextSerial();
+}
+
+void RegionOfInterest::clearCropBox() {
+    m_hasCropBox = false;
+    m_serial = nextSerial();
+}
+
+void RegionOfInterest::rebuild() {
+    m_spans.clear();
+    m_rowStarts.assign(static_cast<size_t>(m_height) + 1, 0);
+    m_firstRow = m_height;
+    m_endRow = 0;
+    m_pixelCount = 0;
+
+    const uint32_t rectEnd = m_rectX + m_rectWidth;
+    for (uint32_t r = 0; r < m_height; ++r) {
+        m_rowStarts[r] = static_cast<uint32_t>(m_spans.size());
+        if (r < m_rectY || r >= m_rectY + m_rectHeight || 0 == m_rectWidth) {
+            continue;
+        }
+
+        if (m_mask.empty()) {
+            m_spans.push_back(RoiSpan{m_rectX, rectEnd});
+        } else {
+            const uint8_t *maskRowP = &m_mask[static_cast<size_t>(r) * m_width];
+            uint32_t c = m_rectX;
+            while (c < rectEnd) {
+                while (c < rectEnd && 0 == maskRowP[c]) {
+                    ++c;
+                }
+                const uint32_t begin = c;
+                while (c < rectEnd && 0 != maskRowP[c]) {
+                    ++c;
+                }
+                if (c > begin) {
+                    m_spans.push_back(RoiSpan{begin, c});
+                }
+            }
+        }
+
+        for (size_t i = m_rowStarts[r]; i < m_spans.size(); ++i) {
+            m_pixelCount += m_spans[i].end - m_spans[i].begin;
+        }
+        if (m_spans.size() > m_rowStarts[r]) {
+            m_firstRow = std::min(m_firstRow, r);
+            m_endRow = r + 1;
+        }
+    }
+    m_rowStarts[m_height] = static_cast<uint32_t>(m_spans.size());
+
+    if (m_firstRow > m_endRow) {
+        m_firstRow = m_endRow;
+    }
+    m_serial = nextSerial();
+}
+
+} // namespace pipeline
@@ -0,0 +1,83 @@
+#include "pipeline/ReplayClock.h"
+
+#include <thread>
+
+namespace pipeline {
+
+namespace {
+
+const double LATE_SECONDS = 1e-3;
+
+} // anonymous namespace
+
+ReplayClock::ReplayClock(double speed)
+        : m_speed(speed > 0.0 ? speed : 0.0) {
+    reset();
+}
+
+void ReplayClock::reset() {
+    m_started = false;
+    m_firstLogTime = 0.0;
+    m_lastLogTime = 0.0;
+    m_frames = 0;
+    m_lateSum = 0.0;
+    m_lateMax = 0.0;
+    m_lateFrames = 0;
+}
+
+double ReplayClock::waitFor(double logTime) {
+    if (!m_started) {
+        m_started = true;
+        m_start = Clock::now();
+        m_lastDelivery = m_start;
+        m_firstLogTime = logTime;
+        m_lastLogTime = logTime;
+        m_frames = 1;
+        return 0.0;
+    }
+
+    if (logTime > m_lastLogTime) {
+        m_lastLogTime = logTime;
+    }
+    m_frames++;
+
+    double late = 0.0;
+    if (m_speed > 0.0) {
+        const Clock::time_point due = m_start + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>((m_lastLogTime - m_firstLogTime) / m_speed));
+        std::this_thread::sleep_until(due);
+        m_lastDelivery = Clock::now();
+        late = std::chrono::duration<double>(m_lastDelivery - due).count();
+        if (late < 0.0) {
+            late = 0.0;
+        }
+    } else {
+        m_lastDelivery = Clock::now();
+    }
+
+    m_lateSum += late;
+    if (late > m_lateMax) {
+        m_lateMax = late;
+    }
+    if (late > LATE_SECONDS) {
+        m_lateFrames++;
+    }
+    return late;
+}
+
+ReplayClock::Stats ReplayClock::stats() const {
+    Stats stats;
+    stats.frames = m_frames;
+    if (m_started) {
+        stats.wallSeconds = std::chrono::duration<double>(m_lastDelivery - m_start).count();
+        stats.recordedSeconds = m_lastLogTime - m_firstLogTime;
+    }
+    if (m_frames > 0) {
+        stats.meanLateMs = 1e3 * m_lateSum / m_frames;
+    }
+    stats.maxLateMs = 1e3 * m_lateMax;
+    stats.lateFrames = m_lateFrames;
+    return stats;
+}
+
+} // namespace pipeline
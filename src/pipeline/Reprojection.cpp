@@ -0,0 +1,164 @@
+#include "pipeline/Reprojection.h"
+
+#include "pipeline/PointFrame.h"
+
+namespace pipeline {
+
+DisparityReprojector::DisparityReprojector()
+        : m_width(0),
+          m_height(0),
+          m_depthTerm(0.0f),
+          m_disparityScale(0.0f),
+          m_wOffset(0.0f) {
+    m_fullRow.begin = 0;
+    m_fullRow.end = 0;
+}
+
+void DisparityReprojector::setQ(const float *q, uint32_t width, uint32_t height) {
+    m_width = width;
+    m_height = height;
+
+    m_columnTerms.resize(width);
+    for (uint32_t c = 0; c < width; ++c) {
+        m_columnTerms[c] = q[0] * c + q[3];
+    }
+    m_rowTerms.resize(height);
+    for (uint32_t r = 0; r < height; ++r) {
+        m_rowTerms[r] = q[5] * r + q[7];
+    }
+
+    m_depthTerm = q[11];
+    m_disparityScale = q[14] / 16.0f;
+    m_wOffset = q[15];
+
+    m_fullRow.begin = 0;
+    m_fullRow.end = width;
+}
+
+void DisparityReprojector::setRegion(const RegionOfInterest &region) {
+    m_region = region;
+}
+
+const RoiSpan *DisparityReprojector::spans(uint32_t row, size_t &count) const {
+    if (useRegion()) {
+        return m_region.spans(row, count);
+    }
+    count = 1;
+    return &m_fullRow;
+}
+
+namespace {
+
+// Point sinks of reprojectRowTo(): packed x, y, z, or one array per
+// coordinate.
+struct PackedOutput {
+    float *xyzP;
+    uint32_t *columnsP;
+    size_t count;
+
+    void add(float x, float y, float z, uint32_t column) {
+        xyzP[3 * count] = x;
+        xyzP[3 * count + 1] = y;
+        xyzP[3 * count + 2] = z;
+        columnsP[count++] = column;
+    }
+};
+
+struct PlanarOutput {
+    float *xP;
+    float *yP;
+    float *zP;
+    uint32_t *columnsP;
+    size_t count;
+
+    void add(float x, float y, float z, uint32_t column) {
+        xP[count] = x;
+        yP[count] = y;
+        zP[count] = z;
+        columnsP[count++] = column;
+    }
+};
+
+} // anonymous namespace
+
+template <class Output>
+size_t DisparityReprojector::reprojectRowTo(const uint16_t *disparityRowP, uint32_t row, Output &output) const {
+    if (row >= m_height) {
+        return 0;
+    }
+
+    size_t spanCount;
+    const RoiSpan *spansP = spans(row, spanCount);
+
+    const float rowTerm = m_rowTerms[row];
+
+    for (size_t k = 0; k < spanCount; ++k) {
+        for (uint32_t c = spansP[k].begin; c < spansP[k].end; ++c) {
+            const uint16_t d = disparityRowP[c];
+
+            // 0 marks pixels without a stereo match.
+            if (0 == d) {
+                continue;
+            }
+
+            const float inverseW = 1.0f / (d * m_disparityScale + m_wOffset);
+            const float x = m_columnTerms[c] * inverseW;
+            const float y = -rowTerm * inverseW;
+            const float z = -m_depthTerm * inverseW;
+
+            if (m_region.inCropBox(x, y, z)) {
+                output.add(x, y, z, c);
+            }
+        }
+    }
+
+    return output.count;
+}
+
+size_t DisparityReprojector::reprojectRow(const uint16_t *disparityRowP,
+                                          uint32_t row,
+                                          float *xyzP,
+                                          uint32_t *columnsP) const {
+    PackedOutput output = {xyzP, columnsP, 0};
+    return reprojectRowTo(disparityRowP, row, output);
+}
+
+size_t DisparityReprojector::reprojectRow(const uint16_t *disparityRowP,
+                                          uint32_t row,
+                                          float *xP,
+                                          float *yP,
+                                          float *zP,
+                                          uint32_t *columnsP) const {
+    PlanarOutput output = {xP, yP, zP, columnsP, 0};
+    return reprojectRowTo(disparityRowP, row, output);
+}
+
+void DisparityReprojector::reproject(const uint16_t *disparityP,
+                                     int64_t frameId,
+                                     PointFrame &frame,
+                                     const uint8_t *intensityP) const {
+    frame.reset(frameId, m_width, m_height);
+
+    // Rows go through float scratch, which also covers the conversion of
+    // half precision frames.
+    std::vector<float> x(m_width), y(m_width), z(m_width), intensity(intensityP ? m_width : 0);
+    std::vector<uint32_t> columns(m_width);
+
+    for (uint32_t r = firstRow(); r < endRow(); ++r) {
+        const size_t rowOffset = static_cast<size_t>(r) * m_width;
+        const size_t count = reprojectRow(disparityP + rowOffset, r, x.data(), y.data(), z.data(), columns.data());
+        if (intensityP) {
+            for (size_t i = 0; i < count; ++i) {
+                intensity[i] = intensityP[rowOffset + columns[i]];
+            }
+        }
+
+        // Columns become image pixel indices in place.
+        for (size_t i = 0; i < count; ++i) {
+            columns[i] += static_cast<uint32_t>(rowOffset);
+        }
+        frame.append(x.data(), y.data(), z.data(), intensityP ? intensity.data() : 0, columns.data(), count);
+    }
+}
+
+} // namespace pipeline
@@ -0,0 +1,23 @@
+#include "pipeline/RiceCoding.h"
+
+#include "MultiSense/details/utility/Exception.hh"
+
+namespace pipeline {
+
+uint32_t riceParameter(const uint16_t *valuesP, size_t count) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; ++i) {
+        sum += valuesP[i];
+    }
+    uint32_t k = 0;
+    while (k < 15 && (static_cast<uint64_t>(count) << k) < sum) {
+        ++k;
+    }
+    return k;
+}
+
+void throwTruncatedStream() {
+    CRL_EXCEPTION("Truncated bit stream\n");
+}
+
+} // namespace pipeline
@@ -0,0 +1,403 @@
+#include "pipeline/SharedMemoryRing.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "MultiSense/details/utility/Exception.hh"
+
+namespace pipeline {
+
+namespace {
+
+const uint32_t RING_MAGIC = 0x52534d4d;  // "MMSR"
+const uint32_t RING_VERSION = 2;
+const size_t PAGE = 4096;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "Shared memory ring needs lock-free 64-bit atomics");
+
+struct RingHeader {
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t slotCount;
+
+    // Set once a newer publisher has replaced the segment.
+    std::atomic<uint32_t> retired;
+
+    uint64_t slotStride;
+    uint64_t maxPayload;
+
+    // One more than that of the segment this one replaced.
+    uint64_t generation;
+
+    // Number of frames committed so far.  Frame k (zero based) lives in
+    // slot k % slotCount.
+    alignas(64) std::atomic<uint64_t> published;
+};
+
+struct alignas(64) SlotHeader {
+    // 2k + 1 while frame k is being written, 2k + 2 once it is complete.
+    std::atomic<uint64_t> state;
+    ShmFrameInfo info;
+};
+
+const size_t HEADER_SIZE = (sizeof(RingHeader) + PAGE - 1) & ~(PAGE - 1);
+
+std::string segmentName(const std::string &name) {
+    return (!name.empty() && '/' == name[0]) ? name : "/" + name;
+}
+
+RingHeader *ringHeader(void *baseP) {
+    return static_cast<RingHeader *>(baseP);
+}
+
+SlotHeader *slotHeader(void *baseP, uint64_t frame) {
+    RingHeader *headerP = ringHeader(baseP);
+    uint8_t *slotP = static_cast<uint8_t *>(baseP) + HEADER_SIZE +
+                     (frame % headerP->slotCount) * headerP->slotStride;
+    return reinterpret_cast<SlotHeader *>(slotP);
+}
+
+void *slotPayload(SlotHeader *slotP) {
+    return reinterpret_cast<uint8_t *>(slotP) + sizeof(SlotHeader);
+}
+
+// Mark the segment a previous publisher left under name as retired, and
+// return its generation, or 0 if there is none.
+uint64_t retireSegment(const std::string &name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        return 0;
+    }
+
+    uint64_t generation = 0;
+    struct stat info;
+    if (0 == fstat(fd, &info) && static_cast<size_t>(info.st_size) >= HEADER_SIZE) {
+        void *baseP = mmap(0, HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (MAP_FAILED != baseP) {
+            RingHeader *headerP = ringHeader(baseP);
+            if (RING_MAGIC == headerP->magic.load(std::memory_order_acquire) &&
+                RING_VERSION == headerP->version) {
+                generation = headerP->generation;
+                headerP->retired.store(1, std::memory_order_release);
+            }
+            munmap(baseP, HEADER_SIZE);
+        }
+    }
+    ::close(fd);
+    return generation;
+}
+
+} // anonymous namespace
+
+uint64_t monotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+ShmPublisher::ShmPublisher()
+        : m_baseP(0),
+          m_mappedSize(0),
+          m_pendingSlotP(0) {
+}
+
+ShmPublisher::~ShmPublisher() {
+    close();
+}
+
+void ShmPublisher::open(const std::string &name, uint32_t slotCount, size_t maxPayload) {
+    close();
+
+    if (slotCount < 2) {
+        CRL_EXCEPTION("Shared memory ring needs at least two slots\n");
+    }
+
+    m_name = segmentName(name);
+    const size_t slotStride = (sizeof(SlotHeader) + maxPayload + PAGE - 1) & ~(PAGE - 1);
+    const size_t size = HEADER_SIZE + slotStride * slotCount;
+
+    // Start from a fresh segment so that subscribers of an earlier run
+    // never see a mix of old and new frames.  They still have the old one
+    // mapped, which tells them to move on.
+    const uint64_t generation = retireSegment(m_name) + 1;
+    shm_unlink(m_name.c_str());
+    int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        CRL_EXCEPTION("shm_open(%s) failed: %s\n", m_name.c_str(), strerror(errno));
+    }
+    if (0 != ftruncate(fd, size)) {
+        int error = errno;
+        ::close(fd);
+        shm_unlink(m_name.c_str());
+        CRL_EXCEPTION("Failed to size shared memory segment %s: %s\n",
+                      m_name.c_str(), strerror(error));
+    }
+
+    void *baseP = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (MAP_FAILED == baseP) {
+        shm_unlink(m_name.c_str());
+        CRL_EXCEPTION("Failed to map shared memory segment %s: %s\n",
+                      m_name.c_str(), strerror(errno));
+    }
+
+    m_baseP = baseP;
+    m_mappedSize = size;
+
+    // The segment starts out zeroed, so every slot state is 0 ("never
+    // written").  The magic number goes in last to tell subscribers the
+    // layout is ready.
+    RingHeader *headerP = ringHeader(m_baseP);
+    headerP->version = RING_VERSION;
+    headerP->slotCount = slotCount;
+    headerP->slotStride = slotStride;
+    headerP->maxPayload = slotStride - sizeof(SlotHeader);
+    headerP->generation = generation;
+    headerP->published.store(0, std::memory_order_relaxed);
+    headerP->magic.store(RING_MAGIC, std::memory_order_release);
+}
+
+void ShmPublisher::close() {
+    if (m_baseP) {
+        ringHeader(m_baseP)->retired.store(1, std::memory_order_release);
+        munmap(m_baseP, m_mappedSize);
+        shm_unlink(m_name.c_str());
+        m_baseP = 0;
+        m_mappedSize = 0;
+        m_pendingSlotP = 0;
+    }
+}
+
+void *ShmPublisher::beginWrite(size_t maxLength) {
+    if (!m_baseP || maxLength > ringHeader(m_baseP)->maxPayload) {
+        return 0;
+    }
+
+    // Only this process writes, so the counter can be read relaxed.
+    const uint64_t frame = ringHeader(m_baseP)->published.load(std::memory_order_relaxed);
+    SlotHeader *slotP = slotHeader(m_baseP, frame);
+
+    slotP->state.store(2 * frame + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    m_pendingSlotP = slotP;
+    return slotPayload(slotP);
+}
+
+void ShmPublisher::commit(const ShmFrameInfo &info) {
+    if (!m_pendingSlotP) {
+        return;
+    }
+
+    RingHeader *headerP = ringHeader(m_baseP);
+    SlotHeader *slotP = static_cast<SlotHeader *>(m_pendingSlotP);
+    const uint64_t frame = headerP->published.load(std::memory_order_relaxed);
+
+    slotP->info = info;
+    slotP->state.store(2 * frame + 2, std::memory_order_release);
+    headerP->published.store(frame + 1, std::memory_order_release);
+    m_pendingSlotP = 0;
+}
+
+bool ShmPublisher::publish(const ShmFrameInfo &info, const void *payloadP, size_t length) {
+    const ShmPiece piece = {payloadP, length};
+    return publish(info, &piece, 1);
+}
+
+bool ShmPublisher::publish(const ShmFrameInfo &info, const ShmPiece *piecesP, size_t pieceCount) {
+    size_t length = 0;
+    for (size_t i = 0; i < pieceCount; ++i) {
+        length += piecesP[i].length;
+    }
+
+    uint8_t *targetP = static_cast<uint8_t *>(beginWrite(length));
+    if (!targetP) {
+        return false;
+    }
+
+    for (size_t i = 0; i < pieceCount; ++i) {
+        std::memcpy(targetP, piecesP[i].dataP, piecesP[i].length);
+        targetP += piecesP[i].length;
+    }
+
+    ShmFrameInfo stamped = info;
+    stamped.payloadLength = length;
+    commit(stamped);
+    return true;
+}
+
+uint64_t ShmPublisher::published() const {
+    return m_baseP ? ringHeader(m_baseP)->published.load(std::memory_order_relaxed) : 0;
+}
+
+ShmSubscriber::ShmSubscriber()
+        : m_baseP(0),
+          m_mappedSize(0),
+          m_lastSequence(0),
+          m_dropped(0) {
+}
+
+ShmSubscriber::~ShmSubscriber() {
+    close();
+}
+
+bool ShmSubscriber::open(const std::string &name) {
+    close();
+    m_name = segmentName(name);
+    m_lastSequence = 0;
+    m_dropped = 0;
+    return map(m_name);
+}
+
+bool ShmSubscriber::map(const std::string &segment) {
+    int fd = shm_open(segment.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (0 != fstat(fd, &info) || static_cast<size_t>(info.st_size) < HEADER_SIZE) {
+        ::close(fd);
+        return false;
+    }
+
+    void *baseP = mmap(0, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (MAP_FAILED == baseP) {
+        return false;
+    }
+
+    RingHeader *headerP = ringHeader(baseP);
+    if (RING_MAGIC != headerP->magic.load(std::memory_order_acquire) ||
+        RING_VERSION != headerP->version ||
+        HEADER_SIZE + headerP->slotStride * headerP->slotCount > static_cast<size_t>(info.st_size)) {
+        munmap(baseP, info.st_size);
+        return false;
+    }
+
+    m_baseP = baseP;
+    m_mappedSize = info.st_size;
+    return true;
+}
+
+void ShmSubscriber::close() {
+    if (m_baseP) {
+        munmap(m_baseP, m_mappedSize);
+        m_baseP = 0;
+        m_mappedSize = 0;
+    }
+}
+
+uint64_t ShmSubscriber::generation() const {
+    return m_baseP ? ringHeader(m_baseP)->generation : 0;
+}
+
+// Move to the replacement of a retired segment, if there is one yet.
+// Frames fetched from the old segment stay readable until this runs.
+bool ShmSubscriber::current() {
+    if (!m_baseP) {
+        return false;
+    }
+    if (0 == ringHeader(m_baseP)->retired.load(std::memory_order_acquire)) {
+        return true;
+    }
+
+    void *oldBaseP = m_baseP;
+    const size_t oldSize = m_mappedSize;
+    if (!map(m_name)) {
+        return false;
+    }
+    if (0 != ringHeader(m_baseP)->retired.load(std::memory_order_acquire)) {
+        // The name still refers to the retired segment; the replacement
+        // is not there yet.
+        munmap(m_baseP, m_mappedSize);
+        m_baseP = oldBaseP;
+        m_mappedSize = oldSize;
+        return false;
+    }
+    munmap(oldBaseP, oldSize);
+    m_lastSequence = 0;
+    return true;
+}
+
+bool ShmSubscriber::read(uint64_t sequence, ShmFrame &frame) {
+    SlotHeader *slotP = slotHeader(m_baseP, sequence - 1);
+
+    if (2 * sequence != slotP->state.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    frame.info = slotP->info;
+    frame.payloadP = slotPayload(slotP);
+    frame.sequence = sequence;
+    frame.slotP = slotP;
+
+    // The metadata was copied out; make sure it was not torn.
+    return stillValid(frame);
+}
+
+bool ShmSubscriber::stillValid(const ShmFrame &frame) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const SlotHeader *slotP = static_cast<const SlotHeader *>(frame.slotP);
+    return 2 * frame.sequence == slotP->state.load(std::memory_order_relaxed);
+}
+
+bool ShmSubscriber::latest(ShmFrame &frame) {
+    if (!current()) {
+        return false;
+    }
+
+    const uint64_t published = ringHeader(m_baseP)->published.load(std::memory_order_acquire);
+    if (published <= m_lastSequence) {
+        return false;
+    }
+    if (!read(published, frame)) {
+        return false;
+    }
+
+    m_lastSequence = published;
+    return true;
+}
+
+bool ShmSubscriber::next(ShmFrame &frame) {
+    if (!current()) {
+        return false;
+    }
+
+    const uint32_t slotCount = ringHeader(m_baseP)->slotCount;
+
+    for (;;) {
+        const uint64_t published = ringHeader(m_baseP)->published.load(std::memory_order_acquire);
+        uint64_t wanted = m_lastSequence + 1;
+        if (wanted > published) {
+            return false;
+        }
+
+        // Skip ahead past frames that have already been overwritten,
+        // leaving one slot of headroom for the frame being written.
+        if (published - wanted + 1 >= slotCount) {
+            uint64_t oldest = published - slotCount + 2;
+            m_dropped += oldest - wanted;
+            wanted = oldest;
+        }
+
+        if (read(wanted, frame)) {
+            m_lastSequence = wanted;
+            return true;
+        }
+
+        // The publisher lapped us while reading; count the frame as lost
+        // and try the next one.
+        m_lastSequence = wanted;
+        m_dropped++;
+    }
+}
+
+} // namespace pipeline
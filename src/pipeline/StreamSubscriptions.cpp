@@ -0,0 +1,184 @@
+#include "pipeline/StreamSubscriptions.h"
+
+#include <cstdio>
+
+#include "pipeline/ScopedLock.h"
+
+namespace pipeline {
+
+StreamSubscriptions::StreamSubscriptions()
+        : m_nextId(1),
+          m_active(0),
+          m_updating(false),
+          m_updater(),
+          m_fps(0.0) {
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_mutex_init(&m_controlMutex, NULL);
+    for (double &bytes : m_frameBytes) {
+        bytes = 0.0;
+    }
+}
+
+StreamSubscriptions::~StreamSubscriptions() {
+    pthread_mutex_destroy(&m_controlMutex);
+    pthread_mutex_destroy(&m_mutex);
+}
+
+void StreamSubscriptions::setControl(const Control &start, const Control &stop) {
+    {
+        ScopedLock lock(&m_mutex);
+        m_start = start;
+        m_stop = stop;
+    }
+    update();
+}
+
+int StreamSubscriptions::subscribe(const std::string &name, Mask sources) {
+    int id;
+    {
+        ScopedLock lock(&m_mutex);
+        id = m_nextId++;
+        m_subscriptions.push_back({id, name, sources});
+    }
+    update();
+    return id;
+}
+
+void StreamSubscriptions::unsubscribe(int id) {
+    {
+        ScopedLock lock(&m_mutex);
+        for (size_t i = 0; i < m_subscriptions.size(); ++i) {
+            if (m_subscriptions[i].id == id) {
+                m_subscriptions.erase(m_subscriptions.begin() + i);
+                break;
+            }
+        }
+    }
+    update();
+}
+
+StreamSubscriptions::Mask StreamSubscriptions::active() const {
+    ScopedLock lock(&m_mutex);
+    return m_active;
+}
+
+StreamSubscriptions::Mask StreamSubscriptions::wanted() const {
+    ScopedLock lock(&m_mutex);
+    return wantedLocked();
+}
+
+std::string StreamSubscriptions::consumers(Mask sources) const {
+    ScopedLock lock(&m_mutex);
+    std::string names;
+    for (const Subscription &subscription : m_subscriptions) {
+        if (subscription.sources & sources) {
+            names += names.empty() ? subscription.name : ", " + subscription.name;
+        }
+    }
+    return names;
+}
+
+void StreamSubscriptions::setFrameBytes(Mask source, double bytes) {
+    ScopedLock lock(&m_mutex);
+    for (uint32_t bit = 0; bit < 64; ++bit) {
+        if (source & (Mask(1) << bit)) {
+            m_frameBytes[bit] = bytes;
+        }
+    }
+}
+
+void StreamSubscriptions::setFrameRate(double fps) {
+    ScopedLock lock(&m_mutex);
+    m_fps = fps;
+}
+
+double StreamSubscriptions::bytesPerSecond(Mask sources) const {
+    ScopedLock lock(&m_mutex);
+    double bytes = 0.0;
+    for (uint32_t bit = 0; bit < 64; ++bit) {
+        if (sources & (Mask(1) << bit)) {
+            bytes += m_frameBytes[bit];
+        }
+    }
+    return bytes * m_fps;
+}
+
+StreamSubscriptions::Mask StreamSubscriptions::wantedLocked() const {
+    Mask sources = 0;
+    for (const Subscription &subscription : m_subscriptions) {
+        sources |= subscription.sources;
+    }
+    return sources;
+}
+
+void StreamSubscriptions::update() {
+    // A control calling back leaves its change to the loop it runs in.
+    {
+        ScopedLock lock(&m_mutex);
+        if (m_updating && pthread_equal(m_updater, pthread_self())) {
+            return;
+        }
+    }
+
+    // Only one update talks to the sensor at a time, so two of them cannot
+    // work from the same stale m_active.  Subscriptions that change while
+    // the controls run are picked up by the loop.
+    ScopedLock controlLock(&m_controlMutex);
+    {
+        ScopedLock lock(&m_mutex);
+        m_updating = true;
+        m_updater = pthread_self();
+    }
+
+    runControls();
+
+    ScopedLock lock(&m_mutex);
+    m_updating = false;
+}
+
+void StreamSubscriptions::runControls() {
+    for (;;) {
+        Control start;
+        Control stop;
+        Mask unused;
+        Mask missing;
+        {
+            ScopedLock lock(&m_mutex);
+            if (!m_start || !m_stop) {
+                return;
+            }
+            start = m_start;
+            stop = m_stop;
+
+            const Mask wanted = wantedLocked();
+            unused = m_active & ~wanted;
+            missing = wanted & ~m_active;
+        }
+        if (!unused && !missing) {
+            return;
+        }
+
+        // Stop first, so the link is freed before anything new is started.
+        // A failed control is not retried until the subscriptions change
+        // again.
+        const bool stopped = !unused || stop(unused);
+        const bool started = !missing || start(missing);
+
+        ScopedLock lock(&m_mutex);
+        if (stopped) {
+            m_active &= ~unused;
+        } else {
+            fprintf(stderr, "Failed to stop streams 0x%08llx\n", static_cast<unsigned long long>(unused));
+        }
+        if (started) {
+            m_active |= missing;
+        } else {
+            fprintf(stderr, "Failed to start streams 0x%08llx\n", static_cast<unsigned long long>(missing));
+        }
+        if (!stopped || !started) {
+            return;
+        }
+    }
+}
+
+} // namespace pipeline
@@ -0,0 +1,141 @@
+#include "pipeline/TemporalFilter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "pipeline/RegionOfInterest.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace pipeline {
+
+TemporalFilter::TemporalFilter()
+        : m_width(0),
+          m_height(0),
+          m_regionSerial(0),
+          m_alphaQ15(0),
+          m_resetThreshold(0) {
+    setParameters(0.3f, 1.0f);
+}
+
+void TemporalFilter::setParameters(float alpha, float resetThreshold) {
+    alpha = std::min(std::max(alpha, 1.0f / 32768.0f), 1.0f);
+    m_alphaQ15 = static_cast<int16_t>(std::min(std::lround(alpha * 32768.0f), 32767L));
+
+    // Raw disparity carries 4 fractional bits.  The threshold is capped so
+    // that doubling a difference that passed the test can never overflow
+    // 16 bits in the update kernel.
+    long threshold = std::lround(std::max(resetThreshold, 0.0f) * 16.0f);
+    m_resetThreshold = static_cast<int16_t>(std::min(threshold, 16383L));
+}
+
+void TemporalFilter::reset() {
+    m_width = 0;
+    m_height = 0;
+}
+
+const uint16_t *TemporalFilter::apply(const uint16_t *disparityP,
+                                      uint32_t width,
+                                      uint32_t height,
+                                      const RegionOfInterest *regionP) {
+    const size_t count = static_cast<size_t>(width) * height;
+    if (regionP && (regionP->width() != width || regionP->height() != height || regionP->isFull())) {
+        regionP = 0;
+    }
+    const uint64_t regionSerial = regionP ? regionP->serial() : 0;
+
+    // A new frame size or region invalidates the history.  The buffer is
+    // only reallocated when it has to grow.
+    if (width != m_width || height != m_height || regionSerial != m_regionSerial) {
+        m_state.resize(count);
+        m_width = width;
+        m_height = height;
+        m_regionSerial = regionSerial;
+
+        if (!regionP) {
+            std::memcpy(m_state.data(), disparityP, count * sizeof(uint16_t));
+            return m_state.data();
+        }
+
+        std::fill(m_state.begin(), m_state.end(), 0);
+        for (uint32_t r = regionP->firstRow(); r < regionP->endRow(); ++r) {
+            size_t spanCount;
+            const RoiSpan *spansP = regionP->spans(r, spanCount);
+            const size_t rowStart = static_cast<size_t>(r) * width;
+            for (size_t k = 0; k < spanCount; ++k) {
+                std::memcpy(&m_state[rowStart + spansP[k].begin], disparityP + rowStart + spansP[k].begin,
+                            (spansP[k].end - spansP[k].begin) * sizeof(uint16_t));
+            }
+        }
+        return m_state.data();
+    }
+
+    if (!regionP) {
+        filter(m_state.data(), disparityP, 0, count);
+        return m_state.data();
+    }
+
+    for (uint32_t r = regionP->firstRow(); r < regionP->endRow(); ++r) {
+        size_t spanCount;
+        const RoiSpan *spansP = regionP->spans(r, spanCount);
+        const size_t rowStart = static_cast<size_t>(r) * width;
+        for (size_t k = 0; k < spanCount; ++k) {
+            filter(m_state.data(), disparityP, rowStart + spansP[k].begin, rowStart + spansP[k].end);
+        }
+    }
+    return m_state.data();
+}
+
+void TemporalFilter::filter(uint16_t *stateP, const uint16_t *disparityP, size_t begin, size_t end) const {
+    size_t i = begin;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi16(m_alphaQ15);
+    const __m128i threshold = _mm_set1_epi16(m_resetThreshold);
+
+    for (; i + 8 <= end; i += 8) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(stateP + i));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(disparityP + i));
+
+        __m128i diff = _mm_sub_epi16(d, s);
+        __m128i absDiff = _mm_max_epi16(diff, _mm_sub_epi16(zero, diff));
+
+        // Pixels that moved too far, or where either sample is invalid,
+        // restart from the new measurement.
+        __m128i restart = _mm_or_si128(_mm_cmpgt_epi16(absDiff, threshold),
+                                       _mm_or_si128(_mm_cmpeq_epi16(s, zero),
+                                                    _mm_cmpeq_epi16(d, zero)));
+
+        // step = round(diff * alpha), computed as the high half of
+        // (2 * diff) * alphaQ15 plus the carry out of the low half.
+        __m128i diff2 = _mm_slli_epi16(diff, 1);
+        __m128i step = _mm_add_epi16(_mm_mulhi_epi16(diff2, alpha),
+                                     _mm_srli_epi16(_mm_mullo_epi16(diff2, alpha), 15));
+        __m128i filtered = _mm_add_epi16(s, step);
+
+        __m128i result = _mm_or_si128(_mm_and_si128(restart, d),
+                                      _mm_andnot_si128(restart, filtered));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(stateP + i), result);
+    }
+#endif
+
+    // Scalar tail, using the same fixed point arithmetic as above.
+    for (; i < end; ++i) {
+        int16_t s = static_cast<int16_t>(stateP[i]);
+        int16_t d = static_cast<int16_t>(disparityP[i]);
+        int16_t diff = static_cast<int16_t>(d - s);
+
+        if (0 == s || 0 == d || std::abs(static_cast<int32_t>(diff)) > m_resetThreshold) {
+            stateP[i] = disparityP[i];
+        } else {
+            int32_t step = (2 * static_cast<int32_t>(diff) * m_alphaQ15 + 0x8000) >> 16;
+            stateP[i] = static_cast<uint16_t>(s + step);
+        }
+    }
+}
+
+} // namespace pipeline
@@ -0,0 +1,126 @@
+#include "pipeline/ToneMapper.h"
+
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace pipeline {
+
+namespace {
+
+uint32_t clampBits(uint32_t inputBits) {
+    return inputBits < 1 ? 1 : (inputBits > 16 ? 16 : inputBits);
+}
+
+} // anonymous namespace
+
+ToneMapper::ToneMapper() {
+    setLinear(12, 0, 4095);
+}
+
+void ToneMapper::setLinear(uint32_t inputBits, uint16_t black, uint16_t white) {
+    m_curve = Curve_Linear;
+    m_inputBits = clampBits(inputBits);
+    m_black = black;
+    m_range = white > black ? white - black : 1;
+
+    // Rounding the gain up keeps range * gain >> 16 at or below 255.
+    const uint64_t gain = ((255ull << 16) + m_range - 1) / m_range;
+    if (gain <= 0xffff) {
+        m_gain = static_cast<uint32_t>(gain);
+        m_lut.clear();
+        return;
+    }
+
+    // Ranges below 256 steps would need a gain that does not fit the
+    // 16-bit multiply, so fall back to a table.
+    m_gain = 0;
+    m_lut.resize(size_t(1) << m_inputBits);
+    for (size_t v = 0; v < m_lut.size(); ++v) {
+        const uint32_t x = v > black ? static_cast<uint32_t>(v - black) : 0;
+        m_lut[v] = static_cast<uint8_t>(x >= m_range ? 255 : (x * 255 + m_range / 2) / m_range);
+    }
+}
+
+void ToneMapper::setGamma(uint32_t inputBits, uint16_t black, uint16_t white, float gamma) {
+    m_curve = Curve_Gamma;
+    m_inputBits = clampBits(inputBits);
+    m_black = black;
+    m_range = white > black ? white - black : 1;
+    m_gain = 0;
+
+    const float exponent = gamma > 0.0f ? 1.0f / gamma : 1.0f;
+    m_lut.resize(size_t(1) << m_inputBits);
+    for (size_t v = 0; v < m_lut.size(); ++v) {
+        const float x = v > black ? static_cast<float>(v - black) / m_range : 0.0f;
+        m_lut[v] = static_cast<uint8_t>(std::lround(255.0f * std::pow(x < 1.0f ? x : 1.0f, exponent)));
+    }
+}
+
+void ToneMapper::setLut(uint32_t inputBits, const uint8_t *lutP) {
+    m_curve = Curve_Lut;
+    m_inputBits = clampBits(inputBits);
+    m_gain = 0;
+    m_lut.assign(lutP, lutP + (size_t(1) << m_inputBits));
+}
+
+void ToneMapper::apply(const uint16_t *inP, uint8_t *outP, size_t n) const {
+    size_t i = 0;
+
+    if (!m_lut.empty()) {
+        // Clamp instead of masking, so stray high bits saturate rather
+        // than wrap around.
+        const uint16_t last = static_cast<uint16_t>(m_lut.size() - 1);
+        const uint8_t *lutP = m_lut.data();
+        for (; i + 4 <= n; i += 4) {
+            outP[i] = lutP[inP[i] < last ? inP[i] : last];
+            outP[i + 1] = lutP[inP[i + 1] < last ? inP[i + 1] : last];
+            outP[i + 2] = lutP[inP[i + 2] < last ? inP[i + 2] : last];
+            outP[i + 3] = lutP[inP[i + 3] < last ? inP[i + 3] : last];
+        }
+        for (; i < n; ++i) {
+            outP[i] = lutP[inP[i] < last ? inP[i] : last];
+        }
+        return;
+    }
+
+#ifdef __SSE2__
+    const __m128i black = _mm_set1_epi16(static_cast<short>(m_black));
+    const __m128i range = _mm_set1_epi16(static_cast<short>(m_range));
+    const __m128i gain = _mm_set1_epi16(static_cast<short>(m_gain));
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(inP + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(inP + i + 8));
+
+        // min(x, range) is x - max(x - range, 0) with unsigned saturation.
+        a = _mm_subs_epu16(a, black);
+        b = _mm_subs_epu16(b, black);
+        a = _mm_sub_epi16(a, _mm_subs_epu16(a, range));
+        b = _mm_sub_epi16(b, _mm_subs_epu16(b, range));
+
+        a = _mm_mulhi_epu16(a, gain);
+        b = _mm_mulhi_epu16(b, gain);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(outP + i), _mm_packus_epi16(a, b));
+    }
+#endif
+
+    for (; i < n; ++i) {
+        uint32_t x = inP[i] > m_black ? inP[i] - m_black : 0;
+        x = x < m_range ? x : m_range;
+        outP[i] = static_cast<uint8_t>((x * m_gain) >> 16);
+    }
+}
+
+void ToneMapper::apply(const uint16_t *inP, size_t inStride,
+                       uint8_t *outP, size_t outStride,
+                       uint32_t width, uint32_t height) const {
+    for (uint32_t r = 0; r < height; ++r) {
+        apply(inP + r * inStride, outP + r * outStride, width);
+    }
+}
+
+} // namespace pipeline
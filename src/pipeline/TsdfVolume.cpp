@@ -0,0 +1,558 @@
+#include "pipeline/TsdfVolume.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "pipeline/Reprojection.h"
+#include "pipeline/WorkerPool.h"
+
+namespace pipeline {
+
+namespace {
+
+const float DISTANCE_SCALE = 32767.0f;
+
+// Block coordinates are packed into 21 bits each, which covers +/-1M
+// blocks in every direction.
+const int32_t COORDINATE_BIAS = 1 << 20;
+const uint64_t COORDINATE_MASK = (1u << 21) - 1;
+
+// Sampled pixel rows per block collection task.
+const uint32_t TILE_SAMPLE_ROWS = 8;
+
+// Pinhole projection of viewer-convention camera points into the
+// disparity image, derived from the reprojector's ray tables.
+struct Projection {
+    explicit Projection(const DisparityReprojector &reprojector)
+            : width(reprojector.width()),
+              height(reprojector.height()),
+              columnStep(width > 1 ? reprojector.columnTerm(1) - reprojector.columnTerm(0) : 1.0f),
+              columnZero(width > 0 ? reprojector.columnTerm(0) : 0.0f),
+              rowStep(height > 1 ? reprojector.rowTerm(1) - reprojector.rowTerm(0) : 1.0f),
+              rowZero(height > 0 ? reprojector.rowTerm(0) : 0.0f),
+              depthTerm(reprojector.depthTerm()),
+              disparityScale(reprojector.disparityScale()),
+              wOffset(reprojector.wOffset()) {
+    }
+
+    // Distance in front of the camera of a raw disparity.
+    float distance(uint16_t disparity) const { return depthTerm / (disparity * disparityScale + wOffset); }
+
+    // Pixel of a point `forward` meters in front of the camera.
+    bool pixel(float x, float y, float forward, uint32_t &column, uint32_t &row) const {
+        const float c = (x / forward * depthTerm - columnZero) / columnStep + 0.5f;
+        const float r = (-y / forward * depthTerm - rowZero) / rowStep + 0.5f;
+        if (!(c >= 0.0f && c < width && r >= 0.0f && r < height)) {
+            return false;
+        }
+        column = static_cast<uint32_t>(c);
+        row = static_cast<uint32_t>(r);
+        return true;
+    }
+
+    uint32_t width;
+    uint32_t height;
+    float columnStep;
+    float columnZero;
+    float rowStep;
+    float rowZero;
+    float depthTerm;
+    float disparityScale;
+    float wOffset;
+};
+
+bool included(const DisparityReprojector &reprojector, uint32_t column, uint32_t row) {
+    size_t spanCount;
+    const RoiSpan *spansP = reprojector.spans(row, spanCount);
+    for (size_t k = 0; k < spanCount; ++k) {
+        if (column >= spansP[k].begin && column < spansP[k].end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // anonymous namespace
+
+TsdfVolume::TsdfVolume()
+        : TsdfVolume(Config()) {
+}
+
+TsdfVolume::TsdfVolume(const Config &config)
+        : m_config(config),
+          m_frame(0) {
+    if (0 == m_config.pixelStride) {
+        m_config.pixelStride = 1;
+    }
+    if (0 == m_config.maxWeight) {
+        m_config.maxWeight = 1;
+    }
+}
+
+void TsdfVolume::reset() {
+    m_lookup.clear();
+    m_evicted.clear();
+    m_blocks.clear();
+    m_freeBlocks.clear();
+    m_touched.clear();
+}
+
+uint64_t TsdfVolume::keyOf(int32_t x, int32_t y, int32_t z) {
+    return ((static_cast<uint64_t>(x + COORDINATE_BIAS) & COORDINATE_MASK) << 42) |
+           ((static_cast<uint64_t>(y + COORDINATE_BIAS) & COORDINATE_MASK) << 21) |
+           (static_cast<uint64_t>(z + COORDINATE_BIAS) & COORDINATE_MASK);
+}
+
+void TsdfVolume::collectBlocks(const DisparityReprojector &reprojector,
+                               const uint16_t *disparityP,
+                               const Pose &cameraPose,
+                               uint32_t beginRow,
+                               uint32_t endRow,
+                               std::vector<uint64_t> &keys) const {
+    const RegionOfInterest &region = reprojector.region();
+    const float inverseBlock = 1.0f / (m_config.voxelSize * BLOCK_SIZE);
+    const float truncation = m_config.truncation;
+    const uint32_t stride = m_config.pixelStride;
+    const float scale = reprojector.disparityScale();
+    const float offset = reprojector.wOffset();
+    const float depthTerm = reprojector.depthTerm();
+
+    // Neighbouring pixels mostly fall into the same blocks, so a key is
+    // only recorded when it differs from the last one of its ray step.
+    uint64_t lastKeys[3] = {~0ull, ~0ull, ~0ull};
+
+    for (uint32_t r = beginRow; r < endRow; r += stride) {
+        const uint16_t *rowP = disparityP + static_cast<size_t>(r) * reprojector.width();
+        const float rowTerm = reprojector.rowTerm(r);
+
+        size_t spanCount;
+        const RoiSpan *spansP = reprojector.spans(r, spanCount);
+        for (size_t k = 0; k < spanCount; ++k) {
+            for (uint32_t c = (spansP[k].begin + stride - 1) / stride * stride; c < spansP[k].end; c += stride) {
+                const uint16_t d = rowP[c];
+                if (0 == d) {
+                    continue;
+                }
+                const float inverseW = 1.0f / (d * scale + offset);
+                const float forward = depthTerm * inverseW;
+                const float point[3] = {reprojector.columnTerm(c) * inverseW, -rowTerm * inverseW, -forward};
+                if (forward < m_config.minDistance || forward > m_config.maxDistance ||
+                    !region.inCropBox(point[0], point[1], point[2])) {
+                    continue;
+                }
+
+                // Blocks within truncation along the ray, in front of and
+                // behind the surface.
+                for (int step = -1; step <= 1; ++step) {
+                    const float along = (forward + step * truncation) / forward;
+                    const float sample[3] = {point[0] * along, point[1] * along, point[2] * along};
+                    float world[3];
+                    cameraPose.apply(sample, world);
+
+                    const uint64_t key = keyOf(static_cast<int32_t>(std::floor(world[0] * inverseBlock)),
+                                               static_cast<int32_t>(std::floor(world[1] * inverseBlock)),
+                                               static_cast<int32_t>(std::floor(world[2] * inverseBlock)));
+                    if (key != lastKeys[step + 1]) {
+                        lastKeys[step + 1] = key;
+                        keys.push_back(key);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void TsdfVolume::allocate(const DisparityReprojector &reprojector,
+                          const uint16_t *disparityP,
+                          const Pose &cameraPose,
+                          WorkerPool *poolP) {
+    // Keys are collected per worker over row tiles, then merged and
+    // looked up once each on this thread.
+    const uint32_t workers = poolP ? poolP->size() : 1;
+    if (m_workerKeys.size() < workers) {
+        m_workerKeys.resize(workers);
+    }
+    for (std::vector<uint64_t> &keys : m_workerKeys) {
+        keys.clear();
+    }
+
+    const uint32_t firstRow = reprojector.firstRow();
+    const uint32_t endRow = reprojector.endRow();
+    const uint32_t tileRows = TILE_SAMPLE_ROWS * m_config.pixelStride;
+    const size_t tiles = endRow > firstRow ? (endRow - firstRow + tileRows - 1) / tileRows : 0;
+    WorkerPool::Task collect = [&](size_t tile, uint32_t worker) {
+        const uint32_t begin = firstRow + static_cast<uint32_t>(tile) * tileRows;
+        const uint32_t end = begin + tileRows < endRow ? begin + tileRows : endRow;
+        collectBlocks(reprojector, disparityP, cameraPose, begin, end, m_workerKeys[worker]);
+    };
+    if (poolP) {
+        poolP->run(tiles, collect);
+    } else {
+        for (size_t tile = 0; tile < tiles; ++tile) {
+            collect(tile, 0);
+        }
+    }
+
+    std::vector<uint64_t> &keys = m_workerKeys[0];
+    for (uint32_t worker = 1; worker < workers; ++worker) {
+        keys.insert(keys.end(), m_workerKeys[worker].begin(), m_workerKeys[worker].end());
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    m_touched.clear();
+    for (uint64_t key : keys) {
+        size_t index;
+        auto found = m_lookup.find(key);
+        if (found != m_lookup.end()) {
+            index = found->second;
+        } else {
+            if (m_freeBlocks.empty()) {
+                index = m_blocks.size();
+                m_blocks.emplace_back();
+            } else {
+                index = m_freeBlocks.back();
+                m_freeBlocks.pop_back();
+            }
+            Block &block = m_blocks[index];
+            block.coordinates[0] = static_cast<int32_t>((key >> 42) & COORDINATE_MASK) - COORDINATE_BIAS;
+            block.coordinates[1] = static_cast<int32_t>((key >> 21) & COORDINATE_MASK) - COORDINATE_BIAS;
+            block.coordinates[2] = static_cast<int32_t>(key & COORDINATE_MASK) - COORDINATE_BIAS;
+            block.changed = false;
+            for (bool &face : block.faceChanged) {
+                face = false;
+            }
+            for (Voxel &voxel : block.voxels) {
+                voxel.distance = 0;
+                voxel.weight = 0;
+            }
+            m_lookup[key] = index;
+        }
+        m_blocks[index].updatedFrame = m_frame;
+        m_touched.push_back(index);
+    }
+}
+
+void TsdfVolume::updateBlock(const DisparityReprojector &reprojector,
+                             const uint16_t *disparityP,
+                             const Pose &worldToCamera,
+                             Block &block) const {
+    const Projection projection(reprojector);
+    const float voxelSize = m_config.voxelSize;
+    const float inverseTruncation = 1.0f / m_config.truncation;
+
+    // Camera coordinates of the first voxel center, and the steps to the
+    // next voxel along each block axis.
+    const float origin[3] = {(block.coordinates[0] * static_cast<float>(BLOCK_SIZE) + 0.5f) * voxelSize,
+                             (block.coordinates[1] * static_cast<float>(BLOCK_SIZE) + 0.5f) * voxelSize,
+                             (block.coordinates[2] * static_cast<float>(BLOCK_SIZE) + 0.5f) * voxelSize};
+    float base[3];
+    worldToCamera.apply(origin, base);
+    const float axes[3][3] = {{voxelSize, 0.0f, 0.0f}, {0.0f, voxelSize, 0.0f}, {0.0f, 0.0f, voxelSize}};
+    float steps[3][3];
+    for (int a = 0; a < 3; ++a) {
+        worldToCamera.rotate(axes[a], steps[a]);
+    }
+
+    bool changed = false;
+    bool faces[3] = {false, false, false};
+    for (uint32_t k = 0; k < BLOCK_SIZE; ++k) {
+        for (uint32_t j = 0; j < BLOCK_SIZE; ++j) {
+            for (uint32_t i = 0; i < BLOCK_SIZE; ++i) {
+                float p[3];
+                for (int a = 0; a < 3; ++a) {
+                    p[a] = base[a] + i * steps[0][a] + j * steps[1][a] + k * steps[2][a];
+                }
+                const float forward = -p[2];
+                uint32_t column, row;
+                if (forward < m_config.minDistance || !projection.pixel(p[0], p[1], forward, column, row)) {
+                    continue;
+                }
+                if (row < reprojector.firstRow() || row >= reprojector.endRow()) {
+                    continue;
+                }
+                const uint16_t d = disparityP[static_cast<size_t>(row) * projection.width + column];
+                if (0 == d || !included(reprojector, column, row)) {
+                    continue;
+                }
+                const float measured = projection.distance(d);
+                if (measured < m_config.minDistance || measured > m_config.maxDistance) {
+                    continue;
+                }
+
+                // Positive in front of the surface; voxels far behind it
+                // are hidden and left alone.
+                const float signedDistance = (measured - forward) * inverseTruncation;
+                if (signedDistance < -1.0f) {
+                    continue;
+                }
+                const float sample = signedDistance < 1.0f ? signedDistance : 1.0f;
+
+                Voxel &voxel = block.voxels[(k * BLOCK_SIZE + j) * BLOCK_SIZE + i];
+                const float weight = voxel.weight;
+                const float fused = (voxel.distance / DISTANCE_SCALE * weight + sample) / (weight + 1.0f);
+                voxel.distance = static_cast<int16_t>(std::lround(fused * DISTANCE_SCALE));
+                voxel.weight = voxel.weight < m_config.maxWeight ? voxel.weight + 1 : m_config.maxWeight;
+                changed = true;
+                faces[0] = faces[0] || 0 == i;
+                faces[1] = faces[1] || 0 == j;
+                faces[2] = faces[2] || 0 == k;
+            }
+        }
+    }
+
+    if (changed) {
+        block.changed = true;
+        for (int a = 0; a < 3; ++a) {
+            block.faceChanged[a] = block.faceChanged[a] || faces[a];
+        }
+    }
+}
+
+void TsdfVolume::evict(const Pose &cameraPose) {
+    const float blockSize = m_config.voxelSize * BLOCK_SIZE;
+    const float limit = m_config.evictDistance * m_config.evictDistance;
+
+    std::vector<uint64_t> distant;
+    for (const auto &entry : m_lookup) {
+        const Block &block = m_blocks[entry.second];
+        float squared = 0.0f;
+        for (int a = 0; a < 3; ++a) {
+            const float center = (block.coordinates[a] + 0.5f) * blockSize;
+            squared += (center - cameraPose.translation[a]) * (center - cameraPose.translation[a]);
+        }
+        if (squared > limit) {
+            distant.push_back(entry.first);
+        }
+    }
+    for (uint64_t key : distant) {
+        release(key);
+    }
+
+    if (m_lookup.size() <= m_config.maxBlocks) {
+        return;
+    }
+
+    // Still too many: drop the blocks that were updated least recently.
+    std::vector<std::pair<uint64_t, uint64_t> > ages;
+    ages.reserve(m_lookup.size());
+    for (const auto &entry : m_lookup) {
+        ages.push_back(std::make_pair(m_blocks[entry.second].updatedFrame, entry.first));
+    }
+    const size_t excess = m_lookup.size() - m_config.maxBlocks;
+    std::nth_element(ages.begin(), ages.begin() + excess, ages.end());
+    for (size_t i = 0; i < excess; ++i) {
+        release(ages[i].second);
+    }
+}
+
+void TsdfVolume::release(uint64_t key) {
+    auto found = m_lookup.find(key);
+    if (found == m_lookup.end()) {
+        return;
+    }
+    Block &block = m_blocks[found->second];
+    block.changed = false;
+    m_freeBlocks.push_back(found->second);
+    m_lookup.erase(found);
+    m_evicted.push_back(key);
+
+    // The blocks below lose their crossings into this one.
+    const bool faces[3] = {true, true, true};
+    markNeighboursBelow(block.coordinates, faces);
+}
+
+const TsdfVolume::Block *TsdfVolume::findBlock(int32_t x, int32_t y, int32_t z) const {
+    auto found = m_lookup.find(keyOf(x, y, z));
+    return found != m_lookup.end() ? &m_blocks[found->second] : 0;
+}
+
+void TsdfVolume::markNeighboursBelow(const int32_t coordinates[3], const bool faces[3]) {
+    for (int a = 0; a < 3; ++a) {
+        if (!faces[a]) {
+            continue;
+        }
+        int32_t below[3] = {coordinates[0], coordinates[1], coordinates[2]};
+        below[a]--;
+        auto found = m_lookup.find(keyOf(below[0], below[1], below[2]));
+        if (found != m_lookup.end()) {
+            m_blocks[found->second].changed = true;
+        }
+    }
+}
+
+void TsdfVolume::integrate(const DisparityReprojector &reprojector,
+                           const uint16_t *disparityP,
+                           const Pose &cameraPose,
+                           WorkerPool *poolP) {
+    if (!reprojector.isValid()) {
+        return;
+    }
+    m_frame++;
+
+    allocate(reprojector, disparityP, cameraPose, poolP);
+
+    const Pose worldToCamera = cameraPose.inverse();
+    WorkerPool::Task update = [&](size_t task, uint32_t) {
+        updateBlock(reprojector, disparityP, worldToCamera, m_blocks[m_touched[task]]);
+    };
+    if (poolP) {
+        poolP->run(m_touched.size(), update);
+    } else {
+        for (size_t task = 0; task < m_touched.size(); ++task) {
+            update(task, 0);
+        }
+    }
+
+    evict(cameraPose);
+}
+
+void TsdfVolume::extractBlock(const Block &block, std::vector<float> &xyz) const {
+    const float voxelSize = m_config.voxelSize;
+    const uint16_t minWeight = m_config.minExtractWeight > 0 ? m_config.minExtractWeight : 1;
+    const uint32_t strides[3] = {1, BLOCK_SIZE, BLOCK_SIZE * BLOCK_SIZE};
+
+    // The next voxels after the last ones along each axis are the first
+    // ones of the neighbouring blocks above, if those exist.
+    const Block *aboveP[3] = {
+            findBlock(block.coordinates[0] + 1, block.coordinates[1], block.coordinates[2]),
+            findBlock(block.coordinates[0], block.coordinates[1] + 1, block.coordinates[2]),
+            findBlock(block.coordinates[0], block.coordinates[1], block.coordinates[2] + 1)};
+
+    xyz.clear();
+    for (uint32_t k = 0; k < BLOCK_SIZE; ++k) {
+        for (uint32_t j = 0; j < BLOCK_SIZE; ++j) {
+            for (uint32_t i = 0; i < BLOCK_SIZE; ++i) {
+                const uint32_t index = (k * BLOCK_SIZE + j) * BLOCK_SIZE + i;
+                const Voxel &voxel = block.voxels[index];
+                if (voxel.weight < minWeight) {
+                    continue;
+                }
+                const uint32_t position[3] = {i, j, k};
+
+                // Zero crossings towards the next voxel along each axis.
+                for (int a = 0; a < 3; ++a) {
+                    const Voxel *nextP;
+                    if (position[a] + 1 < BLOCK_SIZE) {
+                        nextP = &block.voxels[index + strides[a]];
+                    } else if (aboveP[a]) {
+                        nextP = &aboveP[a]->voxels[index - (BLOCK_SIZE - 1) * strides[a]];
+                    } else {
+                        continue;
+                    }
+                    const Voxel &next = *nextP;
+                    if (next.weight < minWeight || (voxel.distance > 0) == (next.distance > 0) ||
+                        voxel.distance == next.distance) {
+                        continue;
+                    }
+                    const float t = static_cast<float>(voxel.distance) / (voxel.distance - next.distance);
+                    for (int b = 0; b < 3; ++b) {
+                        const float voxelCoordinate = block.coordinates[b] * static_cast<float>(BLOCK_SIZE) +
+                                                      position[b] + 0.5f + (a == b ? t : 0.0f);
+                        xyz.push_back(voxelCoordinate * voxelSize);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void TsdfVolume::extractChanged(std::vector<TsdfBlockPoints> &updated,
+                                std::vector<uint64_t> &evicted,
+                                WorkerPool *poolP) {
+    evicted.swap(m_evicted);
+    m_evicted.clear();
+
+    // Changed faces change the points of the blocks below them.
+    for (const auto &entry : m_lookup) {
+        Block &block = m_blocks[entry.second];
+        markNeighboursBelow(block.coordinates, block.faceChanged);
+        for (bool &face : block.faceChanged) {
+            face = false;
+        }
+    }
+
+    std::vector<const Block *> changed;
+    for (const auto &entry : m_lookup) {
+        Block &block = m_blocks[entry.second];
+        if (block.changed) {
+            block.changed = false;
+            changed.push_back(&block);
+        }
+    }
+
+    updated.resize(changed.size());
+    WorkerPool::Task extract = [&](size_t task, uint32_t) {
+        const Block &block = *changed[task];
+        updated[task].key = keyOf(block.coordinates[0], block.coordinates[1], block.coordinates[2]);
+        extractBlock(block, updated[task].xyz);
+    };
+    if (poolP) {
+        poolP->run(changed.size(), extract);
+    } else {
+        for (size_t task = 0; task < changed.size(); ++task) {
+            extract(task, 0);
+        }
+    }
+}
+
+void TsdfSurface::apply(const std::vector<TsdfBlockPoints> &updated, const std::vector<uint64_t> &evicted) {
+    for (uint64_t key : evicted) {
+        assign(key, 0, 0);
+    }
+    for (const TsdfBlockPoints &block : updated) {
+        assign(block.key, block.xyz.data(), block.xyz.size() / 3);
+    }
+}
+
+void TsdfSurface::clear() {
+    m_xyz.clear();
+    m_owners.clear();
+    m_slots.clear();
+}
+
+void TsdfSurface::assign(uint64_t key, const float *xyzP, size_t count) {
+    auto found = m_slots.find(key);
+    if (m_slots.end() == found) {
+        if (0 == count) {
+            return;
+        }
+        found = m_slots.emplace(key, std::vector<uint32_t>()).first;
+    }
+    std::vector<uint32_t> &slots = found->second;
+
+    while (slots.size() > count) {
+        removeLast(slots);
+    }
+
+    for (size_t i = 0; i < slots.size(); ++i) {
+        std::copy(xyzP + 3 * i, xyzP + 3 * i + 3, m_xyz.begin() + 3 * static_cast<size_t>(slots[i]));
+    }
+    for (size_t i = slots.size(); i < count; ++i) {
+        slots.push_back(static_cast<uint32_t>(m_owners.size()));
+        m_owners.push_back({key, static_cast<uint32_t>(i)});
+        m_xyz.insert(m_xyz.end(), xyzP + 3 * i, xyzP + 3 * i + 3);
+    }
+
+    if (slots.empty()) {
+        m_slots.erase(found);
+    }
+}
+
+void TsdfSurface::removeLast(std::vector<uint32_t> &slots) {
+    const size_t slot = slots.back();
+    slots.pop_back();
+
+    // Move the last point of the array into the freed slot and tell its
+    // block where it went.
+    const size_t last = m_owners.size() - 1;
+    if (slot != last) {
+        std::copy(m_xyz.begin() + 3 * last, m_xyz.begin() + 3 * last + 3, m_xyz.begin() + 3 * slot);
+        m_owners[slot] = m_owners[last];
+        m_slots[m_owners[slot].key][m_owners[slot].rank] = static_cast<uint32_t>(slot);
+    }
+    m_owners.pop_back();
+    m_xyz.resize(3 * last);
+}
+
+} // namespace pipeline
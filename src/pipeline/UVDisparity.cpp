@@ -0,0 +1,312 @@
+#include "pipeline/UVDisparity.h"
+
+#include <cmath>
+#include <cstdlib>
+
+#include "pipeline/Reprojection.h"
+#include "pipeline/WorkerPool.h"
+
+namespace pipeline {
+
+namespace {
+
+// Histogram cells per merge task.
+const size_t MERGE_CELLS = 16384;
+
+} // anonymous namespace
+
+UVDisparityDetector::UVDisparityDetector()
+        : UVDisparityDetector(Config()) {
+}
+
+UVDisparityDetector::UVDisparityDetector(const Config &config)
+        : m_config(config),
+          m_width(0),
+          m_height(0),
+          m_frame(0),
+          m_randomState(0x2545f491u) {
+    if (0 == m_config.maxDisparity) {
+        m_config.maxDisparity = 1;
+    }
+    if (0 == m_config.rowsPerTile) {
+        m_config.rowsPerTile = 1;
+    }
+}
+
+uint32_t UVDisparityDetector::random() {
+    m_randomState ^= m_randomState << 13;
+    m_randomState ^= m_randomState >> 17;
+    m_randomState ^= m_randomState << 5;
+    return m_randomState;
+}
+
+void UVDisparityDetector::binRows(const DisparityReprojector &reprojector,
+                                  const uint16_t *disparityP,
+                                  uint32_t beginRow,
+                                  uint32_t endRow,
+                                  std::vector<uint16_t> &u) {
+    const uint32_t bins = m_config.maxDisparity;
+    const uint32_t lastBin = bins - 1;
+    const uint32_t minBin = m_config.minDisparity;
+    uint16_t *uP = u.data();
+
+    for (uint32_t r = beginRow; r < endRow; ++r) {
+        const uint16_t *rowP = disparityP + static_cast<size_t>(r) * m_width;
+        uint16_t *vRowP = &m_v[static_cast<size_t>(r) * bins];
+
+        size_t spanCount;
+        const RoiSpan *spansP = reprojector.spans(r, spanCount);
+        for (size_t k = 0; k < spanCount; ++k) {
+            for (uint32_t c = spansP[k].begin; c < spansP[k].end; ++c) {
+                // Whole pixels of disparity; 0 marks pixels without a match.
+                uint32_t bin = rowP[c] >> 4;
+                if (bin < minBin) {
+                    continue;
+                }
+                bin = bin > lastBin ? lastBin : bin;
+                vRowP[bin]++;
+                uP[static_cast<size_t>(bin) * m_width + c]++;
+            }
+        }
+    }
+}
+
+void UVDisparityDetector::fitGround(const DisparityReprojector &reprojector) {
+    const uint32_t bins = m_config.maxDisparity;
+    m_ground.valid = false;
+
+    // Peak of every row that has a clear one.
+    m_peakRows.clear();
+    m_peakBins.clear();
+    for (uint32_t r = reprojector.firstRow(); r < reprojector.endRow(); ++r) {
+        const uint16_t *vRowP = &m_v[static_cast<size_t>(r) * bins];
+        uint32_t total = 0;
+        uint32_t peak = 0;
+        for (uint32_t b = 0; b < bins; ++b) {
+            total += vRowP[b];
+            peak = vRowP[b] > vRowP[peak] ? b : peak;
+        }
+        if (vRowP[peak] >= 2 && vRowP[peak] >= m_config.groundPeakShare * total) {
+            m_peakRows.push_back(static_cast<float>(r));
+            m_peakBins.push_back(peak + 0.5f);
+        }
+    }
+
+    const size_t count = m_peakRows.size();
+    if (count < m_config.minGroundRows) {
+        return;
+    }
+
+    const float tolerance = m_config.inlierBins;
+    uint32_t bestInliers = 0;
+    float bestSlope = 0.0f;
+    float bestOffset = 0.0f;
+    for (uint32_t iteration = 0; iteration < m_config.groundIterations; ++iteration) {
+        const size_t i = random() % count;
+        const size_t j = random() % count;
+        if (m_peakRows[j] == m_peakRows[i]) {
+            continue;
+        }
+
+        // Disparity grows towards the bottom of the image on the ground.
+        const float slope = (m_peakBins[j] - m_peakBins[i]) / (m_peakRows[j] - m_peakRows[i]);
+        if (slope <= 0.0f) {
+            continue;
+        }
+        const float offset = m_peakBins[i] - slope * m_peakRows[i];
+
+        uint32_t inliers = 0;
+        for (size_t k = 0; k < count; ++k) {
+            inliers += std::fabs(slope * m_peakRows[k] + offset - m_peakBins[k]) <= tolerance;
+        }
+        if (inliers > bestInliers) {
+            bestInliers = inliers;
+            bestSlope = slope;
+            bestOffset = offset;
+        }
+    }
+    if (bestInliers < m_config.minGroundRows) {
+        return;
+    }
+
+    // Least squares over the inliers of the best line.
+    double n = 0, sumR = 0, sumB = 0, sumRR = 0, sumRB = 0;
+    for (size_t k = 0; k < count; ++k) {
+        if (std::fabs(bestSlope * m_peakRows[k] + bestOffset - m_peakBins[k]) > tolerance) {
+            continue;
+        }
+        n += 1;
+        sumR += m_peakRows[k];
+        sumB += m_peakBins[k];
+        sumRR += static_cast<double>(m_peakRows[k]) * m_peakRows[k];
+        sumRB += static_cast<double>(m_peakRows[k]) * m_peakBins[k];
+    }
+    const double denominator = n * sumRR - sumR * sumR;
+    if (denominator > 0.0) {
+        const double slope = (n * sumRB - sumR * sumB) / denominator;
+        if (slope > 0.0) {
+            bestSlope = static_cast<float>(slope);
+            bestOffset = static_cast<float>((sumB - slope * sumR) / n);
+        }
+    }
+
+    m_ground.valid = true;
+    m_ground.slope = bestSlope;
+    m_ground.offset = bestOffset;
+}
+
+void UVDisparityDetector::findObstacles(const DisparityReprojector &reprojector) {
+    const uint32_t bins = m_config.maxDisparity;
+    m_obstacles.clear();
+
+    // Pixels an obstacle of minHeight covers in one column at the
+    // disparity of each bin.  Ground seen at a grazing angle spreads over
+    // 1 / slope rows per bin, which the threshold must stay clear of.
+    const float rowStep = m_height > 1 ? reprojector.rowTerm(1) - reprojector.rowTerm(0) : 0.0f;
+    const float groundRows = m_ground.valid ? 1.5f / m_ground.slope + 1.0f : 0.0f;
+    m_thresholds.resize(bins);
+    for (uint32_t b = 0; b < bins; ++b) {
+        const float w = (b + 0.5f) * 16.0f * reprojector.disparityScale() + reprojector.wOffset();
+        const float obstacleRows = 0.0f != rowStep ? std::fabs(m_config.minHeight * w / rowStep) : 0.0f;
+        const float threshold = obstacleRows > groundRows ? obstacleRows : groundRows;
+        m_thresholds[b] = threshold > 2.0f ? static_cast<uint32_t>(std::ceil(threshold)) : 2;
+    }
+
+    // Closest obstacle disparity of every column.
+    m_columnBins.assign(m_width, -1);
+    for (uint32_t b = bins; b-- > m_config.minDisparity;) {
+        const uint16_t *uRowP = &m_u[static_cast<size_t>(b) * m_width];
+        const uint32_t threshold = m_thresholds[b];
+        for (uint32_t c = 0; c < m_width; ++c) {
+            if (m_columnBins[c] < 0 && uRowP[c] >= threshold) {
+                m_columnBins[c] = static_cast<int32_t>(b);
+            }
+        }
+    }
+
+    // Runs of neighbouring columns with similar disparity.
+    const int32_t tolerance = static_cast<int32_t>(m_config.disparityTolerance);
+    uint32_t c = 0;
+    while (c < m_width) {
+        if (m_columnBins[c] < 0) {
+            ++c;
+            continue;
+        }
+
+        const uint32_t left = c;
+        int32_t minBin = m_columnBins[c];
+        int32_t maxBin = m_columnBins[c];
+        for (++c; c < m_width && m_columnBins[c] >= 0 &&
+                  std::abs(m_columnBins[c] - m_columnBins[c - 1]) <= tolerance; ++c) {
+            minBin = m_columnBins[c] < minBin ? m_columnBins[c] : minBin;
+            maxBin = m_columnBins[c] > maxBin ? m_columnBins[c] : maxBin;
+        }
+        const uint32_t width = c - left;
+        if (width < m_config.minWidth) {
+            continue;
+        }
+
+        // Rows where the obstacle's disparities cover at least half its
+        // width.
+        uint32_t top = m_height;
+        uint32_t bottom = 0;
+        for (uint32_t r = reprojector.firstRow(); r < reprojector.endRow(); ++r) {
+            const uint16_t *vRowP = &m_v[static_cast<size_t>(r) * bins];
+            uint32_t pixels = 0;
+            for (int32_t b = minBin; b <= maxBin; ++b) {
+                pixels += vRowP[b];
+            }
+            if (2 * pixels >= width) {
+                top = r < top ? r : top;
+                bottom = r + 1;
+            }
+        }
+        if (bottom <= top) {
+            continue;
+        }
+
+        ObstacleBox box;
+        box.left = left;
+        box.right = c;
+        box.top = top;
+        box.bottom = bottom;
+        box.disparity = maxBin + 0.5f;
+        const float w = box.disparity * 16.0f * reprojector.disparityScale() + reprojector.wOffset();
+        box.distance = 0.0f != w ? std::fabs(reprojector.depthTerm() / w) : 0.0f;
+        m_obstacles.push_back(box);
+    }
+}
+
+const std::vector<ObstacleBox> &UVDisparityDetector::detect(const DisparityReprojector &reprojector,
+                                                             const uint16_t *disparityP,
+                                                             WorkerPool *poolP) {
+    const uint32_t bins = m_config.maxDisparity;
+    m_width = reprojector.width();
+    m_height = reprojector.height();
+    const size_t uCells = static_cast<size_t>(bins) * m_width;
+    m_u.resize(uCells);
+    m_v.assign(static_cast<size_t>(m_height) * bins, 0);
+
+    const uint32_t workers = poolP ? poolP->size() : 1;
+    if (m_workerU.size() < workers) {
+        m_workerU.resize(workers);
+        m_workerFrame.resize(workers, 0);
+    }
+    m_frame++;
+
+    const uint32_t firstRow = reprojector.isValid() ? reprojector.firstRow() : 0;
+    const uint32_t endRow = reprojector.isValid() ? reprojector.endRow() : 0;
+    const uint32_t tileRows = m_config.rowsPerTile;
+    const size_t tiles = endRow > firstRow ? (endRow - firstRow + tileRows - 1) / tileRows : 0;
+
+    WorkerPool::Task binTile = [&](size_t tile, uint32_t worker) {
+        if (m_workerFrame[worker] != m_frame) {
+            m_workerU[worker].assign(uCells, 0);
+            m_workerFrame[worker] = m_frame;
+        }
+        const uint32_t begin = firstRow + static_cast<uint32_t>(tile) * tileRows;
+        const uint32_t end = begin + tileRows < endRow ? begin + tileRows : endRow;
+        binRows(reprojector, disparityP, begin, end, m_workerU[worker]);
+    };
+
+    // Sum the U histograms of the workers that got a tile.
+    std::vector<const uint16_t *> histograms;
+    WorkerPool::Task mergeCells = [&](size_t task, uint32_t) {
+        const size_t begin = task * MERGE_CELLS;
+        const size_t end = begin + MERGE_CELLS < uCells ? begin + MERGE_CELLS : uCells;
+        for (size_t i = begin; i < end; ++i) {
+            uint16_t sum = 0;
+            for (const uint16_t *histogramP : histograms) {
+                sum += histogramP[i];
+            }
+            m_u[i] = sum;
+        }
+    };
+    const size_t mergeTasks = (uCells + MERGE_CELLS - 1) / MERGE_CELLS;
+
+    if (poolP) {
+        poolP->run(tiles, binTile);
+    } else {
+        for (size_t tile = 0; tile < tiles; ++tile) {
+            binTile(tile, 0);
+        }
+    }
+    for (uint32_t worker = 0; worker < workers; ++worker) {
+        if (m_workerFrame[worker] == m_frame) {
+            histograms.push_back(m_workerU[worker].data());
+        }
+    }
+    if (poolP) {
+        poolP->run(mergeTasks, mergeCells);
+    } else {
+        for (size_t task = 0; task < mergeTasks; ++task) {
+            mergeCells(task, 0);
+        }
+    }
+
+    fitGround(reprojector);
+    findObstacles(reprojector);
+    return m_obstacles;
+}
+
+} // namespace pipeline
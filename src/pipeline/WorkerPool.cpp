@@ -0,0 +1,106 @@
+#include "pipeline/WorkerPool.h"
+
+#include "pipeline/ScopedLock.h"
+
+namespace pipeline {
+
+WorkerPool::WorkerPool(uint32_t threads)
+        : m_generation(0),
+          m_busy(0),
+          m_stopping(false),
+          m_taskP(0),
+          m_count(0),
+          m_next(0) {
+    pthread_mutex_init(&m_runMutex, NULL);
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_start, NULL);
+    pthread_cond_init(&m_done, NULL);
+
+    if (0 == threads) {
+        threads = std::thread::hardware_concurrency();
+    }
+    for (uint32_t worker = 1; worker < threads; ++worker) {
+        m_threads.emplace_back(&WorkerPool::workerLoop, this, worker);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        ScopedLock lock(&m_mutex);
+        m_stopping = true;
+        pthread_cond_broadcast(&m_start);
+    }
+    for (std::thread &thread : m_threads) {
+        thread.join();
+    }
+
+    pthread_cond_destroy(&m_done);
+    pthread_cond_destroy(&m_start);
+    pthread_mutex_destroy(&m_mutex);
+    pthread_mutex_destroy(&m_runMutex);
+}
+
+void WorkerPool::run(size_t count, const Task &task) {
+    if (0 == count) {
+        return;
+    }
+    if (m_threads.empty() || 1 == count) {
+        for (size_t i = 0; i < count; ++i) {
+            task(i, 0);
+        }
+        return;
+    }
+
+    ScopedLock runLock(&m_runMutex);
+    {
+        ScopedLock lock(&m_mutex);
+        m_taskP = &task;
+        m_count = count;
+        m_next = 0;
+        m_busy = static_cast<uint32_t>(m_threads.size());
+        m_generation++;
+        pthread_cond_broadcast(&m_start);
+    }
+
+    work(0);
+
+    // Wait until every worker has left the job, so nothing touches the
+    // task after it goes out of scope.
+    ScopedLock lock(&m_mutex);
+    while (m_busy > 0) {
+        pthread_cond_wait(&m_done, &m_mutex);
+    }
+    m_taskP = 0;
+}
+
+void WorkerPool::work(uint32_t worker) {
+    const Task &task = *m_taskP;
+    for (size_t i = m_next++; i < m_count; i = m_next++) {
+        task(i, worker);
+    }
+}
+
+void WorkerPool::workerLoop(uint32_t worker) {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            ScopedLock lock(&m_mutex);
+            while (!m_stopping && seen == m_generation) {
+                pthread_cond_wait(&m_start, &m_mutex);
+            }
+            if (m_stopping) {
+                return;
+            }
+            seen = m_generation;
+        }
+
+        work(worker);
+
+        ScopedLock lock(&m_mutex);
+        if (0 == --m_busy) {
+            pthread_cond_signal(&m_done);
+        }
+    }
+}
+
+} // namespace pipeline
@@ -0,0 +1,168 @@
+#include "pipeline/YCbCr.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The build targets plain x86-64, so the SSSE3 path is compiled through
+// a target attribute and only taken when the CPU has SSSE3.
+#if defined(__SSE2__) && defined(__GNUC__)
+#define YCBCR_SSSE3 1
+#include <tmmintrin.h>
+#endif
+
+namespace pipeline {
+
+namespace {
+
+// Conversion coefficients in Q14.  Chroma offsets are pre-multiplied by
+// four, so taking the high half of the 16x16 bit product yields
+// (chroma * coefficient) in whole units.
+const int16_t CR_TO_R = 22970;  // 1.40200
+const int16_t CB_TO_G = 5638;   // 0.34414
+const int16_t CR_TO_G = 11700;  // 0.71414
+const int16_t CB_TO_B = 29032;  // 1.77200
+
+inline int32_t mulHigh(int32_t chroma4, int16_t coefficient) {
+    return (chroma4 * coefficient) >> 16;
+}
+
+inline uint32_t clampByte(int32_t v) {
+    return static_cast<uint32_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+#ifdef __SSE2__
+// Convert 8 pixels to B, G, R, A, returned as two registers of 4 pixels.
+inline void convert8(const uint8_t *yP, const uint8_t *cbP, const uint8_t *crP,
+                     __m128i &lo, __m128i &hi) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i offset = _mm_set1_epi16(128);
+    const __m128i alpha = _mm_set1_epi8(static_cast<char>(0xff));
+
+    __m128i y = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(yP)), zero);
+    __m128i cb = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(cbP)), zero);
+    __m128i cr = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(crP)), zero);
+
+    cb = _mm_slli_epi16(_mm_sub_epi16(cb, offset), 2);
+    cr = _mm_slli_epi16(_mm_sub_epi16(cr, offset), 2);
+
+    __m128i r = _mm_add_epi16(y, _mm_mulhi_epi16(cr, _mm_set1_epi16(CR_TO_R)));
+    __m128i g = _mm_sub_epi16(_mm_sub_epi16(y, _mm_mulhi_epi16(cb, _mm_set1_epi16(CB_TO_G))),
+                              _mm_mulhi_epi16(cr, _mm_set1_epi16(CR_TO_G)));
+    __m128i b = _mm_add_epi16(y, _mm_mulhi_epi16(cb, _mm_set1_epi16(CB_TO_B)));
+
+    // Saturate to bytes and interleave to B, G, R, A.
+    __m128i b8 = _mm_packus_epi16(b, zero);
+    __m128i g8 = _mm_packus_epi16(g, zero);
+    __m128i r8 = _mm_packus_epi16(r, zero);
+    __m128i bg = _mm_unpacklo_epi8(b8, g8);
+    __m128i ra = _mm_unpacklo_epi8(r8, alpha);
+
+    lo = _mm_unpacklo_epi16(bg, ra);
+    hi = _mm_unpackhi_epi16(bg, ra);
+}
+#endif
+
+#ifdef YCBCR_SSSE3
+bool haveSsse3() {
+    static const bool have = __builtin_cpu_supports("ssse3");
+    return have;
+}
+
+// Convert pixels 16 at a time, dropping the alpha bytes with a byte
+// shuffle.  Returns the number of pixels converted.
+__attribute__((target("ssse3")))
+size_t ycbcrToBgrSsse3(const uint8_t *yP,
+                       const uint8_t *cbP,
+                       const uint8_t *crP,
+                       uint8_t *bgrP,
+                       size_t n) {
+    const __m128i dropAlpha = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i p0, p1, p2, p3;
+        convert8(yP + i, cbP + i, crP + i, p0, p1);
+        convert8(yP + i + 8, cbP + i + 8, crP + i + 8, p2, p3);
+        p0 = _mm_shuffle_epi8(p0, dropAlpha);
+        p1 = _mm_shuffle_epi8(p1, dropAlpha);
+        p2 = _mm_shuffle_epi8(p2, dropAlpha);
+        p3 = _mm_shuffle_epi8(p3, dropAlpha);
+
+        __m128i *outP = reinterpret_cast<__m128i *>(bgrP + 3 * i);
+        _mm_storeu_si128(outP, _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+        _mm_storeu_si128(outP + 1, _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+        _mm_storeu_si128(outP + 2, _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+    }
+    return i;
+}
+#endif
+
+} // anonymous namespace
+
+void ycbcrToBgra(const uint8_t *yP,
+                 const uint8_t *cbP,
+                 const uint8_t *crP,
+                 uint32_t *bgraP,
+                 size_t n) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo, hi;
+        convert8(yP + i, cbP + i, crP + i, lo, hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(bgraP + i), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(bgraP + i + 4), hi);
+    }
+#endif
+
+    for (; i < n; ++i) {
+        const int32_t y = yP[i];
+        const int32_t cb = (cbP[i] - 128) * 4;
+        const int32_t cr = (crP[i] - 128) * 4;
+
+        const uint32_t r = clampByte(y + mulHigh(cr, CR_TO_R));
+        const uint32_t g = clampByte(y - mulHigh(cb, CB_TO_G) - mulHigh(cr, CR_TO_G));
+        const uint32_t b = clampByte(y + mulHigh(cb, CB_TO_B));
+
+        bgraP[i] = b | (g << 8) | (r << 16) | 0xff000000u;
+    }
+}
+
+void ycbcrToBgr(const uint8_t *yP,
+                const uint8_t *cbP,
+                const uint8_t *crP,
+                uint8_t *bgrP,
+                size_t n) {
+    size_t i = 0;
+
+#ifdef YCBCR_SSSE3
+    if (haveSsse3()) {
+        i = ycbcrToBgrSsse3(yP, cbP, crP, bgrP, n);
+    }
+#endif
+#ifdef __SSE2__
+    // Without a byte shuffle, convert to B, G, R, A on the stack and
+    // copy out three bytes per pixel.
+    for (; i + 8 <= n; i += 8) {
+        uint32_t bgra[8];
+        __m128i lo, hi;
+        convert8(yP + i, cbP + i, crP + i, lo, hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(bgra), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(bgra + 4), hi);
+        for (size_t k = 0; k < 8; ++k) {
+            std::memcpy(bgrP + 3 * (i + k), &bgra[k], 3);
+        }
+    }
+#endif
+
+    // The tail goes through the scalar path of ycbcrToBgra().
+    for (; i < n; ++i) {
+        uint32_t bgra;
+        ycbcrToBgra(yP + i, cbP + i, crP + i, &bgra, 1);
+        std::memcpy(bgrP + 3 * i, &bgra, 3);
+    }
+}
+
+} // namespace pipeline
@@ -0,0 +1,134 @@
+// Measures publish cost and publisher-to-subscriber latency of the
+// shared memory ring.  A child process subscribes to the ring while the
+// parent publishes disparity-sized frames at a fixed rate; the child
+// reports latency percentiles based on the CLOCK_MONOTONIC stamp in
+// each frame.
+//
+// Usage: shm_ring_benchmark [frames] [payload bytes] [interval us]
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "pipeline/SharedMemoryRing.h"
+
+namespace {
+
+const char *RING_NAME = "/multisense_ring_benchmark";
+
+int runSubscriber(uint64_t frames) {
+    pipeline::ShmSubscriber subscriber;
+
+    // The parent creates the ring; wait for it to appear.
+    for (int i = 0; i < 1000 && !subscriber.open(RING_NAME); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!subscriber.isOpen()) {
+        fprintf(stderr, "Subscriber could not open %s\n", RING_NAME);
+        return 1;
+    }
+
+    std::vector<double> latencies;
+    latencies.reserve(frames);
+    uint64_t torn = 0;
+    uint64_t checksum = 0;
+    const uint64_t deadline = pipeline::monotonicNs() + 60ull * 1000000000ull;
+
+    pipeline::ShmFrame frame;
+    while (pipeline::monotonicNs() < deadline) {
+        if (!subscriber.next(frame)) {
+            continue;
+        }
+
+        const uint64_t now = pipeline::monotonicNs();
+
+        // Touch the payload in place, as a real consumer would.
+        const uint8_t *payloadP = static_cast<const uint8_t *>(frame.payloadP);
+        for (uint64_t i = 0; i < frame.info.payloadLength; i += 4096) {
+            checksum += payloadP[i];
+        }
+
+        if (subscriber.stillValid(frame)) {
+            latencies.push_back((now - frame.info.publishTimeNs) / 1000.0);
+        } else {
+            torn++;
+        }
+
+        if (static_cast<uint64_t>(frame.info.frameId) + 1 == frames) {
+            break;
+        }
+    }
+
+    if (latencies.empty()) {
+        fprintf(stderr, "Subscriber received no frames\n");
+        return 1;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+    };
+
+    printf("received %zu frames, %lu dropped, %lu overwritten while reading (checksum %lu)\n",
+           latencies.size(), subscriber.dropped(), torn, checksum);
+    printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           percentile(0.5), percentile(0.9), percentile(0.99), latencies.back());
+    return 0;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    const uint64_t frames = argc > 1 ? std::strtoull(argv[1], 0, 10) : 1000;
+    const size_t payload = argc > 2 ? std::strtoull(argv[2], 0, 10) : 1024 * 544 * 2;
+    const int intervalUs = argc > 3 ? std::atoi(argv[3]) : 1000;
+
+    pipeline::ShmPublisher publisher;
+    publisher.open(RING_NAME, 8, payload);
+
+    pid_t child = fork();
+    if (child < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (0 == child) {
+        return runSubscriber(frames);
+    }
+
+    // Give the subscriber time to map the ring before the first frame.
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::vector<uint8_t> data(payload, 1);
+    double publishSeconds = 0.0;
+
+    for (uint64_t i = 0; i < frames; ++i) {
+        pipeline::ShmFrameInfo info = {};
+        info.frameId = static_cast<int64_t>(i);
+        info.payloadType = pipeline::ShmPayload_Image;
+        info.width = 1024;
+        info.height = static_cast<uint32_t>(payload / 2048);
+        info.bitsPerPixel = 16;
+        info.publishTimeNs = pipeline::monotonicNs();
+
+        auto start = std::chrono::steady_clock::now();
+        publisher.publish(info, data.data(), data.size());
+        publishSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::this_thread::sleep_for(std::chrono::microseconds(intervalUs));
+    }
+
+    int status = 0;
+    waitpid(child, &status, 0);
+
+    printf("published %lu frames of %zu bytes, %.1f us per publish (%.0f MB/s)\n",
+           frames, payload, publishSeconds / frames * 1e6,
+           frames * payload / publishSeconds / 1e6);
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
@@ -1,7 +1,11 @@
 /* \author Geoffrey Biggs */
 
+#include <atomic>
+#include <cstring>
+#include <ctime>
 #include <iostream>
 #include <thread>
+#include <unordered_map>
 
 #include <pcl/common/common_headers.h>
 #include <pcl/features/normal_3d.h>
@@ -9,7 +13,32 @@
 #include "MultiSense/MultiSenseTypes.hh"
 #include "opencv2/opencv.hpp"
 #include "MultiSense/details/utility/Exception.hh"
-#include <pcl/visualization/cloud_viewer.h>
+#include <pcl/visualization/pcl_visualizer.h>
+#include <vtkRenderer.h>
+#include <vtkRendererCollection.h>
+#include "pipeline/CallbackBufferMonitor.h"
+#include "pipeline/CloudKernels.h"
+#include "pipeline/CloudWriter.h"
+#include "pipeline/DepthImage.h"
+#include "pipeline/DisparityFrame.h"
+#include "pipeline/FrameLog.h"
+#include "pipeline/GroundPlane.h"
+#include "pipeline/HeightMap.h"
+#include "pipeline/LatestMailbox.h"
+#include "pipeline/LevelOfDetail.h"
+#include "pipeline/LoadController.h"
+#include "pipeline/PclPointFrame.h"
+#include "pipeline/PersistentCloudActor.h"
+#include "pipeline/PointFrame.h"
+#include "pipeline/ProjectiveIcp.h"
+#include "pipeline/RectifiedColor.h"
+#include "pipeline/RegionOfInterest.h"
+#include "pipeline/Reprojection.h"
+#include "pipeline/SharedMemoryRing.h"
+#include "pipeline/StreamSubscriptions.h"
+#include "pipeline/TemporalFilter.h"
+#include "pipeline/TsdfVolume.h"
+#include "pipeline/WorkerPool.h"
 
 crl::multisense::Channel *m_channelP;
 crl::multisense::image::Header m_disparityHeader;
@@ -57,7 +86,135 @@ void *m_matchedLumaLeftBufferP;
 bool m_chromaSupported = true;
 
 pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZ>);
-pcl::visualization::CloudViewer viewer ("Simple Cloud Viewer");
+
+// Temporal smoothing of the raw disparity before it is reprojected.
+// Toggled with the 't' key in the viewer.
+pipeline::TemporalFilter m_temporalFilter;
+std::atomic<bool> m_temporalFilterEnabled(true);
+
+// Background writer for the live clouds. Recording is toggled with
+// the 'm' key; frames are dropped rather than stalling the callbacks
+// if the disk cannot keep up.
+pipeline::CloudWriter m_cloudWriter;
+std::atomic<bool> m_recording(false);
+
+// Raw disparity, left luma and left chroma as the callbacks get them,
+// with the calibration, for processing a session again offline (see
+// batch_process). Toggled with the 'b' key.
+pipeline::FrameLogWriter m_frameLog;
+pipeline::FrameLogCalibration m_logCalibration;
+
+// Callback buffers held and frames lost per source. While libMultiSense
+// drops frames because the callbacks fall behind, new images are dropped
+// in the callbacks instead of being held and processed (see
+// reserveCallbackBuffer()).
+pipeline::CallbackBufferMonitor m_callbackBuffers;
+
+// Shared memory rings that hand every frame to other local processes
+// (see pipeline/SharedMemoryRing.h for the subscriber side).
+pipeline::ShmPublisher m_disparityPublisher;
+pipeline::ShmPublisher m_lumaPublisher;
+pipeline::ShmPublisher m_cloudPublisher;
+pipeline::ShmPublisher m_depthPublisher;
+
+// Per-pixel depth in millimeters, for the consumers of the depth ring
+// that need no points.
+pipeline::DepthConverter m_depthConverter;
+
+// A cloud together with the disparity frame it was computed from, so
+// that the viewer and the image window always show the same frame. The
+// live points are only converted to a PCL cloud, and the disparity only
+// to a display image, once the render thread draws them, so frames it
+// skips never are.
+struct RenderFrame {
+    int64_t frameId = -1;
+    std::shared_ptr<pipeline::DisparityFrame> disparity;
+    std::shared_ptr<pipeline::PclPointFrame> points;
+    // Set instead of points while fusion is on.
+    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
+    // Set instead of being drawn from cloud when color is available.
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr colorCloud;
+    cv::Mat heightMapDisplay;
+};
+
+// The disparity callback only posts frames here. A separate render
+// thread picks up the newest one at a capped rate, so slow rendering
+// skips frames instead of holding up the callbacks.
+pipeline::LatestMailbox<RenderFrame> m_renderMailbox;
+const double m_maxRenderFps = 30.0;
+
+// Pixels and volume the disparity stages work on: the top rows and a
+// +/-10 m box by default, further restricted by the nonzero pixels of
+// roi_mask.png in the working directory if present (e.g. to blank out
+// parts of the robot). See configureRegion().
+pipeline::RegionOfInterest m_region;
+
+// Ground plane of the live cloud, and which points lie on it. The 'g'
+// key hides the ground points in the viewer.
+pipeline::GroundPlaneEstimator m_groundEstimator;
+std::vector<uint8_t> m_groundMask;
+std::atomic<bool> m_hideGround(false);
+
+// Threads shared by the data-parallel disparity stages.
+pipeline::WorkerPool m_workerPool;
+
+// Top-down grid of point heights around the camera, binned straight from
+// disparity for the planner. Its display is toggled with the 'k' key.
+pipeline::HeightMapBuilder m_heightMapBuilder;
+pipeline::HeightMap m_heightMap;
+std::atomic<bool> m_showHeightMap(true);
+
+// Fusion of the disparity frames into a TSDF volume, shown instead of
+// the live cloud while the 'v' key has it enabled. The camera pose is
+// tracked frame to frame by ICP on the disparity; frames it cannot
+// align are fused at the last good pose. The surface points are kept
+// up to date block by block, so only changed blocks are touched.
+pipeline::TsdfVolume m_volume;
+pipeline::ProjectiveIcp m_odometry;
+pipeline::Pose m_cameraPose;
+std::atomic<bool> m_fusionEnabled(false);
+pipeline::TsdfSurface m_fusedSurface;
+std::vector<pipeline::TsdfBlockPoints> m_fusedUpdates;
+std::vector<uint64_t> m_fusedEvictions;
+
+// Reprojection of the raw disparity through precomputed ray tables,
+// and coloring of the points straight from the raw left luma/chroma
+// buffers. Colored clouds are toggled with the 'c' key. Point frames are
+// reused once no render frame refers to them any more.
+pipeline::DisparityReprojector m_reprojector;
+pipeline::RectifiedColorLookup m_colorLookup;
+pipeline::PointFramePool m_pointFramePool;
+std::atomic<bool> m_colorCloud(true);
+
+// What the products of every disparity frame are computed with. The
+// reprojector is a copy of m_reprojector, replaced whenever that is
+// rebuilt, so frames still in flight keep the calibration they came with.
+pipeline::BufferPool m_disparityPool;
+pipeline::DisparityFrameContext m_frameContext = [] {
+    pipeline::DisparityFrameContext context;
+    context.depthConverterP = &m_depthConverter;
+    context.disparityPoolP = &m_disparityPool;
+    context.pointPoolP = &m_pointFramePool;
+    context.workerPoolP = &m_workerPool;
+    return context;
+}();
+
+// Streams are only started while some stage consumes them. The cloud
+// needs disparity, the luma ring needs left luma, and the colored cloud
+// additionally needs left chroma.
+pipeline::StreamSubscriptions m_streams;
+int m_colorSubscription = 0;
+
+// Steps the sensor resolution and frame rate down when the disparity
+// processing cannot keep up, and back up once it has headroom. The
+// callback only requests a change; the main loop applies it.
+pipeline::LoadController m_loadController;
+std::atomic<bool> m_reconfigureRequested(false);
+int64_t m_lastDisparityFrameId = -1;
+
+// Decimates the displayed cloud when rendering cannot hold the frame
+// rate. Toggled with the 'l' key.
+bool m_adaptiveDetail = true;
 
 
 // Mutexes to coordinate image access between the callback
@@ -77,13 +234,90 @@ private:
 };
 
 
-unsigned int text_id = 0;
+// Everything the samples used to start unconditionally, to report the
+// link bandwidth the subscriptions save.
+const crl::multisense::DataSource m_allStreams =
+        crl::multisense::Source_Disparity | crl::multisense::Source_Disparity_Cost |
+        crl::multisense::Source_Luma_Left | crl::multisense::Source_Luma_Right |
+        crl::multisense::Source_Chroma_Left;
 
-void viewerOneOff(pcl::visualization::PCLVisualizer &viewer) {
-    viewer.setBackgroundColor(0.01, 0.01, 0.01);
+void reportStreams() {
+    const pipeline::StreamSubscriptions::Mask active = m_streams.active();
+    const double used = m_streams.bytesPerSecond(active);
+    const double saved = m_streams.bytesPerSecond(m_allStreams) - used;
+    printf("Streams 0x%08llx running for %s: %.1f MB/s, %.1f MB/s saved\n",
+           static_cast<unsigned long long>(active), m_streams.consumers(active).c_str(), used / 1e6, saved / 1e6);
+}
 
+void reportCallbackBuffers(const char *prefixP) {
+    for (const pipeline::CallbackBufferMonitor::SourceStats &stats : m_callbackBuffers.sources()) {
+        printf("%s0x%08x: %u held, %u at most, %lu reserved, %lu refused, %lu shed, %lu lost\n", prefixP,
+               stats.source, stats.outstanding, stats.highWater, static_cast<unsigned long>(stats.reserved),
+               static_cast<unsigned long>(stats.failed), static_cast<unsigned long>(stats.shed),
+               static_cast<unsigned long>(stats.dropped));
+    }
 }
 
+void logCallbackBufferEvent(pipeline::CallbackBufferMonitor::Event event) {
+    if (pipeline::CallbackBufferMonitor::Event_ShedStarted == event) {
+        printf("Callbacks falling behind (%u buffers held, %lu frames lost), dropping images\n",
+               m_callbackBuffers.outstanding(), static_cast<unsigned long>(m_callbackBuffers.droppedCount()));
+        reportCallbackBuffers("  ");
+    } else if (pipeline::CallbackBufferMonitor::Event_ShedStopped == event) {
+        printf("Callbacks caught up (%u buffers held), %lu images dropped so far\n",
+               m_callbackBuffers.outstanding(), static_cast<unsigned long>(m_callbackBuffers.shedCount()));
+    }
+}
+
+// Keep the libMultiSense buffer behind the image of source being
+// delivered until releaseCallbackBuffer(). Returns 0 without keeping it
+// while frames are being lost, and when libMultiSense has no buffer left.
+void *reserveCallbackBuffer(uint32_t source, int64_t frameId) {
+    pipeline::CallbackBufferMonitor::Event event;
+    const bool admitted = m_callbackBuffers.admit(source, frameId, &event);
+    logCallbackBufferEvent(event);
+    if (!admitted) {
+        return 0;
+    }
+
+    void *bufferP = m_channelP->reserveCallbackBuffer();
+    logCallbackBufferEvent(m_callbackBuffers.reserved(source, bufferP));
+    return bufferP;
+}
+
+void releaseCallbackBuffer(uint32_t source, void *bufferP) {
+    m_channelP->releaseCallbackBuffer(bufferP);
+    logCallbackBufferEvent(m_callbackBuffers.released(source));
+}
+
+// Per-frame sizes of the streams at the given resolution, for the
+// bandwidth estimate. Chroma is 4:2:0, so it carries half as many bytes
+// as 8-bit luma.
+void setStreamFrameSizes(uint32_t width, uint32_t height, float fps) {
+    const double pixels = static_cast<double>(width) * height;
+    m_streams.setFrameBytes(crl::multisense::Source_Disparity, 2 * pixels);
+    m_streams.setFrameBytes(crl::multisense::Source_Disparity_Cost, pixels);
+    m_streams.setFrameBytes(crl::multisense::Source_Luma_Left | crl::multisense::Source_Luma_Right, pixels);
+    m_streams.setFrameBytes(crl::multisense::Source_Chroma_Left, pixels / 2);
+    m_streams.setFrameRate(fps);
+}
+
+void subscribeColor(bool enable) {
+    if (enable && m_chromaSupported && 0 == m_colorSubscription) {
+        m_colorSubscription = m_streams.subscribe("colored cloud",
+                                                  crl::multisense::Source_Luma_Left |
+                                                  crl::multisense::Source_Chroma_Left);
+    } else if (!enable && 0 != m_colorSubscription) {
+        m_streams.unsubscribe(m_colorSubscription);
+        m_colorSubscription = 0;
+    }
+}
+
+
+unsigned int text_id = 0;
+
+// Runs on the render thread. The toggles it flips are read by the image
+// callbacks, so they are atomic.
 void keyboardEventOccurred(const pcl::visualization::KeyboardEvent &event,
                            void *viewer_void) {
 
@@ -99,15 +333,35 @@ void keyboardEventOccurred(const pcl::visualization::KeyboardEvent &event,
     }
 
     if (event.getKeySym() == "m" && event.keyDown()) {
-        printf("m was pressed\n");
+        m_recording = !m_recording;
 
-        printf("Points: ");
-        for (int i = 0; i < 3; ++i){
-            std::cout << cloud->points[i * 10] << " ";
+        pipeline::CloudWriter::Stats stats = m_cloudWriter.stats();
+        printf("Recording %s (%lu written, %lu dropped, %lu failed)\n",
+               m_recording ? "started" : "stopped",
+               static_cast<unsigned long>(stats.written), static_cast<unsigned long>(stats.dropped),
+               static_cast<unsigned long>(stats.failed));
+    }
+    if (event.getKeySym() == "b" && event.keyDown()) {
+        if (m_frameLog.isRunning()) {
+            // Flushes the log to disk, so no callback lock is held.
+            m_frameLog.stop();
+            pipeline::FrameLogWriter::Stats stats = m_frameLog.stats();
+            printf("Frame log stopped (%lu records, %.1f MB, %lu dropped)\n",
+                   static_cast<unsigned long>(stats.written), stats.bytes / 1e6,
+                   static_cast<unsigned long>(stats.dropped));
+        } else {
+            char path[64];
+            snprintf(path, sizeof(path), "session_%lld.msfl", static_cast<long long>(time(NULL)));
+            try {
+                // The calibration cannot change while the log is started
+                // with it.
+                ScopedLock lock(&m_disparityMutex);
+                m_frameLog.start(path, m_logCalibration);
+                printf("Frame log started: %s\n", path);
+            } catch (const std::exception &e) {
+                fprintf(stderr, "%s", e.what());
+            }
         }
-        printf("\n");
-
-        viewer.showCloud(cloud);
     }
     if (event.getKeySym() == "n" && event.keyDown()) {
         printf("n was pressed\n");
@@ -127,7 +381,37 @@ void keyboardEventOccurred(const pcl::visualization::KeyboardEvent &event,
         basic_cloud_ptr->width = basic_cloud_ptr->size();
         basic_cloud_ptr->height = 1;
 
-        viewer.showCloud(basic_cloud_ptr);
+        // Keyboard callbacks run on the render thread, which owns the actor.
+        static_cast<pipeline::PersistentCloudActor *>(viewer_void)->update(*basic_cloud_ptr);
+    }
+    if (event.getKeySym() == "l" && event.keyDown()) {
+        m_adaptiveDetail = !m_adaptiveDetail;
+        printf("Adaptive level of detail %s\n", m_adaptiveDetail ? "enabled" : "disabled");
+    }
+    if (event.getKeySym() == "c" && event.keyDown()) {
+        m_colorCloud = !m_colorCloud;
+        printf("Colored cloud %s\n", m_colorCloud ? "enabled" : "disabled");
+        subscribeColor(m_colorCloud);
+        reportStreams();
+    }
+    if (event.getKeySym() == "g" && event.keyDown()) {
+        m_hideGround = !m_hideGround;
+        printf("Ground points %s\n", m_hideGround ? "hidden" : "shown");
+    }
+    if (event.getKeySym() == "k" && event.keyDown()) {
+        m_showHeightMap = !m_showHeightMap;
+        printf("Height map display %s\n", m_showHeightMap ? "enabled" : "disabled");
+        if (!m_showHeightMap) {
+            cv::destroyWindow("height map");
+        }
+    }
+    if (event.getKeySym() == "v" && event.keyDown()) {
+        m_fusionEnabled = !m_fusionEnabled;
+        printf("Volume fusion %s\n", m_fusionEnabled ? "enabled" : "disabled");
+    }
+    if (event.getKeySym() == "t" && event.keyDown()) {
+        m_temporalFilterEnabled = !m_temporalFilterEnabled;
+        printf("Temporal filter %s\n", m_temporalFilterEnabled ? "enabled" : "disabled");
     }
 
 
@@ -144,6 +428,86 @@ void mouseEventOccurred(const pcl::visualization::MouseEvent &event,
 }
 
 
+// Queue a raw image for the frame log, if one is being written.
+void logImage(const crl::multisense::image::Header &header) {
+    const crl::multisense::DataSource logged =
+            crl::multisense::Source_Disparity | crl::multisense::Source_Luma_Left | crl::multisense::Source_Chroma_Left;
+    if (0 == (header.source & logged) || !m_frameLog.isRunning()) {
+        return;
+    }
+
+    pipeline::FrameLogImage image;
+    image.source = header.source;
+    image.frameId = header.frameId;
+    image.timeSeconds = header.timeSeconds;
+    image.timeMicroSeconds = header.timeMicroSeconds;
+    image.width = header.width;
+    image.height = header.height;
+    image.bitsPerPixel = header.bitsPerPixel;
+    image.length = header.imageLength;
+    m_frameLog.submit(image, header.imageDataP);
+}
+
+
+// Copy an image into a shared memory ring, keeping the metadata of the
+// libMultiSense header.
+void publishImage(pipeline::ShmPublisher &publisher,
+                  const crl::multisense::image::Header &header,
+                  const void *dataP) {
+    if (!publisher.isOpen() || !dataP) {
+        return;
+    }
+
+    pipeline::ShmFrameInfo info = {};
+    info.frameId = header.frameId;
+    info.source = header.source;
+    info.payloadType = pipeline::ShmPayload_Image;
+    info.width = header.width;
+    info.height = header.height;
+    info.bitsPerPixel = header.bitsPerPixel;
+    info.timeSeconds = header.timeSeconds;
+    info.timeMicroSeconds = header.timeMicroSeconds;
+    info.publishTimeNs = pipeline::monotonicNs();
+
+    publisher.publish(info, dataP, static_cast<size_t>(header.width) * header.height * header.bitsPerPixel / 8);
+}
+
+// Write a cloud straight into the next ring slot as packed x, y, z,
+// through the plain cloud kernel.
+void publishCloud(pipeline::ShmPublisher &publisher,
+                  const crl::multisense::image::Header &header,
+                  const pipeline::PointFrame &points) {
+    if (!publisher.isOpen()) {
+        return;
+    }
+
+    pipeline::CloudConfig config;
+    pipeline::CloudSources sources;
+    sources.pointsP = &points;
+    pipeline::CloudOutput output;
+    output.capacity = pipeline::cloudCapacity(config, points);
+    output.pointsP = static_cast<float *>(publisher.beginWrite(output.capacity * 3 * sizeof(float)));
+    if (!output.pointsP) {
+        return;
+    }
+    size_t count = 0;
+    pipeline::convertCloud(config, sources, output, count);
+
+    pipeline::ShmFrameInfo info = {};
+    info.frameId = header.frameId;
+    info.source = header.source;
+    info.payloadType = pipeline::ShmPayload_Cloud;
+    info.width = count;
+    info.height = 1;
+    info.bitsPerPixel = 3 * 8 * sizeof(float);
+    info.timeSeconds = header.timeSeconds;
+    info.timeMicroSeconds = header.timeMicroSeconds;
+    info.publishTimeNs = pipeline::monotonicNs();
+    info.payloadLength = count * 3 * sizeof(float);
+    publisher.commit(info);
+}
+
+
 pcl::PointCloud<pcl::PointXYZ>::Ptr MatToPoinXYZ(cv::Mat OpencVPointCloud) {
     /*
     *  Function: Get from a Mat to pcl pointcloud datatype
@@ -179,6 +543,104 @@ pcl::PointCloud<pcl::PointXYZ>::Ptr MatToPoinXYZ(cv::Mat OpencVPointCloud) {
 }
 
 
+// Fuse a disparity frame into the volume and return the surface points
+// of the whole volume.
+pcl::PointCloud<pcl::PointXYZ>::Ptr fuseFrame(const uint16_t *disparityP) {
+    if (m_odometry.track(m_reprojector, disparityP, &m_workerPool)) {
+        m_cameraPose = m_odometry.pose();
+    }
+    m_volume.integrate(m_reprojector, disparityP, m_cameraPose, &m_workerPool);
+    m_volume.extractChanged(m_fusedUpdates, m_fusedEvictions, &m_workerPool);
+    m_fusedSurface.apply(m_fusedUpdates, m_fusedEvictions);
+
+    // The render thread gets its own copy of the packed points.
+    pcl::PointCloud<pcl::PointXYZ>::Ptr fused(new pcl::PointCloud<pcl::PointXYZ>);
+    fused->points.resize(m_fusedSurface.size());
+    const float *xyzP = m_fusedSurface.xyz();
+    for (size_t i = 0; i < fused->points.size(); i++, xyzP += 3) {
+        fused->points[i].x = xyzP[0];
+        fused->points[i].y = xyzP[1];
+        fused->points[i].z = xyzP[2];
+    }
+    fused->width = (int) fused->points.size();
+    fused->height = 1;
+    return fused;
+}
+
+
+// Drop the fused volume and start tracking from the origin again.
+void resetFusion() {
+    m_volume.reset();
+    m_fusedSurface.clear();
+    m_odometry.reset();
+    m_cameraPose = pipeline::Pose();
+}
+
+
+// Color coded maximum height of every cell, forward pointing up and
+// empty cells black, scaled up for display.
+cv::Mat renderHeightMap(const pipeline::HeightMap &map) {
+    const pipeline::HeightMapBuilder::Config &config = m_heightMapBuilder.config();
+    const float scale = 255.0f / (config.maxHeight - config.minHeight);
+
+    cv::Mat heights(map.rows, map.columns, CV_8UC1);
+    cv::Mat empty(map.rows, map.columns, CV_8UC1);
+    for (uint32_t r = 0; r < map.rows; r++) {
+        uint8_t *heightRowP = heights.ptr<uint8_t>(map.rows - 1 - r);
+        uint8_t *emptyRowP = empty.ptr<uint8_t>(map.rows - 1 - r);
+        for (uint32_t c = 0; c < map.columns; c++) {
+            const size_t cell = map.index(c, r);
+            heightRowP[c] = cv::saturate_cast<uint8_t>((map.maxHeight[cell] - config.minHeight) * scale);
+            emptyRowP[c] = 0 == map.hits[cell] ? 255 : 0;
+        }
+    }
+
+    cv::Mat display;
+    cv::applyColorMap(heights, display, cv::COLORMAP_JET);
+    display.setTo(cv::Scalar::all(0), empty);
+    cv::resize(display, display, cv::Size(), 3, 3, cv::INTER_NEAREST);
+    return display;
+}
+
+
+// Colored cloud of the reprojected points, sampled through the pixel of
+// every point from the latest matched left luma/chroma pair. Returns an
+// empty pointer if no usable color image is available yet, so the caller
+// can fall back to a plain cloud.
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr colorPoints(const crl::multisense::image::Header &disparityHeader,
+                                                    const pipeline::PointFrame &points) {
+    ScopedLock lock(&m_lumaAndChromaLeftMutex);
+
+    if (0 == m_matchedLumaLeftBufferP || 0 == m_matchedChromaLeftBufferP ||
+        8 != m_matchedLumaLeftHeader.bitsPerPixel ||
+        m_matchedLumaLeftHeader.width != disparityHeader.width ||
+        m_matchedLumaLeftHeader.height != disparityHeader.height ||
+        m_leftCalibrationMapX.size() != cv::Size(disparityHeader.width, disparityHeader.height)) {
+        return pcl::PointCloud<pcl::PointXYZRGB>::Ptr();
+    }
+
+    if (!m_colorLookup.isValid()) {
+        m_colorLookup.build(m_leftCalibrationMapX.ptr<float>(0), m_leftCalibrationMapY.ptr<float>(0),
+                            disparityHeader.width, disparityHeader.height);
+    }
+
+    // The points are colored a row at a time by the colored cloud kernel.
+    pipeline::CloudConfig config;
+    config.pointType = pipeline::CloudPoint_XyzRgb;
+    pipeline::CloudSources sources;
+    sources.pointsP = &points;
+    sources.colorLookupP = &m_colorLookup;
+    sources.rawLumaP = static_cast<const uint8_t *>(m_matchedLumaLeftHeader.imageDataP);
+    sources.rawChromaP = static_cast<const uint8_t *>(m_matchedChromaLeftHeader.imageDataP);
+
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr point_cloud_ptr(new pcl::PointCloud<pcl::PointXYZRGB>);
+    if (!pipeline::convertCloud(config, sources, *point_cloud_ptr)) {
+        return pcl::PointCloud<pcl::PointXYZRGB>::Ptr();
+    }
+    return point_cloud_ptr;
+}
+
+
 void updateImage(const crl::multisense::image::Header &sourceHeader,
                  crl::multisense::image::Header &targetHeader,
                  pthread_mutex_t *mutexP,
@@ -193,72 +655,151 @@ void updateImage(const crl::multisense::image::Header &sourceHeader,
     // Return any previously reserved image data to the libMultiSense
     // library.
     if (0 != (*bufferP)) {
-        m_channelP->releaseCallbackBuffer(*bufferP);
+        releaseCallbackBuffer(targetHeader.source, *bufferP);
     }
 
     // Reserve the data that's backing the new image header.
-    *bufferP = m_channelP->reserveCallbackBuffer();
+    *bufferP = reserveCallbackBuffer(sourceHeader.source, sourceHeader.frameId);
 
     // And make a local copy, so that client code can access the image
     // later.
     targetHeader = sourceHeader;
 
+    // Logged before any processing, so the session can be processed
+    // again with other settings.
+    logImage(sourceHeader);
 
-    if (targetHeader.source == crl::multisense::Source_Disparity) {
-        cv::Mat disparityFloatMat;
-        cv::Mat disparityMat(targetHeader.height, targetHeader.width, CV_16UC1,
-                             const_cast<void *>(targetHeader.imageDataP));
-
-        // Convert to float, as promised to the calling context.
-        disparityMat.convertTo(disparityFloatMat, CV_32FC1, 1.0 / 16.0);
+    // Without a reserved buffer the data goes away with this callback,
+    // so the image is dropped unprocessed.
+    if (0 == (*bufferP)) {
+        targetHeader.imageDataP = 0;
+        return;
+    }
 
-        // Default constructor initializes to zero size.
+    if (targetHeader.source == crl::multisense::Source_Disparity) {
+        // Frames still in flight from before a resolution change do not
+        // match the current calibration; skip them.
+        if (m_leftCalibrationMapX.size() != cv::Size(targetHeader.width, targetHeader.height)) {
+            return;
+        }
 
-        if (!disparityMat.empty()) {
+        const auto processingStart = std::chrono::steady_clock::now();
+        const int64_t skippedFrames = m_lastDisparityFrameId < 0 ? 0 :
+                                      targetHeader.frameId - m_lastDisparityFrameId - 1;
+        m_lastDisparityFrameId = targetHeader.frameId;
+
+        const void *disparityP = targetHeader.imageDataP;
+
+        // Smooth the raw disparity over time before it is converted and
+        // reprojected. Dropping the history when the filter is turned off
+        // makes sure stale data is never blended in once it is re-enabled.
+        if (m_temporalFilterEnabled && 16 == targetHeader.bitsPerPixel) {
+            disparityP = m_temporalFilter.apply(static_cast<const uint16_t *>(targetHeader.imageDataP),
+                                                targetHeader.width, targetHeader.height, &m_region);
+        } else {
+            m_temporalFilter.reset();
+        }
 
-            cv::Mat cloudMat;
-            reprojectImageTo3D(disparityFloatMat, cloudMat, m_qMatrix, true);
+        publishImage(m_disparityPublisher, targetHeader, disparityP);
 
-            pcl::PointCloud<pcl::PointXYZ>::Ptr point_cloud_ptr(
-                    new pcl::PointCloud<pcl::PointXYZ>);//(new pcl::pointcloud<pcl::pointXYZ>);
-            cv::Vec3f CloudPt;
-            float X, Y, Z;
+        cv::Mat disparityMat(targetHeader.height, targetHeader.width, CV_16UC1,
+                             const_cast<void *>(disparityP));
 
-            for (int r = 20 ; r < cloudMat.rows ; r++) {
-                for (int c = 0; c < cloudMat.cols; c++) {
-                    CloudPt = cloudMat.at<cv::Vec3f>(r, c);
-                    X = (float) (CloudPt[0]);           // Left-Right in camera frame
-                    Y = (float) (-CloudPt[1]);          // Up-down in camera frame
-                    Z = (float) (-CloudPt[2]);          // More negative is farther from the camera
+        if (!disparityMat.empty() && 16 == targetHeader.bitsPerPixel) {
 
-                    if (X < 10 && X > -10){
-                        if (Y < 10 && Y > -10){
-                            if (Z < 10 && Z > -10){
-                                point_cloud_ptr->push_back({X, Y, Z});
-                            }
-                        }
-                    }
+            // The ray tables only depend on Q and the image size, so they
+            // are rebuilt only when those change.
+            if (m_reprojector.width() != targetHeader.width || m_reprojector.height() != targetHeader.height) {
+                m_reprojector.setQ(m_qMatrix.ptr<float>(0), targetHeader.width, targetHeader.height);
+                m_reprojector.setRegion(m_region);
+                m_frameContext.reprojector = std::make_shared<const pipeline::DisparityReprojector>(m_reprojector);
+            }
 
+            // Everything derived from the frame alone is computed on first
+            // use, by whichever consumer asks first.
+            std::shared_ptr<pipeline::DisparityFrame> disparityFrame = std::make_shared<pipeline::DisparityFrame>(
+                    m_frameContext, targetHeader.frameId, static_cast<const uint16_t *>(disparityP),
+                    targetHeader.width, targetHeader.height);
+
+            if (m_depthPublisher.isOpen()) {
+                const pipeline::DepthImage &depth = disparityFrame->depth();
+                if (depth.buffer) {
+                    crl::multisense::image::Header depthHeader = targetHeader;
+                    depthHeader.bitsPerPixel = 16;
+                    publishImage(m_depthPublisher, depthHeader, depth.buffer.get());
                 }
             }
 
+            // The grid does not need the cloud, so it is binned first.  It
+            // is only shown, so it is only built while its window is open.
+            const bool showHeightMap = m_showHeightMap;
+            if (showHeightMap) {
+                m_heightMapBuilder.build(m_reprojector, static_cast<const uint16_t *>(disparityP), m_heightMap,
+                                         &m_workerPool);
+            }
 
+            // The points stay in the point frame; PCL clouds are made from
+            // it only where one is asked for.
+            std::shared_ptr<const pipeline::PointFrame> points = disparityFrame->points();
+            std::shared_ptr<pipeline::PclPointFrame> pclPoints = std::make_shared<pipeline::PclPointFrame>(points);
+
+            // Track the ground plane, starting from the one found in the
+            // previous frame.
+            bool haveGround = false;
+            if (!points->empty()) {
+                haveGround = m_groundEstimator.estimate(points->x(), points->y(), points->z(), points->size(),
+                                                        &m_groundMask);
+            }
 
-            point_cloud_ptr->width = (int) point_cloud_ptr->points.size();
-            point_cloud_ptr->height = 1;
+            publishCloud(m_cloudPublisher, targetHeader, *points);
 
-            viewer.showCloud(point_cloud_ptr);
+            if (m_recording) {
+                m_cloudWriter.submit(targetHeader.frameId, pclPoints->xyz());
+            }
 
-        }
+            // Hand the cloud and the disparity frame over to the render
+            // thread, which makes the display image from the frame's own
+            // copy of the disparity. While fusing, only the fused surface
+            // is shown, so the live cloud is neither filtered nor colored.
+            RenderFrame frame;
+            frame.frameId = targetHeader.frameId;
+            frame.disparity = disparityFrame;
+            if (m_fusionEnabled) {
+                frame.cloud = fuseFrame(static_cast<const uint16_t *>(disparityP));
+            } else {
+                if (!m_fusedSurface.empty() || m_volume.blockCount() > 0) {
+                    resetFusion();
+                }
 
-        cv::Mat matdisplay;
-        disparityFloatMat.convertTo(matdisplay, CV_8UC1, 1);
+                // The ground mask is indexed like the point frame, so the
+                // ground is dropped there, and only the remaining points are
+                // colored, each through its own pixel.
+                std::shared_ptr<pipeline::PclPointFrame> shownPoints = pclPoints;
+                if (m_hideGround && haveGround) {
+                    std::shared_ptr<pipeline::PointFrame> obstacles = m_pointFramePool.acquire();
+                    obstacles->assignUnmasked(*points, m_groundMask.data());
+                    shownPoints = std::make_shared<pipeline::PclPointFrame>(obstacles);
+                }
 
-        if (!matdisplay.empty()) {
-            cv::imshow("disparity", matdisplay);
-            if (cv::waitKey(1) == 27)
-                running = false;
+                // A colored cloud is drawn as it is, so no plain cloud goes
+                // along with it.
+                if (m_colorCloud && m_chromaSupported) {
+                    frame.colorCloud = colorPoints(targetHeader, shownPoints->frame());
+                }
+                if (!frame.colorCloud) {
+                    frame.points = shownPoints;
+                }
+            }
+            if (showHeightMap) {
+                frame.heightMapDisplay = renderHeightMap(m_heightMap);
+            }
+            m_renderMailbox.post(std::move(frame));
+        }
 
+        const double processingMs = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - processingStart).count();
+        if (m_loadController.reportFrame(processingMs, static_cast<uint32_t>(std::max<int64_t>(skippedFrames, 0)))) {
+            m_reconfigureRequested = true;
         }
     }
 }
@@ -279,7 +820,7 @@ void updateLumaAndChroma(const crl::multisense::image::Header &header) {
     if (crl::multisense::Source_Luma_Left == header.source) {
         updateImage(header, m_lumaLeftHeader,
                     0, &m_lumaLeftBufferP);
-    } else if (crl::multisense::Source_Luma_Right == header.source) {
+    } else if (crl::multisense::Source_Chroma_Left == header.source) {
         updateImage(header, m_chromaLeftHeader,
                     0, &m_chromaLeftBufferP);
     } else {
@@ -287,7 +828,9 @@ void updateLumaAndChroma(const crl::multisense::image::Header &header) {
                       "MultiSenseWrapper::updateLumaAndChroma()\n");
     }
 
-    if (m_chromaSupported) {
+    // Chroma may also be stopped because nothing consumes it, in which
+    // case luma is passed on by itself as on monochrome units.
+    if (m_chromaSupported && (m_streams.active() & crl::multisense::Source_Chroma_Left)) {
 
         // Now that we've buffered a reference to the incoming data
         // reference, check to see if the incoming data makes a complete
@@ -312,12 +855,10 @@ void updateLumaAndChroma(const crl::multisense::image::Header &header) {
 
             // Release any previously saved (and now obselete) luma/chroma data.
             if (0 != m_matchedLumaLeftBufferP) {
-                m_channelP->releaseCallbackBuffer(
-                        m_matchedLumaLeftBufferP);
+                releaseCallbackBuffer(m_matchedLumaLeftHeader.source, m_matchedLumaLeftBufferP);
             }
             if (0 != m_matchedChromaLeftBufferP) {
-                m_channelP->releaseCallbackBuffer(
-                        m_matchedChromaLeftBufferP);
+                releaseCallbackBuffer(m_matchedChromaLeftHeader.source, m_matchedChromaLeftBufferP);
             }
 
             // Transfer the new luma and chroma component into secondary
@@ -331,13 +872,21 @@ void updateLumaAndChroma(const crl::multisense::image::Header &header) {
             m_matchedChromaLeftHeader = m_chromaLeftHeader;
             m_chromaLeftBufferP = 0;
 
+            publishImage(m_lumaPublisher, m_matchedLumaLeftHeader, m_matchedLumaLeftHeader.imageDataP);
         }
-    } else {
+    } else if (crl::multisense::Source_Luma_Left == header.source) {
 
         // Release any previously saved (and now obsolete) luma data.
         if (0 != m_matchedLumaLeftBufferP) {
-            m_channelP->releaseCallbackBuffer(
-                    m_matchedLumaLeftBufferP);
+            releaseCallbackBuffer(m_matchedLumaLeftHeader.source, m_matchedLumaLeftBufferP);
+        }
+
+        // Drop any chroma left over from before the chroma stream was
+        // stopped; it no longer matches the luma.
+        if (0 != m_matchedChromaLeftBufferP) {
+            releaseCallbackBuffer(m_matchedChromaLeftHeader.source, m_matchedChromaLeftBufferP);
+            m_matchedChromaLeftBufferP = 0;
+            m_matchedChromaLeftHeader.frameId = -1;
         }
 
         // Unit is monochrome, so all we need to use is transfer the new luma component
@@ -345,6 +894,12 @@ void updateLumaAndChroma(const crl::multisense::image::Header &header) {
         m_matchedLumaLeftBufferP = m_lumaLeftBufferP;
         m_matchedLumaLeftHeader = m_lumaLeftHeader;
         m_lumaLeftBufferP = 0;
+
+        // Keep late chroma of this frame from being paired with it again
+        // once the chroma stream is restarted.
+        m_lumaLeftHeader.frameId = -1;
+
+        publishImage(m_lumaPublisher, m_matchedLumaLeftHeader, m_matchedLumaLeftHeader.imageDataP);
     }
 }
 
@@ -553,6 +1108,21 @@ void InitializeTransforms() {
     m_qMatrix.at<float>(3, 2) = -c.fy();
     m_qMatrix.at<float>(3, 3) = c.fy() * (0.0);
 
+    // Keep everything for the frame log, and log the change if one is
+    // being written.
+    m_logCalibration.width = ImgCols;
+    m_logCalibration.height = ImgRows;
+    std::memcpy(m_logCalibration.q, m_qMatrix.ptr<float>(0), sizeof(m_logCalibration.q));
+    std::memcpy(m_logCalibration.leftM, LeftM, sizeof(LeftM));
+    std::memcpy(m_logCalibration.leftD, LeftD, sizeof(LeftD));
+    std::memcpy(m_logCalibration.leftR, LeftR, sizeof(LeftR));
+    std::memcpy(m_logCalibration.leftP, LeftP, sizeof(LeftP));
+    std::memcpy(m_logCalibration.rightM, RightM, sizeof(RightM));
+    std::memcpy(m_logCalibration.rightD, RightD, sizeof(RightD));
+    std::memcpy(m_logCalibration.rightR, RightR, sizeof(RightR));
+    std::memcpy(m_logCalibration.rightP, RightP, sizeof(RightP));
+    m_frameLog.writeCalibration(m_logCalibration);
+
     // Compute rectification maps
     initUndistortRectifyMap(M1, D1, R1, P1, m_leftCalibrationMapX.size(), CV_32FC1,
                             m_leftCalibrationMapX, m_leftCalibrationMapY);
@@ -580,6 +1150,114 @@ void SetFPS(float FPS) {
 }
 
 
+// Collect the operating points the load controller may switch between:
+// every supported resolution up to the requested one, at the requested
+// and at half the frame rate.
+std::vector<pipeline::LoadController::OperatingPoint> buildOperatingPoints(crl::multisense::DataSource RequiredSources,
+                                                                           float FPS) {
+    // The current resolution and rate come first, which is where the
+    // controller starts.
+    std::vector<pipeline::LoadController::OperatingPoint> points;
+    points.push_back({static_cast<uint32_t>(m_grabbingCols), static_cast<uint32_t>(m_grabbingRows), FPS});
+    points.push_back({static_cast<uint32_t>(m_grabbingCols), static_cast<uint32_t>(m_grabbingRows), FPS / 2});
+
+    std::vector<crl::multisense::system::DeviceMode> modeVector;
+    crl::multisense::Status status = m_channelP->getDeviceModes(modeVector);
+    if (crl::multisense::Status_Ok != status) {
+        fprintf(stderr, "Failed to query device modes, resolution stays fixed: %d\n", status);
+        modeVector.clear();
+    }
+
+    for (auto &mode: modeVector) {
+        if ((mode.supportedDataSources & RequiredSources) != RequiredSources ||
+            static_cast<int>(mode.width) > m_grabbingCols || static_cast<int>(mode.height) > m_grabbingRows) {
+            continue;
+        }
+
+        bool duplicate = false;
+        for (auto &point: points) {
+            duplicate |= point.width == mode.width && point.height == mode.height;
+        }
+        if (!duplicate) {
+            points.push_back({mode.width, mode.height, FPS});
+            points.push_back({mode.width, mode.height, FPS / 2});
+        }
+    }
+
+    return points;
+}
+
+// Set up the region of interest for width x height images: skip the top
+// 20 rows, crop the cloud to +/-10 m and, if roi_mask.png exists, drop
+// the pixels that are black in it. The mask is scaled to the image size,
+// so one mask serves every resolution.
+void configureRegion(pipeline::RegionOfInterest &region, uint32_t width, uint32_t height) {
+    region.reset(width, height);
+    region.setRect(0, 20, width, height > 20 ? height - 20 : 0);
+
+    const float cropMinimum[3] = {-10.0f, -10.0f, -10.0f};
+    const float cropMaximum[3] = {10.0f, 10.0f, 10.0f};
+    region.setCropBox(cropMinimum, cropMaximum);
+
+    cv::Mat mask = cv::imread("roi_mask.png", cv::IMREAD_GRAYSCALE);
+    if (!mask.empty()) {
+        cv::resize(mask, mask, cv::Size(width, height), 0, 0, cv::INTER_NEAREST);
+        region.setMask(mask.ptr<uint8_t>(0), mask.step);
+    }
+
+    printf("Region of interest: %zu of %u pixels\n", region.pixelCount(), width * height);
+}
+
+// Switch the sensor to the operating point picked by the load
+// controller. Resolution changes also recompute the rectification maps
+// and the Q matrix, and drop every state derived from them, while the
+// image callbacks are held off.
+void applyOperatingPoint(const pipeline::LoadController::OperatingPoint &point) {
+    crl::multisense::image::Config cfg;
+    crl::multisense::Status status = m_channelP->getImageConfig(cfg);
+    if (crl::multisense::Status_Ok != status) {
+        fprintf(stderr, "Failed to query image config: %d\n", status);
+        return;
+    }
+
+    const bool resize = cfg.width() != point.width || cfg.height() != point.height;
+    cfg.setResolution(point.width, point.height);
+    cfg.setFps(point.fps);
+    status = m_channelP->setImageConfig(cfg);
+    if (crl::multisense::Status_Ok != status) {
+        fprintf(stderr, "Failed to switch to %ux%u at %.1f FPS: %d\n", point.width, point.height, point.fps, status);
+        return;
+    }
+
+    printf("Switched to %ux%u at %.1f FPS (load %.2f)\n", point.width, point.height, point.fps,
+           m_loadController.load());
+    setStreamFrameSizes(point.width, point.height, point.fps);
+
+    if (resize) {
+        // Reading and scaling the mask can take a while, so the region is
+        // built before the callbacks are held off.
+        pipeline::RegionOfInterest region;
+        configureRegion(region, point.width, point.height);
+
+        ScopedLock disparityLock(&m_disparityMutex);
+        ScopedLock lumaLock(&m_lumaAndChromaLeftMutex);
+
+        m_grabbingCols = point.width;
+        m_grabbingRows = point.height;
+        InitializeTransforms();
+        m_region = region;
+
+        m_reprojector = pipeline::DisparityReprojector();
+        m_frameContext.reprojector.reset();
+        m_colorLookup = pipeline::RectifiedColorLookup();
+        m_temporalFilter.reset();
+
+        // The volume was fused, and the pose tracked, through the old Q.
+        resetFusion();
+    }
+}
+
+
 void simpleVis(pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud) {
     // --------------------------------------------
     // -----Open 3D viewer and add point cloud-----
@@ -589,6 +1267,84 @@ void simpleVis(pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud) {
 
 }
 
+// Show the newest frame from the mailbox, at most m_maxRenderFps times a
+// second. The visualizer, its VTK objects and all OpenCV windows are
+// created and used on this thread only.
+void renderLoop() {
+    pcl::visualization::PCLVisualizer visualizer("Simple Cloud Viewer");
+    visualizer.setBackgroundColor(0.01, 0.01, 0.01);
+    visualizer.initCameraParameters();
+
+    // The cloud is drawn by a single actor whose buffers are overwritten
+    // for every frame instead of being rebuilt. Start out with the example
+    // cloud until the camera delivers.
+    pipeline::PersistentCloudActor cloudActor;
+    cloudActor.update(*cloud);
+    visualizer.getRendererCollection()->GetFirstRenderer()->AddActor(cloudActor.actor());
+    visualizer.resetCamera();
+
+    visualizer.registerKeyboardCallback(keyboardEventOccurred, &cloudActor);
+    visualizer.registerMouseCallback(mouseEventOccurred, &cloudActor);
+
+    const auto period = std::chrono::duration<double>(1.0 / m_maxRenderFps);
+    auto nextRender = std::chrono::steady_clock::now();
+
+    pipeline::LevelOfDetailController::Config detailConfig;
+    detailConfig.targetFrameMs = 1000.0 / m_maxRenderFps;
+    pipeline::LevelOfDetailController detail(detailConfig);
+    uint32_t lastLevel = 0;
+
+    while (running && !visualizer.wasStopped()) {
+        RenderFrame frame;
+        if (std::chrono::steady_clock::now() >= nextRender && m_renderMailbox.take(frame, 5)) {
+            if (!m_adaptiveDetail) {
+                detail.reset();
+            }
+
+            // Time the buffer update plus the render it triggers, which is
+            // what the level of detail controls.
+            auto start = std::chrono::steady_clock::now();
+            if (frame.colorCloud) {
+                cloudActor.updateColored(*frame.colorCloud, detail.stride());
+            } else if (frame.points) {
+                cloudActor.update(*frame.points->xyz(), detail.stride());
+            } else {
+                cloudActor.update(*frame.cloud, detail.stride());
+            }
+            visualizer.spinOnce(1, true);
+            detail.reportFrameTime(std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count());
+
+            if (detail.level() != lastLevel) {
+                printf("Render level of detail %u: drawing every %u. point (%.1f ms per frame)\n",
+                       detail.level(), detail.stride(), detail.averageFrameMs());
+                lastLevel = detail.level();
+            }
+
+            if (frame.disparity) {
+                // imshow() copies, and the frame outlives the call.
+                const std::vector<uint8_t> &display = frame.disparity->display();
+                cv::imshow("disparity", cv::Mat(frame.disparity->height(), frame.disparity->width(), CV_8UC1,
+                                                const_cast<uint8_t *>(display.data())));
+            }
+            if (!frame.heightMapDisplay.empty()) {
+                cv::imshow("height map", frame.heightMapDisplay);
+            }
+
+            nextRender += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+            nextRender = std::max(nextRender, std::chrono::steady_clock::now());
+        } else {
+            // Keep handling input between frames.
+            visualizer.spinOnce(1, true);
+        }
+
+        if (cv::waitKey(1) == 27)
+            running = false;
+    }
+
+    running = false;
+}
+
 void prepareMultiSenseCamera() {
 
     std::cout << "Hello, World!" << std::endl;
@@ -604,6 +1360,9 @@ void prepareMultiSenseCamera() {
     if (0 != pthread_mutex_init(&m_disparityCostMutex, NULL)) {
         CRL_EXCEPTION("pthread_mutex_init() failed: %s", strerror(errno));
     }
+    if (0 != pthread_mutex_init(&m_lumaAndChromaLeftMutex, NULL)) {
+        CRL_EXCEPTION("pthread_mutex_init() failed: %s", strerror(errno));
+    }
     // Initialize communications.
     m_channelP = crl::multisense::Channel::Create(currentAddress);
     if (NULL == m_channelP) {
@@ -642,6 +1401,14 @@ void prepareMultiSenseCamera() {
 
     selectDeviceMode(Cols, Rows, RequiredSources, m_grabbingCols, m_grabbingRows);
 
+    // Size the shared memory rings for the selected resolution before
+    // any callback can publish into them.
+    const size_t pixels = static_cast<size_t>(m_grabbingCols) * m_grabbingRows;
+    m_disparityPublisher.open("/multisense_disparity", 8, pixels * sizeof(uint16_t));
+    m_lumaPublisher.open("/multisense_luma_left", 8, pixels * sizeof(uint16_t));
+    m_cloudPublisher.open("/multisense_cloud", 4, pixels * 3 * sizeof(float));
+    m_depthPublisher.open("/multisense_depth", 8, pixels * sizeof(uint16_t));
+
     // Configure the sensor.
     crl::multisense::image::Config cfg;
     status = m_channelP->getImageConfig(cfg);
@@ -670,6 +1437,9 @@ void prepareMultiSenseCamera() {
     // Read calibration data and compute rectification maps.
     InitializeTransforms();
 
+    m_loadController.setOperatingPoints(buildOperatingPoints(RequiredSources, FPS));
+    configureRegion(m_region, m_grabbingCols, m_grabbingRows);
+
     // Initialize frameId's so image data can be copied properly
     // on startup. I.e. prevent the case where the image frame ids and
     // the matched frame ids are both 0.
@@ -678,32 +1448,31 @@ void prepareMultiSenseCamera() {
     m_matchedLumaLeftHeader.frameId = -1;
     m_matchedChromaLeftHeader.frameId = -1;
 
-    status = m_channelP->startStreams(crl::multisense::Source_Disparity) != crl::multisense::Status_Ok;
-    if (status != crl::multisense::Status_Ok)
-        CRL_EXCEPTION("Unable to start Source_Disparity stream: %s",
-                      strerror(errno));
-
-    status = m_channelP->startStreams(crl::multisense::Source_Luma_Left);
-    if (status != crl::multisense::Status_Ok)
-        CRL_EXCEPTION("Unable to start Source_Chroma_Left stream: %s",
-                      strerror(errno));
-
-    status = m_channelP->startStreams(crl::multisense::Source_Luma_Right);
-    if (status != crl::multisense::Status_Ok)
-        CRL_EXCEPTION("Unable to start Source_Chroma_Left stream: %s",
-                      strerror(errno));
-    status = m_channelP->startStreams(crl::multisense::Source_Disparity_Cost);
-    if (status != crl::multisense::Status_Ok)
-        CRL_EXCEPTION("Unable to start Source_Chroma_Left stream: %s",
-                      strerror(errno));
-
-
     m_channelP->addIsolatedCallback(disparityCallback, crl::multisense::Source_Disparity);
     m_channelP->addIsolatedCallback(disparityCostCallback, crl::multisense::Source_Disparity_Cost);
 
     m_channelP->addIsolatedCallback(lumaChromaLeftCallback,
-                                    crl::multisense::Source_Luma_Left | crl::multisense::Source_Luma_Right);
-
+                                    crl::multisense::Source_Luma_Left | crl::multisense::Source_Chroma_Left);
+
+    // Right luma and disparity cost have no consumer, so they are not
+    // started at all.
+    setStreamFrameSizes(m_grabbingCols, m_grabbingRows, FPS);
+    m_streams.subscribe("point cloud", crl::multisense::Source_Disparity);
+    m_streams.subscribe("luma ring", crl::multisense::Source_Luma_Left);
+    subscribeColor(m_colorCloud);
+    m_streams.setControl(
+            [](pipeline::StreamSubscriptions::Mask sources) {
+                m_callbackBuffers.restarted(sources);
+                return crl::multisense::Status_Ok == m_channelP->startStreams(sources);
+            },
+            [](pipeline::StreamSubscriptions::Mask sources) {
+                return crl::multisense::Status_Ok == m_channelP->stopStreams(sources);
+            });
+    if (m_streams.active() != m_streams.wanted())
+        CRL_EXCEPTION("Unable to start streams 0x%08llx: %s",
+                      static_cast<unsigned long long>(m_streams.wanted() & ~m_streams.active()),
+                      strerror(errno));
+    reportStreams();
 }
 
 
@@ -730,19 +1499,43 @@ int main() {
 
     cloud = basic_cloud_ptr;
 
-    viewer.registerKeyboardCallback(keyboardEventOccurred);
-    viewer.registerMouseCallback(mouseEventOccurred);
-    viewer.runOnVisualizationThreadOnce(viewerOneOff);
+    pipeline::CloudWriter::Config writerConfig;
+    writerConfig.format = pipeline::CloudWriter::Format_PCD;
+    writerConfig.maxFiles = 900;
+    m_cloudWriter.start(writerConfig);
+
+    std::thread renderThread(renderLoop);
 
     prepareMultiSenseCamera();
 
     //--------------------
     // -----Main loop-----
     //--------------------
-    while (!viewer.wasStopped()) {
+    while (running) {
+
+        if (m_reconfigureRequested.exchange(false)) {
+            pipeline::LoadController::OperatingPoint point;
+            {
+                ScopedLock lock(&m_disparityMutex);
+                point = m_loadController.current();
+            }
+            applyOperatingPoint(point);
+        }
 
         std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
 
+    running = false;
+    m_renderMailbox.close();
+    renderThread.join();
+    printf("Rendered %lu of %lu frames\n",
+           m_renderMailbox.posted() - m_renderMailbox.overwritten(), m_renderMailbox.posted());
+
+    m_cloudWriter.stop();
+    m_frameLog.stop();
+
+    printf("Callback buffers: %u held at most\n", m_callbackBuffers.highWater());
+    reportCallbackBuffers("  ");
+
     return 0;
 }